@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+
+#  Copyright 2018 Oxford Nanopore Technologies, Ltd
+
+#  This Source Code Form is subject to the terms of the Oxford Nanopore
+#  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+#  was not  distributed with this file, You can obtain one at
+#  http://nanoporetech.com
+
+import argparse
+import json
+import subprocess
+import sys
+
+parser = argparse.ArgumentParser(
+    description='Report how far basecalls at reduced precision are from those in float')
+parser.add_argument('--flappie', default='flappie', help='Flappie executable')
+parser.add_argument('--model', default='r941_native', help='Model to use')
+parser.add_argument('--precision', default='int8', help='Precision to compare with float')
+parser.add_argument('--calibration', default=None, help='Calibration for --precision int16, from flappie --calibrate')
+parser.add_argument('--math-precision', default=None,
+                    help='Precision of functions for calls at --precision, those in float being the default')
+parser.add_argument('files', metavar='fast5', nargs='+', help='Files or directories of reads to basecall')
+
+
+def basecall(args, precision, math_precision):
+    """Call reads with flappie
+
+    :returns: dict of read uuid to (sequence, normalised score)
+    """
+    cmd = [args.flappie, '--model', args.model, '--precision', precision, '--format', 'fastq']
+    if math_precision is not None:
+        cmd += ['--math-precision', math_precision]
+    if precision == 'int16' and args.calibration is not None:
+        cmd += ['--calibration', args.calibration]
+    cmd += args.files
+    out = subprocess.run(cmd, stdout=subprocess.PIPE, check=True).stdout.decode().splitlines()
+    calls = {}
+    for header, seq in zip(out[0::4], out[1::4]):
+        name, _, meta = header[1:].partition(' ')
+        calls[name] = (seq, json.loads(meta)['normalised_score'])
+    return calls
+
+
+def nindel(a, b):
+    """Number of insertions and deletions turning a into b
+
+    Myers' O(ND) difference algorithm, fast when the sequences are similar.
+    """
+    n, m = len(a), len(b)
+    offset = n + m
+    v = [0] * (2 * offset + 2)
+    for d in range(offset + 1):
+        for k in range(-d, d + 1, 2):
+            if k == -d or (k != d and v[offset + k - 1] < v[offset + k + 1]):
+                x = v[offset + k + 1]
+            else:
+                x = v[offset + k - 1] + 1
+            y = x - k
+            while x < n and y < m and a[x] == b[y]:
+                x, y = x + 1, y + 1
+            v[offset + k] = x
+            if x >= n and y >= m:
+                return d
+    return offset
+
+
+if __name__ == '__main__':
+    args = parser.parse_args()
+    reference = basecall(args, 'float', None)
+    reduced = basecall(args, args.precision, args.math_precision)
+
+    print('read\tlength_float\tlength_{0}\tidentity\tscore_delta'.format(args.precision))
+    total_match = total_length = 0
+    score_delta = []
+    for name, (seq, score) in sorted(reference.items()):
+        if name not in reduced:
+            print('{}\tmissing from {} calls'.format(name, args.precision), file=sys.stderr)
+            continue
+        rseq, rscore = reduced[name]
+        nmatch = (len(seq) + len(rseq) - nindel(seq, rseq)) // 2
+        length = max(len(seq), len(rseq))
+        total_match += nmatch
+        total_length += length
+        score_delta.append(rscore - score)
+        print('{}\t{}\t{}\t{:.4f}\t{:+.5f}'.format(name, len(seq), len(rseq),
+                                                   nmatch / max(length, 1), rscore - score))
+
+    if score_delta:
+        print('Identity of {} calls to float over {} reads: {:.4f}, mean change in normalised score {:+.5f}'.format(
+            args.precision, len(score_delta), total_match / max(total_length, 1),
+            sum(score_delta) / len(score_delta)), file=sys.stderr)
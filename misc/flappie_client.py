@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+
+#  Copyright 2018 Oxford Nanopore Technologies, Ltd
+
+#  This Source Code Form is subject to the terms of the Oxford Nanopore
+#  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+#  was not  distributed with this file, You can obtain one at
+#  http://nanoporetech.com
+
+import argparse
+import os
+import socket
+import sys
+import time
+
+parser = argparse.ArgumentParser(
+    description='Basecall fast5 files using a running `flappie --server`')
+parser.add_argument('--format', default='fastq', choices=['fasta', 'fastq', 'sam', 'trace'],
+                    help='Format of output')
+parser.add_argument('--model', default='r941_native', help='Model to use')
+parser.add_argument('--models', default=False, action='store_true',
+                    help='List models available on server and exit')
+parser.add_argument('--timing', default=False, action='store_true',
+                    help='Write time taken by each request to stderr')
+parser.add_argument('socket', help='Unix domain socket server is listening on')
+parser.add_argument('files', metavar='fast5', nargs='*', help='Files to basecall')
+
+
+def request(conn, line):
+    """Send request and return output of server
+
+    :param conn: File-like object wrapping socket
+    :param line: Request, without newline
+
+    :returns: bytes
+    """
+    conn.write(line.encode() + b'\n')
+    conn.flush()
+    status = conn.readline().decode().rstrip('\n')
+    if status.startswith('OK '):
+        return conn.read(int(status[3:]))
+    raise RuntimeError('Request "{}" failed: {}'.format(line, status))
+
+
+if __name__ == '__main__':
+    args = parser.parse_args()
+
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+        sock.connect(args.socket)
+        conn = sock.makefile('rwb')
+        if args.models:
+            sys.stdout.buffer.write(request(conn, 'models'))
+            sys.exit(0)
+
+        for fn in args.files:
+            #  Files are opened by the server, so paths must be absolute
+            t0 = time.time()
+            out = request(conn, 'basecall {} {} {}'.format(args.model, args.format, os.path.abspath(fn)))
+            sys.stdout.buffer.write(out)
+            if args.timing:
+                sys.stderr.write('{}\t{:.1f} ms\n'.format(fn, 1000.0 * (time.time() - t0)))
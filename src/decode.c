@@ -114,10 +114,82 @@ inline size_t trans_lookup(size_t from, size_t to, size_t nbase){
 }
 
 
+/**   One block of forwards Viterbi pass of CRF flipflop
+ *
+ *    @param trans Transition weights of block
+ *    @param nbase Number of bases
+ *    @param prev Scores of each state at end of previous block
+ *    @param curr [out] Scores of each state at end of block
+ *    @param tb [out] State each state at end of block was reached from
+ **/
+static void viterbi_step_flipflop(const float * trans, size_t nbase, const float * prev, float * curr, int32_t * tb){
+    const size_t nstate = nbase + nbase;
+    const float * trans_flop = trans + nstate * nbase;
+
+    for(size_t b2=nbase ; b2 < nstate ; b2++){
+        // Stay in flop state
+        curr[b2] = prev[b2] + trans_flop[b2];
+        tb[b2] = b2;
+        // Move from flip to flop state
+        const size_t from_base = b2 - nbase;
+        const float score = prev[from_base] + trans_flop[from_base];
+        if(score > curr[b2]){
+            curr[b2] = score;
+            tb[b2] = from_base;
+        }
+    }
+
+
+    for(size_t b1=0 ; b1 < nbase ; b1++){
+        //   b1 -- flip state
+        const float * trans_state = trans + b1 * nstate;
+        curr[b1] = trans_state[0] + prev[0];
+        tb[b1] = 0;
+        for(size_t from_state=1 ; from_state < nstate ; from_state++){
+            // from_state either flip or flop
+            const float score = trans_state[from_state] + prev[from_state];
+            if(score > curr[b1]){
+                curr[b1] = score;
+                tb[b1] = from_state;
+            }
+        }
+    }
+}
+
+
 /**   Viterbi decoding of CRF flipflop
  **/
 float decode_crf_flipflop(const_flappie_matrix trans, bool combine_stays, int * path, float * qpath){
     RETURN_NULL_IF(NULL == trans, NAN);
+
+    const size_t nbase = nbase_from_flipflop_nparam(trans->nr);
+    flappie_imatrix tb = make_flappie_imatrix(nbase + nbase, trans->nc);
+    RETURN_NULL_IF(NULL == tb, NAN);
+
+    const float score = decode_crf_flipflop_tb(trans, combine_stays, tb, path, qpath);
+
+    tb = free_flappie_imatrix(tb);
+    return score;
+}
+
+
+/**   Viterbi decoding of CRF flipflop into preallocated traceback
+ *
+ *    As decode_crf_flipflop but makes no allocations, for callers decoding
+ *    many short reads against a fixed latency.
+ *
+ *    @param trans Transitions, nblk columns
+ *    @param combine_stays Whether to set flop states of path to -1
+ *    @param tb [out] Traceback, nstate rows and at least nblk columns
+ *    @param path [out] Path of nblk + 1 states
+ *    @param qpath [out] Score of each transition of path, first is NAN
+ *
+ *    @returns Score of path
+ **/
+float decode_crf_flipflop_tb(const_flappie_matrix trans, bool combine_stays, flappie_imatrix tb, int * path,
+                             float * qpath){
+    RETURN_NULL_IF(NULL == trans, NAN);
+    RETURN_NULL_IF(NULL == tb, NAN);
     RETURN_NULL_IF(NULL == path, NAN);
     RETURN_NULL_IF(NULL == qpath, NAN);
 
@@ -126,14 +198,10 @@ float decode_crf_flipflop(const_flappie_matrix trans, bool combine_stays, int *
     const size_t nstate = nbase + nbase;
     assert(nstate == nbase + nbase);
     assert(nstate * (nbase + 1) == trans->nr);
+    assert(tb->nr == nstate && tb->nc >= nblk);
 
-    float * mem = calloc(2 * nstate, sizeof(float));
-    flappie_imatrix tb = make_flappie_imatrix(nstate, nblk);
-    if(NULL == mem || NULL == tb){
-        tb = free_flappie_imatrix(tb);
-        free(mem);
-        return NAN;
-    }
+    float mem[2 * nstate];
+    memset(mem, 0, sizeof(mem));
 
     float * curr = mem;
     float * prev = mem + nstate;
@@ -141,43 +209,13 @@ float decode_crf_flipflop(const_flappie_matrix trans, bool combine_stays, int *
 
     //  Forwards Viterbi pass
     for(size_t blk=0 ; blk < nblk ; blk++){
-        const size_t offset = blk * trans->stride;
-        const size_t offset_flop = offset + nstate * nbase;
-        const size_t tboffset = blk * tb->stride;
         {   // Swap
             float * tmp = curr;
             curr = prev;
             prev = tmp;
         }
-
-        for(size_t b2=nbase ; b2 < nstate ; b2++){
-            // Stay in flop state
-            curr[b2] = prev[b2] + trans->data.f[offset_flop + b2];
-            tb->data.f[tboffset + b2] = b2;
-            // Move from flip to flop state
-            const size_t from_base = b2 - nbase;
-            const float score = prev[from_base] + trans->data.f[offset_flop + from_base];
-            if(score > curr[b2]){
-                curr[b2] = score;
-                tb->data.f[tboffset + b2] = from_base;
-            }
-        }
-
-
-        for(size_t b1=0 ; b1 < nbase ; b1++){
-	    //   b1 -- flip state
-            const size_t offset_state = offset + b1 * nstate;
-            curr[b1] = trans->data.f[offset_state + 0] + prev[0];
-            tb->data.f[tboffset + b1] = 0;
-            for(size_t from_state=1 ; from_state < nstate ; from_state++){
-                // from_state either flip or flop
-                const float score = trans->data.f[offset_state + from_state] + prev[from_state];
-                if(score > curr[b1]){
-                    curr[b1] = score;
-                    tb->data.f[tboffset + b1] = from_state;
-                }
-            }
-        }
+        viterbi_step_flipflop(trans->data.f + blk * trans->stride, nbase, prev, curr,
+                              tb->data.f + blk * tb->stride);
     }
 
     //  Traceback
@@ -197,13 +235,172 @@ float decode_crf_flipflop(const_flappie_matrix trans, bool combine_stays, int *
         }
     }
 
-    tb = free_flappie_imatrix(tb);
-    free(mem);
-
     return score;
 }
 
 
+struct _flipflop_fixed_lag {
+    size_t nbase;
+    size_t lag;
+    //  Scores of states at end of last block, and workspace for next
+    float * score;
+    float * next;
+    //  Traceback of blocks whose states have not been committed
+    int32_t * tb;
+    int * path;
+    size_t capacity;
+    size_t ntb;
+    //  Number of blocks decoded and of positions of path committed
+    size_t nblock;
+    size_t ncommit;
+    //  Last committed state, -1 if none
+    int last;
+};
+
+
+/**   Fixed-lag Viterbi decoder of CRF flipflop for transitions arriving in pieces
+ *
+ *    The state of each position of the path is committed once the forwards
+ *    pass is lag blocks beyond it, taking the state on the best path at that
+ *    time.  Committed states are never revised, so bases are emitted with a
+ *    bounded delay at the price of occasionally differing from the full
+ *    Viterbi path near where the best path changed late.
+ *
+ *    @param nbase Number of bases of model
+ *    @param lag Blocks that decoding lags behind forwards pass
+ *
+ *    @returns Decoder or NULL on failure
+ **/
+flipflop_fixed_lag make_flipflop_fixed_lag(size_t nbase, size_t lag){
+    RETURN_NULL_IF(0 == nbase, NULL);
+    flipflop_fixed_lag dec = calloc(1, sizeof(*dec));
+    RETURN_NULL_IF(NULL == dec, NULL);
+    const size_t nstate = nbase + nbase;
+    dec->nbase = nbase;
+    dec->lag = lag;
+    dec->score = calloc(nstate, sizeof(float));
+    dec->next = calloc(nstate, sizeof(float));
+    if(NULL == dec->score || NULL == dec->next){
+        return free_flipflop_fixed_lag(dec);
+    }
+    dec->last = -1;
+    return dec;
+}
+
+
+flipflop_fixed_lag free_flipflop_fixed_lag(flipflop_fixed_lag dec){
+    if(NULL != dec){
+        free(dec->path);
+        free(dec->tb);
+        free(dec->next);
+        free(dec->score);
+        free(dec);
+    }
+    return NULL;
+}
+
+
+//  Commit states of path up to position end, returning number of bases
+static size_t commit_fixed_lag(flipflop_fixed_lag dec, size_t end, char * bases){
+    if(end <= dec->ncommit){
+        return 0;
+    }
+    const size_t nstate = dec->nbase + dec->nbase;
+    dec->path[dec->ntb] = argmaxf(dec->score, nstate);
+    for(size_t i=dec->ntb ; i > 0 ; i--){
+        dec->path[i - 1] = dec->tb[(i - 1) * nstate + dec->path[i]];
+    }
+
+    const size_t ncommit = end - dec->ncommit;
+    size_t nb = 0;
+    for(size_t i=0 ; i < ncommit ; i++){
+        if(dec->last >= 0 && dec->path[i] != dec->last){
+            bases[nb++] = base_lookup[dec->path[i] % dec->nbase];
+        }
+        dec->last = dec->path[i];
+    }
+
+    //  Traceback to committed positions no longer needed
+    const size_t ndrop = (ncommit < dec->ntb) ? ncommit : dec->ntb;
+    memmove(dec->tb, dec->tb + ndrop * nstate, (dec->ntb - ndrop) * nstate * sizeof(int32_t));
+    dec->ntb -= ndrop;
+    dec->ncommit = end;
+    return nb;
+}
+
+
+/**   Add blocks of transitions to fixed-lag decoder
+ *
+ *    @param dec Decoder
+ *    @param trans Transitions
+ *    @param first First block of trans to add
+ *    @param nblock Number of blocks to add
+ *    @param bases [out] Bases newly committed, with room for nblock + lag + 1
+ *
+ *    @returns Number of bases committed or -1 on failure
+ **/
+int flipflop_fixed_lag_push(flipflop_fixed_lag dec, const_flappie_matrix trans, size_t first, size_t nblock,
+                            char * bases){
+    RETURN_NULL_IF(NULL == dec, -1);
+    RETURN_NULL_IF(NULL == trans, -1);
+    RETURN_NULL_IF(NULL == bases, -1);
+    const size_t nstate = dec->nbase + dec->nbase;
+    RETURN_NULL_IF(nstate * (dec->nbase + 1) != trans->nr, -1);
+    RETURN_NULL_IF(first + nblock > trans->nc, -1);
+
+    if(dec->ntb + nblock > dec->capacity){
+        const size_t capacity = dec->ntb + nblock + dec->lag;
+        int32_t * tb = realloc(dec->tb, capacity * nstate * sizeof(int32_t));
+        RETURN_NULL_IF(NULL == tb, -1);
+        dec->tb = tb;
+        int * path = realloc(dec->path, (capacity + 1) * sizeof(int));
+        RETURN_NULL_IF(NULL == path, -1);
+        dec->path = path;
+        dec->capacity = capacity;
+    }
+
+    for(size_t blk=first ; blk < first + nblock ; blk++){
+        viterbi_step_flipflop(trans->data.f + blk * trans->stride, dec->nbase, dec->score, dec->next,
+                              dec->tb + dec->ntb * nstate);
+        float * tmp = dec->score;
+        dec->score = dec->next;
+        dec->next = tmp;
+        dec->ntb += 1;
+        dec->nblock += 1;
+    }
+    //  Scores only matter relative to each other, keep them near zero
+    const float maxscore = valmaxf(dec->score, nstate);
+    for(size_t st=0 ; st < nstate ; st++){
+        dec->score[st] -= maxscore;
+    }
+
+    //  Positions of path run from 0 to nblock inclusive
+    const size_t end = (dec->nblock + 1 > dec->lag) ? (dec->nblock + 1 - dec->lag) : 0;
+    return commit_fixed_lag(dec, end, bases);
+}
+
+
+/**   Commit every remaining state of fixed-lag decoder and reset it
+ *
+ *    @param dec Decoder
+ *    @param bases [out] Bases newly committed, with room for lag + 1
+ *
+ *    @returns Number of bases committed
+ **/
+size_t flipflop_fixed_lag_finish(flipflop_fixed_lag dec, char * bases){
+    RETURN_NULL_IF(NULL == dec, 0);
+    RETURN_NULL_IF(NULL == bases, 0);
+    const size_t nb = (dec->nblock > 0) ? commit_fixed_lag(dec, dec->nblock + 1, bases) : 0;
+
+    memset(dec->score, 0, 2 * dec->nbase * sizeof(float));
+    dec->ntb = 0;
+    dec->nblock = 0;
+    dec->ncommit = 0;
+    dec->last = -1;
+    return nb;
+}
+
+
 /**   Decoding of CRF flip-posteriors with transition constraint
  **/
 float constrained_crf_flipflop(const_flappie_matrix post, int * path){
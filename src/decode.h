@@ -23,10 +23,19 @@ char * collapse_repeats(int const * path, size_t npos, int modbase);
 size_t change_positions(int const * path, size_t npos, int * chpos);
 
 float decode_crf_flipflop(const_flappie_matrix trans, bool combine_stays, int * path, float * qpath);
+float decode_crf_flipflop_tb(const_flappie_matrix trans, bool combine_stays, flappie_imatrix tb, int * path,
+                             float * qpath);
 float decode_runlength(const_flappie_matrix param, int * path);
 float decode_crf_runlength(const_flappie_matrix transparam, int * path);
 float constrained_crf_flipflop(const_flappie_matrix post, int * path);
 
+typedef struct _flipflop_fixed_lag *flipflop_fixed_lag;
+flipflop_fixed_lag make_flipflop_fixed_lag(size_t nbase, size_t lag);
+flipflop_fixed_lag free_flipflop_fixed_lag(flipflop_fixed_lag dec);
+int flipflop_fixed_lag_push(flipflop_fixed_lag dec, const_flappie_matrix trans, size_t first, size_t nblock,
+                            char * bases);
+size_t flipflop_fixed_lag_finish(flipflop_fixed_lag dec, char * bases);
+
 size_t runlengths_mean(const_flappie_matrix param, const int * path, int * runlength);
 size_t runlengths_unit(const_flappie_matrix param, const int * path, int * runlength);
 char * runlength_to_basecall(const int * path, const int * runlength, size_t nblk);
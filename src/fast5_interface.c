@@ -19,6 +19,7 @@
 #include <unistd.h>
 
 #include "fast5_interface.h"
+#include "flappie_profile.h"
 #include "flappie_stdlib.h"
 #include "util.h"
 
@@ -206,10 +207,9 @@ cleanup1:
 }
 
 
-fast5_raw_scaling get_raw_scaling(hid_t hdf5file) {
+fast5_raw_scaling get_raw_scaling(hid_t hdf5file, const char * scaling_path) {
     // Add 1e-5 to sensible sample rate as a sentinel value
     fast5_raw_scaling scaling = { NAN, NAN, NAN, NAN };
-    const char *scaling_path = "/UniqueGlobalKey/channel_id";
 
     hid_t scaling_group = H5Gopen(hdf5file, scaling_path, H5P_DEFAULT);
     if (scaling_group < 0) {
@@ -228,57 +228,39 @@ fast5_raw_scaling get_raw_scaling(hid_t hdf5file) {
 }
 
 
-raw_table read_raw(const char *filename, bool scale_to_pA) {
-    assert(NULL != filename);
+/**  Read raw signal of one read from an open fast5 file
+ *
+ *  @param hdf5file Open fast5 file
+ *  @param read_path Group containing read_id attribute and Signal dataset
+ *  @param scaling_path Group containing channel_id attributes for scaling
+ *  @param scale_to_pA Whether to scale signal from ADC values to pA
+ *
+ *  @returns raw_table for read.  raw is NULL on failure.
+ **/
+static raw_table read_raw_from_group(hid_t hdf5file, const char * read_path, const char * scaling_path,
+                                     bool scale_to_pA) {
     raw_table rawtbl = { NULL, 0, 0, 0, NULL };
+    double t = flappie_profile_start();
 
-    hid_t hdf5file = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
-    if (hdf5file < 0) {
-        warnx("Failed to open %s for reading.", filename);
-        return rawtbl;
-    }
-    H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
-
-    const char *root = "/Raw/Reads/";
-    const int rootstr_len = strlen(root);
-    ssize_t size =
-        H5Lget_name_by_idx(hdf5file, root, H5_INDEX_NAME, H5_ITER_INC, 0, NULL,
-                           0, H5P_DEFAULT);
-    if (size < 0) {
-        warnx("Failed find read name under %s.", root);
-        goto cleanup1;
-    }
-    char *name = calloc(1 + size, sizeof(char));
-    H5Lget_name_by_idx(hdf5file, root, H5_INDEX_NAME, H5_ITER_INC, 0, name,
-                       1 + size, H5P_DEFAULT);
-
-    // uuid pat
-    char * dset_path = calloc(rootstr_len + size + 1, sizeof(char));
-    (void)snprintf(dset_path, rootstr_len + size + 1, "%s%s", root, name);
-    hid_t ugroup = H5Gopen(hdf5file, dset_path, H5P_DEFAULT);
+    hid_t ugroup = H5Gopen(hdf5file, read_path, H5P_DEFAULT);
     if(ugroup < 0){
-        warnx("Failed to find read_id under %s.", dset_path);
-        goto cleanup1_1;
+        warnx("Failed to find read_id under %s.", read_path);
+        return rawtbl;
     }
     char * uuid = read_string_attribute(ugroup, "read_id");
-    H5Gclose(ugroup);
 
-    // Create group name
-    char *signal_path = calloc(rootstr_len + size + 8, sizeof(char));
-    (void)snprintf(signal_path, rootstr_len + size + 8, "%s%s/Signal", root, name);
-
-    hid_t dset = H5Dopen(hdf5file, signal_path, H5P_DEFAULT);
+    hid_t dset = H5Dopen(ugroup, "Signal", H5P_DEFAULT);
     if (dset < 0) {
-        warnx("Failed to open dataset '%s' to read raw signal from.",
-              signal_path);
-        goto cleanup2;
+        warnx("Failed to open dataset '%s/Signal' to read raw signal from.", read_path);
+        free(uuid);
+        goto cleanup1;
     }
 
     hid_t space = H5Dget_space(dset);
     if (space < 0) {
-        warnx("Failed to create copy of dataspace for raw signal %s.",
-              signal_path);
-        goto cleanup3;
+        warnx("Failed to create copy of dataspace for raw signal %s/Signal.", read_path);
+        free(uuid);
+        goto cleanup2;
     }
     hsize_t nsample;
     H5Sget_simple_extent_dims(space, &nsample, NULL);
@@ -288,31 +270,269 @@ raw_table read_raw(const char *filename, bool scale_to_pA) {
     if (status < 0) {
         free(rawptr);
         free(uuid);
-        warnx("Failed to read raw data from dataset %s.", signal_path);
-        goto cleanup4;
+        warnx("Failed to read raw data from dataset %s/Signal.", read_path);
+        goto cleanup3;
     }
     rawtbl = (raw_table) {
     uuid, nsample, 0, nsample, rawptr};
+    flappie_profile_stop(FLAPPIE_PROFILE_READ, t, uuid, nsample);
 
     if (scale_to_pA) {
-        const fast5_raw_scaling scaling = get_raw_scaling(hdf5file);
+        t = flappie_profile_start();
+        const fast5_raw_scaling scaling = get_raw_scaling(hdf5file, scaling_path);
         const float raw_unit = scaling.range / scaling.digitisation;
         for (size_t i = 0; i < nsample; i++) {
             rawptr[i] = (rawptr[i] + scaling.offset) * raw_unit;
         }
+        flappie_profile_stop(FLAPPIE_PROFILE_SCALE, t, uuid, nsample);
     }
 
- cleanup4:
-    H5Sclose(space);
  cleanup3:
-    H5Dclose(dset);
+    H5Sclose(space);
  cleanup2:
-    free(signal_path);
- cleanup1_1:
-    free(dset_path);
-    free(name);
+    H5Dclose(dset);
  cleanup1:
-    H5Fclose(hdf5file);
+    H5Gclose(ugroup);
+
+    return rawtbl;
+}
+
+
+/**  Reader iterating over every read in a fast5 file
+ *
+ *  Single-read files hold one read under /Raw/Reads/ with scaling in
+ *  /UniqueGlobalKey/channel_id.  Multi-read files hold a group read_<id> per
+ *  read, containing Raw/Signal and its own channel_id.  The file is opened
+ *  once and reads are returned in turn.
+ **/
+struct _fast5_reader {
+    hid_t hdf5file;
+    bool multi_read;
+    hsize_t nlink;
+    hsize_t next;
+};
+
+
+static fast5_reader make_fast5_reader(hid_t hdf5file, const char * filename) {
+    if (hdf5file < 0) {
+        warnx("Failed to open %s for reading.", filename);
+        return NULL;
+    }
+    H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
+
+    fast5_reader reader = calloc(1, sizeof(*reader));
+    if(NULL == reader){
+        H5Fclose(hdf5file);
+        return NULL;
+    }
+    reader->hdf5file = hdf5file;
+    reader->multi_read = (H5Lexists(hdf5file, "/Raw", H5P_DEFAULT) <= 0);
+
+    H5G_info_t info;
+    const char * root = reader->multi_read ? "/" : "/Raw/Reads/";
+    if(H5Gget_info_by_name(hdf5file, root, &info, H5P_DEFAULT) < 0){
+        warnx("Failed find reads under %s in %s.", root, filename);
+        return close_fast5_reader(reader);
+    }
+    //  Only the first read of a single-read file is used
+    reader->nlink = reader->multi_read ? info.nlinks : ((info.nlinks > 0) ? 1 : 0);
+
+    return reader;
+}
+
+
+fast5_reader open_fast5_reader(const char * filename) {
+    assert(NULL != filename);
+    return make_fast5_reader(H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT), filename);
+}
+
+
+/**  Open reader on a fast5 file already loaded into memory
+ *
+ *  The file is opened through the HDF5 core driver so no further I/O is
+ *  performed.  HDF5 takes its own copy of the image, which may be freed as
+ *  soon as this function returns.
+ *
+ *  @param image Image of fast5 file, see load_fast5_image
+ *
+ *  @returns Reader or NULL on failure
+ **/
+fast5_reader open_fast5_reader_image(const fast5_image image) {
+    RETURN_NULL_IF(NULL == image.data, NULL);
+
+    hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+    RETURN_NULL_IF(fapl < 0, NULL);
+    hid_t hdf5file = -1;
+    if(H5Pset_fapl_core(fapl, image.size, false) >= 0
+       && H5Pset_file_image(fapl, image.data, image.size) >= 0){
+        //  Core driver refuses an image whose name exists on disk
+        char image_name[64];
+        (void)snprintf(image_name, 64, "fast5_image_%p", image.data);
+        hdf5file = H5Fopen(image_name, H5F_ACC_RDONLY, fapl);
+    }
+    H5Pclose(fapl);
+
+    return make_fast5_reader(hdf5file, image.filename);
+}
+
+
+/**  Load entire fast5 file into memory
+ *
+ *  The file is read with a single large sequential read, avoiding the many
+ *  small scattered reads made by HDF5 when opening a file in place.  Does
+ *  not call HDF5 so is safe to use from any thread.
+ *
+ *  @param filename Name of file to load
+ *
+ *  @returns Image of file.  data is NULL on failure
+ **/
+fast5_image load_fast5_image(const char * filename) {
+    assert(NULL != filename);
+    fast5_image image = {NULL, 0, NULL};
+
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0){
+        warnx("Failed to open %s for reading.", filename);
+        return image;
+    }
+    struct stat st;
+    if(0 != fstat(fd, &st) || st.st_size <= 0){
+        warnx("Failed to determine size of %s.", filename);
+        close(fd);
+        return image;
+    }
+
+    const size_t size = st.st_size;
+    const size_t namelen = strlen(filename);
+    image.filename = calloc(namelen + 1, sizeof(char));
+    image.data = malloc(size);
+    if(NULL == image.filename || NULL == image.data){
+        close(fd);
+        free_fast5_image(&image);
+        return image;
+    }
+    memcpy(image.filename, filename, namelen * sizeof(char));
+
+    size_t nread = 0;
+    while(nread < size){
+        ssize_t ret = read(fd, (char *)image.data + nread, size - nread);
+        if(ret <= 0){
+            warnx("Failed to read %s.", filename);
+            free_fast5_image(&image);
+            break;
+        }
+        nread += ret;
+    }
+    close(fd);
+    image.size = nread;
+
+    return image;
+}
+
+
+void free_fast5_image(fast5_image * image) {
+    if(NULL == image){
+        return;
+    }
+    free(image->filename);
+    free(image->data);
+    *image = (fast5_image){NULL, 0, NULL};
+}
+
+
+/**  Whether file of reader is a multi-read fast5 file
+ *
+ *  @param reader Open reader
+ *
+ *  @returns true if the file may hold many reads, false for a single-read file
+ **/
+bool fast5_reader_multi_read(const fast5_reader reader) {
+    assert(NULL != reader);
+    return reader->multi_read;
+}
+
+
+fast5_reader close_fast5_reader(fast5_reader reader) {
+    if(NULL != reader){
+        H5Fclose(reader->hdf5file);
+        free(reader);
+    }
+    return NULL;
+}
+
+
+/**  Read next read from fast5 file
+ *
+ *  @param reader Open reader
+ *  @param scale_to_pA Whether to scale signal from ADC values to pA
+ *  @param rawtbl [out] Raw signal of read.  raw is NULL if read could not be read.
+ *
+ *  @returns false when there are no more reads in file, true otherwise
+ **/
+bool fast5_reader_next(fast5_reader reader, bool scale_to_pA, raw_table * rawtbl) {
+    assert(NULL != reader);
+    assert(NULL != rawtbl);
+    *rawtbl = (raw_table){ NULL, 0, 0, 0, NULL };
+
+    const char * root = reader->multi_read ? "/" : "/Raw/Reads/";
+    const size_t rootstr_len = strlen(root);
+    char * name = NULL;
+    for( ; reader->next < reader->nlink ; reader->next++){
+        ssize_t size = H5Lget_name_by_idx(reader->hdf5file, root, H5_INDEX_NAME, H5_ITER_INC,
+                                          reader->next, NULL, 0, H5P_DEFAULT);
+        if (size < 0) {
+            continue;
+        }
+        name = calloc(1 + size, sizeof(char));
+        RETURN_NULL_IF(NULL == name, false);
+        H5Lget_name_by_idx(reader->hdf5file, root, H5_INDEX_NAME, H5_ITER_INC, reader->next,
+                           name, 1 + size, H5P_DEFAULT);
+        if(!reader->multi_read || 0 == strncmp(name, "read_", 5)){
+            break;
+        }
+        //  Not a read group
+        free(name);
+        name = NULL;
+    }
+    if(NULL == name){
+        return false;
+    }
+    reader->next += 1;
+
+    const size_t namelen = strlen(name);
+    const size_t pathlen = rootstr_len + namelen + 12;
+    char * read_path = calloc(pathlen, sizeof(char));
+    char * scaling_path = calloc(pathlen, sizeof(char));
+    if(NULL != read_path && NULL != scaling_path){
+        if(reader->multi_read){
+            (void)snprintf(read_path, pathlen, "%s%s/Raw", root, name);
+            (void)snprintf(scaling_path, pathlen, "%s%s/channel_id", root, name);
+        } else {
+            (void)snprintf(read_path, pathlen, "%s%s", root, name);
+            (void)snprintf(scaling_path, pathlen, "/UniqueGlobalKey/channel_id");
+        }
+        *rawtbl = read_raw_from_group(reader->hdf5file, read_path, scaling_path, scale_to_pA);
+    }
+
+    free(scaling_path);
+    free(read_path);
+    free(name);
+
+    return true;
+}
+
+
+raw_table read_raw(const char *filename, bool scale_to_pA) {
+    assert(NULL != filename);
+    raw_table rawtbl = { NULL, 0, 0, 0, NULL };
+
+    fast5_reader reader = open_fast5_reader(filename);
+    if(NULL != reader){
+        if(!fast5_reader_next(reader, scale_to_pA, &rawtbl)){
+            warnx("Failed find read in %s.", filename);
+        }
+        reader = close_fast5_reader(reader);
+    }
 
     return rawtbl;
 }
@@ -15,6 +15,23 @@
 
 #include "flappie_structures.h"
 
+typedef struct {
+    char * filename;
+    size_t size;
+    void * data;
+} fast5_image;
+
+typedef struct _fast5_reader *fast5_reader;
+
+fast5_reader open_fast5_reader(const char * filename);
+fast5_reader open_fast5_reader_image(const fast5_image image);
+fast5_reader close_fast5_reader(fast5_reader reader);
+bool fast5_reader_next(fast5_reader reader, bool scale_to_pA, raw_table * rawtbl);
+bool fast5_reader_multi_read(const fast5_reader reader);
+
+fast5_image load_fast5_image(const char * filename);
+void free_fast5_image(fast5_image * image);
+
 raw_table read_raw(const char *filename, bool scale_to_pA);
 hid_t open_or_create_hdf5(const char * filename);
 
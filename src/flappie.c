@@ -9,19 +9,37 @@
 #include <dirent.h>
 #include <glob.h>
 #include <libgen.h>
+#include <limits.h>
 #include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <strings.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #include "decode.h"
 #include "fast5_interface.h"
+#include "flappie_cache.h"
+#include "flappie_caller.h"
 #include "layers.h"
 #include "networks.h"
 #include "flappie_common.h"
+#include "flappie_cpu.h"
 #include "flappie_licence.h"
+#include "flappie_math.h"
+#include "flappie_numa.h"
 #include "flappie_output.h"
+#include "flappie_profile.h"
+#include "flappie_queue.h"
 #include "flappie_stdlib.h"
+#include "flappie_readuntil.h"
+#include "flappie_stream.h"
 #include "flappie_structures.h"
+#include "flappie_threadpool.h"
 #include "util.h"
 #include "version.h"
 
@@ -57,6 +75,29 @@ static struct argp_option options[] = {
 
     {"uuid", 14, 0, 0, "Output UUID"},
     {"no-uuid", 15, 0, OPTION_ALIAS, "Output read file"},
+    {"queue-depth", 16, "nreads", 0, "Maximum number of reads waiting between each stage of pipeline"},
+    {"network-threads", 17, "nthread", 0, "Number of threads running network"},
+    {"decode-threads", 18, "nthread", 0, "Number of threads decoding transitions"},
+    {"batch-size", 19, "nreads", 0, "Maximum number of reads passed through network together"},
+    {"chunk-size", 20, "nsample", 0, "Split reads into chunks of this many samples for network (0 is off)"},
+    {"chunk-overlap", 21, "nsample", 0, "Number of samples overlap between neighbouring chunks"},
+    {"read-ahead", 22, "nfile", 0, "Load whole files into memory, reading this many files ahead (0 is off)"},
+    {"threads", 23, "nthread", 0, "Number of threads shared by network threads to run reads of a batch concurrently"},
+    {"cache", 24, "directory", 0, "Keep basecalls in directory, reusing those of reads already called with the same settings"},
+    {"server", 25, "socket", 0, "Run as a server, answering requests on Unix domain socket"},
+    {"profile", 26, "filename", 0, "Write time spent in each stage of basecalling to file as JSON"},
+    {"timeline", 27, "filename", 0, "Write timeline of every stage on every read to file, for Chrome or Perfetto"},
+    {"max-memory", 28, "size", 0, "Admit reads for calling only while their predicted memory fits in size (e.g. 16G, 0 is unlimited)"},
+    {"numa", 29, 0, 0, "Spread network threads over NUMA nodes, each pinned to its node and using a copy of the weights local to it"},
+    {"stream", 30, "source", 0, "Call signal of many channels as it arrives from source (- for stdin, a file, FIFO or Unix socket), writing bases as they are committed"},
+    {"stream-window", 31, "step:lookahead", 0, "Samples called per run of network when streaming, and samples after them the network sees"},
+    {"read-until", 32, "nsample", 0, "Call only the first nsample samples of each read, as for read until, writing bases, confidence and latency"},
+    {"cpu-level", 33, "level", 0, "Instruction set of kernels: sse4, avx, avx2 or avx512 (default best supported by host)"},
+    {"precision", 34, "precision", 0, "Precision of weights: float, int8, fp16, bf16 or int16 (converted at model load, int16 runs flip-flop models wholly in fixed point)"},
+    {"activation-precision", 35, "precision", 0, "Precision activations are stored at between layers: float, fp16 or bf16"},
+    {"calibrate", 36, 0, 0, "Run model in float over reads and write its calibration for --precision int16, rather than calling"},
+    {"calibration", 37, "filename", 0, "Calibration of model for --precision int16, written by --calibrate"},
+    {"math-precision", 38, "precision", 0, "Precision of exp, log, tanh, logistic and ELU in every layer: default, exact, fast or fastest (default: default, accurate activations with fastest gates of modified GRU layers)"},
     {0}
 };
 
@@ -70,6 +111,7 @@ struct arguments {
     enum flappie_outformat_type outformat;
     int limit;
     enum model_type model;
+    enum flappie_precision precision;
     FILE * output;
     char * prefix;
     float temperature;
@@ -79,6 +121,26 @@ struct arguments {
     float varseg_thresh;
     char ** files;
     bool uuid;
+    int queue_depth;
+    int network_threads;
+    int decode_threads;
+    int batch_size;
+    int chunk_size;
+    int chunk_overlap;
+    int read_ahead;
+    int threads;
+    char * cache;
+    char * server;
+    char * profile;
+    char * timeline;
+    size_t max_memory;
+    bool numa;
+    char * stream;
+    size_t stream_step;
+    size_t stream_lookahead;
+    size_t read_until;
+    bool calibrate;
+    char * calibration;
 };
 
 static struct arguments args = {
@@ -87,6 +149,7 @@ static struct arguments args = {
     .trace = NULL,
     .limit = 0,
     .model = DEFAULT_MODEL,
+    .precision = FLAPPIE_PRECISION_FLOAT,
     .output = NULL,
     .outformat = FLAPPIE_OUTFORMAT_FASTQ,
     .prefix = "",
@@ -96,7 +159,27 @@ static struct arguments args = {
     .varseg_chunk = 100,
     .varseg_thresh = 0.0f,
     .files = NULL,
-    .uuid = true
+    .uuid = true,
+    .queue_depth = 8,
+    .network_threads = 1,
+    .decode_threads = 1,
+    .batch_size = 4,
+    .chunk_size = 0,
+    .chunk_overlap = 500,
+    .read_ahead = 0,
+    .threads = 1,
+    .cache = NULL,
+    .server = NULL,
+    .profile = NULL,
+    .timeline = NULL,
+    .max_memory = 0,
+    .numa = false,
+    .stream = NULL,
+    .stream_step = 2000,
+    .stream_lookahead = 1000,
+    .read_until = 0,
+    .calibrate = false,
+    .calibration = NULL
 };
 
 
@@ -112,6 +195,41 @@ void fprint_flappie_models(FILE * fh, enum model_type default_model){
 }
 
 
+/**  Parse size in bytes, with an optional binary suffix K, M, G or T
+ *
+ *  @returns true on success
+ **/
+static bool parse_memory_size(const char * str, size_t * size){
+    char * end = NULL;
+    double val = strtod(str, &end);
+    if(end == str || val < 0.0){
+        return false;
+    }
+    switch(*end){
+    case 'T': case 't':
+        val *= 1024.0;
+        // fall through
+    case 'G': case 'g':
+        val *= 1024.0;
+        // fall through
+    case 'M': case 'm':
+        val *= 1024.0;
+        // fall through
+    case 'K': case 'k':
+        val *= 1024.0;
+        end += 1;
+        break;
+    default:
+        break;
+    }
+    if('\0' != *end && 0 != strcasecmp(end, "B")){
+        return false;
+    }
+    *size = (size_t)val;
+    return true;
+}
+
+
 static error_t parse_arg(int key, char * arg, struct  argp_state * state){
     int ret = 0;
     char * next_tok = NULL;
@@ -195,8 +313,112 @@ static error_t parse_arg(int key, char * arg, struct  argp_state * state){
     case 15:
         args.uuid = false;
         break;
+    case 16:
+        args.queue_depth = atoi(arg);
+        assert(args.queue_depth > 0);
+        break;
+    case 17:
+        args.network_threads = atoi(arg);
+        assert(args.network_threads > 0);
+        break;
+    case 18:
+        args.decode_threads = atoi(arg);
+        assert(args.decode_threads > 0);
+        break;
+    case 19:
+        args.batch_size = atoi(arg);
+        assert(args.batch_size > 0);
+        break;
+    case 20:
+        args.chunk_size = atoi(arg);
+        assert(args.chunk_size >= 0);
+        break;
+    case 21:
+        args.chunk_overlap = atoi(arg);
+        assert(args.chunk_overlap >= 0);
+        break;
+    case 22:
+        args.read_ahead = atoi(arg);
+        assert(args.read_ahead >= 0);
+        break;
+    case 23:
+        args.threads = atoi(arg);
+        assert(args.threads > 0);
+        break;
+    case 24:
+        args.cache = arg;
+        break;
+    case 25:
+        args.server = arg;
+        break;
+    case 26:
+        args.profile = arg;
+        break;
+    case 27:
+        args.timeline = arg;
+        break;
+    case 28:
+        if(!parse_memory_size(arg, &args.max_memory)){
+            argp_error(state, "Invalid memory size \"%s\".", arg);
+        }
+        break;
+    case 29:
+        args.numa = true;
+        break;
+    case 30:
+        args.stream = arg;
+        break;
+    case 31:
+        args.stream_step = atoi(strtok(arg, ":"));
+        next_tok = strtok(NULL, ":");
+        if(NULL == next_tok){
+            errx(EXIT_FAILURE, "--stream-window should be of form step:lookahead");
+        }
+        args.stream_lookahead = atoi(next_tok);
+        assert(args.stream_step > 0);
+        break;
+    case 32:
+        args.read_until = atoi(arg);
+        assert(args.read_until > 0);
+        break;
+    case 33:
+        {
+            const enum flappie_cpu_level level = get_flappie_cpu_level(arg);
+            if(FLAPPIE_CPU_INVALID == level){
+                errx(EXIT_FAILURE, "Unrecognised CPU level \"%s\", should be one of sse4, avx, avx2 or avx512.", arg);
+            }
+            if(!flappie_set_cpu_level(level)){
+                errx(EXIT_FAILURE, "Host does not support CPU level %s, best supported is %s.",
+                     arg, flappie_cpu_level_string(flappie_cpu_detect()));
+            }
+        }
+        break;
+    case 34:
+        args.precision = get_flappie_precision(arg);
+        if(FLAPPIE_PRECISION_INVALID == args.precision){
+            errx(EXIT_FAILURE, "Unrecognised precision \"%s\", should be float, int8, fp16, bf16 or int16.", arg);
+        }
+        break;
+    case 35:
+        if(!flappie_set_activation_precision(get_flappie_precision(arg))){
+            errx(EXIT_FAILURE, "Unrecognised precision of activations \"%s\", should be float, fp16 or bf16.", arg);
+        }
+        break;
+    case 36:
+        args.calibrate = true;
+        break;
+    case 37:
+        args.calibration = arg;
+        break;
+    case 38:
+        if(!flappie_set_math_precision(get_flappie_math_precision(arg))){
+            errx(EXIT_FAILURE, "Unrecognised precision of functions \"%s\", should be default, exact, fast or fastest.", arg);
+        }
+        break;
     case ARGP_KEY_NO_ARGS:
-        argp_usage (state);
+        if(NULL == args.server && NULL == args.stream){
+            argp_usage (state);
+        }
         break;
 
     case ARGP_KEY_ARG:
@@ -213,134 +435,1471 @@ static error_t parse_arg(int key, char * arg, struct  argp_state * state){
 
 static struct argp argp = {options, parse_arg, args_doc, doc};
 
-// NOTES array of raw_basecall_info struct and return the full array
-// array of raw_table passed to calculate_transistions, after reading all files
-// After calculate transitions use a for loop to decode and enter into the raw_basecall_info struct array.
-void calculate_post(char * filename[], enum model_type model, int nfiles, struct _raw_basecall_info *res){
-
-  raw_table rt[max_files];	
-  for (int fn=0; fn < nfiles; fn++){	
-    rt[fn] = read_raw(filename[fn], true);
-    rt[fn] = trim_and_segment_raw(rt[fn], args.trim_start, args.trim_end, args.varseg_chunk, args.varseg_thresh);
-    medmad_normalise_array(rt[fn].raw + rt[fn].start, rt[fn].end - rt[fn].start);
-  }
-
-  
-  flappie_matrix trans_weights[max_files];
-  /*for (int fn=0; fn < nfiles; fn++){	
-    // NOTES return array of trans_weights
-    trans_weights[fn] = calculate_transitions(rt[fn], args.temperature, model);
-    if (NULL == trans_weights[fn]) {
-        free(rt[fn].raw);
-        free(rt[fn].uuid);
-    }
-   }*/
-  calculate_transitions_new(rt, args.temperature, model, nfiles, trans_weights);
-
-  for (int fn=0; fn < nfiles; fn++){	
-    const size_t nbase = nbase_from_flipflop_nparam(trans_weights[fn]->nr);
-    const size_t nblock = trans_weights[fn]->nc;
-    int * path = calloc(nblock + 2, sizeof(int));
-    int * path_idx = calloc(nblock + 2, sizeof(int));
-    float * qpath = calloc(nblock + 2, sizeof(float));
-    int * pos = calloc(nblock + 1, sizeof(int));
-
-    float score = NAN;
-
-    flappie_matrix posterior = transpost_crf_flipflop(trans_weights[fn], true);
-    score = decode_crf_flipflop(posterior, false, path, qpath);
-    size_t path_nidx = change_positions(path, nblock, path_idx);
-
-    char * basecall = calloc(path_nidx + 1, sizeof(char));
-    char * quality = calloc(path_nidx + 1, sizeof(char));
-    for(size_t i=0 ; i < path_nidx ; i++){
-        const size_t idx = path_idx[i];
-        basecall[i] = base_lookup[path[idx] % nbase];
-        quality[i] = phredf(expf(qpath[idx]));
-    }
-
-    exp_activation_inplace(posterior);
-    flappie_imatrix trace = trace_from_posterior(posterior);
-    posterior = free_flappie_matrix(posterior);
-    free(qpath);
-    free(path_idx);
-    free(path);
-    trans_weights[fn] = free_flappie_matrix(trans_weights[fn]);
-    const size_t basecall_length = strlen(basecall);
-
-    res[fn].score = score;
-    res[fn].rt = rt[fn];
-    res[fn].basecall = basecall;
-    res[fn].quality = quality;
-    res[fn].basecall_length = basecall_length;
-    res[fn].trace = trace;
-    res[fn].pos = pos;
-    res[fn].nblock = nblock;
-   }
+//  Callers for each model, owning the threads shared by all network threads
+//  for running reads of a batch.  Only the caller for the chosen model is made
+//  unless serving.
+static flappie_caller caller[FLAPPIE_MODEL_INVALID] = {NULL};
+//  With --numa, a caller for the chosen model bound to each NUMA node.
+//  Network threads are dealt out to the nodes in turn.
+static flappie_topology topology = NULL;
+static flappie_caller node_caller[FLAPPIE_MAX_NUMA_NODE] = {NULL};
+static size_t nnode = 0;
+static size_t nnetwork_thread = 0;
+static pthread_mutex_t numa_lock = PTHREAD_MUTEX_INITIALIZER;
+//  Basecalls from previous runs, NULL if not used
+static flappie_cache cache = NULL;
+
+
+/**  Unit of work passed between the stages of the basecalling pipeline
+ *
+ *   Each read is owned by exactly one stage at a time; the stage that drops a
+ *   read (because of failure or because it is the writer) frees it.
+ **/
+struct read_job {
+    char * filename;
+    //  Read is one of many in its file, at position iread, so is named by both
+    bool multi_read;
+    size_t iread;
+    raw_table rt;
+    flappie_matrix trans;
+    struct _raw_basecall_info res;
+    //  Long reads are split into chunks that pass through the network as
+    //  separate jobs, sharing the raw signal of their parent.
+    struct read_job * parent;
+    size_t ichunk;
+    size_t nchunk;
+    size_t chunks_remaining;
+    raw_table * chunks;
+    flappie_matrix * chunk_trans;
+    //  Predicted working set admitted against --max-memory
+    size_t memory;
+};
+
+
+/**  Name of read when not output by read id
+ *
+ *   Reads of a single-read file are named by the file.  Those of a
+ *   multi-read file would then share a name, so the position of the read
+ *   within the file is appended, as file.fast5:3
+ *
+ *   @param job Read
+ *   @param buf Buffer name of a read from a multi-read file is written to
+ *   @param len Length of buffer
+ *
+ *   @returns Name of read
+ **/
+static const char * read_job_name(const struct read_job * job, char * buf, size_t len){
+    const char * file = basename(job->filename);
+    if(!job->multi_read){
+        return file;
+    }
+    snprintf(buf, len, "%s:%zu", file, job->iread);
+    return buf;
+}
+
+
+/**  Memory admitted to the network and decode stages, in bytes
+ *
+ *   A read is admitted only while its predicted working set fits within the
+ *   limit, so long reads make for smaller batches.  A read larger than the
+ *   limit on its own is admitted once nothing else is in flight.
+ **/
+struct memory_budget {
+    size_t limit;
+    size_t used;
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+};
+static struct memory_budget budget = {0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+
+//  Wait until nbyte fit in budget and take them.  Returns amount to release.
+static size_t admit_memory(size_t nbyte){
+    if(0 == budget.limit){
+        return 0;
+    }
+    pthread_mutex_lock(&budget.lock);
+    while(budget.used > 0 && budget.used + nbyte > budget.limit){
+        pthread_cond_wait(&budget.released, &budget.lock);
+    }
+    budget.used += nbyte;
+    pthread_mutex_unlock(&budget.lock);
+    return nbyte;
+}
+
+
+static void release_memory(size_t nbyte){
+    if(0 == nbyte){
+        return;
+    }
+    pthread_mutex_lock(&budget.lock);
+    budget.used -= nbyte;
+    pthread_cond_broadcast(&budget.released);
+    pthread_mutex_unlock(&budget.lock);
+}
+
+
+static void free_read_job(struct read_job * job){
+    if(NULL == job){
+        return;
+    }
+    job->trans = free_flappie_matrix(job->trans);
+    if(NULL != job->parent){
+        // Chunk does not own its signal
+        free(job);
+        return;
+    }
+    release_memory(job->memory);
+    if(NULL != job->chunk_trans){
+        for(size_t i=0 ; i < job->nchunk ; i++){
+            job->chunk_trans[i] = free_flappie_matrix(job->chunk_trans[i]);
+        }
+        free(job->chunk_trans);
+    }
+    free(job->chunks);
+    if(NULL != job->res.basecall){
+        // Result owns raw table
+        free_raw_basecall_info(&job->res);
+    } else {
+        free_raw_table(&job->rt);
+    }
+    free(job->filename);
+    free(job);
+}
+
+
+/**  Stage of pipeline: a pool of threads taking work from one queue and
+ *   passing it to the next.
+ **/
+struct pipeline_stage {
+    const char * name;
+    struct read_job * (*process)(struct read_job * job);
+    flappie_queue in;
+    flappie_queue out;
+    int nthread;
+    pthread_t * thread;
+};
+
+
+static void * run_pipeline_stage(void * ptr){
+    struct pipeline_stage * stage = ptr;
+    flappie_profile_name_thread(stage->name);
+    struct read_job * job = NULL;
+    while(NULL != (job = flappie_queue_pop(stage->in))){
+        job = stage->process(job);
+        if(NULL != job && !flappie_queue_push(stage->out, job)){
+            free_read_job(job);
+        }
+    }
+    flappie_queue_close(stage->out);
+    return NULL;
+}
+
+
+static void start_pipeline_stage(struct pipeline_stage * stage, void * (*fun)(void *)){
+    // Network layers keep large work arrays on the stack
+    const size_t stack_size = 16 * 1024 * 1024;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, stack_size);
+
+    stage->thread = calloc(stage->nthread, sizeof(pthread_t));
+    if(NULL == stage->thread){
+        errx(EXIT_FAILURE, "Failed to allocate threads for %s stage.", stage->name);
+    }
+    for(int i=0 ; i < stage->nthread ; i++){
+        if(0 != pthread_create(stage->thread + i, &attr, fun, stage)){
+            errx(EXIT_FAILURE, "Failed to start thread for %s stage.", stage->name);
+        }
+    }
+    pthread_attr_destroy(&attr);
+}
+
+
+static void join_pipeline_stage(struct pipeline_stage * stage){
+    for(int i=0 ; i < stage->nthread ; i++){
+        pthread_join(stage->thread[i], NULL);
+    }
+    free(stage->thread);
+    stage->thread = NULL;
+}
+
+
+/**  Find every fast5 file named on the command line
+ *
+ *   Directories are searched for files ending in .fast5
+ *
+ *   @param fun Function called on each filename in turn.  Search stops if it returns false.
+ *   @param data Passed to fun
+ **/
+static void for_each_fast5_file(bool (*fun)(const char * filename, void * data), void * data){
+    for(int fn=0 ; NULL != args.files[fn] ; fn++){
+        //  Iterate through all files and directories on command line.
+        glob_t globbuf;
+        {
+            // Find all files matching commandline argument using system glob
+            const size_t rootlen = strlen(args.files[fn]);
+            char * globpath = calloc(rootlen + 9, sizeof(char));
+            memcpy(globpath, args.files[fn], rootlen * sizeof(char));
+            {
+                DIR * dirp = opendir(args.files[fn]);
+                if(NULL != dirp){
+                    // If filename is a directory, add wildcard to find all fast5 files within it
+                    memcpy(globpath + rootlen, "/*.fast5", 8 * sizeof(char));
+                    closedir(dirp);
+                }
+            }
+            int globret = glob(globpath, GLOB_NOSORT, NULL, &globbuf);
+            free(globpath);
+            if(0 != globret){
+                if(GLOB_NOMATCH == globret){
+                    warnx("File or directory \"%s\" does not exist or no fast5 files found.", args.files[fn]);
+                }
+                globfree(&globbuf);
+                continue;
+            }
+        }
+
+        bool more = true;
+        for(size_t fn2=0 ; more && fn2 < globbuf.gl_pathc ; fn2++){
+            more = fun(globbuf.gl_pathv[fn2], data);
+        }
+        globfree(&globbuf);
+        if(!more){
+            break;
+        }
+    }
+}
+
+
+//  HDF5 is not thread-safe, so every call into it from the reader, the writer of
+//  the trace and connections to the server is made holding this lock
+static pthread_mutex_t hdf5_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static fast5_reader locked_open_fast5_reader(const char * filename){
+    pthread_mutex_lock(&hdf5_lock);
+    fast5_reader reader = open_fast5_reader(filename);
+    pthread_mutex_unlock(&hdf5_lock);
+    return reader;
+}
+
+
+static fast5_reader locked_open_fast5_reader_image(const fast5_image image){
+    pthread_mutex_lock(&hdf5_lock);
+    fast5_reader reader = open_fast5_reader_image(image);
+    pthread_mutex_unlock(&hdf5_lock);
+    return reader;
+}
+
+
+static fast5_reader locked_close_fast5_reader(fast5_reader reader){
+    pthread_mutex_lock(&hdf5_lock);
+    reader = close_fast5_reader(reader);
+    pthread_mutex_unlock(&hdf5_lock);
+    return reader;
+}
+
+
+//  Lock is released between reads, so it is never held while waiting on a queue
+static bool locked_fast5_reader_next(fast5_reader reader, raw_table * rt){
+    pthread_mutex_lock(&hdf5_lock);
+    const bool more = fast5_reader_next(reader, true, rt);
+    pthread_mutex_unlock(&hdf5_lock);
+    return more;
+}
+
+
+struct read_source {
+    struct pipeline_stage * stage;
+    int reads_started;
+    //  Whole files loaded ahead of the reader when non-NULL
+    flappie_queue prefetch;
+    pthread_mutex_t lock;
+    bool stop;
+};
+
+
+static bool read_limit_reached(const struct read_source * source){
+    return args.limit > 0 && source->reads_started >= args.limit;
+}
+
+
+/**  Pass every read of an open file to the next stage
+ *
+ *   @returns false if the limit on the number of reads has been reached
+ **/
+static bool push_file_reads(fast5_reader reader, const char * filename, struct read_source * source){
+    const size_t pathlen = strlen(filename);
+    raw_table rt;
+    for(size_t iread=0 ; !read_limit_reached(source) && locked_fast5_reader_next(reader, &rt) ; iread++){
+        source->reads_started += 1;
+        if(NULL == rt.raw){
+            warnx("No basecall returned for read in %s", filename);
+            continue;
+        }
+
+        struct read_job * job = calloc(1, sizeof(struct read_job));
+        if(NULL == job){
+            free_raw_table(&rt);
+            return false;
+        }
+        job->rt = rt;
+        job->filename = calloc(pathlen + 1, sizeof(char));
+        if(NULL == job->filename){
+            free_read_job(job);
+            return false;
+        }
+        memcpy(job->filename, filename, pathlen * sizeof(char));
+        job->multi_read = fast5_reader_multi_read(reader);
+        job->iread = iread;
+        if(!flappie_queue_push(source->stage->out, job)){
+            free_read_job(job);
+        }
+    }
+    return !read_limit_reached(source);
+}
+
+
+static bool read_fast5_file(const char * filename, void * data){
+    struct read_source * source = data;
+    //  Each file is opened once and may contain many reads
+    fast5_reader reader = locked_open_fast5_reader(filename);
+    if(NULL == reader){
+        return true;
+    }
+    bool more = push_file_reads(reader, filename, source);
+    reader = locked_close_fast5_reader(reader);
+    return more;
+}
+
+
+static bool prefetch_fast5_file(const char * filename, void * data){
+    struct read_source * source = data;
+    pthread_mutex_lock(&source->lock);
+    const bool stop = source->stop;
+    pthread_mutex_unlock(&source->lock);
+    if(stop){
+        return false;
+    }
+
+    fast5_image * image = calloc(1, sizeof(fast5_image));
+    RETURN_NULL_IF(NULL == image, false);
+    *image = load_fast5_image(filename);
+    if(NULL == image->data || !flappie_queue_push(source->prefetch, image)){
+        free_fast5_image(image);
+        free(image);
+    }
+    return true;
+}
+
+
+/**  Read-ahead stage: load whole fast5 files into memory
+ *
+ *   Only plain file I/O is performed, no HDF5 calls, so this may run
+ *   alongside the reader.
+ **/
+static void * run_prefetch_stage(void * ptr){
+    struct read_source * source = ptr;
+    flappie_profile_name_thread("prefetch");
+    for_each_fast5_file(prefetch_fast5_file, source);
+    flappie_queue_close(source->prefetch);
+    return NULL;
+}
+
+
+/**  Reader stage: find fast5 files and read the raw signal of every read
+ *
+ *   HDF5 is not thread-safe so there is only ever a single reader, and it
+ *   shares hdf5_lock with the writer of the trace.
+ **/
+static void * run_read_stage(void * ptr){
+    struct read_source source = {.stage = ptr};
+    flappie_profile_name_thread(source.stage->name);
+
+    if(args.read_ahead <= 0){
+        for_each_fast5_file(read_fast5_file, &source);
+        flappie_queue_close(source.stage->out);
+        return NULL;
+    }
+
+    //  Files are loaded whole on a separate thread and opened from memory
+    source.prefetch = make_flappie_queue(args.read_ahead, 1);
+    if(NULL == source.prefetch){
+        errx(EXIT_FAILURE, "Failed to create queue for read-ahead.");
+    }
+    pthread_mutex_init(&source.lock, NULL);
+    pthread_t prefetch_thread;
+    if(0 != pthread_create(&prefetch_thread, NULL, run_prefetch_stage, &source)){
+        errx(EXIT_FAILURE, "Failed to start thread for read-ahead.");
+    }
+
+    fast5_image * image = NULL;
+    bool more = true;
+    while(NULL != (image = flappie_queue_pop(source.prefetch))){
+        if(more){
+            fast5_reader reader = locked_open_fast5_reader_image(*image);
+            if(NULL != reader){
+                more = push_file_reads(reader, image->filename, &source);
+                reader = locked_close_fast5_reader(reader);
+            }
+            if(!more){
+                //  Limit reached, tell prefetcher to stop and drain what it has loaded
+                pthread_mutex_lock(&source.lock);
+                source.stop = true;
+                pthread_mutex_unlock(&source.lock);
+            }
+        }
+        free_fast5_image(image);
+        free(image);
+    }
+
+    pthread_join(prefetch_thread, NULL);
+    pthread_mutex_destroy(&source.lock);
+    source.prefetch = free_flappie_queue(source.prefetch);
+    flappie_queue_close(source.stage->out);
+    return NULL;
+}
+
+
+static struct read_job * trim_and_normalise_job(struct read_job * job){
+    job->rt = flappie_caller_trim(caller[args.model], job->rt);
+    if(NULL == job->rt.raw){
+        warnx("No basecall returned for %s", job->filename);
+        free_read_job(job);
+        return NULL;
+    }
+    return job;
+}
+
+
+/**  Trim stage: trim and normalise reads, splitting long reads into chunks
+ *
+ *   Chunks of one read are independent jobs, so they are spread across all
+ *   network threads and batched with other work of the same size.
+ **/
+static void * run_trim_stage(void * ptr){
+    struct pipeline_stage * stage = ptr;
+    flappie_profile_name_thread(stage->name);
+    const size_t stride = get_model_stride(args.model);
+    struct read_job * job = NULL;
+    while(NULL != (job = flappie_queue_pop(stage->in))){
+        if(flappie_cache_lookup(cache, job->rt, NULL != args.trace, &job->res)){
+            //  Already called, passed straight through to writer
+            if(!flappie_queue_push(stage->out, job)){
+                free_read_job(job);
+            }
+            continue;
+        }
+        job = trim_and_normalise_job(job);
+        if(NULL == job){
+            continue;
+        }
+        job->memory = admit_memory(predict_basecall_memory(args.model, job->rt.n));
+        if(0 == args.chunk_size || job->rt.end - job->rt.start <= (size_t)args.chunk_size){
+            if(!flappie_queue_push(stage->out, job)){
+                free_read_job(job);
+            }
+            continue;
+        }
+
+        job->chunks = chunk_raw_table(job->rt, args.chunk_size, args.chunk_overlap, stride, &job->nchunk);
+        job->chunk_trans = calloc(job->nchunk, sizeof(flappie_matrix));
+        struct read_job ** chunk = calloc(job->nchunk, sizeof(struct read_job *));
+        if(NULL == job->chunks || NULL == job->chunk_trans || NULL == chunk){
+            errx(EXIT_FAILURE, "Failed to allocate chunks for %s.", job->filename);
+        }
+        for(size_t i=0 ; i < job->nchunk ; i++){
+            chunk[i] = calloc(1, sizeof(struct read_job));
+            if(NULL == chunk[i]){
+                errx(EXIT_FAILURE, "Failed to allocate chunks for %s.", job->filename);
+            }
+            chunk[i]->rt = job->chunks[i];
+            chunk[i]->parent = job;
+            chunk[i]->ichunk = i;
+        }
+        //  Parent is owned by its chunks from here on
+        job->chunks_remaining = job->nchunk;
+        for(size_t i=0 ; i < job->nchunk ; i++){
+            if(!flappie_queue_push(stage->out, chunk[i])){
+                errx(EXIT_FAILURE, "Network stage finished before all chunks of %s were called.", job->filename);
+            }
+        }
+        free(chunk);
+    }
+    flappie_queue_close(stage->out);
+    return NULL;
+}
+
+
+static pthread_mutex_t chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**  Record transitions for a chunk, stitching its parent once all are done
+ *
+ *   @returns Parent read if this was its last outstanding chunk, otherwise NULL
+ **/
+static struct read_job * finish_chunk(struct read_job * chunk){
+    struct read_job * job = chunk->parent;
+    job->chunk_trans[chunk->ichunk] = chunk->trans;
+    chunk->trans = NULL;
+    free_read_job(chunk);
+
+    pthread_mutex_lock(&chunk_lock);
+    job->chunks_remaining -= 1;
+    const bool is_last = (0 == job->chunks_remaining);
+    pthread_mutex_unlock(&chunk_lock);
+    if(!is_last){
+        return NULL;
+    }
+
+    job->trans = stitch_chunk_transitions(job->rt, job->chunks, job->chunk_trans, job->nchunk, get_model_stride(args.model));
+    for(size_t i=0 ; i < job->nchunk ; i++){
+        job->chunk_trans[i] = free_flappie_matrix(job->chunk_trans[i]);
+    }
+    return job;
+}
+
+
+/**  Network stage: run batches of reads through the network together
+ *
+ *   Batches are formed from whatever reads are waiting, up to the batch size,
+ *   so there is no fixed limit on the number of reads called in a run and a
+ *   partial batch is never held back waiting for more input.
+ **/
+static void * run_network_stage(void * ptr){
+    struct pipeline_stage * stage = ptr;
+    flappie_profile_name_thread(stage->name);
+    const_flappie_caller network_caller = caller[args.model];
+    if(nnode > 0){
+        pthread_mutex_lock(&numa_lock);
+        const size_t node = nnetwork_thread % nnode;
+        nnetwork_thread += 1;
+        pthread_mutex_unlock(&numa_lock);
+        //  Work arrays of the network are then allocated on the node
+        flappie_pin_thread(flappie_topology_cpus(topology, node), flappie_topology_ncpu(topology, node));
+        network_caller = node_caller[node];
+    }
+    const size_t batch_size = args.batch_size;
+    struct read_job ** batch = calloc(batch_size, sizeof(struct read_job *));
+    raw_table * rt = calloc(batch_size, sizeof(raw_table));
+    flappie_matrix * trans = calloc(batch_size, sizeof(flappie_matrix));
+    size_t * order = calloc(batch_size, sizeof(size_t));
+    if(NULL == batch || NULL == rt || NULL == trans || NULL == order){
+        errx(EXIT_FAILURE, "Failed to allocate batch for %s stage.", stage->name);
+    }
+
+    size_t nbatch = 0;
+    while(0 != (nbatch = flappie_queue_pop_batch(stage->in, (void **)batch, batch_size))){
+        size_t ncall = 0;
+        for(size_t i=0 ; i < nbatch ; i++){
+            if(NULL != batch[i]->res.basecall){
+                //  Found in cache
+                if(!flappie_queue_push(stage->out, batch[i])){
+                    free_read_job(batch[i]);
+                }
+                continue;
+            }
+            batch[ncall] = batch[i];
+            rt[ncall] = batch[i]->rt;
+            ncall += 1;
+        }
+        nbatch = ncall;
+        if(0 == nbatch){
+            continue;
+        }
+        flappie_caller_transitions(network_caller, rt, nbatch, trans);
+        //  Pass longest reads on first so their decoding starts soonest
+        for(size_t i=0 ; i < nbatch ; i++){
+            order[i] = i;
+            for(size_t j=i ; j > 0 && rt[order[j - 1]].n < rt[order[j]].n ; j--){
+                const size_t tmp = order[j];
+                order[j] = order[j - 1];
+                order[j - 1] = tmp;
+            }
+        }
+        for(size_t i=0 ; i < nbatch ; i++){
+            struct read_job * job = batch[order[i]];
+            job->trans = trans[order[i]];
+            if(NULL != job->parent){
+                job = finish_chunk(job);
+                if(NULL == job){
+                    continue;
+                }
+            }
+            if(NULL == job->trans){
+                warnx("No basecall returned for %s", job->filename);
+                free_read_job(job);
+                continue;
+            }
+            if(!flappie_queue_push(stage->out, job)){
+                free_read_job(job);
+            }
+        }
+    }
+
+    free(order);
+    free(trans);
+    free(rt);
+    free(batch);
+    flappie_queue_close(stage->out);
+    return NULL;
+}
+
+
+static struct read_job * decode_job(struct read_job * job){
+    if(NULL != job->res.basecall){
+        //  Found in cache
+        return job;
+    }
+    if(!basecall_from_flipflop_transitions(job->trans, job->rt, &job->res)){
+        warnx("No basecall returned for %s", job->filename);
+        free_read_job(job);
+        return NULL;
+    }
+    job->trans = free_flappie_matrix(job->trans);
+    flappie_cache_store(cache, &job->res, NULL != args.trace);
+
+    return job;
+}
+
+
+/**  Open cache of basecalls
+ *
+ *   Entries are keyed on every setting that changes the basecall of a read,
+ *   but not on those that only change how it is written.
+ **/
+static flappie_cache open_cache(const char * dirname){
+    char settings[1024];
+    int len = snprintf(settings, sizeof(settings),
+                       "flappie %s\nmodel %s\nprecision %s:%s:%s\ntemperature %a\ntrim %d:%d\nsegmentation %d:%a\nchunk %d:%d\n",
+                       FLAPPIE_VERSION, flappie_model_string(args.model), flappie_precision_string(args.precision),
+                       flappie_precision_string(flappie_activation_precision()),
+                       flappie_math_precision_string(flappie_math_precision()), args.temperature,
+                       args.trim_start, args.trim_end, args.varseg_chunk, args.varseg_thresh,
+                       args.chunk_size, (args.chunk_size > 0) ? args.chunk_overlap : 0);
+    struct flappie_calibration cal;
+    if(FLAPPIE_PRECISION_INT16 == args.precision && flappie_get_calibration(args.model, &cal)){
+        len += snprintf(settings + len, sizeof(settings) - len, "calibration %a", cal.features);
+        for(size_t layer=0 ; layer < FLAPPIE_NLAYER_RECURRENT ; layer++){
+            len += snprintf(settings + len, sizeof(settings) - len, " %a:%a", cal.gru_input[layer], cal.gru_recurrent[layer]);
+        }
+        snprintf(settings + len, sizeof(settings) - len, "\n");
+    }
+    return make_flappie_cache(dirname, settings);
+}
+
+
+/**  Server mode
+ *
+ *   Every model is warmed once at start-up and requests are then answered
+ *   over a Unix domain socket, so a small job pays neither process start-up
+ *   nor page-faulting of the weights.  Each connection is served by its own
+ *   thread and may make any number of requests, one per line:
+ *
+ *     models
+ *     basecall <model> <format> <path of fast5 file>
+ *     signal <model> <format> <read id> <nsample>
+ *
+ *   A signal request is followed by nsample raw samples, in pA, as native
+ *   floats.  Format is fasta, fastq, sam or trace.  The reply is a line
+ *   "OK <nbyte>" followed by nbyte bytes of output, or a line
+ *   "ERROR <message>".
+ **/
+
+//  Removed when server is stopped
+static const char * server_socket = NULL;
+
+
+static void stop_server(int sig){
+    unlink(server_socket);
+    _exit((SIGTERM == sig || SIGINT == sig) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+
+//  Touch the weights of every model and start BLAS before the first request
+static void warm_models(void){
+    const size_t nsample = 4000;
+    float * raw = calloc(nsample, sizeof(float));
+    if(NULL == raw){
+        return;
+    }
+    for(size_t i=0 ; i < nsample ; i++){
+        raw[i] = 2.0f * rand() / (float)RAND_MAX - 1.0f;
+    }
+    for(size_t mdl=0 ; mdl < flappie_nmodel ; mdl++){
+        raw_table rt = {NULL, nsample, 0, nsample, raw};
+        flappie_matrix trans = NULL;
+        flappie_caller_transitions(caller[mdl], &rt, 1, &trans);
+        trans = free_flappie_matrix(trans);
+    }
+    free(raw);
+}
+
+
+static void write_server_read(struct read_job * job, enum flappie_outformat_type outformat, bool trace, FILE * out){
+    char namebuf[PATH_MAX];
+    const char * readname = read_job_name(job, namebuf, sizeof(namebuf));
+    if(!trace){
+        fprintf_format(outformat, out, job->res.rt.uuid, readname, args.uuid, args.prefix, job->res);
+        return;
+    }
+
+    fprintf(out, "# %s\n", args.uuid ? job->res.rt.uuid : readname);
+    const_flappie_imatrix tr = job->res.trace;
+    if(NULL == tr){
+        return;
+    }
+    for(size_t c=0 ; c < tr->nc ; c++){
+        for(size_t r=0 ; r < tr->nr ; r++){
+            fprintf(out, (r + 1 < tr->nr) ? "%d\t" : "%d\n", tr->data.f[c * tr->stride + r]);
+        }
+    }
+}
+
+
+/**  Call reads of a request in batches, writing each as it is decoded
+ *
+ *   Every job is freed.
+ **/
+static void call_server_reads(struct read_job ** job, size_t njob, enum model_type model,
+                              enum flappie_outformat_type outformat, bool trace, FILE * out){
+    const size_t batch_size = args.batch_size;
+    raw_table * rt = calloc(batch_size, sizeof(raw_table));
+    struct _raw_basecall_info * res = calloc(batch_size, sizeof(struct _raw_basecall_info));
+    if(NULL == rt || NULL == res){
+        warnx("Failed to allocate batch for request.");
+        for(size_t i=0 ; i < njob ; i++){
+            free_read_job(job[i]);
+        }
+        goto cleanup;
+    }
+
+    for(size_t start=0, nbatch=0 ; start < njob ; start += nbatch){
+        //  Batch is cut short once its predicted memory would exceed limit
+        size_t memory = 0;
+        for(nbatch=0 ; start + nbatch < njob && nbatch < batch_size ; nbatch++){
+            memory += predict_basecall_memory(model, job[start + nbatch]->rt.n);
+            if(nbatch > 0 && args.max_memory > 0 && memory > args.max_memory){
+                break;
+            }
+        }
+        for(size_t i=0 ; i < nbatch ; i++){
+            //  Signal is owned by caller from here on
+            rt[i] = job[start + i]->rt;
+            job[start + i]->rt = (raw_table){0};
+        }
+        flappie_call_raw_batch(caller[model], rt, nbatch, res);
+        for(size_t i=0 ; i < nbatch ; i++){
+            struct read_job * read = job[start + i];
+            read->res = res[i];
+            if(NULL == read->res.basecall){
+                warnx("No basecall returned for %s", read->filename);
+            } else {
+                write_server_read(read, outformat, trace, out);
+            }
+            free_read_job(read);
+        }
+    }
+
+cleanup:
+    free(res);
+    free(rt);
+}
+
+
+static struct read_job * make_server_job(raw_table rt, const char * filename, bool multi_read, size_t iread){
+    struct read_job * job = calloc(1, sizeof(struct read_job));
+    RETURN_NULL_IF(NULL == job, NULL);
+    const size_t len = strlen(filename);
+    job->filename = calloc(len + 1, sizeof(char));
+    if(NULL == job->filename){
+        free(job);
+        return NULL;
+    }
+    memcpy(job->filename, filename, len * sizeof(char));
+    job->multi_read = multi_read;
+    job->iread = iread;
+    job->rt = rt;
+    return job;
+}
+
+
+//  Read every read of a fast5 file into jobs
+static struct read_job ** read_server_file(const char * filename, size_t * njob){
+    *njob = 0;
+    pthread_mutex_lock(&hdf5_lock);
+    fast5_reader reader = open_fast5_reader(filename);
+    if(NULL == reader){
+        pthread_mutex_unlock(&hdf5_lock);
+        return NULL;
+    }
+    size_t capacity = 0;
+    struct read_job ** job = NULL;
+    raw_table rt;
+    for(size_t iread=0 ; fast5_reader_next(reader, true, &rt) ; iread++){
+        if(NULL == rt.raw){
+            continue;
+        }
+        if(*njob == capacity){
+            capacity = 2 * capacity + 1;
+            struct read_job ** tmp = realloc(job, capacity * sizeof(struct read_job *));
+            if(NULL == tmp){
+                free_raw_table(&rt);
+                break;
+            }
+            job = tmp;
+        }
+        job[*njob] = make_server_job(rt, filename, fast5_reader_multi_read(reader), iread);
+        if(NULL == job[*njob]){
+            free_raw_table(&rt);
+            break;
+        }
+        *njob += 1;
+    }
+    reader = close_fast5_reader(reader);
+    pthread_mutex_unlock(&hdf5_lock);
+    return job;
+}
+
+
+/**  Answer a single request
+ *
+ *   @param line Request
+ *   @param in Connection, from which any signal following request is read
+ *   @param reply Output of request
+ *
+ *   @returns NULL on success, otherwise a description of the error
+ **/
+static const char * serve_request(char * line, FILE * in, FILE * reply){
+    char command[16];
+    char modelstr[64];
+    char formatstr[16];
+    int offset = 0;
+    line[strcspn(line, "\r\n")] = '\0';
+
+    if(1 != sscanf(line, "%15s", command)){
+        return "Empty request";
+    }
+    if(0 == strcmp(command, "models")){
+        for(size_t mdl=0 ; mdl < flappie_nmodel ; mdl++){
+            fprintf(reply, "%s\t%s\n", flappie_model_string(mdl), flappie_model_description(mdl));
+        }
+        return NULL;
+    }
+    if(0 != strcmp(command, "basecall") && 0 != strcmp(command, "signal")){
+        return "Unknown request";
+    }
+
+    if(3 != sscanf(line, "%15s %63s %15s %n", command, modelstr, formatstr, &offset) || 0 == offset){
+        return "Request should be of form: <request> <model> <format> ...";
+    }
+    const enum model_type model = get_flappie_model_type(modelstr);
+    if(model >= flappie_nmodel){
+        return "Unknown model";
+    }
+    const bool trace = (0 == strcmp(formatstr, "trace"));
+    const enum flappie_outformat_type outformat = trace ? FLAPPIE_OUTFORMAT_FASTQ : get_outformat(formatstr);
+    if(FLAPPIE_OUTFORMAT_INVALID == outformat){
+        return "Unknown format";
+    }
+    char * param = line + offset;
+
+    if(0 == strcmp(command, "basecall")){
+        size_t njob = 0;
+        struct read_job ** job = read_server_file(param, &njob);
+        if(NULL == job){
+            return "Failed to read file";
+        }
+        call_server_reads(job, njob, model, outformat, trace, reply);
+        free(job);
+        return NULL;
+    }
+
+    char read_id[256];
+    size_t nsample = 0;
+    if(2 != sscanf(param, "%255s %zu", read_id, &nsample) || 0 == nsample){
+        return "Signal request should be of form: signal <model> <format> <read id> <nsample>";
+    }
+    const size_t idlen = strlen(read_id);
+    raw_table rt = {calloc(idlen + 1, sizeof(char)), nsample, 0, nsample, calloc(nsample, sizeof(float))};
+    if(NULL == rt.uuid || NULL == rt.raw){
+        free_raw_table(&rt);
+        return "Failed to allocate signal";
+    }
+    memcpy(rt.uuid, read_id, idlen * sizeof(char));
+    if(nsample != fread(rt.raw, sizeof(float), nsample, in)){
+        free_raw_table(&rt);
+        return "Failed to read signal";
+    }
+    struct read_job * job = make_server_job(rt, read_id, false, 0);
+    if(NULL == job){
+        free_raw_table(&rt);
+        return "Failed to allocate read";
+    }
+    call_server_reads(&job, 1, model, outformat, trace, reply);
+    return NULL;
+}
+
+
+static void * run_server_connection(void * ptr){
+    const int fd = *(int *)ptr;
+    free(ptr);
+
+    FILE * in = fdopen(fd, "r");
+    const int outfd = dup(fd);
+    FILE * out = (outfd >= 0) ? fdopen(outfd, "w") : NULL;
+    if(NULL == in || NULL == out){
+        warnx("Failed to open connection.");
+        goto cleanup;
+    }
+
+    char line[4096];
+    char buf[65536];
+    while(NULL != fgets(line, sizeof(line), in)){
+        FILE * reply = tmpfile();
+        const char * error = (NULL != reply) ? serve_request(line, in, reply) : "Failed to create reply";
+        if(NULL == error){
+            fprintf(out, "OK %ld\n", ftell(reply));
+            rewind(reply);
+            size_t nread = 0;
+            while(0 != (nread = fread(buf, sizeof(char), sizeof(buf), reply))){
+                fwrite(buf, sizeof(char), nread, out);
+            }
+        } else {
+            fprintf(out, "ERROR %s\n", error);
+        }
+        if(NULL != reply){
+            fclose(reply);
+        }
+        if(0 != fflush(out)){
+            //  Client has gone
+            break;
+        }
+    }
+
+cleanup:
+    if(NULL != out){
+        fclose(out);
+    } else if(outfd >= 0){
+        close(outfd);
+    }
+    if(NULL != in){
+        fclose(in);
+    } else {
+        close(fd);
+    }
+    return NULL;
+}
+
+
+/**  Answer requests on a Unix domain socket until killed
+ *
+ *   @param path Filename of socket, which must not already exist
+ **/
+static void run_server(const char * path){
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    const size_t pathlen = strlen(path);
+    if(pathlen >= sizeof(addr.sun_path)){
+        errx(EXIT_FAILURE, "Name of socket \"%s\" is too long.", path);
+    }
+    memcpy(addr.sun_path, path, pathlen * sizeof(char));
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0){
+        err(EXIT_FAILURE, "Failed to create socket");
+    }
+    if(0 != bind(fd, (struct sockaddr *)&addr, sizeof(addr))){
+        err(EXIT_FAILURE, "Failed to bind socket \"%s\" (remove it if no server is running)", path);
+    }
+    server_socket = path;
+    signal(SIGINT, stop_server);
+    signal(SIGTERM, stop_server);
+    //  A client disconnecting early must not stop the server
+    signal(SIGPIPE, SIG_IGN);
+    if(0 != listen(fd, 16)){
+        unlink(path);
+        err(EXIT_FAILURE, "Failed to listen on socket \"%s\"", path);
+    }
+
+    warm_models();
+    warnx("Listening on %s", path);
+
+    // Network layers keep large work arrays on the stack
+    const size_t stack_size = 16 * 1024 * 1024;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, stack_size);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for(;;){
+        const int conn = accept(fd, NULL, NULL);
+        if(conn < 0){
+            if(EINTR != errno){
+                warn("Failed to accept connection");
+            }
+            continue;
+        }
+        int * arg = malloc(sizeof(int));
+        pthread_t thread;
+        if(NULL == arg){
+            close(conn);
+            continue;
+        }
+        *arg = conn;
+        if(0 != pthread_create(&thread, &attr, run_server_connection, arg)){
+            warnx("Failed to start thread for connection.");
+            free(arg);
+            close(conn);
+        }
+    }
+}
+
+
+/**  Make a caller for the chosen model on each NUMA node of the host
+ *
+ *   Threads for running reads of a batch (--threads) are divided between the
+ *   nodes and every node is given its own copy of the weights.
+ **/
+static void make_node_callers(void){
+    topology = make_flappie_topology();
+    if(NULL == topology){
+        errx(EXIT_FAILURE, "Failed to detect NUMA topology.");
+    }
+    nnode = flappie_topology_nnode(topology);
+    if(nnode > FLAPPIE_MAX_NUMA_NODE){
+        warnx("Using only the first %d of %zu NUMA nodes.", FLAPPIE_MAX_NUMA_NODE, nnode);
+        nnode = FLAPPIE_MAX_NUMA_NODE;
+    }
+    if((size_t)args.network_threads < nnode){
+        warnx("Fewer network threads (%d) than NUMA nodes (%zu), some nodes will be idle.", args.network_threads, nnode);
+    }
+
+    struct flappie_caller_options options = flappie_caller_get_options(caller[args.model]);
+    options.nthread = ((size_t)args.threads > nnode) ? (args.threads / nnode) : 1;
+    for(size_t node=0 ; node < nnode ; node++){
+        options.numa_node = node;
+        node_caller[node] = make_flappie_caller(options);
+        if(NULL == node_caller[node]){
+            errx(EXIT_FAILURE, "Failed to create basecaller for NUMA node %zu.", node);
+        }
+    }
+}
+
+
+/**  Open source of streamed signal
+ *
+ *   @param source "-" for stdin, otherwise name of a file, FIFO or Unix
+ *   domain socket to connect to
+ *
+ *   @returns Stream or NULL on failure
+ **/
+static FILE * open_stream_source(const char * source){
+    if(0 == strcmp(source, "-")){
+        return stdin;
+    }
+    struct stat st;
+    if(0 != stat(source, &st)){
+        return NULL;
+    }
+    if(S_ISREG(st.st_mode) || S_ISFIFO(st.st_mode)){
+        return fopen(source, "r");
+    }
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    const size_t pathlen = strlen(source);
+    RETURN_NULL_IF(pathlen >= sizeof(addr.sun_path), NULL);
+    memcpy(addr.sun_path, source, pathlen * sizeof(char));
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    RETURN_NULL_IF(fd < 0, NULL);
+    if(0 != connect(fd, (struct sockaddr *)&addr, sizeof(addr))){
+        close(fd);
+        return NULL;
+    }
+    FILE * in = fdopen(fd, "r");
+    if(NULL == in){
+        close(fd);
+    }
+    return in;
+}
+
+
+//  Whether input is waiting to be read without blocking
+static bool stream_input_pending(FILE * in){
+    struct pollfd pfd = {.fd = fileno(in), .events = POLLIN};
+    return poll(&pfd, 1, 0) > 0;
+}
+
+
+static void write_stream_bases(size_t channel, const char * read_id, const char * bases, size_t nbase,
+                               size_t nsample, bool end, void * data){
+    FILE * out = data;
+    fprintf(out, "%zu\t%s\t%zu\t%s\t%.*s\n", channel, read_id, nsample, end ? "end" : "call", (int)nbase, bases);
+    fflush(out);
+}
+
+
+/**  Call signal streamed from a source until it is closed
+ *
+ *   Source sends messages of the form
+ *     signal <channel> <read id> <nsample>\n<nsample native floats of signal>
+ *     end <channel>\n
+ *   Each line of output is a channel, read id, samples received, whether the
+ *   read has ended and the bases committed since the last line for the read.
+ *   Windows are called once a batch is ready or no more input is waiting.
+ *
+ *   @param source See open_stream_source
+ **/
+static void run_stream(const char * source){
+    FILE * in = open_stream_source(source);
+    if(NULL == in){
+        err(EXIT_FAILURE, "Failed to open stream \"%s\"", source);
+    }
+    struct flappie_stream_options options = default_flappie_stream_options();
+    options.step = args.stream_step;
+    options.lookahead = args.stream_lookahead;
+    flappie_stream stream = make_flappie_stream(caller[args.model], options, write_stream_bases, args.output);
+    if(NULL == stream){
+        errx(EXIT_FAILURE, "Failed to create stream.");
+    }
+    warnx("Streaming from %s, bases committed within %zu samples of signal.", source,
+          flappie_stream_max_latency(stream));
+
+    char line[4096];
+    float * signal = NULL;
+    size_t capacity = 0;
+    size_t nchannel = 0;
+    while(NULL != fgets(line, sizeof(line), in)){
+        char command[16];
+        char read_id[256];
+        size_t channel = 0;
+        size_t nsample = 0;
+        if(4 == sscanf(line, "%15s %zu %255s %zu", command, &channel, read_id, &nsample) && 0 == strcmp(command, "signal")){
+            if(nsample > capacity){
+                float * tmp = realloc(signal, nsample * sizeof(float));
+                if(NULL == tmp){
+                    errx(EXIT_FAILURE, "Failed to allocate signal of %zu samples.", nsample);
+                }
+                signal = tmp;
+                capacity = nsample;
+            }
+            if(nsample != fread(signal, sizeof(float), nsample, in)){
+                errx(EXIT_FAILURE, "Stream ended within signal of read %s.", read_id);
+            }
+            if(!flappie_stream_push(stream, channel, read_id, signal, nsample)){
+                errx(EXIT_FAILURE, "Failed to add signal of read %s.", read_id);
+            }
+            nchannel = (channel >= nchannel) ? (channel + 1) : nchannel;
+        } else if(2 == sscanf(line, "%15s %zu", command, &channel) && 0 == strcmp(command, "end")){
+            flappie_stream_end(stream, channel);
+        } else {
+            line[strcspn(line, "\r\n")] = '\0';
+            errx(EXIT_FAILURE, "Unrecognised message in stream: \"%s\".", line);
+        }
+
+        if(flappie_stream_nready(stream) >= (size_t)args.batch_size || !stream_input_pending(in)){
+            flappie_stream_process(stream);
+        }
+    }
+
+    //  Source has closed, so every read has ended
+    for(size_t c=0 ; c < nchannel ; c++){
+        flappie_stream_end(stream, c);
+    }
+    flappie_stream_process(stream);
+
+    free(signal);
+    stream = free_flappie_stream(stream);
+    if(stdin != in){
+        fclose(in);
+    }
+}
+
+
+struct read_until_data {
+    flappie_prefix_classifier classifier;
+    int nread;
+    double * latency;
+    size_t capacity;
+};
+
+
+static bool call_prefix_fast5_file(const char * filename, void * data){
+    struct read_until_data * d = data;
+    fast5_reader reader = open_fast5_reader(filename);
+    if(NULL == reader){
+        return true;
+    }
+    raw_table rt;
+    while((args.limit <= 0 || d->nread < args.limit) && fast5_reader_next(reader, true, &rt)){
+        struct flappie_prefix_call res;
+        if(NULL != rt.raw && flappie_call_prefix(d->classifier, rt.raw, rt.n, &res)){
+            fprintf(args.output, "%s\t%zu\t%.4f\t%.3f\t%s\n", rt.uuid, res.nsample, res.confidence,
+                    1e3 * res.seconds, res.bases);
+            if((size_t)d->nread >= d->capacity){
+                d->capacity = (0 == d->capacity) ? 1024 : (2 * d->capacity);
+                double * tmp = realloc(d->latency, d->capacity * sizeof(double));
+                if(NULL == tmp){
+                    errx(EXIT_FAILURE, "Failed to allocate record of latency.");
+                }
+                d->latency = tmp;
+            }
+            d->latency[d->nread] = res.seconds;
+            d->nread += 1;
+        } else {
+            warnx("Read %s in %s too short to call.", rt.uuid, filename);
+        }
+        free_raw_table(&rt);
+    }
+    reader = close_fast5_reader(reader);
+    return args.limit <= 0 || d->nread < args.limit;
+}
+
+
+static int doublecmp(const void * a, const void * b){
+    const double da = *(const double *)a;
+    const double db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+
+/**  Call the first samples of every read, one read at a time on one thread
+ *
+ *   Each line of output is a read id, samples called, confidence, latency in
+ *   milliseconds and bases.  Percentiles of latency are reported at the end.
+ **/
+static void run_read_until(void){
+    struct flappie_caller_options options = default_flappie_caller_options();
+    options.model = args.model;
+    options.precision = args.precision;
+    options.temperature = args.temperature;
+    options.trim_start = args.trim_start;
+    struct read_until_data data = {
+        .classifier = make_flappie_prefix_classifier(options, args.read_until)};
+    if(NULL == data.classifier){
+        errx(EXIT_FAILURE, "Failed to create read until classifier, is the prefix longer than the trim (%d)?",
+             args.trim_start);
+    }
+
+    for_each_fast5_file(call_prefix_fast5_file, &data);
+
+    if(data.nread > 0){
+        qsort(data.latency, data.nread, sizeof(double), doublecmp);
+        warnx("Called prefix of %d reads, latency median %.3fms, p99 %.3fms, max %.3fms.", data.nread,
+              1e3 * data.latency[data.nread / 2], 1e3 * data.latency[(99 * (data.nread - 1)) / 100],
+              1e3 * data.latency[data.nread - 1]);
+    }
+    free(data.latency);
+    data.classifier = free_flappie_prefix_classifier(data.classifier);
+}
+
+
+struct calibrate_data {
+    struct flappie_calibration cal;
+    int nread;
+};
+
+
+static bool calibrate_fast5_file(const char * filename, void * data){
+    struct calibrate_data * d = data;
+    fast5_reader reader = open_fast5_reader(filename);
+    if(NULL == reader){
+        return true;
+    }
+    raw_table rt;
+    while((args.limit <= 0 || d->nread < args.limit) && fast5_reader_next(reader, true, &rt)){
+        rt = flappie_caller_trim(caller[args.model], rt);
+        if(NULL != rt.raw && flappie_calibrate_read(rt, args.model, &d->cal)){
+            d->nread += 1;
+        } else {
+            warnx("Read %s in %s too short to calibrate with.", rt.uuid, filename);
+        }
+        free_raw_table(&rt);
+    }
+    reader = close_fast5_reader(reader);
+    return args.limit <= 0 || d->nread < args.limit;
+}
+
+
+/**  Calibrate model for fixed point on reads, writing the calibration as output
+ **/
+static void run_calibrate(void){
+    struct calibrate_data data = {{0}, 0};
+    for_each_fast5_file(calibrate_fast5_file, &data);
+    if(0 == data.nread){
+        errx(EXIT_FAILURE, "No reads to calibrate model %s with.", flappie_model_string(args.model));
+    }
+    if(!write_flappie_calibration(args.output, args.model, &data.cal)){
+        errx(EXIT_FAILURE, "Failed to write calibration.");
+    }
+    warnx("Calibrated model %s on %d reads.", flappie_model_string(args.model), data.nread);
+}
+
+
+/**  Basecall reads of files through a pipeline of threads
+ *
+ *   @param hdf5out File to write trace of each read to, negative if none
+ **/
+static void run_pipeline(hid_t hdf5out){
+    //  Reader -> trim and normalise -> network -> decode -> writer
+    //  Every queue is bounded so memory use is set by the queue depth rather
+    //  than the number of reads.
+    struct pipeline_stage stages[] = {
+        {.name = "read", .nthread = 1},
+        {.name = "trim", .nthread = 1},
+        {.name = "network", .nthread = args.network_threads},
+        {.name = "decode", .process = decode_job, .nthread = args.decode_threads}
+    };
+    const size_t nstage = sizeof(stages) / sizeof(stages[0]);
+    const size_t network_stage = 2;
+    for(size_t i=0 ; i < nstage ; i++){
+        //  Queue feeding network must be able to hold a full batch
+        const size_t depth = (i + 1 == network_stage && args.batch_size > args.queue_depth)
+                           ? args.batch_size : args.queue_depth;
+        stages[i].out = make_flappie_queue(depth, stages[i].nthread);
+        if(NULL == stages[i].out){
+            errx(EXIT_FAILURE, "Failed to create queue for %s stage.", stages[i].name);
+        }
+        if(i > 0){
+            stages[i].in = stages[i - 1].out;
+        }
+    }
+
+    start_pipeline_stage(stages, run_read_stage);
+    start_pipeline_stage(stages + 1, run_trim_stage);
+    start_pipeline_stage(stages + 2, run_network_stage);
+    start_pipeline_stage(stages + 3, run_pipeline_stage);
+
+    //  Writer runs on main thread, emitting reads as soon as they are decoded
+    flappie_profile_name_thread("writer");
+    struct read_job * job = NULL;
+    while(NULL != (job = flappie_queue_pop(stages[nstage - 1].out))){
+        const double t = flappie_profile_start();
+        char namebuf[PATH_MAX];
+        const char * readname = read_job_name(job, namebuf, sizeof(namebuf));
+        fprintf_format(args.outformat, args.output, job->res.rt.uuid, readname, args.uuid, args.prefix, job->res);
+        if(hdf5out >= 0){
+            //  Reader may be in HDF5 at the same time
+            pthread_mutex_lock(&hdf5_lock);
+            write_summary(hdf5out, args.uuid ? job->res.rt.uuid : readname, job->res, args.compression_chunk_size, args.compression_level);
+            pthread_mutex_unlock(&hdf5_lock);
+        }
+        flappie_profile_stop(FLAPPIE_PROFILE_OUTPUT, t, job->res.rt.uuid, job->res.rt.n);
+        flappie_profile_add_read(job->res.rt.n, job->res.basecall_length);
+        free_read_job(job);
+    }
+
+    for(size_t i=0 ; i < nstage ; i++){
+        join_pipeline_stage(stages + i);
+    }
+    for(size_t i=0 ; i < nstage ; i++){
+        stages[i].out = free_flappie_queue(stages[i].out);
+    }
 }
 
 
 int main(int argc, char * argv[]){
     argp_parse(&argp, argc, argv, 0, 0, NULL);
+    if(NULL != args.server && (NULL != args.cache || NULL != args.trace || NULL != args.profile || NULL != args.timeline)){
+        errx(EXIT_FAILURE, "Server does not support --cache, --trace, --profile or --timeline, request trace output instead.");
+    }
+    if(NULL != args.server && args.numa){
+        errx(EXIT_FAILURE, "Server does not support --numa.");
+    }
+    if(NULL != args.stream && (NULL != args.server || NULL != args.cache || NULL != args.trace || args.numa)){
+        errx(EXIT_FAILURE, "Streaming does not support --server, --cache, --trace or --numa.");
+    }
+    if(NULL != args.stream && args.model >= flappie_nmodel){
+        errx(EXIT_FAILURE, "Streaming requires a flip-flop model.");
+    }
+    if(args.read_until > 0 && (NULL != args.server || NULL != args.stream || NULL != args.cache || NULL != args.trace)){
+        errx(EXIT_FAILURE, "Read until does not support --server, --stream, --cache or --trace.");
+    }
+    if(args.calibrate && (NULL != args.server || NULL != args.stream || args.read_until > 0 || NULL != args.cache)){
+        errx(EXIT_FAILURE, "Calibration does not support --server, --stream, --read-until or --cache.");
+    }
+    if(args.calibrate && args.model >= flappie_nmodel){
+        errx(EXIT_FAILURE, "Calibration requires a flip-flop model.");
+    }
+    if(NULL != args.calibration){
+        FILE * fh = fopen(args.calibration, "r");
+        enum model_type calmodel = FLAPPIE_MODEL_INVALID;
+        struct flappie_calibration cal = {0};
+        if(NULL == fh || !read_flappie_calibration(fh, &calmodel, &cal)){
+            errx(EXIT_FAILURE, "Failed to read calibration \"%s\".", args.calibration);
+        }
+        fclose(fh);
+        if(calmodel != args.model){
+            errx(EXIT_FAILURE, "Calibration \"%s\" is of model %s, not %s.", args.calibration,
+                 flappie_model_string(calmodel), flappie_model_string(args.model));
+        }
+        flappie_set_calibration(calmodel, &cal);
+    }
+    if(NULL != args.profile){
+        flappie_profile_enable();
+    }
+    if(NULL != args.timeline && !flappie_timeline_open(args.timeline)){
+        errx(EXIT_FAILURE, "Failed to open timeline \"%s\".", args.timeline);
+    }
+    const double start_time = flappie_profile_clock();
+    budget.limit = args.max_memory;
+    if(args.chunk_size > 0 && args.chunk_overlap >= args.chunk_size){
+        errx(EXIT_FAILURE, "Chunk overlap (%d) must be less than chunk size (%d).", args.chunk_overlap, args.chunk_size);
+    }
     if(NULL == args.output){
         args.output = stdout;
     }
 
     hid_t hdf5out = open_or_create_hdf5(args.trace);
-
-
-    int nfile = 0;
-    for( ; args.files[nfile] ; nfile++);
-
-    int reads_started = 0;
-    const int reads_limit = args.limit;
-
-    glob_t globbuf;
-    // Find all files matching commandline argument using system glob
-    const size_t rootlen = strlen(args.files[0]);
-    char * globpath = calloc(rootlen + 9, sizeof(char));
-    memcpy(globpath, args.files[0], rootlen * sizeof(char));
-    {
-	DIR * dirp = opendir(args.files[0]);
-	if(NULL != dirp){
-	    // If filename is a directory, add wildcard to find all fast5 files within it
-	    memcpy(globpath + rootlen, "/*.fast5", 8 * sizeof(char));
-	    closedir(dirp);
-	}
-    }
-    int globret = glob(globpath, GLOB_NOSORT, NULL, &globbuf);
-    free(globpath);
-    if(0 != globret){
-	if(GLOB_NOMATCH == globret){
-	    warnx("File or directory \"%s\" does not exist or no fast5 files found.", args.files[0]);
-	}
-	globfree(&globbuf);
-    }
-
-    char *filename[max_files];
-    for(size_t fn2=0 ; fn2 < globbuf.gl_pathc ; fn2++){
-	if(reads_limit > 0 && reads_started >= reads_limit)
-	    continue;
-	reads_started += 1;
-	filename[fn2] = globbuf.gl_pathv[fn2];
-    }    
-
-    //struct _raw_basecall_info res[max_files];
-    struct _raw_basecall_info *res = (struct _raw_basecall_info *) malloc(sizeof(struct _raw_basecall_info)*max_files);
-    //for(size_t fn2=0 ; fn2 < globbuf.gl_pathc ; fn2++)
-        //res[fn2] = /calculate_post(filename[fn2], args.model);
-        calculate_post(filename, args.model, globbuf.gl_pathc, res);
-
-    for(size_t fn2=0 ; fn2 < globbuf.gl_pathc ; fn2++){
-        if(NULL == res[fn2].basecall){
-            warnx("No basecall returned for %s", filename[fn2]);
+    if(NULL != args.cache){
+        cache = open_cache(args.cache);
+        if(NULL == cache){
+            errx(EXIT_FAILURE, "Failed to open cache \"%s\".", args.cache);
+        }
+    }
+    for(size_t mdl=0 ; mdl < flappie_nmodel ; mdl++){
+        if(NULL == args.server && mdl != args.model){
             continue;
         }
-        fprintf_format(args.outformat, args.output, res[fn2].rt.uuid, basename(filename[fn2]), args.uuid, args.prefix, res[fn2]);
-        write_summary(hdf5out, args.uuid ? res[fn2].rt.uuid : basename(filename[fn2]), res[fn2], args.compression_chunk_size, args.compression_level);
-        free_raw_basecall_info(&res[fn2]);
+        const struct flappie_caller_options options = {
+            .model = mdl,
+            .precision = args.precision,
+            .temperature = args.temperature,
+            .trim_start = args.trim_start,
+            .trim_end = args.trim_end,
+            .varseg_chunk = args.varseg_chunk,
+            .varseg_thresh = args.varseg_thresh,
+            .chunk_size = args.chunk_size,
+            .chunk_overlap = args.chunk_overlap,
+            .nthread = args.threads,
+            .numa_node = -1};
+        caller[mdl] = make_flappie_caller(options);
+        if(NULL == caller[mdl]){
+            errx(EXIT_FAILURE, "Failed to create basecaller for model %s.", flappie_model_string(mdl));
+        }
+    }
+    if(args.numa){
+        make_node_callers();
+    }
+    if(NULL != args.server){
+        run_server(args.server);
     }
-    globfree(&globbuf);
+
+    if(NULL != args.stream){
+        run_stream(args.stream);
+    } else if(args.calibrate){
+        run_calibrate();
+    } else if(args.read_until > 0){
+        run_read_until();
+    } else {
+        run_pipeline(hdf5out);
+    }
+    for(size_t mdl=0 ; mdl < flappie_nmodel ; mdl++){
+        caller[mdl] = free_flappie_caller(caller[mdl]);
+    }
+    for(size_t node=0 ; node < nnode ; node++){
+        node_caller[node] = free_flappie_caller(node_caller[node]);
+    }
+    topology = free_flappie_topology(topology);
+    cache = free_flappie_cache(cache);
 
     if (hdf5out >= 0) {
         H5Fclose(hdf5out);
@@ -350,5 +1909,18 @@ int main(int argc, char * argv[]){
         fclose(args.output);
     }
 
+    if(NULL != args.timeline && !flappie_timeline_close()){
+        warnx("Failed to write timeline to \"%s\".", args.timeline);
+    }
+    if(NULL != args.profile){
+        FILE * fh = fopen(args.profile, "w");
+        if(NULL == fh || !flappie_profile_write(fh, flappie_profile_clock() - start_time)){
+            warnx("Failed to write profile to \"%s\".", args.profile);
+        }
+        if(NULL != fh){
+            fclose(fh);
+        }
+    }
+
     return EXIT_SUCCESS;
 }
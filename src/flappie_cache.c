@@ -0,0 +1,352 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "flappie_cache.h"
+#include "flappie_stdlib.h"
+
+static const char cache_magic[8] = {'F', 'L', 'P', 'C', 'A', 'C', 'H', 'E'};
+static const uint32_t cache_version = 1;
+
+struct _flappie_cache {
+    char * dirname;
+    char * settings;
+    //  Number of entries written, used to name temporary files
+    size_t nwritten;
+    pthread_mutex_t lock;
+};
+
+/**  Fixed size part of entry, following magic and version
+ *
+ *   Followed by key, basecall, quality and, if trace_nc is non-zero, the
+ *   trace column by column and the normalised signal from start to end.
+ **/
+struct cache_header {
+    float score;
+    uint64_t n;
+    uint64_t start;
+    uint64_t end;
+    uint64_t nblock;
+    uint64_t basecall_length;
+    uint64_t key_length;
+    uint64_t trace_nr;
+    uint64_t trace_nc;
+};
+
+
+static char * copy_string(const char * str){
+    const size_t len = strlen(str);
+    char * copy = calloc(len + 1, sizeof(char));
+    RETURN_NULL_IF(NULL == copy, NULL);
+    memcpy(copy, str, len * sizeof(char));
+    return copy;
+}
+
+
+/**  Create cache, making its directory if necessary
+ *
+ *  @param dirname Directory holding entries
+ *  @param settings Description of every setting affecting a call.  Entries
+ *  written with different settings are never returned.
+ *
+ *  @returns Cache or NULL on failure
+ **/
+flappie_cache make_flappie_cache(const char * dirname, const char * settings){
+    RETURN_NULL_IF(NULL == dirname, NULL);
+    RETURN_NULL_IF(NULL == settings, NULL);
+
+    if(0 != mkdir(dirname, 0777) && EEXIST != errno){
+        warnx("Failed to create cache directory \"%s\".", dirname);
+        return NULL;
+    }
+    struct stat sb;
+    if(0 != stat(dirname, &sb) || !S_ISDIR(sb.st_mode)){
+        warnx("Cache \"%s\" is not a directory.", dirname);
+        return NULL;
+    }
+
+    flappie_cache cache = calloc(1, sizeof(*cache));
+    RETURN_NULL_IF(NULL == cache, NULL);
+    cache->dirname = copy_string(dirname);
+    cache->settings = copy_string(settings);
+    if(NULL == cache->dirname || NULL == cache->settings){
+        return free_flappie_cache(cache);
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+
+    return cache;
+}
+
+
+flappie_cache free_flappie_cache(flappie_cache cache){
+    if(NULL != cache){
+        if(NULL != cache->dirname && NULL != cache->settings){
+            pthread_mutex_destroy(&cache->lock);
+        }
+        free(cache->settings);
+        free(cache->dirname);
+        free(cache);
+    }
+    return NULL;
+}
+
+
+//  Key of entry: read id followed by settings
+static char * make_cache_key(const_flappie_cache cache, const char * read_id){
+    const size_t idlen = strlen(read_id);
+    const size_t settingslen = strlen(cache->settings);
+    char * key = calloc(idlen + settingslen + 2, sizeof(char));
+    RETURN_NULL_IF(NULL == key, NULL);
+    memcpy(key, read_id, idlen * sizeof(char));
+    key[idlen] = '\n';
+    memcpy(key + idlen + 1, cache->settings, settingslen * sizeof(char));
+    return key;
+}
+
+
+//  64-bit FNV-1a hash
+static uint64_t hash_cache_key(const char * key){
+    uint64_t hash = UINT64_C(14695981039346656037);
+    for( ; '\0' != *key ; key++){
+        hash ^= (unsigned char)*key;
+        hash *= UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+
+static char * cache_filename(const_flappie_cache cache, const char * key, const char * suffix){
+    const size_t len = strlen(cache->dirname);
+    const size_t suffixlen = strlen(suffix);
+    //  Separator, 16 hex digits and terminator
+    const size_t size = len + suffixlen + 18;
+    char * filename = calloc(size, sizeof(char));
+    RETURN_NULL_IF(NULL == filename, NULL);
+    snprintf(filename, size, "%s/%016" PRIx64 "%s", cache->dirname, hash_cache_key(key), suffix);
+    return filename;
+}
+
+
+/**  Find basecall of read in cache
+ *
+ *  @param cache Cache, may be NULL
+ *  @param rt Untrimmed read.  On success the normalised signal is copied into
+ *  rt.raw if with_trace is set.
+ *  @param with_trace Only accept entries holding trace and signal
+ *  @param res [out] Basecall, taking ownership of rt with start and end of
+ *  trimmed read set.  Unchanged on failure.
+ *
+ *  @returns true if read was found
+ **/
+bool flappie_cache_lookup(const_flappie_cache cache, raw_table rt, bool with_trace,
+                          struct _raw_basecall_info * res){
+    if(NULL == cache){
+        //  Not using cache
+        return false;
+    }
+    RETURN_NULL_IF(NULL == rt.uuid, false);
+    RETURN_NULL_IF(NULL == rt.raw, false);
+    RETURN_NULL_IF(NULL == res, false);
+
+    bool found = false;
+    char * filename = NULL;
+    char * stored_key = NULL;
+    char * basecall = NULL;
+    char * quality = NULL;
+    int * pos = NULL;
+    float * signal = NULL;
+    flappie_imatrix trace = NULL;
+    FILE * fh = NULL;
+
+    char * key = make_cache_key(cache, rt.uuid);
+    if(NULL == key){
+        goto cleanup;
+    }
+    filename = cache_filename(cache, key, "");
+    if(NULL == filename){
+        goto cleanup;
+    }
+    fh = fopen(filename, "rb");
+    if(NULL == fh){
+        //  Not in cache
+        goto cleanup;
+    }
+
+    char magic[8];
+    uint32_t version = 0;
+    struct cache_header header;
+    if(1 != fread(magic, sizeof(magic), 1, fh) || 0 != memcmp(magic, cache_magic, sizeof(magic))
+       || 1 != fread(&version, sizeof(version), 1, fh) || cache_version != version
+       || 1 != fread(&header, sizeof(header), 1, fh)){
+        goto cleanup;
+    }
+    const size_t keylen = strlen(key);
+    if(keylen != header.key_length || header.n != rt.n
+       || header.start > header.end || header.end > header.n){
+        goto cleanup;
+    }
+    if(with_trace && 0 == header.trace_nc){
+        goto cleanup;
+    }
+
+    stored_key = calloc(keylen + 1, sizeof(char));
+    basecall = calloc(header.basecall_length + 1, sizeof(char));
+    quality = calloc(header.basecall_length + 1, sizeof(char));
+    pos = calloc(header.nblock + 1, sizeof(int));
+    if(NULL == stored_key || NULL == basecall || NULL == quality || NULL == pos){
+        goto cleanup;
+    }
+    if(keylen != fread(stored_key, sizeof(char), keylen, fh) || 0 != strcmp(stored_key, key)){
+        //  Collision of hashes
+        goto cleanup;
+    }
+    if(header.basecall_length != fread(basecall, sizeof(char), header.basecall_length, fh)
+       || header.basecall_length != fread(quality, sizeof(char), header.basecall_length, fh)){
+        goto cleanup;
+    }
+
+    if(with_trace){
+        trace = make_flappie_imatrix(header.trace_nr, header.trace_nc);
+        const size_t nsample = header.end - header.start;
+        signal = calloc(nsample, sizeof(float));
+        if(NULL == trace || NULL == signal){
+            goto cleanup;
+        }
+        for(size_t c=0 ; c < trace->nc ; c++){
+            if(trace->nr != fread(trace->data.f + c * trace->stride, sizeof(int32_t), trace->nr, fh)){
+                goto cleanup;
+            }
+        }
+        if(nsample != fread(signal, sizeof(float), nsample, fh)){
+            goto cleanup;
+        }
+        memcpy(rt.raw + header.start, signal, nsample * sizeof(float));
+    }
+
+    rt.start = header.start;
+    rt.end = header.end;
+    *res = (struct _raw_basecall_info) {
+        .score = header.score,
+        .rt = rt,
+        .basecall = basecall,
+        .quality = quality,
+        .basecall_length = header.basecall_length,
+        .trace = trace,
+        .pos = pos,
+        .nblock = header.nblock};
+    //  Now owned by result
+    basecall = NULL;
+    quality = NULL;
+    pos = NULL;
+    trace = NULL;
+    found = true;
+
+cleanup:
+    if(NULL != fh){
+        fclose(fh);
+    }
+    trace = free_flappie_imatrix(trace);
+    free(signal);
+    free(pos);
+    free(quality);
+    free(basecall);
+    free(stored_key);
+    free(filename);
+    free(key);
+    return found;
+}
+
+
+/**  Add basecall of read to cache
+ *
+ *  @param cache Cache, may be NULL
+ *  @param res Basecall of read, with trimmed and normalised read
+ *  @param with_trace Store trace and normalised signal as well as basecall
+ *
+ *  @returns true on success
+ **/
+bool flappie_cache_store(flappie_cache cache, const struct _raw_basecall_info * res, bool with_trace){
+    if(NULL == cache){
+        return false;
+    }
+    RETURN_NULL_IF(NULL == res, false);
+    RETURN_NULL_IF(NULL == res->rt.uuid, false);
+    RETURN_NULL_IF(NULL == res->basecall || NULL == res->quality, false);
+    with_trace = with_trace && NULL != res->trace && NULL != res->rt.raw;
+
+    bool ok = false;
+    char * filename = NULL;
+    char * tmpname = NULL;
+    char * key = make_cache_key(cache, res->rt.uuid);
+    if(NULL == key){
+        goto cleanup;
+    }
+    filename = cache_filename(cache, key, "");
+
+    //  Temporary file unique to this process and entry
+    pthread_mutex_lock(&cache->lock);
+    const size_t id = cache->nwritten;
+    cache->nwritten += 1;
+    pthread_mutex_unlock(&cache->lock);
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".%ld.%zu.tmp", (long)getpid(), id);
+    tmpname = cache_filename(cache, key, suffix);
+    if(NULL == filename || NULL == tmpname){
+        goto cleanup;
+    }
+
+    FILE * fh = fopen(tmpname, "wb");
+    if(NULL == fh){
+        goto cleanup;
+    }
+    const size_t keylen = strlen(key);
+    const struct cache_header header = {
+        .score = res->score,
+        .n = res->rt.n,
+        .start = res->rt.start,
+        .end = res->rt.end,
+        .nblock = res->nblock,
+        .basecall_length = res->basecall_length,
+        .key_length = keylen,
+        .trace_nr = with_trace ? res->trace->nr : 0,
+        .trace_nc = with_trace ? res->trace->nc : 0};
+    ok = 1 == fwrite(cache_magic, sizeof(cache_magic), 1, fh)
+      && 1 == fwrite(&cache_version, sizeof(cache_version), 1, fh)
+      && 1 == fwrite(&header, sizeof(header), 1, fh)
+      && keylen == fwrite(key, sizeof(char), keylen, fh)
+      && res->basecall_length == fwrite(res->basecall, sizeof(char), res->basecall_length, fh)
+      && res->basecall_length == fwrite(res->quality, sizeof(char), res->basecall_length, fh);
+    if(ok && with_trace){
+        for(size_t c=0 ; ok && c < res->trace->nc ; c++){
+            ok = res->trace->nr == fwrite(res->trace->data.f + c * res->trace->stride, sizeof(int32_t), res->trace->nr, fh);
+        }
+        const size_t nsample = res->rt.end - res->rt.start;
+        ok = ok && nsample == fwrite(res->rt.raw + res->rt.start, sizeof(float), nsample, fh);
+    }
+    ok = (0 == fclose(fh)) && ok;
+
+    //  Entry only appears once complete
+    ok = ok && 0 == rename(tmpname, filename);
+    if(!ok){
+        remove(tmpname);
+        warnx("Failed to write cache entry for read %s.", res->rt.uuid);
+    }
+
+cleanup:
+    free(tmpname);
+    free(filename);
+    free(key);
+    return ok;
+}
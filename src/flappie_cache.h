@@ -0,0 +1,36 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#pragma once
+#ifndef FLAPPIE_CACHE_H
+#    define FLAPPIE_CACHE_H
+
+#    include <stdbool.h>
+
+#    include "flappie_structures.h"
+
+/**  On-disk cache of basecalls
+ *
+ *   Each entry is a file in the cache directory named by a hash of the read
+ *   id and a string describing every setting that affects the call (model,
+ *   temperature, trimming, ...).  The full key is stored in the entry and
+ *   checked on lookup, so a hash collision is a miss rather than a wrong
+ *   call.  Entries are written to a temporary file and renamed into place,
+ *   so an interrupted run never leaves a partial entry.
+ **/
+typedef struct _flappie_cache *flappie_cache;
+typedef struct _flappie_cache const *const_flappie_cache;
+
+flappie_cache make_flappie_cache(const char * dirname, const char * settings);
+flappie_cache free_flappie_cache(flappie_cache cache);
+
+bool flappie_cache_lookup(const_flappie_cache cache, raw_table rt, bool with_trace,
+                          struct _raw_basecall_info * res);
+bool flappie_cache_store(flappie_cache cache, const struct _raw_basecall_info * res, bool with_trace);
+
+#endif /* FLAPPIE_CACHE_H */
@@ -0,0 +1,420 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#include <math.h>
+
+#include "decode.h"
+#include "flappie_caller.h"
+#include "flappie_common.h"
+#include "flappie_numa.h"
+#include "flappie_profile.h"
+#include "flappie_stdlib.h"
+#include "flappie_threadpool.h"
+#include "layers.h"
+#include "util.h"
+
+struct _flappie_caller {
+    struct flappie_caller_options options;
+    flappie_threadpool pool;
+    //  CPUs of node, if caller is bound to one
+    flappie_topology topology;
+};
+
+
+/**  Options matching the defaults of the flappie command line
+ **/
+struct flappie_caller_options default_flappie_caller_options(void){
+    return (struct flappie_caller_options){
+        .model = FLAPPIE_MODEL_R941_NATIVE,
+        .precision = FLAPPIE_PRECISION_FLOAT,
+        .temperature = 1.0f,
+        .trim_start = 200,
+        .trim_end = 10,
+        .varseg_chunk = 100,
+        .varseg_thresh = 0.0f,
+        .chunk_size = 0,
+        .chunk_overlap = 500,
+        .nthread = 1,
+        .numa_node = -1};
+}
+
+
+static void replicate_weights_job(void * data){
+    const struct flappie_caller_options * options = data;
+    replicate_model_weights(options->model, options->precision);
+}
+
+
+//  Pool pinned to CPUs of node of caller and copy of weights local to node
+static bool bind_caller_to_node(flappie_caller caller){
+    const size_t node = caller->options.numa_node;
+    caller->topology = make_flappie_topology();
+    RETURN_NULL_IF(NULL == caller->topology, false);
+    RETURN_NULL_IF(node >= flappie_topology_nnode(caller->topology), false);
+
+    if(caller->options.nthread > 1){
+        caller->pool = make_flappie_threadpool_pinned(caller->options.nthread,
+                                                      flappie_topology_cpus(caller->topology, node),
+                                                      flappie_topology_ncpu(caller->topology, node), node);
+        RETURN_NULL_IF(NULL == caller->pool, false);
+    }
+    //  Nodes beyond FLAPPIE_MAX_NUMA_NODE share the original weights
+    return flappie_run_on_node(caller->topology, node, replicate_weights_job, &caller->options);
+}
+
+
+/**  Create basecaller
+ *
+ *  @param options Settings of caller.  Only flip-flop models are supported.
+ *
+ *  @returns Caller or NULL on failure
+ **/
+flappie_caller make_flappie_caller(struct flappie_caller_options options){
+    RETURN_NULL_IF(options.model >= flappie_nmodel, NULL);
+    RETURN_NULL_IF(options.precision >= FLAPPIE_PRECISION_INVALID, NULL);
+    RETURN_NULL_IF(!isfinite(options.temperature) || options.temperature <= 0.0f, NULL);
+    RETURN_NULL_IF(options.varseg_chunk < 2, NULL);
+    RETURN_NULL_IF(options.varseg_thresh < 0.0f || options.varseg_thresh > 1.0f, NULL);
+    RETURN_NULL_IF(options.chunk_size > 0 && options.chunk_overlap >= options.chunk_size, NULL);
+
+    flappie_caller caller = calloc(1, sizeof(*caller));
+    RETURN_NULL_IF(NULL == caller, NULL);
+    caller->options = options;
+    if(options.numa_node >= 0){
+        if(!bind_caller_to_node(caller)){
+            return free_flappie_caller(caller);
+        }
+    } else if(options.nthread > 1){
+        caller->pool = make_flappie_threadpool(options.nthread);
+        if(NULL == caller->pool){
+            return free_flappie_caller(caller);
+        }
+    }
+
+    return caller;
+}
+
+
+flappie_caller free_flappie_caller(flappie_caller caller){
+    if(NULL != caller){
+        caller->pool = free_flappie_threadpool(caller->pool);
+        caller->topology = free_flappie_topology(caller->topology);
+        free(caller);
+    }
+    return NULL;
+}
+
+
+struct flappie_caller_options flappie_caller_get_options(const_flappie_caller caller){
+    assert(NULL != caller);
+    return caller->options;
+}
+
+
+/**  Trim and normalise read
+ *
+ *  @param caller Caller whose settings are used
+ *  @param rt Untrimmed read, ownership taken
+ *
+ *  @returns Trimmed read, normalised in place between start and end.  If the
+ *  read is entirely trimmed away, its signal is freed and raw is NULL.
+ **/
+raw_table flappie_caller_trim(const_flappie_caller caller, raw_table rt){
+    assert(NULL != caller);
+    if(NULL == rt.raw){
+        return rt;
+    }
+    const struct flappie_caller_options * opt = &caller->options;
+    char * uuid = rt.uuid;
+    const size_t nsample = rt.n;
+    double t = flappie_profile_start();
+    rt = trim_and_segment_raw(rt, opt->trim_start, opt->trim_end, opt->varseg_chunk, opt->varseg_thresh);
+    flappie_profile_stop(FLAPPIE_PROFILE_TRIM, t, uuid, nsample);
+    //  Read id survives failure so it can be reported and freed
+    rt.uuid = uuid;
+    if(NULL != rt.raw){
+        t = flappie_profile_start();
+        medmad_normalise_array(rt.raw + rt.start, rt.end - rt.start);
+        flappie_profile_stop(FLAPPIE_PROFILE_NORMALISE, t, uuid, rt.end - rt.start);
+    }
+    return rt;
+}
+
+
+static void caller_transitions(const_flappie_caller caller, raw_table * rt, size_t nread, flappie_matrix * trans){
+    const struct flappie_caller_options * opt = &caller->options;
+    if(0 == opt->chunk_size){
+        calculate_transitions_new(rt, opt->temperature, opt->model, opt->precision, nread, trans, caller->pool);
+        return;
+    }
+
+    raw_table * whole = calloc(nread, sizeof(raw_table));
+    flappie_matrix * whole_trans = calloc(nread, sizeof(flappie_matrix));
+    if(NULL == whole || NULL == whole_trans){
+        for(size_t i=0 ; i < nread ; i++){
+            trans[i] = NULL;
+        }
+        goto cleanup;
+    }
+    for(size_t i=0 ; i < nread ; i++){
+        const bool is_long = NULL != rt[i].raw && rt[i].end - rt[i].start > opt->chunk_size;
+        whole[i] = is_long ? (raw_table){0} : rt[i];
+    }
+    calculate_transitions_new(whole, opt->temperature, opt->model, opt->precision, nread, whole_trans, caller->pool);
+    for(size_t i=0 ; i < nread ; i++){
+        trans[i] = (NULL != whole[i].raw) ? whole_trans[i]
+                 : (NULL != rt[i].raw) ? calculate_transitions_chunked(rt[i], opt->chunk_size, opt->chunk_overlap,
+                                                                       opt->temperature, opt->model, opt->precision,
+                                                                       caller->pool)
+                 : NULL;
+    }
+
+cleanup:
+    free(whole_trans);
+    free(whole);
+}
+
+
+/**  Calculate transitions for a batch of trimmed reads
+ *
+ *   Reads longer than the chunk size of the caller are called in overlapping
+ *   chunks, the rest are batched together.  A caller bound to a NUMA node
+ *   uses the node's copy of the weights; its work arrays are local to the
+ *   node if the calling thread is pinned there too.
+ *
+ *  @param caller Caller
+ *  @param rt Array of trimmed and normalised reads
+ *  @param nread Number of reads
+ *  @param trans [out] Array of nread transitions, NULL for reads that could
+ *  not be called
+ **/
+void flappie_caller_transitions(const_flappie_caller caller, raw_table * rt, size_t nread, flappie_matrix * trans){
+    assert(NULL != caller);
+    const int thread_node = flappie_thread_node();
+    flappie_set_thread_node(caller->options.numa_node);
+    caller_transitions(caller, rt, nread, trans);
+    flappie_set_thread_node(thread_node);
+}
+
+
+/**  Decode basecall from flip-flop transitions
+ *
+ *  @param trans Transitions of read
+ *  @param rt Trimmed read that transitions were calculated from
+ *  @param res [out] Basecall, taking ownership of rt.  Unchanged on failure.
+ *
+ *  @returns true on success
+ **/
+bool basecall_from_flipflop_transitions(const_flappie_matrix trans, raw_table rt, struct _raw_basecall_info * res){
+    RETURN_NULL_IF(NULL == trans, false);
+    RETURN_NULL_IF(NULL == res, false);
+
+    const size_t nbase = nbase_from_flipflop_nparam(trans->nr);
+    const size_t nblock = trans->nc;
+    const size_t nsample = rt.end - rt.start;
+    int * path = calloc(nblock + 2, sizeof(int));
+    int * path_idx = calloc(nblock + 2, sizeof(int));
+    float * qpath = calloc(nblock + 2, sizeof(float));
+    int * pos = calloc(nblock + 1, sizeof(int));
+    double t = flappie_profile_start();
+    flappie_matrix posterior = transpost_crf_flipflop(trans, true);
+    flappie_profile_stop(FLAPPIE_PROFILE_POSTERIOR, t, rt.uuid, nsample);
+    if(NULL == path || NULL == path_idx || NULL == qpath || NULL == pos || NULL == posterior){
+        posterior = free_flappie_matrix(posterior);
+        free(pos);
+        free(qpath);
+        free(path_idx);
+        free(path);
+        return false;
+    }
+
+    t = flappie_profile_start();
+    const float score = decode_crf_flipflop(posterior, false, path, qpath);
+    const size_t path_nidx = change_positions(path, nblock, path_idx);
+
+    char * basecall = calloc(path_nidx + 1, sizeof(char));
+    char * quality = calloc(path_nidx + 1, sizeof(char));
+    if(NULL != basecall && NULL != quality){
+        for(size_t i=0 ; i < path_nidx ; i++){
+            const size_t idx = path_idx[i];
+            basecall[i] = base_lookup[path[idx] % nbase];
+            quality[i] = phredf(expf(qpath[idx]));
+        }
+    }
+    flappie_profile_stop(FLAPPIE_PROFILE_DECODE, t, rt.uuid, nsample);
+
+    t = flappie_profile_start();
+    exp_activation_inplace(posterior);
+    flappie_imatrix trace = trace_from_posterior(posterior);
+    posterior = free_flappie_matrix(posterior);
+    flappie_profile_stop(FLAPPIE_PROFILE_TRACE, t, rt.uuid, nsample);
+    free(qpath);
+    free(path_idx);
+    free(path);
+    if(NULL == basecall || NULL == quality){
+        trace = free_flappie_imatrix(trace);
+        free(pos);
+        free(quality);
+        free(basecall);
+        return false;
+    }
+
+    *res = (struct _raw_basecall_info) {
+        .score = score,
+        .rt = rt,
+        .basecall = basecall,
+        .quality = quality,
+        .basecall_length = path_nidx,
+        .trace = trace,
+        .pos = pos,
+        .nblock = nblock};
+
+    return true;
+}
+
+
+struct call_batch_data {
+    const_flappie_caller caller;
+    raw_table * rt;
+    flappie_matrix * trans;
+    struct _raw_basecall_info * res;
+};
+
+
+static void trim_read(size_t i, void * ptr){
+    struct call_batch_data * data = ptr;
+    data->rt[i] = flappie_caller_trim(data->caller, data->rt[i]);
+}
+
+
+static void decode_read(size_t i, void * ptr){
+    struct call_batch_data * data = ptr;
+    data->res[i] = (struct _raw_basecall_info){0};
+    if(NULL == data->trans[i]
+       || !basecall_from_flipflop_transitions(data->trans[i], data->rt[i], data->res + i)){
+        free_raw_table(data->rt + i);
+    }
+    data->trans[i] = free_flappie_matrix(data->trans[i]);
+}
+
+
+/**  Basecall a batch of reads
+ *
+ *   Reads are trimmed, run through the network together and decoded in
+ *   parallel using the pool of the caller.
+ *
+ *  @param caller Caller
+ *  @param rt Array of untrimmed reads, ownership of every read is taken
+ *  @param nread Number of reads
+ *  @param res [out] Array of nread basecalls.  A read that could not be
+ *  called has a NULL basecall and nothing to free.
+ *
+ *  @returns Number of reads called
+ **/
+size_t flappie_call_raw_batch(const_flappie_caller caller, raw_table * rt, size_t nread,
+                              struct _raw_basecall_info * res){
+    RETURN_NULL_IF(NULL == caller, 0);
+    RETURN_NULL_IF(NULL == rt, 0);
+    RETURN_NULL_IF(NULL == res, 0);
+    if(0 == nread){
+        return 0;
+    }
+
+    flappie_matrix * trans = calloc(nread, sizeof(flappie_matrix));
+    if(NULL == trans){
+        for(size_t i=0 ; i < nread ; i++){
+            free_raw_table(rt + i);
+            res[i] = (struct _raw_basecall_info){0};
+        }
+        return 0;
+    }
+
+    struct call_batch_data data = {caller, rt, trans, res};
+    flappie_parallel_for(caller->pool, nread, trim_read, &data);
+    flappie_caller_transitions(caller, rt, nread, trans);
+    flappie_parallel_for(caller->pool, nread, decode_read, &data);
+    free(trans);
+
+    size_t ncalled = 0;
+    for(size_t i=0 ; i < nread ; i++){
+        //  Ownership has passed to result
+        rt[i] = (raw_table){0};
+        ncalled += (NULL != res[i].basecall);
+    }
+    return ncalled;
+}
+
+
+/**  Basecall a single read
+ *
+ *  @param caller Caller
+ *  @param rt Untrimmed read, ownership taken
+ *  @param res [out] Basecall
+ *
+ *  @returns true if read was called
+ **/
+bool flappie_call_raw(const_flappie_caller caller, raw_table rt, struct _raw_basecall_info * res){
+    return 1 == flappie_call_raw_batch(caller, &rt, 1, res);
+}
+
+
+/**  Basecall a batch of reads of raw signal
+ *
+ *   The signal may be either the raw counts of the digitiser or calibrated
+ *   to pA: reads are median / MAD normalised before calling, so the call
+ *   does not depend on the calibration.
+ *
+ *  @param caller Caller
+ *  @param signal Array of nread signals, copied
+ *  @param n Array of lengths of signals
+ *  @param nread Number of reads
+ *  @param res [out] Array of nread basecalls, see flappie_call_raw_batch.  The
+ *  read ids of results are NULL.
+ *
+ *  @returns Number of reads called
+ **/
+size_t flappie_call_signal_batch(const_flappie_caller caller, const int16_t * const * signal, const size_t * n,
+                                 size_t nread, struct _raw_basecall_info * res){
+    RETURN_NULL_IF(NULL == signal, 0);
+    RETURN_NULL_IF(NULL == n, 0);
+    if(0 == nread){
+        return 0;
+    }
+
+    raw_table * rt = calloc(nread, sizeof(raw_table));
+    RETURN_NULL_IF(NULL == rt, 0);
+    for(size_t i=0 ; i < nread ; i++){
+        float * raw = (NULL != signal[i] && n[i] > 0) ? calloc(n[i], sizeof(float)) : NULL;
+        if(NULL == raw){
+            continue;
+        }
+        for(size_t j=0 ; j < n[i] ; j++){
+            raw[j] = signal[i][j];
+        }
+        rt[i] = (raw_table){NULL, n[i], 0, n[i], raw};
+    }
+
+    const size_t ncalled = flappie_call_raw_batch(caller, rt, nread, res);
+    free(rt);
+    return ncalled;
+}
+
+
+/**  Basecall a read of raw signal
+ *
+ *  @param caller Caller
+ *  @param signal Signal, copied
+ *  @param n Length of signal
+ *  @param res [out] Basecall
+ *
+ *  @returns true if read was called
+ **/
+bool flappie_call_signal(const_flappie_caller caller, const int16_t * signal, size_t n,
+                         struct _raw_basecall_info * res){
+    return 1 == flappie_call_signal_batch(caller, &signal, &n, 1, res);
+}
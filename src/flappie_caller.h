@@ -0,0 +1,70 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#pragma once
+#ifndef FLAPPIE_CALLER_H
+#    define FLAPPIE_CALLER_H
+
+#    include <stdbool.h>
+#    include <stdint.h>
+
+#    include "flappie_matrix.h"
+#    include "flappie_structures.h"
+#    include "networks.h"
+
+/**  Every setting that changes the basecall of a read, and how it is run
+ *
+ *   Weights are used at precision, converted when first needed and shared by
+ *   every caller of the same model and precision.  chunk_size of zero calls
+ *   each read in one piece.  A numa_node of zero or more pins the threads of
+ *   the caller to the CPUs of that NUMA node and gives it a copy of the
+ *   weights in the node's memory; -1 for no binding.
+ **/
+struct flappie_caller_options {
+    enum model_type model;
+    enum flappie_precision precision;
+    float temperature;
+    size_t trim_start;
+    size_t trim_end;
+    size_t varseg_chunk;
+    float varseg_thresh;
+    size_t chunk_size;
+    size_t chunk_overlap;
+    size_t nthread;
+    int numa_node;
+};
+
+/**  Basecaller for embedding in other programs
+ *
+ *   A caller owns its settings and a pool of threads; the weights of the
+ *   model are read-only and every call allocates its own workspace.  A caller
+ *   is not modified once made, so any number of threads may call through the
+ *   same caller at the same time, sharing its pool.
+ **/
+typedef struct _flappie_caller *flappie_caller;
+typedef struct _flappie_caller const *const_flappie_caller;
+
+struct flappie_caller_options default_flappie_caller_options(void);
+flappie_caller make_flappie_caller(struct flappie_caller_options options);
+flappie_caller free_flappie_caller(flappie_caller caller);
+struct flappie_caller_options flappie_caller_get_options(const_flappie_caller caller);
+
+bool flappie_call_signal(const_flappie_caller caller, const int16_t * signal, size_t n,
+                         struct _raw_basecall_info * res);
+size_t flappie_call_signal_batch(const_flappie_caller caller, const int16_t * const * signal, const size_t * n,
+                                 size_t nread, struct _raw_basecall_info * res);
+bool flappie_call_raw(const_flappie_caller caller, raw_table rt, struct _raw_basecall_info * res);
+size_t flappie_call_raw_batch(const_flappie_caller caller, raw_table * rt, size_t nread,
+                              struct _raw_basecall_info * res);
+
+//  Steps of a call, for callers scheduling work themselves
+raw_table flappie_caller_trim(const_flappie_caller caller, raw_table rt);
+void flappie_caller_transitions(const_flappie_caller caller, raw_table * rt, size_t nread, flappie_matrix * trans);
+bool basecall_from_flipflop_transitions(const_flappie_matrix trans, raw_table rt, struct _raw_basecall_info * res);
+
+#endif /* FLAPPIE_CALLER_H */
@@ -0,0 +1,114 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "flappie_cpu.h"
+
+extern const struct flappie_kernels flappie_kernels_sse4;
+extern const struct flappie_kernels flappie_kernels_avx;
+extern const struct flappie_kernels flappie_kernels_avx2;
+extern const struct flappie_kernels flappie_kernels_avx512;
+
+static const struct flappie_kernels * const kernels_of_level[FLAPPIE_CPU_INVALID] = {
+    &flappie_kernels_sse4,
+    &flappie_kernels_avx,
+    &flappie_kernels_avx2,
+    &flappie_kernels_avx512
+};
+
+static const char * const level_name[FLAPPIE_CPU_INVALID] = {"sse4", "avx", "avx2", "avx512"};
+
+//  Kernels in use, chosen on first call unless set before
+static const struct flappie_kernels * kernels = NULL;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+
+/**  Level from its name
+ *
+ *  @param levelstr Name of level, as flappie_cpu_level_string
+ *
+ *  @returns Level, FLAPPIE_CPU_INVALID if name not recognised
+ **/
+enum flappie_cpu_level get_flappie_cpu_level(const char * levelstr){
+    assert(NULL != levelstr);
+    for(int level=0 ; level < FLAPPIE_CPU_INVALID ; level++){
+        if(0 == strcmp(levelstr, level_name[level])){
+            return level;
+        }
+    }
+    return FLAPPIE_CPU_INVALID;
+}
+
+
+const char * flappie_cpu_level_string(enum flappie_cpu_level level){
+    return (level < FLAPPIE_CPU_INVALID) ? level_name[level] : "invalid";
+}
+
+
+/**  Best level supported by the host, from cpuid
+ *
+ *  Support by the operating system for the wider registers is checked too.
+ *
+ *  @returns Level
+ **/
+enum flappie_cpu_level flappie_cpu_detect(void){
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")
+       && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+        return FLAPPIE_CPU_AVX512;
+    }
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+        return FLAPPIE_CPU_AVX2;
+    }
+    if(__builtin_cpu_supports("avx")){
+        return FLAPPIE_CPU_AVX;
+    }
+    return FLAPPIE_CPU_SSE4;
+}
+
+
+static void choose_kernels(void){
+    if(NULL == kernels){
+        kernels = kernels_of_level[flappie_cpu_detect()];
+    }
+}
+
+
+/**  Use kernels of a level rather than the best supported
+ *
+ *  To be called before kernels are run concurrently, normally at startup.
+ *
+ *  @param level Level to use
+ *
+ *  @returns True on success, false if the host does not support the level
+ **/
+bool flappie_set_cpu_level(enum flappie_cpu_level level){
+    if(level >= FLAPPIE_CPU_INVALID || level > flappie_cpu_detect()){
+        return false;
+    }
+    kernels = kernels_of_level[level];
+    return true;
+}
+
+
+enum flappie_cpu_level flappie_cpu_level(void){
+    return flappie_kernels()->level;
+}
+
+
+/**  Kernels to use on this host
+ *
+ *  @returns Table of kernels of the level set, or the best supported
+ **/
+const struct flappie_kernels * flappie_kernels(void){
+    pthread_once(&kernels_once, choose_kernels);
+    return kernels;
+}
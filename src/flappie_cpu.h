@@ -0,0 +1,63 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#pragma once
+#ifndef FLAPPIE_CPU_H
+#    define FLAPPIE_CPU_H
+
+#    include <stdbool.h>
+#    include <stddef.h>
+
+#    include "flappie_math.h"
+#    include "flappie_matrix.h"
+
+/**  Instruction sets hot kernels are built for, in increasing order
+ *
+ *   The build targets FLAPPIE_CPU_SSE4 and kernels for the other levels are
+ *   compiled alongside.  The best level the host supports is chosen when a
+ *   kernel is first called unless set beforehand.
+ **/
+enum flappie_cpu_level {
+    FLAPPIE_CPU_SSE4 = 0,
+    FLAPPIE_CPU_AVX,
+    FLAPPIE_CPU_AVX2,
+    FLAPPIE_CPU_AVX512,
+    FLAPPIE_CPU_INVALID
+};
+
+/**  Kernels built for one level
+ *
+ *   See grumod_step_fused_batch in layers.c for the arguments of
+ *   grumod_step_batch, grumod_step_fused_batch_int8 for those of
+ *   grumod_step_batch_int8 and grumod_step_fused_batch_half for those of
+ *   grumod_step_batch_half.  affine_columns_fixed has the arguments of its
+ *   namesake in layers.c.  math_inplace applies a function of flappie_math.h
+ *   to an array at the precision given.
+ **/
+struct flappie_kernels {
+    enum flappie_cpu_level level;
+    void (*grumod_step_batch)(const float * x, size_t ldx, const float * istate, size_t ldh,
+                              const_flappie_matrix sW, float * ostate, size_t ldo, size_t nlane);
+    void (*grumod_step_batch_int8)(const float * x, size_t ldx, const float * istate, size_t ldh,
+                                   const_flappie_qmatrix sW, float * ostate, size_t ldo, size_t nlane);
+    void (*grumod_step_batch_half)(const float * x, size_t ldx, const float * istate, size_t ldh,
+                                   const_flappie_hmatrix sW, float * ostate, size_t ldo, size_t nlane);
+    void (*affine_columns_fixed)(const fixed_point_t * W, size_t ld, size_t ncol, const fixed_point_t * x,
+                                 size_t n, const int32_t * b, int shift, fixed_point_t * out);
+    void (*math_inplace)(enum flappie_math_function fun, enum flappie_math_precision precision,
+                         float * x, size_t n);
+};
+
+enum flappie_cpu_level get_flappie_cpu_level(const char * levelstr);
+const char * flappie_cpu_level_string(enum flappie_cpu_level level);
+enum flappie_cpu_level flappie_cpu_detect(void);
+bool flappie_set_cpu_level(enum flappie_cpu_level level);
+enum flappie_cpu_level flappie_cpu_level(void);
+const struct flappie_kernels * flappie_kernels(void);
+
+#endif /* FLAPPIE_CPU_H */
@@ -0,0 +1,743 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+/*  Hot kernels, compiled once for each level of flappie_cpu_level.
+ *
+ *  The build compiles this file with the instruction set of each level,
+ *  defining FLAPPIE_KERNEL_LEVEL and the name of the table of kernels,
+ *  FLAPPIE_KERNEL_TABLE.  Code is chosen by the compiler's own macros
+ *  (__AVX__, __FMA__, __F16C__) so each copy uses what its level allows.
+ */
+
+#include <assert.h>
+#include <math.h>
+
+#include "flappie_cpu.h"
+#include "flappie_math.h"
+#include "flappie_mathfun.h"
+#include "util.h"
+
+#if !defined(FLAPPIE_KERNEL_LEVEL) || !defined(FLAPPIE_KERNEL_TABLE)
+#    error "FLAPPIE_KERNEL_LEVEL and FLAPPIE_KERNEL_TABLE must be defined to build kernels"
+#endif
+
+
+#ifdef __AVX__
+#    ifdef __FMA__
+#        define FMADD_PS(a, b, c) _mm256_fmadd_ps(a, b, c)
+#    else
+#        define FMADD_PS(a, b, c) _mm256_add_ps(_mm256_mul_ps(a, b), c)
+#    endif
+
+//  Mask of first n lanes, n <= 8
+static inline __m256i lane_mask(size_t n){
+    static const int32_t mask_table[16] = {-1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0};
+    return _mm256_loadu_si256((const __m256i *)(mask_table + 8 - n));
+}
+
+
+/**  Dot products of eight neighbouring columns of a matrix with a vector
+ *
+ *  @param col First column
+ *  @param ld Distance between columns
+ *  @param ncol Number of columns wanted, at most 8.  Lanes beyond are garbage.
+ *  @param h Vector of length n
+ *  @param n Length of columns
+ *
+ *  @returns Dot product of each column, one per lane
+ **/
+static inline __m256 dot8_columns(const float * col, size_t ld, size_t ncol, const float * h, size_t n){
+    const float * c[8];
+    for(size_t j=0 ; j < 8 ; j++){
+        //  Columns beyond those wanted repeat the last, so never read out of bounds
+        c[j] = col + ((j < ncol) ? j : (ncol - 1)) * ld;
+    }
+    __m256 acc[8];
+    for(size_t j=0 ; j < 8 ; j++){
+        acc[j] = _mm256_setzero_ps();
+    }
+
+    size_t i = 0;
+    for( ; i + 8 <= n ; i += 8){
+        const __m256 hv = _mm256_loadu_ps(h + i);
+        for(size_t j=0 ; j < 8 ; j++){
+            acc[j] = FMADD_PS(_mm256_loadu_ps(c[j] + i), hv, acc[j]);
+        }
+    }
+    if(i < n){
+        const __m256i mask = lane_mask(n - i);
+        const __m256 hv = _mm256_maskload_ps(h + i, mask);
+        for(size_t j=0 ; j < 8 ; j++){
+            acc[j] = FMADD_PS(_mm256_maskload_ps(c[j] + i, mask), hv, acc[j]);
+        }
+    }
+
+    //  Reduce each accumulator to a lane of the result
+    const __m256 t01 = _mm256_hadd_ps(acc[0], acc[1]);
+    const __m256 t23 = _mm256_hadd_ps(acc[2], acc[3]);
+    const __m256 t45 = _mm256_hadd_ps(acc[4], acc[5]);
+    const __m256 t67 = _mm256_hadd_ps(acc[6], acc[7]);
+    const __m256 t0123 = _mm256_hadd_ps(t01, t23);
+    const __m256 t4567 = _mm256_hadd_ps(t45, t67);
+    return _mm256_add_ps(_mm256_permute2f128_ps(t0123, t4567, 0x20),
+                         _mm256_permute2f128_ps(t0123, t4567, 0x31));
+}
+
+
+//  Sum each of four accumulators, one per lane of result
+static inline __m128 reduce4(__m256 a0, __m256 a1, __m256 a2, __m256 a3){
+    const __m256 t = _mm256_hadd_ps(_mm256_hadd_ps(a0, a1), _mm256_hadd_ps(a2, a3));
+    return _mm_add_ps(_mm256_castps256_ps128(t), _mm256_extractf128_ps(t, 1));
+}
+
+
+/**  Dot products of four neighbouring columns of a matrix with two vectors
+ *
+ *  Each column is loaded once for both vectors, halving the loads per
+ *  multiply compared to dot8_columns.
+ *
+ *  @param col First column
+ *  @param ld Distance between columns
+ *  @param ncol Number of columns wanted, at most 4.  Lanes beyond are garbage.
+ *  @param h0 First vector of length n
+ *  @param h1 Second vector of length n
+ *  @param n Length of columns
+ *  @param d0 [out] Dot product of each column with h0
+ *  @param d1 [out] Dot product of each column with h1
+ **/
+static inline void dot4_columns_pair(const float * col, size_t ld, size_t ncol, const float * h0, const float * h1,
+                                     size_t n, __m128 * d0, __m128 * d1){
+    const float * c[4];
+    for(size_t j=0 ; j < 4 ; j++){
+        c[j] = col + ((j < ncol) ? j : (ncol - 1)) * ld;
+    }
+    __m256 acc0[4], acc1[4];
+    for(size_t j=0 ; j < 4 ; j++){
+        acc0[j] = _mm256_setzero_ps();
+        acc1[j] = _mm256_setzero_ps();
+    }
+
+    size_t i = 0;
+    for( ; i + 8 <= n ; i += 8){
+        const __m256 hv0 = _mm256_loadu_ps(h0 + i);
+        const __m256 hv1 = _mm256_loadu_ps(h1 + i);
+        for(size_t j=0 ; j < 4 ; j++){
+            const __m256 w = _mm256_loadu_ps(c[j] + i);
+            acc0[j] = FMADD_PS(w, hv0, acc0[j]);
+            acc1[j] = FMADD_PS(w, hv1, acc1[j]);
+        }
+    }
+    if(i < n){
+        const __m256i mask = lane_mask(n - i);
+        const __m256 hv0 = _mm256_maskload_ps(h0 + i, mask);
+        const __m256 hv1 = _mm256_maskload_ps(h1 + i, mask);
+        for(size_t j=0 ; j < 4 ; j++){
+            const __m256 w = _mm256_maskload_ps(c[j] + i, mask);
+            acc0[j] = FMADD_PS(w, hv0, acc0[j]);
+            acc1[j] = FMADD_PS(w, hv1, acc1[j]);
+        }
+    }
+    *d0 = reduce4(acc0[0], acc0[1], acc0[2], acc0[3]);
+    *d1 = reduce4(acc1[0], acc1[1], acc1[2], acc1[3]);
+}
+
+
+//  As dot8_columns for two vectors at once
+static inline void dot8_columns_pair(const float * col, size_t ld, size_t ncol, const float * h0, const float * h1,
+                                     size_t n, __m256 * d0, __m256 * d1){
+    __m128 lo0, lo1, hi0 = _mm_setzero_ps(), hi1 = _mm_setzero_ps();
+    dot4_columns_pair(col, ld, (ncol < 4) ? ncol : 4, h0, h1, n, &lo0, &lo1);
+    if(ncol > 4){
+        dot4_columns_pair(col + 4 * ld, ld, ncol - 4, h0, h1, n, &hi0, &hi1);
+    }
+    *d0 = _mm256_insertf128_ps(_mm256_castps128_ps256(lo0), hi0, 1);
+    *d1 = _mm256_insertf128_ps(_mm256_castps128_ps256(lo1), hi1, 1);
+}
+
+
+//  Gates and new state for units [k, k + 8) of one lane, from recurrent products
+static inline void grumod_gates8(const float * x, const float * h, __m256 dz, __m256 dr, __m256 du,
+                                 size_t size, size_t k, __m256i mask, enum flappie_math_precision precision,
+                                 float * out){
+    const __m256 z = (__m256)logistic_v8((v8f)_mm256_add_ps(_mm256_maskload_ps(x + k, mask), dz), precision);
+    const __m256 r = (__m256)logistic_v8((v8f)_mm256_add_ps(_mm256_maskload_ps(x + size + k, mask), dr), precision);
+    const __m256 hbar = (__m256)tanh_v8((v8f)FMADD_PS(r, du, _mm256_maskload_ps(x + size + size + k, mask)),
+                                        precision);
+    const __m256 hk = _mm256_maskload_ps(h + k, mask);
+    //  z * h + (1 - z) * hbar
+    _mm256_maskstore_ps(out + k, mask, FMADD_PS(z, hk, _mm256_sub_ps(hbar, _mm256_mul_ps(z, hbar))));
+}
+#else
+
+//  Sum each of four accumulators, one per lane of result
+static inline __m128 reduce4(__m128 a0, __m128 a1, __m128 a2, __m128 a3){
+    return _mm_hadd_ps(_mm_hadd_ps(a0, a1), _mm_hadd_ps(a2, a3));
+}
+
+
+//  As dot8_columns of the AVX kernels, for four columns
+static inline __m128 dot4_columns(const float * col, size_t ld, size_t ncol, const float * h, size_t n){
+    const float * c[4];
+    for(size_t j=0 ; j < 4 ; j++){
+        c[j] = col + ((j < ncol) ? j : (ncol - 1)) * ld;
+    }
+    __m128 acc[4];
+    for(size_t j=0 ; j < 4 ; j++){
+        acc[j] = _mm_setzero_ps();
+    }
+
+    size_t i = 0;
+    for( ; i + 4 <= n ; i += 4){
+        const __m128 hv = _mm_loadu_ps(h + i);
+        for(size_t j=0 ; j < 4 ; j++){
+            acc[j] = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(c[j] + i), hv), acc[j]);
+        }
+    }
+    float tail[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for( ; i < n ; i++){
+        for(size_t j=0 ; j < 4 ; j++){
+            tail[j] += c[j][i] * h[i];
+        }
+    }
+    return _mm_add_ps(reduce4(acc[0], acc[1], acc[2], acc[3]), _mm_loadu_ps(tail));
+}
+
+
+//  First n elements of p, remainder zero
+static inline __m128 load_partial(const float * p, size_t n){
+    float tmp[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for(size_t i=0 ; i < n ; i++){
+        tmp[i] = p[i];
+    }
+    return _mm_loadu_ps(tmp);
+}
+
+
+//  Gates and new state for units [k, k + nunit) of one lane, from recurrent products
+static inline void grumod_gates4(const float * x, const float * h, __m128 dz, __m128 dr, __m128 du,
+                                 size_t size, size_t k, size_t nunit, enum flappie_math_precision precision,
+                                 float * out){
+    const __m128 z = (__m128)logistic_v4((v4f)_mm_add_ps(load_partial(x + k, nunit), dz), precision);
+    const __m128 r = (__m128)logistic_v4((v4f)_mm_add_ps(load_partial(x + size + k, nunit), dr), precision);
+    const __m128 hbar = (__m128)tanh_v4((v4f)_mm_add_ps(_mm_mul_ps(r, du), load_partial(x + size + size + k, nunit)),
+                                        precision);
+    const __m128 hk = load_partial(h + k, nunit);
+    //  z * h + (1 - z) * hbar
+    float res[4];
+    _mm_storeu_ps(res, _mm_add_ps(_mm_mul_ps(z, hk), _mm_sub_ps(hbar, _mm_mul_ps(z, hbar))));
+    for(size_t i=0 ; i < nunit ; i++){
+        out[k + i] = res[i];
+    }
+}
+
+#endif
+
+
+/*  Int8 kernels
+ *
+ *  The state of a modified GRU lies in [-1, 1] and is quantised to int8 as
+ *  round(127 h).  Int8 elements are sign extended to int16 and multiplied
+ *  pairwise into int32 accumulators (pmaddwd), exact for columns of fewer
+ *  than 2^16 elements.  Only SSE4.1 is needed; AVX2 doubles the width.
+ */
+
+//  Quantised state, scaled by 1 / 127, is multiplied by scale of weights
+static const float state_qscale = 1.0f / 127.0f;
+
+
+/**  Quantise state of a lane
+ *
+ *  @param h State of length n, elements in [-1, 1]
+ *  @param n Length of state
+ *  @param hq [out] Quantised state, length npad.  Elements beyond n are zero.
+ *  @param npad Padded length
+ **/
+static inline void quantise_state(const float * h, size_t n, int16_t * hq, size_t npad){
+    const __m128 s = _mm_set1_ps(127.0f);
+    size_t i = 0;
+    for( ; i + 8 <= n ; i += 8){
+        const __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(h + i), s));
+        const __m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(h + i + 4), s));
+        _mm_storeu_si128((__m128i *)(hq + i), _mm_packs_epi32(lo, hi));
+    }
+    for( ; i < n ; i++){
+        hq[i] = (int16_t)lrintf(127.0f * h[i]);
+    }
+    for( ; i < npad ; i++){
+        hq[i] = 0;
+    }
+}
+
+
+//  Sum each of four int32 accumulators, one per lane of result
+static inline __m128i reduce4_epi32(__m128i a0, __m128i a1, __m128i a2, __m128i a3){
+    return _mm_hadd_epi32(_mm_hadd_epi32(a0, a1), _mm_hadd_epi32(a2, a3));
+}
+
+
+/**  Dot products of four neighbouring int8 columns with two quantised states
+ *
+ *  @param col First column
+ *  @param ld Distance between columns, a multiple of 32
+ *  @param ncol Number of columns wanted, at most 4.  Lanes beyond are garbage.
+ *  @param h0 First quantised state of length n
+ *  @param h1 Second quantised state of length n
+ *  @param n Length of columns and states, a multiple of 32 padded with zeros
+ *  @param d0 [out] Dot product of each column with h0
+ *  @param d1 [out] Dot product of each column with h1
+ **/
+static inline void dot4q_columns_pair(const int8_t * col, size_t ld, size_t ncol, const int16_t * h0, const int16_t * h1,
+                                      size_t n, __m128i * d0, __m128i * d1){
+    const int8_t * c[4];
+    for(size_t j=0 ; j < 4 ; j++){
+        c[j] = col + ((j < ncol) ? j : (ncol - 1)) * ld;
+    }
+#ifdef __AVX2__
+    __m256i acc0[4], acc1[4];
+    for(size_t j=0 ; j < 4 ; j++){
+        acc0[j] = _mm256_setzero_si256();
+        acc1[j] = _mm256_setzero_si256();
+    }
+    for(size_t i=0 ; i < n ; i += 16){
+        const __m256i hv0 = _mm256_loadu_si256((const __m256i *)(h0 + i));
+        const __m256i hv1 = _mm256_loadu_si256((const __m256i *)(h1 + i));
+        for(size_t j=0 ; j < 4 ; j++){
+            const __m256i w = _mm256_cvtepi8_epi16(_mm_load_si128((const __m128i *)(c[j] + i)));
+            acc0[j] = _mm256_add_epi32(acc0[j], _mm256_madd_epi16(w, hv0));
+            acc1[j] = _mm256_add_epi32(acc1[j], _mm256_madd_epi16(w, hv1));
+        }
+    }
+    __m128i a0[4], a1[4];
+    for(size_t j=0 ; j < 4 ; j++){
+        a0[j] = _mm_add_epi32(_mm256_castsi256_si128(acc0[j]), _mm256_extracti128_si256(acc0[j], 1));
+        a1[j] = _mm_add_epi32(_mm256_castsi256_si128(acc1[j]), _mm256_extracti128_si256(acc1[j], 1));
+    }
+#else
+    __m128i a0[4], a1[4];
+    for(size_t j=0 ; j < 4 ; j++){
+        a0[j] = _mm_setzero_si128();
+        a1[j] = _mm_setzero_si128();
+    }
+    for(size_t i=0 ; i < n ; i += 8){
+        const __m128i hv0 = _mm_loadu_si128((const __m128i *)(h0 + i));
+        const __m128i hv1 = _mm_loadu_si128((const __m128i *)(h1 + i));
+        for(size_t j=0 ; j < 4 ; j++){
+            const __m128i w = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i *)(c[j] + i)));
+            a0[j] = _mm_add_epi32(a0[j], _mm_madd_epi16(w, hv0));
+            a1[j] = _mm_add_epi32(a1[j], _mm_madd_epi16(w, hv1));
+        }
+    }
+#endif
+    *d0 = reduce4_epi32(a0[0], a0[1], a0[2], a0[3]);
+    *d1 = reduce4_epi32(a1[0], a1[1], a1[2], a1[3]);
+}
+
+
+//  Recurrent products in float of four columns starting at column c, for two lanes
+static inline void dot4q_scaled_pair(const_flappie_qmatrix sW, size_t c, size_t ncol,
+                                     const int16_t * h0, const int16_t * h1, __m128 * d0, __m128 * d1){
+    __m128i q0, q1;
+    dot4q_columns_pair(sW->data + c * sW->stride, sW->stride, ncol, h0, h1, sW->stride, &q0, &q1);
+    const __m128 s = _mm_mul_ps(_mm_loadu_ps(sW->scale + c), _mm_set1_ps(state_qscale));
+    *d0 = _mm_mul_ps(_mm_cvtepi32_ps(q0), s);
+    *d1 = _mm_mul_ps(_mm_cvtepi32_ps(q1), s);
+}
+
+
+static void grumod_step_batch(const float * x, size_t ldx, const float * istate, size_t ldh,
+                              const_flappie_matrix sW, float * ostate, size_t ldo, size_t nlane){
+    const enum flappie_math_precision precision = flappie_math_gate_precision();
+    const size_t size = sW->nr;
+    const size_t ld = sW->stride;
+    assert(3 * size == sW->nc);
+    const float * W = sW->data.f;
+
+#ifdef __AVX__
+    for(size_t k=0 ; k < size ; k += 8){
+        const size_t nunit = (size - k < 8) ? (size - k) : 8;
+        const __m256i mask = lane_mask(nunit);
+        size_t j = 0;
+        //  Pairs of lanes share loads of the weights
+        for( ; j + 2 <= nlane ; j += 2){
+            const float * h0 = istate + j * ldh;
+            const float * h1 = h0 + ldh;
+            __m256 dz0, dz1, dr0, dr1, du0, du1;
+            dot8_columns_pair(W + k * ld, ld, nunit, h0, h1, size, &dz0, &dz1);
+            dot8_columns_pair(W + (size + k) * ld, ld, nunit, h0, h1, size, &dr0, &dr1);
+            dot8_columns_pair(W + (size + size + k) * ld, ld, nunit, h0, h1, size, &du0, &du1);
+            grumod_gates8(x + j * ldx, h0, dz0, dr0, du0, size, k, mask, precision, ostate + j * ldo);
+            grumod_gates8(x + (j + 1) * ldx, h1, dz1, dr1, du1, size, k, mask, precision, ostate + (j + 1) * ldo);
+        }
+        if(j < nlane){
+            const float * hj = istate + j * ldh;
+            const __m256 dz = dot8_columns(W + k * ld, ld, nunit, hj, size);
+            const __m256 dr = dot8_columns(W + (size + k) * ld, ld, nunit, hj, size);
+            const __m256 du = dot8_columns(W + (size + size + k) * ld, ld, nunit, hj, size);
+            grumod_gates8(x + j * ldx, hj, dz, dr, du, size, k, mask, precision, ostate + j * ldo);
+        }
+    }
+#else
+    for(size_t k=0 ; k < size ; k += 4){
+        const size_t nunit = (size - k < 4) ? (size - k) : 4;
+        for(size_t j=0 ; j < nlane ; j++){
+            const float * xj = x + j * ldx;
+            const float * hj = istate + j * ldh;
+            const __m128 dz = dot4_columns(W + k * ld, ld, nunit, hj, size);
+            const __m128 dr = dot4_columns(W + (size + k) * ld, ld, nunit, hj, size);
+            const __m128 du = dot4_columns(W + (size + size + k) * ld, ld, nunit, hj, size);
+            grumod_gates4(xj, hj, dz, dr, du, size, k, nunit, precision, ostate + j * ldo);
+        }
+    }
+#endif
+}
+
+
+/*  Sixteen bit kernels
+ *
+ *  Weights are stored as fp16 or bf16 and widened to float as they are
+ *  loaded, so products and sums are in float.  A bf16 is the top half of a
+ *  float.  An fp16 is widened with F16C where the level has it (AVX2 and
+ *  above) and otherwise by moving its exponent and mantissa into place and
+ *  rebiasing the exponent, which also normalises subnormals.  Weights are
+ *  finite, so infinities are not handled.
+ */
+
+static inline __m128 load4_half(const uint16_t * p, enum flappie_half_format format){
+    const __m128i v = _mm_loadl_epi64((const __m128i *)p);
+    const __m128i zero = _mm_setzero_si128();
+    if(FLAPPIE_HALF_BF16 == format){
+        return _mm_castsi128_ps(_mm_unpacklo_epi16(zero, v));
+    }
+    const __m128i x = _mm_unpacklo_epi16(v, zero);
+    const __m128i mag = _mm_slli_epi32(_mm_and_si128(x, _mm_set1_epi32(0x7fff)), 13);
+    const __m128i sign = _mm_slli_epi32(_mm_and_si128(x, _mm_set1_epi32(0x8000)), 16);
+    return _mm_or_ps(_mm_mul_ps(_mm_castsi128_ps(mag), _mm_set1_ps(0x1p112f)), _mm_castsi128_ps(sign));
+}
+
+
+#ifdef __AVX__
+static inline __m256 load8_half(const uint16_t * p, enum flappie_half_format format){
+    if(FLAPPIE_HALF_BF16 == format){
+        const __m128i v = _mm_loadu_si128((const __m128i *)p);
+#    ifdef __AVX2__
+        return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(v), 16));
+#    else
+        const __m128i zero = _mm_setzero_si128();
+        return _mm256_castsi256_ps(_mm256_insertf128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16(zero, v)),
+                                                           _mm_unpackhi_epi16(zero, v), 1));
+#    endif
+    }
+#    ifdef __F16C__
+    return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)p));
+#    else
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(load4_half(p, format)), load4_half(p + 4, format), 1);
+#    endif
+}
+#endif
+
+
+/**  Dot products of four neighbouring sixteen bit columns with two vectors
+ *
+ *  @param col First column, padded with zeros to a multiple of 16 elements
+ *  @param ld Distance between columns
+ *  @param ncol Number of columns wanted, at most 4.  Lanes beyond are garbage.
+ *  @param format Format of columns
+ *  @param h0 First vector of length n
+ *  @param h1 Second vector of length n
+ *  @param n Length of columns
+ *  @param d0 [out] Dot product of each column with h0
+ *  @param d1 [out] Dot product of each column with h1
+ **/
+static inline __attribute__((__always_inline__)) void dot4h_columns_pair_fmt(const uint16_t * col, size_t ld, size_t ncol,
+                                                                          enum flappie_half_format format,
+                                                                          const float * h0, const float * h1, size_t n,
+                                                                          __m128 * d0, __m128 * d1){
+    const uint16_t * c[4];
+    for(size_t j=0 ; j < 4 ; j++){
+        c[j] = col + ((j < ncol) ? j : (ncol - 1)) * ld;
+    }
+#ifdef __AVX__
+    __m256 acc0[4], acc1[4];
+    for(size_t j=0 ; j < 4 ; j++){
+        acc0[j] = _mm256_setzero_ps();
+        acc1[j] = _mm256_setzero_ps();
+    }
+    size_t i = 0;
+    for( ; i + 8 <= n ; i += 8){
+        const __m256 hv0 = _mm256_loadu_ps(h0 + i);
+        const __m256 hv1 = _mm256_loadu_ps(h1 + i);
+        for(size_t j=0 ; j < 4 ; j++){
+            const __m256 w = load8_half(c[j] + i, format);
+            acc0[j] = FMADD_PS(w, hv0, acc0[j]);
+            acc1[j] = FMADD_PS(w, hv1, acc1[j]);
+        }
+    }
+    if(i < n){
+        //  Padding of columns is zero, so only the vectors need masking
+        const __m256i mask = lane_mask(n - i);
+        const __m256 hv0 = _mm256_maskload_ps(h0 + i, mask);
+        const __m256 hv1 = _mm256_maskload_ps(h1 + i, mask);
+        for(size_t j=0 ; j < 4 ; j++){
+            const __m256 w = load8_half(c[j] + i, format);
+            acc0[j] = FMADD_PS(w, hv0, acc0[j]);
+            acc1[j] = FMADD_PS(w, hv1, acc1[j]);
+        }
+    }
+#else
+    __m128 acc0[4], acc1[4];
+    for(size_t j=0 ; j < 4 ; j++){
+        acc0[j] = _mm_setzero_ps();
+        acc1[j] = _mm_setzero_ps();
+    }
+    for(size_t i=0 ; i < n ; i += 4){
+        const __m128 hv0 = (i + 4 <= n) ? _mm_loadu_ps(h0 + i) : load_partial(h0 + i, n - i);
+        const __m128 hv1 = (i + 4 <= n) ? _mm_loadu_ps(h1 + i) : load_partial(h1 + i, n - i);
+        for(size_t j=0 ; j < 4 ; j++){
+            const __m128 w = load4_half(c[j] + i, format);
+            acc0[j] = _mm_add_ps(_mm_mul_ps(w, hv0), acc0[j]);
+            acc1[j] = _mm_add_ps(_mm_mul_ps(w, hv1), acc1[j]);
+        }
+    }
+#endif
+    *d0 = reduce4(acc0[0], acc0[1], acc0[2], acc0[3]);
+    *d1 = reduce4(acc1[0], acc1[1], acc1[2], acc1[3]);
+}
+
+
+//  Choose the format once, outside the loop over elements
+static void dot4h_columns_pair(const uint16_t * col, size_t ld, size_t ncol, enum flappie_half_format format,
+                               const float * h0, const float * h1, size_t n, __m128 * d0, __m128 * d1){
+    if(FLAPPIE_HALF_BF16 == format){
+        dot4h_columns_pair_fmt(col, ld, ncol, FLAPPIE_HALF_BF16, h0, h1, n, d0, d1);
+    } else {
+        dot4h_columns_pair_fmt(col, ld, ncol, FLAPPIE_HALF_FP16, h0, h1, n, d0, d1);
+    }
+}
+
+
+static void grumod_step_batch_half(const float * x, size_t ldx, const float * istate, size_t ldh,
+                                   const_flappie_hmatrix sW, float * ostate, size_t ldo, size_t nlane){
+    const enum flappie_math_precision precision = flappie_math_gate_precision();
+    const size_t size = sW->nr;
+    const size_t ld = sW->stride;
+    assert(3 * size == sW->nc);
+
+#ifdef __AVX__
+    for(size_t k=0 ; k < size ; k += 8){
+        const size_t nunit = (size - k < 8) ? (size - k) : 8;
+        const __m256i mask = lane_mask(nunit);
+#else
+    for(size_t k=0 ; k < size ; k += 4){
+        const size_t nunit = (size - k < 4) ? (size - k) : 4;
+#endif
+        //  Pairs of lanes share loads of the weights, a lone final lane is paired with itself
+        for(size_t j=0 ; j < nlane ; j += 2){
+            const size_t j1 = (j + 1 < nlane) ? (j + 1) : j;
+            const float * h0 = istate + j * ldh;
+            const float * h1 = istate + j1 * ldh;
+#ifdef __AVX__
+            __m128 d0[3][2], d1[3][2];
+            for(size_t gate=0 ; gate < 3 ; gate++){
+                const uint16_t * col = sW->data + (gate * size + k) * ld;
+                d0[gate][1] = d1[gate][1] = _mm_setzero_ps();
+                dot4h_columns_pair(col, ld, (nunit < 4) ? nunit : 4, sW->format, h0, h1, size,
+                                   &d0[gate][0], &d1[gate][0]);
+                if(nunit > 4){
+                    dot4h_columns_pair(col + 4 * ld, ld, nunit - 4, sW->format, h0, h1, size,
+                                       &d0[gate][1], &d1[gate][1]);
+                }
+            }
+            __m256 dv0[3], dv1[3];
+            for(size_t gate=0 ; gate < 3 ; gate++){
+                dv0[gate] = _mm256_insertf128_ps(_mm256_castps128_ps256(d0[gate][0]), d0[gate][1], 1);
+                dv1[gate] = _mm256_insertf128_ps(_mm256_castps128_ps256(d1[gate][0]), d1[gate][1], 1);
+            }
+            grumod_gates8(x + j * ldx, h0, dv0[0], dv0[1], dv0[2], size, k, mask, precision, ostate + j * ldo);
+            if(j1 != j){
+                grumod_gates8(x + j1 * ldx, h1, dv1[0], dv1[1], dv1[2], size, k, mask, precision, ostate + j1 * ldo);
+            }
+#else
+            __m128 d0[3], d1[3];
+            for(size_t gate=0 ; gate < 3 ; gate++){
+                dot4h_columns_pair(sW->data + (gate * size + k) * ld, ld, nunit, sW->format, h0, h1, size,
+                                   &d0[gate], &d1[gate]);
+            }
+            grumod_gates4(x + j * ldx, h0, d0[0], d0[1], d0[2], size, k, nunit, precision, ostate + j * ldo);
+            if(j1 != j){
+                grumod_gates4(x + j1 * ldx, h1, d1[0], d1[1], d1[2], size, k, nunit, precision, ostate + j1 * ldo);
+            }
+#endif
+        }
+    }
+}
+
+
+//  Lanes whose state is quantised together, bounding the buffer on the stack
+#define INT8_LANE_GROUP 32
+
+static void grumod_step_batch_int8(const float * x, size_t ldx, const float * istate, size_t ldh,
+                                   const_flappie_qmatrix sW, float * ostate, size_t ldo, size_t nlane){
+    const enum flappie_math_precision precision = flappie_math_gate_precision();
+    const size_t size = sW->nr;
+    const size_t npad = sW->stride;
+    assert(3 * size == sW->nc);
+    assert(0 == npad % 32);
+    int16_t hq[INT8_LANE_GROUP * npad];
+
+    for(size_t lo=0 ; lo < nlane ; lo += INT8_LANE_GROUP){
+        const size_t ngroup = (nlane - lo < INT8_LANE_GROUP) ? (nlane - lo) : INT8_LANE_GROUP;
+        for(size_t j=0 ; j < ngroup ; j++){
+            quantise_state(istate + (lo + j) * ldh, size, hq + j * npad, npad);
+        }
+#ifdef __AVX__
+        for(size_t k=0 ; k < size ; k += 8){
+            const size_t nunit = (size - k < 8) ? (size - k) : 8;
+            const __m256i mask = lane_mask(nunit);
+#else
+        for(size_t k=0 ; k < size ; k += 4){
+            const size_t nunit = (size - k < 4) ? (size - k) : 4;
+#endif
+            //  Pairs of lanes share loads of the weights, a lone final lane is paired with itself
+            for(size_t j=0 ; j < ngroup ; j += 2){
+                const size_t j1 = (j + 1 < ngroup) ? (j + 1) : j;
+                const size_t l0 = lo + j;
+                const size_t l1 = lo + j1;
+#ifdef __AVX__
+                __m128 d0[3][2], d1[3][2];
+                for(size_t gate=0 ; gate < 3 ; gate++){
+                    d0[gate][1] = d1[gate][1] = _mm_setzero_ps();
+                    dot4q_scaled_pair(sW, gate * size + k, (nunit < 4) ? nunit : 4,
+                                      hq + j * npad, hq + j1 * npad, &d0[gate][0], &d1[gate][0]);
+                    if(nunit > 4){
+                        dot4q_scaled_pair(sW, gate * size + k + 4, nunit - 4,
+                                          hq + j * npad, hq + j1 * npad, &d0[gate][1], &d1[gate][1]);
+                    }
+                }
+                __m256 dv0[3], dv1[3];
+                for(size_t gate=0 ; gate < 3 ; gate++){
+                    dv0[gate] = _mm256_insertf128_ps(_mm256_castps128_ps256(d0[gate][0]), d0[gate][1], 1);
+                    dv1[gate] = _mm256_insertf128_ps(_mm256_castps128_ps256(d1[gate][0]), d1[gate][1], 1);
+                }
+                grumod_gates8(x + l0 * ldx, istate + l0 * ldh, dv0[0], dv0[1], dv0[2], size, k, mask,
+                              precision, ostate + l0 * ldo);
+                if(j1 != j){
+                    grumod_gates8(x + l1 * ldx, istate + l1 * ldh, dv1[0], dv1[1], dv1[2], size, k, mask,
+                                  precision, ostate + l1 * ldo);
+                }
+#else
+                __m128 d0[3], d1[3];
+                for(size_t gate=0 ; gate < 3 ; gate++){
+                    dot4q_scaled_pair(sW, gate * size + k, nunit, hq + j * npad, hq + j1 * npad, &d0[gate], &d1[gate]);
+                }
+                grumod_gates4(x + l0 * ldx, istate + l0 * ldh, d0[0], d0[1], d0[2], size, k, nunit,
+                              precision, ostate + l0 * ldo);
+                if(j1 != j){
+                    grumod_gates4(x + l1 * ldx, istate + l1 * ldh, d1[0], d1[1], d1[2], size, k, nunit,
+                                  precision, ostate + l1 * ldo);
+                }
+#endif
+            }
+        }
+    }
+}
+
+
+/*  Fixed point kernels
+ *
+ *  Sixteen bit weights and activations are multiplied pairwise into int32
+ *  accumulators (pmaddwd), which the formats of weights are chosen not to
+ *  overflow.  Sums are rounded to the format of the result and saturated.
+ */
+
+//  Round int32 sums to nearest, ties upwards, and saturate to [-FIXED_POINT_MAX, FIXED_POINT_MAX]
+static inline void narrow4_fixed(__m128i sum, int shift, size_t ncol, fixed_point_t * out){
+    if(shift > 0){
+        sum = _mm_add_epi32(sum, _mm_set1_epi32(1 << (shift - 1)));
+        sum = _mm_sra_epi32(sum, _mm_cvtsi32_si128(shift));
+    }
+    sum = _mm_max_epi32(sum, _mm_set1_epi32(-FIXED_POINT_MAX));
+    fixed_point_t res[8];
+    _mm_storeu_si128((__m128i *)res, _mm_packs_epi32(sum, sum));
+    for(size_t j=0 ; j < ncol ; j++){
+        out[j] = res[j];
+    }
+}
+
+
+static void affine_columns_fixed(const fixed_point_t * W, size_t ld, size_t ncol, const fixed_point_t * x,
+                                 size_t n, const int32_t * b, int shift, fixed_point_t * out){
+    assert(shift >= 0);
+    for(size_t k=0 ; k < ncol ; k += 4){
+        const size_t nk = (ncol - k < 4) ? (ncol - k) : 4;
+        const fixed_point_t * c[4];
+        for(size_t j=0 ; j < 4 ; j++){
+            //  Columns beyond those wanted repeat the last, so never read out of bounds
+            c[j] = W + (k + ((j < nk) ? j : (nk - 1))) * ld;
+        }
+#ifdef __AVX2__
+        __m256i acc[4];
+        for(size_t j=0 ; j < 4 ; j++){
+            acc[j] = _mm256_setzero_si256();
+        }
+        size_t i = 0;
+        for( ; i + 16 <= n ; i += 16){
+            const __m256i xv = _mm256_loadu_si256((const __m256i *)(x + i));
+            for(size_t j=0 ; j < 4 ; j++){
+                acc[j] = _mm256_add_epi32(acc[j], _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *)(c[j] + i)), xv));
+            }
+        }
+        __m128i a[4];
+        for(size_t j=0 ; j < 4 ; j++){
+            a[j] = _mm_add_epi32(_mm256_castsi256_si128(acc[j]), _mm256_extracti128_si256(acc[j], 1));
+        }
+#else
+        __m128i a[4];
+        for(size_t j=0 ; j < 4 ; j++){
+            a[j] = _mm_setzero_si128();
+        }
+        size_t i = 0;
+#endif
+        for( ; i < n ; i += 8){
+            const __m128i xv = _mm_loadu_si128((const __m128i *)(x + i));
+            for(size_t j=0 ; j < 4 ; j++){
+                a[j] = _mm_add_epi32(a[j], _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(c[j] + i)), xv));
+            }
+        }
+        __m128i sum = reduce4_epi32(a[0], a[1], a[2], a[3]);
+        if(NULL != b){
+            int32_t bias[4] = {0};
+            for(size_t j=0 ; j < nk ; j++){
+                bias[j] = b[k + j];
+            }
+            sum = _mm_add_epi32(sum, _mm_loadu_si128((const __m128i *)bias));
+        }
+        narrow4_fixed(sum, shift, nk, out + k);
+    }
+}
+
+
+static void math_inplace(enum flappie_math_function fun, enum flappie_math_precision precision, float * x, size_t n){
+    assert(FLAPPIE_MATH_DEFAULT != precision && precision < FLAPPIE_MATH_INVALID);
+#if defined(__AVX512F__)
+    array_table_v16[fun][precision](x, n);
+#elif defined(__AVX__)
+    array_table_v8[fun][precision](x, n);
+#else
+    array_table_v4[fun][precision](x, n);
+#endif
+}
+
+
+const struct flappie_kernels FLAPPIE_KERNEL_TABLE = {
+    FLAPPIE_KERNEL_LEVEL,
+    grumod_step_batch,
+    grumod_step_batch_int8,
+    grumod_step_batch_half,
+    affine_columns_fixed,
+    math_inplace
+};
@@ -0,0 +1,134 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "flappie_cpu.h"
+#include "flappie_math.h"
+#include "util.h"
+
+static const char * const math_precision_name[FLAPPIE_MATH_INVALID] = {"default", "exact", "fast", "fastest"};
+
+static enum flappie_math_precision math_precision = FLAPPIE_MATH_DEFAULT;
+
+
+/**  Precision of functions from its name
+ *
+ *  @param precisionstr Name of precision, as flappie_math_precision_string
+ *
+ *  @returns Precision, FLAPPIE_MATH_INVALID if name not recognised
+ **/
+enum flappie_math_precision get_flappie_math_precision(const char * precisionstr){
+    assert(NULL != precisionstr);
+    for(int precision=0 ; precision < FLAPPIE_MATH_INVALID ; precision++){
+        if(0 == strcmp(precisionstr, math_precision_name[precision])){
+            return precision;
+        }
+    }
+    return FLAPPIE_MATH_INVALID;
+}
+
+
+const char * flappie_math_precision_string(enum flappie_math_precision precision){
+    return (precision < FLAPPIE_MATH_INVALID) ? math_precision_name[precision] : "invalid";
+}
+
+
+/**  Set precision of functions used by layers
+ *
+ *  To be called before layers are run, normally at startup.
+ *
+ *  @param precision Precision to use
+ *
+ *  @returns True on success, false if precision invalid
+ **/
+bool flappie_set_math_precision(enum flappie_math_precision precision){
+    if(precision >= FLAPPIE_MATH_INVALID){
+        return false;
+    }
+    math_precision = precision;
+    return true;
+}
+
+
+enum flappie_math_precision flappie_math_precision(void){
+    return math_precision;
+}
+
+
+/**  Precision of functions used by the gates of modified GRU layers
+ *
+ *  @returns The precision set, or fastest if it is the default
+ **/
+enum flappie_math_precision flappie_math_gate_precision(void){
+    return (FLAPPIE_MATH_DEFAULT == math_precision) ? FLAPPIE_MATH_FASTEST : math_precision;
+}
+
+
+static __m128 math_default(enum flappie_math_function fun, __m128 x){
+    switch(fun){
+    case FLAPPIE_MATH_EXP:
+        return expfv(x);
+    case FLAPPIE_MATH_LOG:
+        return logfv(x);
+    case FLAPPIE_MATH_TANH:
+        return tanhfv(x);
+    case FLAPPIE_MATH_LOGISTIC:
+        return logisticfv(x);
+    default:
+        return elufv(x);
+    }
+}
+
+
+//  Functions of sse_mathfun.h, four floats at a time whatever the level
+static void math_default_inplace(enum flappie_math_function fun, float * x, size_t n){
+    size_t i = 0;
+    for( ; i + 4 <= n ; i += 4){
+        _mm_storeu_ps(x + i, math_default(fun, _mm_loadu_ps(x + i)));
+    }
+    if(i < n){
+        float tail[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        memcpy(tail, x + i, (n - i) * sizeof(float));
+        _mm_storeu_ps(tail, math_default(fun, _mm_loadu_ps(tail)));
+        memcpy(x + i, tail, (n - i) * sizeof(float));
+    }
+}
+
+
+/**  Apply function to every element of an array, at the precision set
+ *
+ *  Other than at the default precision, runs the kernel for the instruction
+ *  set chosen by flappie_kernels, at the widest vector it has.
+ *
+ *  @param fun Function to apply
+ *  @param x [in/out] Array
+ *  @param n Length of array
+ **/
+void flappie_math_inplace(enum flappie_math_function fun, float * x, size_t n){
+    assert(NULL != x || 0 == n);
+    if(FLAPPIE_MATH_DEFAULT == math_precision){
+        math_default_inplace(fun, x, n);
+        return;
+    }
+    flappie_kernels()->math_inplace(fun, math_precision, x, n);
+}
+
+
+/**  Apply function to every element of an array, as for the gates of a
+ *   modified GRU layer
+ *
+ *  @param fun Function to apply
+ *  @param x [in/out] Array
+ *  @param n Length of array
+ **/
+void flappie_math_gate_inplace(enum flappie_math_function fun, float * x, size_t n){
+    assert(NULL != x || 0 == n);
+    flappie_kernels()->math_inplace(fun, flappie_math_gate_precision(), x, n);
+}
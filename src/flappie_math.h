@@ -0,0 +1,72 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#pragma once
+#ifndef FLAPPIE_MATH_H
+#    define FLAPPIE_MATH_H
+
+#    include <stdbool.h>
+#    include <stddef.h>
+
+/**  Precision of functions used by activations and gates of layers
+ *
+ *   The default keeps the functions flappie has always used: those of
+ *   sse_mathfun.h, four floats at a time, for activations and the gates of
+ *   GRU and LSTM layers; the fastest approximations below for the gates of
+ *   modified GRU layers; and tanhf for the transitions of run-length models.
+ *
+ *   The other precisions apply one set of functions everywhere, at the
+ *   widest vector of the level of flappie_cpu_level.  Exact functions are
+ *   Cephes style polynomials after range reduction.  Fast functions use
+ *   shorter polynomials.  Fastest functions are the bit manipulation
+ *   approximations of Schraudolph (1999), writing a scaled argument
+ *   directly into the exponent of a float.
+ *
+ *   Largest errors in ulp against double precision, measured over every
+ *   float in the range given; test_flappie_math.c checks a sample of them
+ *   at every level of flappie_cpu_level.  Those of the default are of the
+ *   functions of sse_mathfun.h:
+ *
+ *                                default     exact     fast        fastest
+ *   exp       [-87, 88]          1.0         1.1       710         7.4e5
+ *   log       [2^-126, 2^128)    0.9         0.8       46          abs 0.04
+ *   tanh      [-10, 10]          abs 1.8e-7  1.4       240         abs 0.03
+ *   logistic  [-80, 80]          2.5         2.5       700         7.4e5
+ *   elu       [-87, 1]           abs 4.9e-8  1.4       abs 4e-5    abs 0.044
+ *
+ *   Where the relative error of a precision is unbounded near a root of the
+ *   function, the largest absolute error is given instead.
+ **/
+enum flappie_math_precision {
+    FLAPPIE_MATH_DEFAULT = 0,
+    FLAPPIE_MATH_EXACT,
+    FLAPPIE_MATH_FAST,
+    FLAPPIE_MATH_FASTEST,
+    FLAPPIE_MATH_INVALID
+};
+
+/**  Functions applied elementwise by flappie_math_inplace
+ **/
+enum flappie_math_function {
+    FLAPPIE_MATH_EXP = 0,
+    FLAPPIE_MATH_LOG,
+    FLAPPIE_MATH_TANH,
+    FLAPPIE_MATH_LOGISTIC,
+    FLAPPIE_MATH_ELU
+};
+
+enum flappie_math_precision get_flappie_math_precision(const char * precisionstr);
+const char * flappie_math_precision_string(enum flappie_math_precision precision);
+bool flappie_set_math_precision(enum flappie_math_precision precision);
+enum flappie_math_precision flappie_math_precision(void);
+enum flappie_math_precision flappie_math_gate_precision(void);
+
+void flappie_math_inplace(enum flappie_math_function fun, float * x, size_t n);
+void flappie_math_gate_inplace(enum flappie_math_function fun, float * x, size_t n);
+
+#endif                          /* FLAPPIE_MATH_H */
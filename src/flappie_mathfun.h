@@ -0,0 +1,66 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+/*  Vectorised exp, log, tanh, logistic and ELU at each precision of
+ *  flappie_math_precision, on four, eight and sixteen floats.
+ *
+ *  For flappie_kernels.c, which is built once for each level.  The eight
+ *  wide functions are defined where the level has AVX and the sixteen wide
+ *  where it has AVX-512.  Errors of each precision are given with
+ *  flappie_math_precision.
+ */
+
+#pragma once
+#ifndef FLAPPIE_MATHFUN_H
+#    define FLAPPIE_MATHFUN_H
+
+#    include <math.h>
+#    include <stdint.h>
+#    include <string.h>
+
+#    include "flappie_math.h"
+#    include "util.h"
+
+typedef float v4f __attribute__ ((vector_size(16)));
+typedef int32_t v4i __attribute__ ((vector_size(16)));
+
+#    define VF v4f
+#    define VI v4i
+#    define MATHFUN(name) name ## _v4
+#    include "flappie_mathfun_width.h"
+#    undef MATHFUN
+#    undef VI
+#    undef VF
+
+#    ifdef __AVX__
+typedef float v8f __attribute__ ((vector_size(32)));
+typedef int32_t v8i __attribute__ ((vector_size(32)));
+
+#        define VF v8f
+#        define VI v8i
+#        define MATHFUN(name) name ## _v8
+#        include "flappie_mathfun_width.h"
+#        undef MATHFUN
+#        undef VI
+#        undef VF
+#    endif
+
+#    ifdef __AVX512F__
+typedef float v16f __attribute__ ((vector_size(64)));
+typedef int32_t v16i __attribute__ ((vector_size(64)));
+
+#        define VF v16f
+#        define VI v16i
+#        define MATHFUN(name) name ## _v16
+#        include "flappie_mathfun_width.h"
+#        undef MATHFUN
+#        undef VI
+#        undef VF
+#    endif
+
+#endif                          /* FLAPPIE_MATHFUN_H */
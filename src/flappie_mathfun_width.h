@@ -0,0 +1,295 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+/*  Functions of flappie_mathfun.h for one width of vector
+ *
+ *  Included by flappie_mathfun.h once per width, with VF and VI the float
+ *  and int32 vector types and MATHFUN(name) naming functions of the width.
+ *  Written with the vector extensions of GCC so the compiler uses the
+ *  instructions of the level the file is built for.
+ */
+
+static inline VF MATHFUN(select)(VI mask, VF a, VF b){
+    return (VF)((mask & (VI)a) | (~mask & (VI)b));
+}
+
+
+static inline VF MATHFUN(clamp)(VF x, float lo, float hi){
+    x = MATHFUN(select)(x < lo, x - x + lo, x);
+    return MATHFUN(select)(x > hi, x - x + hi, x);
+}
+
+
+//  x with the sign of s
+static inline VF MATHFUN(copysign)(VF x, VF s){
+    return (VF)(((VI)x & 0x7fffffff) | ((VI)s & (int32_t)0x80000000));
+}
+
+
+//  Nearest integer to x, |x| < 2^22
+static inline VF MATHFUN(rint)(VF x){
+    return (x + 12582912.0f) - 12582912.0f;
+}
+
+
+//  2^n for integral n in [-126, 127]
+static inline VF MATHFUN(pow2n)(VF n){
+    return (VF)((__builtin_convertvector(n, VI) + 127) << 23);
+}
+
+
+/*  Exponential
+ *
+ *  x = n log 2 + r with |r| <= log(2) / 2, log 2 split into two parts so
+ *  the reduction is exact, and exp(r) from a polynomial.
+ */
+static inline VF MATHFUN(exp_exact)(VF x){
+    x = MATHFUN(clamp)(x, -87.3365447505531f, 88.3762626647949f);
+    const VF n = MATHFUN(rint)(x * 1.44269504088896341f);
+    const VF r = (x - n * 0.693359375f) + n * 2.12194440e-4f;
+    VF p = r * 1.9875691500E-4f + 1.3981999507E-3f;
+    p = p * r + 8.3334519073E-3f;
+    p = p * r + 4.1665795894E-2f;
+    p = p * r + 1.6666665459E-1f;
+    p = p * r + 5.0000001201E-1f;
+    return (p * r * r + r + 1.0f) * MATHFUN(pow2n)(n);
+}
+
+
+static inline VF MATHFUN(exp_fast)(VF x){
+    x = MATHFUN(clamp)(x, -87.3365447505531f, 88.3762626647949f);
+    const VF n = MATHFUN(rint)(x * 1.44269504088896341f);
+    const VF r = x - n * 0.693147180559945309f;
+    //  Taylor series to r^4
+    const VF p = ((r * (1.0f / 24.0f) + (1.0f / 6.0f)) * r + 0.5f) * r;
+    return (p * r + r + 1.0f) * MATHFUN(pow2n)(n);
+}
+
+
+//  As fast_expf
+static inline VF MATHFUN(exp_fastest)(VF x){
+    x = MATHFUN(clamp)(x, -(float)_BOUND, (float)_BOUND);
+    return (VF)__builtin_convertvector(x * (float)_A + (float)_B, VI);
+}
+
+
+/*  Logarithm
+ *
+ *  x = 2^e m with m in [sqrt(1/2), sqrt(2)) and log(m) = log(1 + f) from a
+ *  polynomial in f.  Not positive x give NaN, flushing subnormals to zero.
+ */
+static inline VF MATHFUN(log_reduce)(VF x, VF * e){
+    const VI bits = (VI)x;
+    const VI m = (bits & 0x007fffff) | 0x3f000000;
+    *e = __builtin_convertvector(((bits >> 23) & 0xff) - 126, VF);
+    //  m in [1/2, 1), move to [sqrt(1/2), sqrt(2))
+    const VI small = (VF)m < 0.707106781186547524f;
+    *e = *e - (VF)(small & (VI)(*e - *e + 1.0f));
+    return (VF)m + MATHFUN(select)(small, (VF)m, *e - *e) - 1.0f;
+}
+
+
+static inline VF MATHFUN(log_domain)(VF x, VF y){
+    const VF zero = x - x;
+    y = MATHFUN(select)(x < zero, zero + NAN, y);
+    y = MATHFUN(select)(x < 1.17549435e-38f, MATHFUN(select)(x < zero, y, zero - INFINITY), y);
+    return MATHFUN(select)(x == INFINITY, x, y);
+}
+
+
+static inline VF MATHFUN(log_exact)(VF x){
+    VF e;
+    const VF f = MATHFUN(log_reduce)(x, &e);
+    const VF z = f * f;
+    VF p = f * 7.0376836292E-2f - 1.1514610310E-1f;
+    p = p * f + 1.1676998740E-1f;
+    p = p * f - 1.2420140846E-1f;
+    p = p * f + 1.4249322787E-1f;
+    p = p * f - 1.6668057665E-1f;
+    p = p * f + 2.0000714765E-1f;
+    p = p * f - 2.4999993993E-1f;
+    p = p * f + 3.3333331174E-1f;
+    VF y = p * f * z - e * 2.12194440e-4f - 0.5f * z;
+    y = (f + y) + e * 0.693359375f;
+    return MATHFUN(log_domain)(x, y);
+}
+
+
+static inline VF MATHFUN(log_fast)(VF x){
+    VF e;
+    const VF f = MATHFUN(log_reduce)(x, &e);
+    //  log(1 + f) = 2 atanh(t) with t = f / (2 + f), |t| < 0.172
+    const VF t = f / (f + 2.0f);
+    const VF t2 = t * t;
+    const VF y = (t2 * (t2 * 0.4f + (2.0f / 3.0f)) + 2.0f) * t;
+    return MATHFUN(log_domain)(x, y + e * 0.693147180559945309f);
+}
+
+
+//  As fast_logfv
+static inline VF MATHFUN(log_fastest)(VF x){
+    return (__builtin_convertvector((VI)x, VF) - 1064872507.1541044f) * 8.262958294867817e-08f;
+}
+
+
+/*  Logistic
+ */
+static inline VF MATHFUN(logistic_exact)(VF x){
+    return 1.0f / (MATHFUN(exp_exact)(-x) + 1.0f);
+}
+
+
+static inline VF MATHFUN(logistic_fast)(VF x){
+    return 1.0f / (MATHFUN(exp_fast)(-x) + 1.0f);
+}
+
+
+static inline VF MATHFUN(logistic_fastest)(VF x){
+    return 1.0f / (MATHFUN(exp_fastest)(-x) + 1.0f);
+}
+
+
+/*  Hyperbolic tangent
+ *
+ *  tanh(x) = 1 - 2 / (exp(2x) + 1), which cancels for small x where an odd
+ *  polynomial is used instead.
+ */
+static inline VF MATHFUN(tanh_small)(VF x){
+    const VF z = x * x;
+    VF p = z * -5.70498872745E-3f + 2.06390887954E-2f;
+    p = p * z - 5.37397155531E-2f;
+    p = p * z + 1.33314422036E-1f;
+    p = p * z - 3.33332819422E-1f;
+    return p * z * x + x;
+}
+
+
+static inline VF MATHFUN(tanh_exact)(VF x){
+    const VF ax = MATHFUN(clamp)(MATHFUN(copysign)(x, x - x), 0.0f, 10.0f);
+    const VF large = 1.0f - 2.0f / (MATHFUN(exp_exact)(ax + ax) + 1.0f);
+    return MATHFUN(select)(ax < 0.625f, MATHFUN(tanh_small)(x), MATHFUN(copysign)(large, x));
+}
+
+
+static inline VF MATHFUN(tanh_fast)(VF x){
+    const VF ax = MATHFUN(clamp)(MATHFUN(copysign)(x, x - x), 0.0f, 10.0f);
+    const VF large = 1.0f - 2.0f / (MATHFUN(exp_fast)(ax + ax) + 1.0f);
+    return MATHFUN(select)(ax < 0.625f, MATHFUN(tanh_small)(x), MATHFUN(copysign)(large, x));
+}
+
+
+//  As fast_tanhf
+static inline VF MATHFUN(tanh_fastest)(VF x){
+    const VF y = MATHFUN(logistic_fastest)(x + x);
+    return y + y - 1.0f;
+}
+
+
+/*  Exponential linear unit, x for positive x and exp(x) - 1 otherwise
+ *
+ *  exp(x) - 1 cancels for small x, where its Taylor series is used instead.
+ */
+static inline VF MATHFUN(elu_exact)(VF x){
+    VF p = x * (1.0f / 40320.0f) + (1.0f / 5040.0f);
+    p = p * x + (1.0f / 720.0f);
+    p = p * x + (1.0f / 120.0f);
+    p = p * x + (1.0f / 24.0f);
+    p = p * x + (1.0f / 6.0f);
+    p = p * x + 0.5f;
+    const VF small = p * x * x + x;
+    const VF y = MATHFUN(select)(x > -0.35f, small, MATHFUN(exp_exact)(x) - 1.0f);
+    return MATHFUN(select)(x >= 0.0f, x, y);
+}
+
+
+static inline VF MATHFUN(elu_fast)(VF x){
+    return MATHFUN(select)(x >= 0.0f, x, MATHFUN(exp_fast)(x) - 1.0f);
+}
+
+
+static inline VF MATHFUN(elu_fastest)(VF x){
+    return MATHFUN(select)(x >= 0.0f, x, MATHFUN(exp_fastest)(x) - 1.0f);
+}
+
+
+/*  Functions at a precision chosen at run time
+ *
+ *  The precision is the same for every call of a layer, so the branch is
+ *  well predicted.
+ */
+static inline VF MATHFUN(logistic)(VF x, enum flappie_math_precision precision){
+    switch(precision){
+    case FLAPPIE_MATH_EXACT:
+        return MATHFUN(logistic_exact)(x);
+    case FLAPPIE_MATH_FAST:
+        return MATHFUN(logistic_fast)(x);
+    default:
+        return MATHFUN(logistic_fastest)(x);
+    }
+}
+
+
+static inline VF MATHFUN(tanh)(VF x, enum flappie_math_precision precision){
+    switch(precision){
+    case FLAPPIE_MATH_EXACT:
+        return MATHFUN(tanh_exact)(x);
+    case FLAPPIE_MATH_FAST:
+        return MATHFUN(tanh_fast)(x);
+    default:
+        return MATHFUN(tanh_fastest)(x);
+    }
+}
+
+
+//  Apply function of a precision to every element of an array
+#define MATHFUN_ARRAY(fun)                                          \
+static void MATHFUN(fun ## _array)(float * x, size_t n){            \
+    size_t i = 0;                                                   \
+    for( ; i + sizeof(VF) / sizeof(float) <= n ; i += sizeof(VF) / sizeof(float)){ \
+        VF v;                                                       \
+        memcpy(&v, x + i, sizeof(VF));                              \
+        v = MATHFUN(fun)(v);                                        \
+        memcpy(x + i, &v, sizeof(VF));                              \
+    }                                                               \
+    if(i < n){                                                      \
+        VF v = {0};                                                 \
+        memcpy(&v, x + i, (n - i) * sizeof(float));                 \
+        v = MATHFUN(fun)(v);                                        \
+        memcpy(x + i, &v, (n - i) * sizeof(float));                 \
+    }                                                               \
+}
+
+MATHFUN_ARRAY(exp_exact)
+MATHFUN_ARRAY(exp_fast)
+MATHFUN_ARRAY(exp_fastest)
+MATHFUN_ARRAY(log_exact)
+MATHFUN_ARRAY(log_fast)
+MATHFUN_ARRAY(log_fastest)
+MATHFUN_ARRAY(tanh_exact)
+MATHFUN_ARRAY(tanh_fast)
+MATHFUN_ARRAY(tanh_fastest)
+MATHFUN_ARRAY(logistic_exact)
+MATHFUN_ARRAY(logistic_fast)
+MATHFUN_ARRAY(logistic_fastest)
+MATHFUN_ARRAY(elu_exact)
+MATHFUN_ARRAY(elu_fast)
+MATHFUN_ARRAY(elu_fastest)
+
+#undef MATHFUN_ARRAY
+
+
+//  Arrays of each function, by function and then precision.  The default
+//  precision is not a set of functions of its own, see flappie_math_inplace
+__attribute__ ((unused)) static void (* const MATHFUN(array_table)[][FLAPPIE_MATH_INVALID])(float * x, size_t n) = {
+    [FLAPPIE_MATH_EXP] = {NULL, MATHFUN(exp_exact_array), MATHFUN(exp_fast_array), MATHFUN(exp_fastest_array)},
+    [FLAPPIE_MATH_LOG] = {NULL, MATHFUN(log_exact_array), MATHFUN(log_fast_array), MATHFUN(log_fastest_array)},
+    [FLAPPIE_MATH_TANH] = {NULL, MATHFUN(tanh_exact_array), MATHFUN(tanh_fast_array), MATHFUN(tanh_fastest_array)},
+    [FLAPPIE_MATH_LOGISTIC] = {NULL, MATHFUN(logistic_exact_array), MATHFUN(logistic_fast_array),
+                               MATHFUN(logistic_fastest_array)},
+    [FLAPPIE_MATH_ELU] = {NULL, MATHFUN(elu_exact_array), MATHFUN(elu_fast_array), MATHFUN(elu_fastest_array)}
+};
@@ -63,44 +63,49 @@ flappie_matrix remake_flappie_matrix(flappie_matrix M, size_t nr, size_t nc) {
 
 // NOTES begin vector routines
 flappie_matrix_vec make_flappie_matrix_vec(size_t nr, size_t nc, int nfiles) {
-    assert(nr > 0);
-    assert(nc > 0);
-    // Matrix padded so row length is multiple of 4
-    const size_t nrq = (size_t)ceil(nr / 4.0);
+    assert(nfiles > 0);
+    size_t * ncs = malloc(nfiles * sizeof(size_t));
+    RETURN_NULL_IF(NULL == ncs, NULL);
+    for(int i = 0; i < nfiles; i++) {
+        ncs[i] = nc;
+    }
+    flappie_matrix_vec mat = make_flappie_matrix_vec_nc(nr, ncs, nfiles);
+    free(ncs);
+    return mat;
+}
+
+/**  Make a vector of matrices sharing a number of rows
+ *
+ *  Reads in a batch differ in length so each matrix has its own number of
+ *  columns.
+ *
+ *  @param nr Number of rows for every matrix
+ *  @param nc Array of length nfiles containing number of columns of each matrix
+ *  @param nfiles Number of matrices
+ *
+ *  @returns Vector of matrices or NULL on failure
+ **/
+flappie_matrix_vec make_flappie_matrix_vec_nc(size_t nr, const size_t * nc, int nfiles) {
+    assert(NULL != nc);
+    assert(nfiles > 0);
 
-    flappie_matrix_vec mat =  malloc(sizeof(*mat)*num_files);
+    flappie_matrix_vec mat = calloc(nfiles, sizeof(*mat));
+    RETURN_NULL_IF(NULL == mat, NULL);
 
     for(int i = 0; i < nfiles; i++) {
-	mat[i] = (flappie_matrix) malloc(sizeof(*mat[i]));
-	RETURN_NULL_IF(NULL == mat, NULL);
-
-	mat[i]->nr = nr;
-	mat[i]->nrq = nrq;
-	mat[i]->nc = nc;
-	mat[i]->stride = nrq * 4;
-
-	{
-	// Check for overflow to please Coverity scanner
-	size_t tmp1 = nrq * sizeof(__m128);
-	size_t tmp2 = tmp1 * nc;
-	if (tmp1 != 0 && tmp2 / tmp1 != nc) {
-	    // Have overflow in memory allocation
-	    free(mat[i]);
-	    return NULL;
-	}
-	}
-
-	if (0 != flappie_memalign((void **)&mat[i]->data.v, 16, nrq * nc * sizeof(__m128))) {
-	warnx("Error allocating memory in %s.\n", __func__);
-	free(mat[i]);
-	return NULL;
-	}
-	memset(mat[i]->data.v, 0, nrq * nc * sizeof(__m128));
-    }
-   	
+        mat[i] = make_flappie_matrix(nr, nc[i]);
+        if(NULL == mat[i]) {
+            return free_flappie_matrix_vec(mat, i);
+        }
+    }
+
     return mat;
 }
+
 flappie_matrix_vec free_flappie_matrix_vec(flappie_matrix_vec mat, int nfiles) {
+    if (NULL == mat) {
+        return NULL;
+    }
     for(int i = 0; i < nfiles; i++) {
 	    if (NULL != mat[i]) {
 		free(mat[i]->data.v);
@@ -110,9 +115,95 @@ flappie_matrix_vec free_flappie_matrix_vec(flappie_matrix_vec mat, int nfiles) {
     free(mat);
     return NULL;
 }
+
+/**  View onto one read of a padded batch
+ *
+ *  A padded batch holds nbatch reads end to end, each padded with zeros to
+ *  the same number of columns.  The view shares memory with the batch and
+ *  must not be freed.
+ *
+ *  @param M Padded batch
+ *  @param nbatch Number of reads in batch
+ *  @param i Index of read
+ *  @param nc Number of valid columns for read, at most M->nc / nbatch
+ *
+ *  @returns View of first nc columns belonging to read i
+ **/
+_Mat flappie_matrix_batch_view(const_flappie_matrix M, size_t nbatch, size_t i, size_t nc) {
+    assert(NULL != M);
+    assert(nbatch > 0 && 0 == M->nc % nbatch);
+    assert(i < nbatch);
+    const size_t npad = M->nc / nbatch;
+    assert(nc <= npad);
+
+    _Mat view = *M;
+    view.nc = nc;
+    view.data.v = M->data.v + i * npad * M->nrq;
+    return view;
+}
 // NOTES end vector routines
 
 
+/**  Interleave a padded batch so each step of all reads is contiguous
+ *
+ *  Column t * nbatch + j of the interleaved matrix holds column t of the
+ *  read in lane j, so a recurrent layer can step every read of the batch
+ *  with one matrix-matrix product.
+ *
+ *  @param M Padded batch, nr x (nbatch * npad)
+ *  @param nbatch Number of reads in batch
+ *  @param order Array of length nbatch with read held by each lane, NULL for read j in lane j
+ *  @param C [out] Interleaved batch.  Reallocated if NULL or of wrong size.
+ *
+ *  @returns Interleaved batch, nr x (npad * nbatch), or NULL on failure
+ **/
+flappie_matrix interleave_flappie_matrix(const_flappie_matrix M, size_t nbatch, const size_t * order, flappie_matrix C) {
+    RETURN_NULL_IF(NULL == M, NULL);
+    assert(nbatch > 0 && 0 == M->nc % nbatch);
+    const size_t npad = M->nc / nbatch;
+    C = remake_flappie_matrix(C, M->nr, M->nc);
+    RETURN_NULL_IF(NULL == C, NULL);
+
+    for (size_t j = 0; j < nbatch; j++) {
+        const size_t read = (NULL != order) ? order[j] : j;
+        assert(read < nbatch);
+        for (size_t t = 0; t < npad; t++) {
+            memcpy(C->data.v + (t * nbatch + j) * C->nrq, M->data.v + (read * npad + t) * M->nrq,
+                   M->nrq * sizeof(__m128));
+        }
+    }
+    return C;
+}
+
+
+/**  Padded batch from an interleaved batch, inverse of interleave_flappie_matrix
+ *
+ *  @param M Interleaved batch, nr x (npad * nbatch)
+ *  @param nbatch Number of reads in batch
+ *  @param order Array of length nbatch with read held by each lane, NULL for read j in lane j
+ *  @param C [out] Padded batch.  Reallocated if NULL or of wrong size.
+ *
+ *  @returns Padded batch, nr x (nbatch * npad), or NULL on failure
+ **/
+flappie_matrix deinterleave_flappie_matrix(const_flappie_matrix M, size_t nbatch, const size_t * order, flappie_matrix C) {
+    RETURN_NULL_IF(NULL == M, NULL);
+    assert(nbatch > 0 && 0 == M->nc % nbatch);
+    const size_t npad = M->nc / nbatch;
+    C = remake_flappie_matrix(C, M->nr, M->nc);
+    RETURN_NULL_IF(NULL == C, NULL);
+
+    for (size_t j = 0; j < nbatch; j++) {
+        const size_t read = (NULL != order) ? order[j] : j;
+        assert(read < nbatch);
+        for (size_t t = 0; t < npad; t++) {
+            memcpy(C->data.v + (read * npad + t) * C->nrq, M->data.v + (t * nbatch + j) * M->nrq,
+                   M->nrq * sizeof(__m128));
+        }
+    }
+    return C;
+}
+
+
 flappie_matrix copy_flappie_matrix(const_flappie_matrix M){
     RETURN_NULL_IF(NULL == M, NULL);
     flappie_matrix C = make_flappie_matrix(M->nr, M->nc);
@@ -410,6 +501,330 @@ int32_t * array_from_flappie_imatrix(const_flappie_imatrix mat){
 }
 
 
+static flappie_qmatrix make_flappie_qmatrix(size_t nr, size_t nc){
+    assert(nr > 0);
+    assert(nc > 0);
+    flappie_qmatrix Q = calloc(1, sizeof(*Q));
+    RETURN_NULL_IF(NULL == Q, NULL);
+    Q->nr = nr;
+    Q->nc = nc;
+    Q->stride = 32 * ((nr + 31) / 32);
+    const size_t ncq = 8 * ((nc + 7) / 8);
+    if(0 != flappie_memalign((void **)&Q->data, 32, Q->stride * nc)
+       || 0 != flappie_memalign((void **)&Q->scale, 32, ncq * sizeof(float))){
+        warnx("Error allocating memory in %s.\n", __func__);
+        return free_flappie_qmatrix(Q);
+    }
+    memset(Q->data, 0, Q->stride * nc);
+    memset(Q->scale, 0, ncq * sizeof(float));
+    return Q;
+}
+
+
+/**  Quantise matrix to int8, symmetrically with one scale per column
+ *
+ *   Each column of a weight matrix holds the weights of one output unit, so
+ *   the largest weight of every unit is represented exactly.
+ *
+ *  @param M Matrix to quantise
+ *
+ *  @returns Quantised matrix or NULL on failure
+ **/
+flappie_qmatrix quantise_flappie_matrix(const_flappie_matrix M){
+    RETURN_NULL_IF(NULL == M, NULL);
+    flappie_qmatrix Q = make_flappie_qmatrix(M->nr, M->nc);
+    RETURN_NULL_IF(NULL == Q, NULL);
+
+    for(size_t c=0 ; c < M->nc ; c++){
+        const float * col = M->data.f + c * M->stride;
+        float maxabs = 0.0f;
+        for(size_t r=0 ; r < M->nr ; r++){
+            maxabs = fmaxf(maxabs, fabsf(col[r]));
+        }
+        if(0.0f == maxabs){
+            continue;
+        }
+        Q->scale[c] = maxabs / 127.0f;
+        for(size_t r=0 ; r < M->nr ; r++){
+            Q->data[c * Q->stride + r] = (int8_t)lrintf(col[r] / Q->scale[c]);
+        }
+    }
+    return Q;
+}
+
+
+flappie_qmatrix copy_flappie_qmatrix(const_flappie_qmatrix Q){
+    RETURN_NULL_IF(NULL == Q, NULL);
+    flappie_qmatrix C = make_flappie_qmatrix(Q->nr, Q->nc);
+    RETURN_NULL_IF(NULL == C, NULL);
+    memcpy(C->data, Q->data, Q->stride * Q->nc);
+    memcpy(C->scale, Q->scale, Q->nc * sizeof(float));
+    return C;
+}
+
+
+flappie_qmatrix free_flappie_qmatrix(flappie_qmatrix Q){
+    if(NULL != Q){
+        free(Q->data);
+        free(Q->scale);
+        free(Q);
+    }
+    return NULL;
+}
+
+
+/**  Float matrix of the values represented by a quantised matrix
+ *
+ *  @param Q Quantised matrix
+ *
+ *  @returns Matrix or NULL on failure
+ **/
+flappie_matrix dequantise_flappie_qmatrix(const_flappie_qmatrix Q){
+    RETURN_NULL_IF(NULL == Q, NULL);
+    flappie_matrix M = make_flappie_matrix(Q->nr, Q->nc);
+    RETURN_NULL_IF(NULL == M, NULL);
+    for(size_t c=0 ; c < Q->nc ; c++){
+        for(size_t r=0 ; r < Q->nr ; r++){
+            M->data.f[c * M->stride + r] = Q->scale[c] * Q->data[c * Q->stride + r];
+        }
+    }
+    return M;
+}
+
+
+flappie_hmatrix make_flappie_hmatrix(size_t nr, size_t nc, enum flappie_half_format format){
+    assert(nr > 0);
+    assert(nc > 0);
+    flappie_hmatrix H = calloc(1, sizeof(*H));
+    RETURN_NULL_IF(NULL == H, NULL);
+    H->nr = nr;
+    H->nc = nc;
+    H->stride = 16 * ((nr + 15) / 16);
+    H->format = format;
+    if(0 != flappie_memalign((void **)&H->data, 32, H->stride * nc * sizeof(uint16_t))){
+        warnx("Error allocating memory in %s.\n", __func__);
+        free(H);
+        return NULL;
+    }
+    memset(H->data, 0, H->stride * nc * sizeof(uint16_t));
+    return H;
+}
+
+
+flappie_hmatrix copy_flappie_hmatrix(const_flappie_hmatrix H){
+    RETURN_NULL_IF(NULL == H, NULL);
+    flappie_hmatrix C = make_flappie_hmatrix(H->nr, H->nc, H->format);
+    RETURN_NULL_IF(NULL == C, NULL);
+    memcpy(C->data, H->data, H->stride * H->nc * sizeof(uint16_t));
+    return C;
+}
+
+
+flappie_hmatrix free_flappie_hmatrix(flappie_hmatrix H){
+    if(NULL != H){
+        free(H->data);
+        free(H);
+    }
+    return NULL;
+}
+
+
+/**  Write columns of matrix into a matrix of sixteen bit floats
+ *
+ *  @param M Matrix to convert
+ *  @param col First column of H written
+ *  @param H [out] Matrix with the same number of rows as M and at least
+ *  col + M->nc columns
+ **/
+void write_half_columns(const_flappie_matrix M, size_t col, flappie_hmatrix H){
+    assert(NULL != M);
+    assert(NULL != H);
+    assert(M->nr == H->nr);
+    assert(col + M->nc <= H->nc);
+    for(size_t c=0 ; c < M->nc ; c++){
+        const float * in = M->data.f + c * M->stride;
+        uint16_t * out = H->data + (col + c) * H->stride;
+        if(FLAPPIE_HALF_BF16 == H->format){
+            for(size_t r=0 ; r < M->nr ; r++){
+                out[r] = bf16_from_float(in[r]);
+            }
+        } else {
+            for(size_t r=0 ; r < M->nr ; r++){
+                out[r] = fp16_from_float(in[r]);
+            }
+        }
+    }
+}
+
+
+/**  Read columns of a matrix of sixteen bit floats
+ *
+ *  @param H Matrix to convert
+ *  @param col First column of H read
+ *  @param M [out] Matrix with the same number of rows as H, receiving
+ *  columns [col, col + M->nc) of H
+ **/
+void read_half_columns(const_flappie_hmatrix H, size_t col, flappie_matrix M){
+    assert(NULL != H);
+    assert(NULL != M);
+    assert(M->nr == H->nr);
+    assert(col + M->nc <= H->nc);
+    for(size_t c=0 ; c < M->nc ; c++){
+        const uint16_t * in = H->data + (col + c) * H->stride;
+        float * out = M->data.f + c * M->stride;
+        if(FLAPPIE_HALF_BF16 == H->format){
+            for(size_t r=0 ; r < M->nr ; r++){
+                out[r] = float_from_bf16(in[r]);
+            }
+        } else {
+            for(size_t r=0 ; r < M->nr ; r++){
+                out[r] = float_from_fp16(in[r]);
+            }
+        }
+    }
+}
+
+
+flappie_hmatrix half_from_flappie_matrix(const_flappie_matrix M, enum flappie_half_format format){
+    RETURN_NULL_IF(NULL == M, NULL);
+    flappie_hmatrix H = make_flappie_hmatrix(M->nr, M->nc, format);
+    RETURN_NULL_IF(NULL == H, NULL);
+    write_half_columns(M, 0, H);
+    return H;
+}
+
+
+flappie_matrix flappie_matrix_from_half(const_flappie_hmatrix H){
+    RETURN_NULL_IF(NULL == H, NULL);
+    flappie_matrix M = make_flappie_matrix(H->nr, H->nc);
+    RETURN_NULL_IF(NULL == M, NULL);
+    read_half_columns(H, 0, M);
+    return M;
+}
+
+
+flappie_xmatrix make_flappie_xmatrix(size_t nr, size_t nc, int frac){
+    assert(nr > 0);
+    assert(nc > 0);
+    flappie_xmatrix X = calloc(1, sizeof(*X));
+    RETURN_NULL_IF(NULL == X, NULL);
+    X->nr = nr;
+    X->nc = nc;
+    X->stride = 16 * ((nr + 15) / 16);
+    X->frac = frac;
+    if(0 != flappie_memalign((void **)&X->data, 32, X->stride * nc * sizeof(fixed_point_t))){
+        warnx("Error allocating memory in %s.\n", __func__);
+        free(X);
+        return NULL;
+    }
+    memset(X->data, 0, X->stride * nc * sizeof(fixed_point_t));
+    return X;
+}
+
+
+flappie_xmatrix copy_flappie_xmatrix(const_flappie_xmatrix X){
+    RETURN_NULL_IF(NULL == X, NULL);
+    flappie_xmatrix C = make_flappie_xmatrix(X->nr, X->nc, X->frac);
+    RETURN_NULL_IF(NULL == C, NULL);
+    memcpy(C->data, X->data, X->stride * X->nc * sizeof(fixed_point_t));
+    return C;
+}
+
+
+flappie_xmatrix free_flappie_xmatrix(flappie_xmatrix X){
+    if(NULL != X){
+        free(X->data);
+        free(X);
+    }
+    return NULL;
+}
+
+
+/**  Convert matrix to fixed point, saturating elements too large for the format
+ *
+ *  @param M Matrix to convert
+ *  @param frac Fractional bits of result
+ *
+ *  @returns Fixed point matrix or NULL on failure
+ **/
+flappie_xmatrix fixed_from_flappie_matrix(const_flappie_matrix M, int frac){
+    RETURN_NULL_IF(NULL == M, NULL);
+    flappie_xmatrix X = make_flappie_xmatrix(M->nr, M->nc, frac);
+    RETURN_NULL_IF(NULL == X, NULL);
+    for(size_t c=0 ; c < M->nc ; c++){
+        for(size_t r=0 ; r < M->nr ; r++){
+            X->data[c * X->stride + r] = float_to_fixed(M->data.f[c * M->stride + r], frac);
+        }
+    }
+    return X;
+}
+
+
+flappie_matrix flappie_matrix_from_fixed(const_flappie_xmatrix X){
+    RETURN_NULL_IF(NULL == X, NULL);
+    flappie_matrix M = make_flappie_matrix(X->nr, X->nc);
+    RETURN_NULL_IF(NULL == M, NULL);
+    for(size_t c=0 ; c < X->nc ; c++){
+        for(size_t r=0 ; r < X->nr ; r++){
+            M->data.f[c * M->stride + r] = fixed_to_float(X->data[c * X->stride + r], X->frac);
+        }
+    }
+    return M;
+}
+
+
+/**  Fractional bits of weights of a fixed point affine map
+ *
+ *   The most bits such that every weight fits in sixteen bits and the
+ *   product of a column of weights with any vector of sixteen bit fixed
+ *   point numbers, plus the bias at the format of the products, fits in 32
+ *   bits.  Sums of products can then be accumulated without saturating.
+ *
+ *  @param W Weights, one column per output
+ *  @param b Bias, one element per output, or NULL
+ *
+ *  @returns Fractional bits, between 0 and FIXED_POINT_FRACTIONAL_BITS
+ **/
+int fixed_weight_frac(const_flappie_matrix W, const_flappie_matrix b){
+    assert(NULL != W);
+    assert(NULL == b || b->nr == W->nc);
+    float maxabs = 0.0f;
+    float maxsum = 0.0f;
+    for(size_t c=0 ; c < W->nc ; c++){
+        float sum = (NULL != b) ? fabsf(b->data.f[c]) : 0.0f;
+        for(size_t r=0 ; r < W->nr ; r++){
+            const float w = fabsf(W->data.f[c * W->stride + r]);
+            maxabs = fmaxf(maxabs, w);
+            sum += w;
+        }
+        maxsum = fmaxf(maxsum, sum);
+    }
+    //  |sum of products| <= 2^15 * maxsum * 2^frac < 2^31
+    const int frac = fixed_frac_for_range(maxabs, FIXED_POINT_FRACTIONAL_BITS);
+    const int sumfrac = fixed_frac_for_range(0.5f * maxsum, FIXED_POINT_FRACTIONAL_BITS);
+    return (frac < sumfrac) ? frac : sumfrac;
+}
+
+
+/**  Bias of fixed point affine map, at the format of the products it is added to
+ *
+ *  @param b Bias
+ *  @param frac Fractional bits of products, those of weights plus those of input
+ *
+ *  @returns Matrix of 32 bit integers or NULL on failure
+ **/
+flappie_imatrix fixed_bias(const_flappie_matrix b, int frac){
+    RETURN_NULL_IF(NULL == b, NULL);
+    flappie_imatrix B = make_flappie_imatrix(b->nr, 1);
+    RETURN_NULL_IF(NULL == B, NULL);
+    for(size_t r=0 ; r < b->nr ; r++){
+        const double x = rint(ldexp(b->data.f[r], frac));
+        B->data.f[r] = (x > INT32_MAX) ? INT32_MAX : ((x < -INT32_MAX) ? -INT32_MAX : (int32_t)x);
+    }
+    return B;
+}
+
+
 flappie_matrix affine_map(const_flappie_matrix X, const_flappie_matrix W,
                            const_flappie_matrix b, flappie_matrix C) {
     /*  Affine transform C = W^t X + b
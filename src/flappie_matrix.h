@@ -32,17 +32,65 @@ typedef struct {
     } data;
 } _iMat;
 
+/**  Matrix quantised to int8, one scale per column
+ *
+ *   Element (r, c) approximates data[c * stride + r] * scale[c].  Columns
+ *   are padded with zeros to a multiple of 32 elements and scale to a
+ *   multiple of 8 columns, so kernels may read whole vectors.
+ **/
+typedef struct {
+    size_t nr, nc, stride;
+    int8_t *data;
+    float *scale;
+} _qMat;
+
+enum flappie_half_format {
+    FLAPPIE_HALF_FP16 = 0,
+    FLAPPIE_HALF_BF16
+};
+
+/**  Matrix of sixteen bit floats
+ *
+ *   Columns are padded with zeros to a multiple of 16 elements.
+ **/
+typedef struct {
+    size_t nr, nc, stride;
+    enum flappie_half_format format;
+    uint16_t *data;
+} _hMat;
+
+/**  Matrix of sixteen bit fixed point numbers sharing one format
+ *
+ *   Element (r, c) is data[c * stride + r] / 2^frac.  Columns are padded
+ *   with zeros to a multiple of 16 elements.
+ **/
+typedef struct {
+    size_t nr, nc, stride;
+    int frac;
+    fixed_point_t *data;
+} _xMat;
+
 typedef _Mat *flappie_matrix;
 typedef _Mat **flappie_matrix_vec; // NOTES vector version
 typedef _iMat *flappie_imatrix;
 typedef _Mat const *const_flappie_matrix;
 typedef _Mat const **const_flappie_matrix_vec; // NOTES vector version
 typedef _iMat const *const_flappie_imatrix;
+typedef _qMat *flappie_qmatrix;
+typedef _qMat const *const_flappie_qmatrix;
+typedef _hMat *flappie_hmatrix;
+typedef _hMat const *const_flappie_hmatrix;
+typedef _xMat *flappie_xmatrix;
+typedef _xMat const *const_flappie_xmatrix;
 
 // NOTES added vector versions
 flappie_matrix_vec make_flappie_matrix_vec(size_t nr, size_t nc, int nfiles);
+flappie_matrix_vec make_flappie_matrix_vec_nc(size_t nr, const size_t * nc, int nfiles);
 flappie_matrix_vec remake_flappie_matrix_vec(flappie_matrix_vec M, size_t nr, size_t nc);
 flappie_matrix_vec free_flappie_matrix_vec(flappie_matrix_vec mat, int nfiles);
+_Mat flappie_matrix_batch_view(const_flappie_matrix M, size_t nbatch, size_t i, size_t nc);
+flappie_matrix interleave_flappie_matrix(const_flappie_matrix M, size_t nbatch, const size_t * order, flappie_matrix C);
+flappie_matrix deinterleave_flappie_matrix(const_flappie_matrix M, size_t nbatch, const size_t * order, flappie_matrix C);
 
 flappie_matrix make_flappie_matrix(size_t nr, size_t nc);
 flappie_matrix remake_flappie_matrix(flappie_matrix M, size_t nr, size_t nc);
@@ -69,6 +117,27 @@ flappie_imatrix free_flappie_imatrix(flappie_imatrix mat);
 void zero_flappie_imatrix(flappie_imatrix M);
 int32_t * array_from_flappie_imatrix(const_flappie_imatrix mat);
 
+flappie_qmatrix quantise_flappie_matrix(const_flappie_matrix M);
+flappie_qmatrix copy_flappie_qmatrix(const_flappie_qmatrix Q);
+flappie_qmatrix free_flappie_qmatrix(flappie_qmatrix Q);
+flappie_matrix dequantise_flappie_qmatrix(const_flappie_qmatrix Q);
+
+flappie_hmatrix make_flappie_hmatrix(size_t nr, size_t nc, enum flappie_half_format format);
+flappie_hmatrix copy_flappie_hmatrix(const_flappie_hmatrix H);
+flappie_hmatrix free_flappie_hmatrix(flappie_hmatrix H);
+flappie_hmatrix half_from_flappie_matrix(const_flappie_matrix M, enum flappie_half_format format);
+flappie_matrix flappie_matrix_from_half(const_flappie_hmatrix H);
+void write_half_columns(const_flappie_matrix M, size_t col, flappie_hmatrix H);
+void read_half_columns(const_flappie_hmatrix H, size_t col, flappie_matrix M);
+
+flappie_xmatrix make_flappie_xmatrix(size_t nr, size_t nc, int frac);
+flappie_xmatrix copy_flappie_xmatrix(const_flappie_xmatrix X);
+flappie_xmatrix free_flappie_xmatrix(flappie_xmatrix X);
+flappie_xmatrix fixed_from_flappie_matrix(const_flappie_matrix M, int frac);
+flappie_matrix flappie_matrix_from_fixed(const_flappie_xmatrix X);
+int fixed_weight_frac(const_flappie_matrix W, const_flappie_matrix b);
+flappie_imatrix fixed_bias(const_flappie_matrix b, int frac);
+
 flappie_matrix affine_map(const_flappie_matrix X, const_flappie_matrix W, const_flappie_matrix b, flappie_matrix C);
 flappie_matrix_vec affine_map_vec(const_flappie_matrix_vec X, const_flappie_matrix W, const_flappie_matrix b, flappie_matrix_vec C);
 
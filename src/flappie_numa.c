@@ -0,0 +1,351 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+//  CPU affinity is not part of C99 or POSIX
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "flappie_numa.h"
+#include "flappie_stdlib.h"
+
+struct _flappie_topology {
+    size_t nnode;
+    size_t * ncpu;
+    int ** cpu;
+};
+
+static const char node_dir[] = "/sys/devices/system/node";
+
+
+/**  Parse list of CPUs in the format of /sys, e.g. "0-3,8,10-11"
+ *
+ *  @param str List
+ *  @param ncpu [out] Number of CPUs in list
+ *
+ *  @returns Array of CPUs or NULL on failure or empty list
+ **/
+static int * parse_cpu_list(const char * str, size_t * ncpu){
+    *ncpu = 0;
+    size_t capacity = 0;
+    int * cpu = NULL;
+    while('\0' != *str && '\n' != *str){
+        int first = 0;
+        int last = 0;
+        int nchar = 0;
+        if(2 == sscanf(str, "%d-%d%n", &first, &last, &nchar)){
+        } else if(1 == sscanf(str, "%d%n", &first, &nchar)){
+            last = first;
+        } else {
+            break;
+        }
+        str += nchar;
+        for(int c=first ; c <= last ; c++){
+            if(*ncpu == capacity){
+                capacity = 2 * capacity + 8;
+                int * tmp = realloc(cpu, capacity * sizeof(int));
+                if(NULL == tmp){
+                    free(cpu);
+                    *ncpu = 0;
+                    return NULL;
+                }
+                cpu = tmp;
+            }
+            cpu[*ncpu] = c;
+            *ncpu += 1;
+        }
+        if(',' == *str){
+            str += 1;
+        }
+    }
+    if(0 == *ncpu){
+        free(cpu);
+        return NULL;
+    }
+    return cpu;
+}
+
+
+static int * read_cpu_list(const char * filename, size_t * ncpu){
+    *ncpu = 0;
+    FILE * fh = fopen(filename, "r");
+    if(NULL == fh){
+        return NULL;
+    }
+    char line[4096];
+    char * str = fgets(line, sizeof(line), fh);
+    fclose(fh);
+    return (NULL != str) ? parse_cpu_list(line, ncpu) : NULL;
+}
+
+
+//  Is CPU the first thread of its physical core?
+static bool is_first_thread_of_core(int cpu){
+    char filename[256];
+    snprintf(filename, sizeof(filename), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+    size_t nsibling = 0;
+    int * sibling = read_cpu_list(filename, &nsibling);
+    if(NULL == sibling){
+        return true;
+    }
+    bool is_first = true;
+    for(size_t i=0 ; i < nsibling ; i++){
+        is_first = is_first && (sibling[i] >= cpu);
+    }
+    free(sibling);
+    return is_first;
+}
+
+
+//  One thread of every physical core first, then remaining threads
+static void order_by_core(int * cpu, size_t ncpu){
+    int * second = calloc(ncpu, sizeof(int));
+    if(NULL == second){
+        return;
+    }
+    size_t nfirst = 0;
+    size_t nsecond = 0;
+    for(size_t i=0 ; i < ncpu ; i++){
+        if(is_first_thread_of_core(cpu[i])){
+            cpu[nfirst++] = cpu[i];
+        } else {
+            second[nsecond++] = cpu[i];
+        }
+    }
+    memcpy(cpu + nfirst, second, nsecond * sizeof(int));
+    free(second);
+}
+
+
+static int cmp_int(const void * a, const void * b){
+    const int ia = *(const int *)a;
+    const int ib = *(const int *)b;
+    return (ia > ib) - (ia < ib);
+}
+
+
+//  Add node with its CPUs, taking ownership of cpu
+static bool add_topology_node(flappie_topology topology, int * cpu, size_t ncpu){
+    size_t * tmp_ncpu = realloc(topology->ncpu, (topology->nnode + 1) * sizeof(size_t));
+    if(NULL == tmp_ncpu){
+        free(cpu);
+        return false;
+    }
+    topology->ncpu = tmp_ncpu;
+    int ** tmp_cpu = realloc(topology->cpu, (topology->nnode + 1) * sizeof(int *));
+    if(NULL == tmp_cpu){
+        free(cpu);
+        return false;
+    }
+    topology->cpu = tmp_cpu;
+    order_by_core(cpu, ncpu);
+    topology->ncpu[topology->nnode] = ncpu;
+    topology->cpu[topology->nnode] = cpu;
+    topology->nnode += 1;
+    return true;
+}
+
+
+/**  Detect NUMA nodes of host
+ *
+ *  @returns Topology or NULL on failure
+ **/
+flappie_topology make_flappie_topology(void){
+    flappie_topology topology = calloc(1, sizeof(*topology));
+    RETURN_NULL_IF(NULL == topology, NULL);
+
+    //  Node numbers, in order.  Nodes without CPUs (memory only) are skipped.
+    size_t nid = 0;
+    int id[1024];
+    DIR * dirp = opendir(node_dir);
+    if(NULL != dirp){
+        struct dirent * entry = NULL;
+        while(NULL != (entry = readdir(dirp)) && nid < sizeof(id) / sizeof(id[0])){
+            int node = 0;
+            char tail = '\0';
+            if(1 == sscanf(entry->d_name, "node%d%c", &node, &tail)){
+                id[nid++] = node;
+            }
+        }
+        closedir(dirp);
+    }
+    qsort(id, nid, sizeof(int), cmp_int);
+
+    for(size_t i=0 ; i < nid ; i++){
+        char filename[256];
+        snprintf(filename, sizeof(filename), "%s/node%d/cpulist", node_dir, id[i]);
+        size_t ncpu = 0;
+        int * cpu = read_cpu_list(filename, &ncpu);
+        if(NULL != cpu && !add_topology_node(topology, cpu, ncpu)){
+            return free_flappie_topology(topology);
+        }
+    }
+
+    if(0 == topology->nnode){
+        //  No NUMA information: a single node of every online CPU
+        size_t ncpu = 0;
+        int * cpu = read_cpu_list("/sys/devices/system/cpu/online", &ncpu);
+        if(NULL == cpu){
+            const long nonline = sysconf(_SC_NPROCESSORS_ONLN);
+            ncpu = (nonline > 0) ? nonline : 1;
+            cpu = calloc(ncpu, sizeof(int));
+            if(NULL == cpu){
+                return free_flappie_topology(topology);
+            }
+            for(size_t c=0 ; c < ncpu ; c++){
+                cpu[c] = c;
+            }
+        }
+        if(!add_topology_node(topology, cpu, ncpu)){
+            return free_flappie_topology(topology);
+        }
+    }
+
+    return topology;
+}
+
+
+flappie_topology free_flappie_topology(flappie_topology topology){
+    if(NULL != topology){
+        for(size_t i=0 ; i < topology->nnode ; i++){
+            free(topology->cpu[i]);
+        }
+        free(topology->cpu);
+        free(topology->ncpu);
+        free(topology);
+    }
+    return NULL;
+}
+
+
+size_t flappie_topology_nnode(const_flappie_topology topology){
+    assert(NULL != topology);
+    return topology->nnode;
+}
+
+
+size_t flappie_topology_ncpu(const_flappie_topology topology, size_t node){
+    assert(NULL != topology);
+    assert(node < topology->nnode);
+    return topology->ncpu[node];
+}
+
+
+const int * flappie_topology_cpus(const_flappie_topology topology, size_t node){
+    assert(NULL != topology);
+    assert(node < topology->nnode);
+    return topology->cpu[node];
+}
+
+
+/**  Restrict calling thread to run on set of CPUs
+ *
+ *  @param cpu Array of CPUs
+ *  @param ncpu Number of CPUs
+ *
+ *  @returns true on success
+ **/
+bool flappie_pin_thread(const int * cpu, size_t ncpu){
+    RETURN_NULL_IF(NULL == cpu, false);
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(size_t i=0 ; i < ncpu ; i++){
+        if(cpu[i] >= 0 && cpu[i] < CPU_SETSIZE){
+            CPU_SET(cpu[i], &set);
+        }
+    }
+    return 0 == pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)ncpu;
+    return false;
+#endif
+}
+
+
+//  Node of each thread, stored as node + 1 so unset is zero
+static pthread_key_t node_key;
+static pthread_once_t node_key_once = PTHREAD_ONCE_INIT;
+
+static void make_node_key(void){
+    pthread_key_create(&node_key, NULL);
+}
+
+
+/**  Record the NUMA node the calling thread runs on
+ *
+ *   Selects which copy of the weights of a model the thread uses.
+ *
+ *  @param node Node, or -1 if not bound to a node
+ **/
+void flappie_set_thread_node(int node){
+    pthread_once(&node_key_once, make_node_key);
+    pthread_setspecific(node_key, (void *)(intptr_t)(node + 1));
+}
+
+
+/**  NUMA node of calling thread
+ *
+ *  @returns Node or -1 if not bound to a node
+ **/
+int flappie_thread_node(void){
+    pthread_once(&node_key_once, make_node_key);
+    return (int)(intptr_t)pthread_getspecific(node_key) - 1;
+}
+
+
+struct node_task {
+    const_flappie_topology topology;
+    size_t node;
+    void (*fun)(void *);
+    void * data;
+};
+
+static void * run_node_task(void * ptr){
+    struct node_task * task = ptr;
+    flappie_pin_thread(task->topology->cpu[task->node], task->topology->ncpu[task->node]);
+    flappie_set_thread_node(task->node);
+    task->fun(task->data);
+    return NULL;
+}
+
+
+/**  Run function on a thread bound to a NUMA node
+ *
+ *   Memory first written by the function is placed on the node, so this is
+ *   used to make the per-node copies of the weights.
+ *
+ *  @param topology Topology of host
+ *  @param node Node to run on
+ *  @param fun Function
+ *  @param data Passed to function
+ *
+ *  @returns true if function was run
+ **/
+bool flappie_run_on_node(const_flappie_topology topology, size_t node, void (*fun)(void *), void * data){
+    RETURN_NULL_IF(NULL == topology, false);
+    RETURN_NULL_IF(node >= topology->nnode, false);
+    struct node_task task = {topology, node, fun, data};
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    //  Network layers keep large work arrays on the stack
+    pthread_attr_setstacksize(&attr, 16 * 1024 * 1024);
+    pthread_t thread;
+    const bool ok = (0 == pthread_create(&thread, &attr, run_node_task, &task));
+    pthread_attr_destroy(&attr);
+    if(ok){
+        pthread_join(thread, NULL);
+    }
+    return ok;
+}
@@ -0,0 +1,40 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#pragma once
+#ifndef FLAPPIE_NUMA_H
+#    define FLAPPIE_NUMA_H
+
+#    include <stdbool.h>
+#    include <stddef.h>
+
+//  Largest number of NUMA nodes given their own copy of the weights
+#    define FLAPPIE_MAX_NUMA_NODE 16
+
+/**  NUMA nodes of the host and the CPUs belonging to each
+ *
+ *   Read from /sys/devices/system/node.  CPUs of a node are ordered so the
+ *   first thread of every physical core comes before any second thread, so
+ *   pinning workers to the first CPUs of a node spreads them over cores.  A
+ *   host without NUMA information is a single node holding every CPU.
+ **/
+typedef struct _flappie_topology *flappie_topology;
+typedef struct _flappie_topology const *const_flappie_topology;
+
+flappie_topology make_flappie_topology(void);
+flappie_topology free_flappie_topology(flappie_topology topology);
+size_t flappie_topology_nnode(const_flappie_topology topology);
+size_t flappie_topology_ncpu(const_flappie_topology topology, size_t node);
+const int * flappie_topology_cpus(const_flappie_topology topology, size_t node);
+
+bool flappie_pin_thread(const int * cpu, size_t ncpu);
+void flappie_set_thread_node(int node);
+int flappie_thread_node(void);
+bool flappie_run_on_node(const_flappie_topology topology, size_t node, void (*fun)(void *), void * data);
+
+#endif /* FLAPPIE_NUMA_H */
@@ -0,0 +1,393 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+//  clock_gettime is not part of C99
+#define _POSIX_C_SOURCE 200112L
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "flappie_profile.h"
+#include "flappie_stdlib.h"
+
+static const char * stage_name[FLAPPIE_PROFILE_NSTAGE] = {
+    "read", "scale", "trim", "normalise", "convolution",
+    "gru1", "gru2", "gru3", "gru4", "gru5",
+    "globalnorm", "posterior", "decode", "trace", "output"};
+
+//  Events held by a thread before being written to the timeline
+#define TIMELINE_BUFFER 4096
+
+struct timeline_event {
+    enum flappie_profile_stage stage;
+    double start;
+    double end;
+    size_t nread;
+    size_t nsample;
+    char read_id[64];
+};
+
+struct profile_counters {
+    double seconds[FLAPPIE_PROFILE_NSTAGE];
+    uint64_t calls[FLAPPIE_PROFILE_NSTAGE];
+    uint64_t samples[FLAPPIE_PROFILE_NSTAGE];
+    uint64_t reads;
+    uint64_t read_samples;
+    uint64_t bases;
+    //  Identity of thread on timeline
+    size_t tid;
+    char name[32];
+    struct timeline_event * events;
+    size_t nevent;
+    struct profile_counters * next;
+};
+
+//  Set once, before any thread is timed
+static bool profile_enabled = false;
+//  Counters of every thread that has timed a stage, kept after it exits
+static struct profile_counters * profile_threads = NULL;
+static size_t profile_nthread = 0;
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t profile_key;
+static pthread_once_t profile_key_once = PTHREAD_ONCE_INIT;
+
+//  Timeline, NULL if not recorded
+static FILE * timeline = NULL;
+static double timeline_origin = 0.0;
+static size_t timeline_nevent = 0;
+static pthread_mutex_t timeline_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void make_profile_key(void){
+    pthread_key_create(&profile_key, NULL);
+}
+
+
+//  Counters of calling thread, created on first use
+static struct profile_counters * thread_counters(void){
+    pthread_once(&profile_key_once, make_profile_key);
+    struct profile_counters * counters = pthread_getspecific(profile_key);
+    if(NULL != counters){
+        return counters;
+    }
+    counters = calloc(1, sizeof(struct profile_counters));
+    RETURN_NULL_IF(NULL == counters, NULL);
+    pthread_setspecific(profile_key, counters);
+
+    pthread_mutex_lock(&profile_lock);
+    counters->tid = profile_nthread;
+    profile_nthread += 1;
+    counters->next = profile_threads;
+    profile_threads = counters;
+    pthread_mutex_unlock(&profile_lock);
+    return counters;
+}
+
+
+//  Write string as the contents of a JSON string
+static void fprint_json_string(FILE * fh, const char * str){
+    for( ; '\0' != *str ; str++){
+        if('"' == *str || '\\' == *str){
+            fputc('\\', fh);
+        }
+        if((unsigned char)*str >= 0x20){
+            fputc(*str, fh);
+        }
+    }
+}
+
+
+//  Write events held by thread to timeline.  Caller holds timeline_lock.
+static void flush_timeline_events(struct profile_counters * counters){
+    for(size_t i=0 ; i < counters->nevent ; i++){
+        const struct timeline_event * ev = counters->events + i;
+        //  Times in microseconds
+        fprintf(timeline, "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %zu, "
+                          "\"ts\": %.3f, \"dur\": %.3f, \"args\": {",
+                (timeline_nevent > 0) ? "," : "", stage_name[ev->stage], counters->tid,
+                1e6 * (ev->start - timeline_origin), 1e6 * (ev->end - ev->start));
+        if('\0' != ev->read_id[0]){
+            fputs("\"read_id\": \"", timeline);
+            fprint_json_string(timeline, ev->read_id);
+            fputs("\", ", timeline);
+        } else {
+            fprintf(timeline, "\"nread\": %zu, ", ev->nread);
+        }
+        fprintf(timeline, "\"nsample\": %zu}}", ev->nsample);
+        timeline_nevent += 1;
+    }
+    counters->nevent = 0;
+}
+
+
+static void add_timeline_event(struct profile_counters * counters, const struct timeline_event * ev){
+    if(NULL == counters->events){
+        counters->events = calloc(TIMELINE_BUFFER, sizeof(struct timeline_event));
+        if(NULL == counters->events){
+            return;
+        }
+    }
+    counters->events[counters->nevent] = *ev;
+    counters->nevent += 1;
+    if(TIMELINE_BUFFER == counters->nevent){
+        pthread_mutex_lock(&timeline_lock);
+        flush_timeline_events(counters);
+        pthread_mutex_unlock(&timeline_lock);
+    }
+}
+
+
+static void record_stage(enum flappie_profile_stage stage, double start, const char * read_id,
+                         size_t nread, size_t nsample){
+    if(!profile_enabled){
+        return;
+    }
+    assert(stage < FLAPPIE_PROFILE_NSTAGE);
+    const double end = flappie_profile_clock();
+    struct profile_counters * counters = thread_counters();
+    if(NULL == counters){
+        return;
+    }
+    counters->seconds[stage] += end - start;
+    counters->calls[stage] += 1;
+    counters->samples[stage] += nsample;
+
+    if(NULL != timeline){
+        struct timeline_event ev = {stage, start, end, nread, nsample, {0}};
+        if(NULL != read_id){
+            strncpy(ev.read_id, read_id, sizeof(ev.read_id) - 1);
+        }
+        add_timeline_event(counters, &ev);
+    }
+}
+
+
+/**  Turn on profiling
+ *
+ *   Should be called before any thread starts basecalling.
+ **/
+void flappie_profile_enable(void){
+    profile_enabled = true;
+}
+
+
+bool flappie_profile_is_enabled(void){
+    return profile_enabled;
+}
+
+
+/**  Monotonic wall time
+ *
+ *  @returns Time in seconds from an arbitrary origin
+ **/
+double flappie_profile_clock(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+
+/**  Start timing a stage
+ *
+ *  @returns Time to pass to flappie_profile_stop
+ **/
+double flappie_profile_start(void){
+    return profile_enabled ? flappie_profile_clock() : 0.0;
+}
+
+
+/**  Finish timing a stage for a single read
+ *
+ *  @param stage Stage timed
+ *  @param start Time returned by flappie_profile_start
+ *  @param read_id Id of read, may be NULL
+ *  @param nsample Number of samples of raw signal processed
+ **/
+void flappie_profile_stop(enum flappie_profile_stage stage, double start, const char * read_id, size_t nsample){
+    record_stage(stage, start, read_id, 1, nsample);
+}
+
+
+/**  Finish timing a stage for a batch of reads
+ *
+ *  @param stage Stage timed
+ *  @param start Time returned by flappie_profile_start
+ *  @param nread Number of reads in batch
+ *  @param nsample Number of samples of raw signal processed
+ **/
+void flappie_profile_stop_batch(enum flappie_profile_stage stage, double start, size_t nread, size_t nsample){
+    record_stage(stage, start, NULL, nread, nsample);
+}
+
+
+/**  Name calling thread on the timeline
+ *
+ *  @param name Name, truncated to 31 characters
+ **/
+void flappie_profile_name_thread(const char * name){
+    if(!profile_enabled || NULL == name){
+        return;
+    }
+    struct profile_counters * counters = thread_counters();
+    if(NULL != counters){
+        strncpy(counters->name, name, sizeof(counters->name) - 1);
+    }
+}
+
+
+/**  Start recording a timeline of every stage
+ *
+ *   Timeline is written in the trace event format of Chrome and Perfetto,
+ *   with a span for each stage on each read in the lane of the thread that
+ *   ran it.  Gaps in a lane are time that thread spent waiting.  Turns on
+ *   profiling and should be called before any thread starts basecalling.
+ *
+ *  @param filename File to write timeline to
+ *
+ *  @returns true on success
+ **/
+bool flappie_timeline_open(const char * filename){
+    RETURN_NULL_IF(NULL == filename, false);
+    RETURN_NULL_IF(NULL != timeline, false);
+    timeline = fopen(filename, "w");
+    RETURN_NULL_IF(NULL == timeline, false);
+    timeline_origin = flappie_profile_clock();
+    timeline_nevent = 0;
+    fputs("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [", timeline);
+    flappie_profile_enable();
+    return true;
+}
+
+
+/**  Write events of every thread and close timeline
+ *
+ *   Should be called once every timed thread has finished.
+ *
+ *  @returns true on success
+ **/
+bool flappie_timeline_close(void){
+    if(NULL == timeline){
+        return false;
+    }
+    pthread_mutex_lock(&profile_lock);
+    pthread_mutex_lock(&timeline_lock);
+    for(struct profile_counters * c=profile_threads ; NULL != c ; c=c->next){
+        flush_timeline_events(c);
+        if('\0' != c->name[0]){
+            fprintf(timeline, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %zu, "
+                              "\"args\": {\"name\": \"",
+                    (timeline_nevent > 0) ? "," : "", c->tid);
+            fprint_json_string(timeline, c->name);
+            fputs("\"}}", timeline);
+            timeline_nevent += 1;
+        }
+    }
+    fputs("\n]}\n", timeline);
+    const bool ok = !ferror(timeline);
+    fclose(timeline);
+    timeline = NULL;
+    pthread_mutex_unlock(&timeline_lock);
+    pthread_mutex_unlock(&profile_lock);
+    return ok;
+}
+
+
+/**  Record a read that has been basecalled
+ *
+ *  @param nsample Number of samples of raw signal
+ *  @param nbase Number of bases called
+ **/
+void flappie_profile_add_read(size_t nsample, size_t nbase){
+    if(!profile_enabled){
+        return;
+    }
+    struct profile_counters * counters = thread_counters();
+    if(NULL == counters){
+        return;
+    }
+    counters->reads += 1;
+    counters->read_samples += nsample;
+    counters->bases += nbase;
+}
+
+
+static double per_second(double count, double seconds){
+    return (seconds > 0.0) ? count / seconds : 0.0;
+}
+
+
+/**  Write profile as JSON
+ *
+ *   Should be called once every timed thread has finished.  Time spent in a
+ *   stage is summed over threads, so the samples per second of a stage is
+ *   the rate a single thread achieves in it.
+ *
+ *  @param fh File handle to write to
+ *  @param wall_time Elapsed time of the whole run, used for overall rates
+ *
+ *  @returns true on success
+ **/
+bool flappie_profile_write(FILE * fh, double wall_time){
+    RETURN_NULL_IF(NULL == fh, false);
+
+    struct profile_counters total = {{0}};
+    size_t nthread = 0;
+    pthread_mutex_lock(&profile_lock);
+    for(const struct profile_counters * c=profile_threads ; NULL != c ; c=c->next){
+        for(size_t i=0 ; i < FLAPPIE_PROFILE_NSTAGE ; i++){
+            total.seconds[i] += c->seconds[i];
+            total.calls[i] += c->calls[i];
+            total.samples[i] += c->samples[i];
+        }
+        total.reads += c->reads;
+        total.read_samples += c->read_samples;
+        total.bases += c->bases;
+        nthread += 1;
+    }
+    pthread_mutex_unlock(&profile_lock);
+
+    fprintf(fh, "{\n");
+    fprintf(fh, "  \"wall_time\": %.6f,\n", wall_time);
+    fprintf(fh, "  \"threads\": %zu,\n", nthread);
+    fprintf(fh, "  \"reads\": %" PRIu64 ",\n", total.reads);
+    fprintf(fh, "  \"samples\": %" PRIu64 ",\n", total.read_samples);
+    fprintf(fh, "  \"bases\": %" PRIu64 ",\n", total.bases);
+    fprintf(fh, "  \"samples_per_second\": %.1f,\n", per_second(total.read_samples, wall_time));
+    fprintf(fh, "  \"bases_per_second\": %.1f,\n", per_second(total.bases, wall_time));
+    fprintf(fh, "  \"stages\": {\n");
+    for(size_t i=0 ; i < FLAPPIE_PROFILE_NSTAGE ; i++){
+        fprintf(fh, "    \"%s\": {\"calls\": %" PRIu64 ", \"seconds\": %.6f, \"samples\": %" PRIu64
+                    ", \"samples_per_second\": %.1f}%s\n",
+                stage_name[i], total.calls[i], total.seconds[i], total.samples[i],
+                per_second(total.samples[i], total.seconds[i]),
+                (i + 1 < FLAPPIE_PROFILE_NSTAGE) ? "," : "");
+    }
+    fprintf(fh, "  }\n");
+    fprintf(fh, "}\n");
+
+    return !ferror(fh);
+}
+
+
+/**  Zero counters of every thread
+ **/
+void flappie_profile_reset(void){
+    pthread_mutex_lock(&profile_lock);
+    for(struct profile_counters * c=profile_threads ; NULL != c ; c=c->next){
+        for(size_t i=0 ; i < FLAPPIE_PROFILE_NSTAGE ; i++){
+            c->seconds[i] = 0.0;
+            c->calls[i] = 0;
+            c->samples[i] = 0;
+        }
+        c->reads = 0;
+        c->read_samples = 0;
+        c->bases = 0;
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
@@ -0,0 +1,60 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#pragma once
+#ifndef FLAPPIE_PROFILE_H
+#    define FLAPPIE_PROFILE_H
+
+#    include <stdbool.h>
+#    include <stddef.h>
+#    include <stdio.h>
+
+/**  Wall time spent in each stage of basecalling
+ *
+ *   Every thread accumulates into its own counters, which are summed when
+ *   the profile is written, so timing a stage never contends for a lock.
+ *   If a timeline is being recorded, each thread also buffers a span per
+ *   stage and takes a lock only to write out a full buffer.  Profiling is off
+ *   unless enabled, when timing a stage costs a single test of a flag.
+ **/
+enum flappie_profile_stage {
+    FLAPPIE_PROFILE_READ = 0,
+    FLAPPIE_PROFILE_SCALE,
+    FLAPPIE_PROFILE_TRIM,
+    FLAPPIE_PROFILE_NORMALISE,
+    FLAPPIE_PROFILE_CONVOLUTION,
+    FLAPPIE_PROFILE_GRU1,
+    FLAPPIE_PROFILE_GRU2,
+    FLAPPIE_PROFILE_GRU3,
+    FLAPPIE_PROFILE_GRU4,
+    FLAPPIE_PROFILE_GRU5,
+    FLAPPIE_PROFILE_GLOBALNORM,
+    FLAPPIE_PROFILE_POSTERIOR,
+    FLAPPIE_PROFILE_DECODE,
+    FLAPPIE_PROFILE_TRACE,
+    FLAPPIE_PROFILE_OUTPUT,
+    FLAPPIE_PROFILE_NSTAGE
+};
+
+void flappie_profile_enable(void);
+bool flappie_profile_is_enabled(void);
+double flappie_profile_clock(void);
+
+double flappie_profile_start(void);
+void flappie_profile_stop(enum flappie_profile_stage stage, double start, const char * read_id, size_t nsample);
+void flappie_profile_stop_batch(enum flappie_profile_stage stage, double start, size_t nread, size_t nsample);
+void flappie_profile_add_read(size_t nsample, size_t nbase);
+void flappie_profile_name_thread(const char * name);
+
+bool flappie_profile_write(FILE * fh, double wall_time);
+void flappie_profile_reset(void);
+
+bool flappie_timeline_open(const char * filename);
+bool flappie_timeline_close(void);
+
+#endif /* FLAPPIE_PROFILE_H */
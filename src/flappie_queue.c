@@ -0,0 +1,174 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#include <pthread.h>
+
+#include "flappie_queue.h"
+#include "flappie_stdlib.h"
+
+struct _flappie_queue {
+    void ** item;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    size_t nproducer;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+
+/**  Create a bounded queue
+ *
+ *  @param capacity Maximum number of items held before producers block
+ *  @param nproducer Number of producers that will call flappie_queue_close
+ *
+ *  @returns Queue or NULL on failure
+ **/
+flappie_queue make_flappie_queue(size_t capacity, size_t nproducer){
+    assert(capacity > 0);
+    assert(nproducer > 0);
+
+    flappie_queue queue = calloc(1, sizeof(*queue));
+    RETURN_NULL_IF(NULL == queue, NULL);
+
+    queue->item = calloc(capacity, sizeof(void *));
+    if(NULL == queue->item){
+        free(queue);
+        return NULL;
+    }
+    queue->capacity = capacity;
+    queue->nproducer = nproducer;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+
+    return queue;
+}
+
+
+flappie_queue free_flappie_queue(flappie_queue queue){
+    if(NULL != queue){
+        pthread_cond_destroy(&queue->not_full);
+        pthread_cond_destroy(&queue->not_empty);
+        pthread_mutex_destroy(&queue->lock);
+        free(queue->item);
+        free(queue);
+    }
+    return NULL;
+}
+
+
+/**  Add item to back of queue, blocking while the queue is full
+ *
+ *  @param queue Queue
+ *  @param item Item to add.  Must not be NULL
+ *
+ *  @returns true on success, false if queue has already been closed
+ **/
+bool flappie_queue_push(flappie_queue queue, void * item){
+    assert(NULL != queue);
+    assert(NULL != item);
+
+    pthread_mutex_lock(&queue->lock);
+    while(queue->count == queue->capacity && queue->nproducer > 0){
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+    if(0 == queue->nproducer){
+        pthread_mutex_unlock(&queue->lock);
+        return false;
+    }
+    queue->item[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count += 1;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+
+    return true;
+}
+
+
+/**  Remove item from front of queue, blocking while the queue is empty
+ *
+ *  @param queue Queue
+ *
+ *  @returns Item or NULL if queue is empty and all producers have finished
+ **/
+void * flappie_queue_pop(flappie_queue queue){
+    assert(NULL != queue);
+
+    pthread_mutex_lock(&queue->lock);
+    while(0 == queue->count && queue->nproducer > 0){
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+    void * item = NULL;
+    if(queue->count > 0){
+        item = queue->item[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count -= 1;
+        pthread_cond_signal(&queue->not_full);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return item;
+}
+
+
+/**  Remove up to nmax items from front of queue
+ *
+ *  Blocks until at least one item is available then takes as many as are
+ *  queued, up to nmax, without waiting for more.  Batches are therefore
+ *  refilled continuously as items arrive rather than waiting to be full.
+ *
+ *  @param queue Queue
+ *  @param item [out] Array of length nmax to receive items
+ *  @param nmax Maximum number of items to remove
+ *
+ *  @returns Number of items removed, zero if queue is empty and all
+ *  producers have finished
+ **/
+size_t flappie_queue_pop_batch(flappie_queue queue, void ** item, size_t nmax){
+    assert(NULL != queue);
+    assert(NULL != item);
+
+    pthread_mutex_lock(&queue->lock);
+    while(0 == queue->count && queue->nproducer > 0){
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+    size_t n = 0;
+    for( ; n < nmax && queue->count > 0 ; n++){
+        item[n] = queue->item[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count -= 1;
+    }
+    if(n > 0){
+        pthread_cond_broadcast(&queue->not_full);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return n;
+}
+
+
+/**  Signal that one producer has finished adding items
+ *
+ *  When the last producer closes the queue, all waiting consumers are woken.
+ *
+ *  @param queue Queue
+ **/
+void flappie_queue_close(flappie_queue queue){
+    assert(NULL != queue);
+
+    pthread_mutex_lock(&queue->lock);
+    assert(queue->nproducer > 0);
+    queue->nproducer -= 1;
+    if(0 == queue->nproducer){
+        pthread_cond_broadcast(&queue->not_empty);
+        pthread_cond_broadcast(&queue->not_full);
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
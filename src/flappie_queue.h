@@ -0,0 +1,33 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#pragma once
+#ifndef FLAPPIE_QUEUE_H
+#    define FLAPPIE_QUEUE_H
+
+#    include <stdbool.h>
+#    include <stddef.h>
+
+/**  Bounded blocking FIFO for handing work between threads
+ *
+ *   Producers block while the queue is full, so a slow consumer throttles
+ *   the stages feeding it.  Each producer calls flappie_queue_close when it
+ *   has finished; once all have done so, consumers drain the remaining items
+ *   and then receive NULL.
+ **/
+typedef struct _flappie_queue *flappie_queue;
+
+flappie_queue make_flappie_queue(size_t capacity, size_t nproducer);
+flappie_queue free_flappie_queue(flappie_queue queue);
+
+bool flappie_queue_push(flappie_queue queue, void * item);
+void * flappie_queue_pop(flappie_queue queue);
+size_t flappie_queue_pop_batch(flappie_queue queue, void ** item, size_t nmax);
+void flappie_queue_close(flappie_queue queue);
+
+#endif /* FLAPPIE_QUEUE_H */
@@ -0,0 +1,217 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#include <math.h>
+
+#include "decode.h"
+#include "flappie_profile.h"
+#include "flappie_readuntil.h"
+#include "flappie_stdlib.h"
+#include "layers.h"
+#include "networks.h"
+#include "util.h"
+
+//  Fewer samples than this after trimming are not called
+static const size_t min_prefix_nsample = 100;
+
+struct _flappie_prefix_classifier {
+    float temperature;
+    size_t trim_start;
+    size_t prefix_length;
+    size_t nbase;
+    //  Trimmed and normalised signal, and scratch to find its median and MAD
+    float * signal;
+    float * scratch;
+    flappie_network_workspace network;
+    flappie_imatrix tb;
+    int * path;
+    float * qpath;
+    int * path_idx;
+    char * bases;
+};
+
+
+/**  Make classifier calling the first samples of reads
+ *
+ *  @param options Model, temperature and samples trimmed from start of read
+ *  @param prefix_length Number of samples called, including those trimmed
+ *
+ *  @returns Classifier or NULL on failure
+ **/
+flappie_prefix_classifier make_flappie_prefix_classifier(struct flappie_caller_options options, size_t prefix_length){
+    RETURN_NULL_IF(options.model >= flappie_nmodel, NULL);
+    RETURN_NULL_IF(prefix_length < options.trim_start + min_prefix_nsample, NULL);
+
+    const size_t max_nsample = prefix_length - options.trim_start;
+    const size_t max_nblock = iceil(max_nsample, get_model_stride(options.model));
+    flappie_prefix_classifier pc = calloc(1, sizeof(*pc));
+    RETURN_NULL_IF(NULL == pc, NULL);
+    pc->temperature = options.temperature;
+    pc->trim_start = options.trim_start;
+    pc->prefix_length = prefix_length;
+    pc->signal = calloc(max_nsample, sizeof(float));
+    pc->scratch = calloc(max_nsample, sizeof(float));
+    pc->network = make_flappie_network_workspace(options.model, options.precision, max_nsample);
+    pc->path = calloc(max_nblock + 1, sizeof(int));
+    pc->qpath = calloc(max_nblock + 1, sizeof(float));
+    pc->path_idx = calloc(max_nblock + 1, sizeof(int));
+    pc->bases = calloc(max_nblock + 1, sizeof(char));
+    if(NULL == pc->signal || NULL == pc->scratch || NULL == pc->network || NULL == pc->path
+       || NULL == pc->qpath || NULL == pc->path_idx || NULL == pc->bases){
+        return free_flappie_prefix_classifier(pc);
+    }
+
+    //  Run network once on a full length of silence, touching every page of the
+    //  workspace before the first call and finding the number of bases of the model
+    const raw_table rt = {.n = max_nsample, .start = 0, .end = max_nsample, .raw = pc->signal};
+    const_flappie_matrix trans = flipflop_transitions_workspace(rt, pc->temperature, pc->network);
+    pc->nbase = (NULL != trans) ? nbase_from_flipflop_nparam(trans->nr) : 0;
+    pc->tb = (pc->nbase > 0) ? make_flappie_imatrix(pc->nbase + pc->nbase, max_nblock) : NULL;
+    if(NULL == pc->tb){
+        return free_flappie_prefix_classifier(pc);
+    }
+
+    return pc;
+}
+
+
+flappie_prefix_classifier free_flappie_prefix_classifier(flappie_prefix_classifier pc){
+    if(NULL != pc){
+        pc->tb = free_flappie_imatrix(pc->tb);
+        pc->network = free_flappie_network_workspace(pc->network);
+        free(pc->bases);
+        free(pc->path_idx);
+        free(pc->qpath);
+        free(pc->path);
+        free(pc->scratch);
+        free(pc->signal);
+        free(pc);
+    }
+    return NULL;
+}
+
+
+//  Rearrange array so x[k] is its k-th smallest element, with no smaller elements after it
+static void select_inplace(float * x, size_t n, size_t k){
+    size_t lo = 0;
+    size_t hi = n - 1;
+    while(lo < hi){
+        const float pivot = x[lo + (hi - lo) / 2];
+        size_t i = lo;
+        size_t j = hi;
+        while(i <= j){
+            while(x[i] < pivot){
+                i++;
+            }
+            while(x[j] > pivot){
+                j--;
+            }
+            if(i <= j){
+                const float tmp = x[i];
+                x[i] = x[j];
+                x[j] = tmp;
+                i++;
+                if(0 == j){
+                    break;
+                }
+                j--;
+            }
+        }
+        if(k <= j){
+            hi = j;
+        } else if(k >= i){
+            lo = i;
+        } else {
+            break;
+        }
+    }
+}
+
+
+//  Median of array, as medianf but rearranging the array rather than allocating
+static float median_inplace(float * x, size_t n){
+    const size_t idx = (n - 1) / 2;
+    select_inplace(x, n, idx);
+    if(1 == n % 2){
+        return x[idx];
+    }
+    const float upper = valminf(x + idx + 1, n - idx - 1);
+    return 0.5f * x[idx] + 0.5f * upper;
+}
+
+
+//  Median / MAD normalisation of array, as medmad_normalise_array
+static void medmad_normalise_scratch(float * x, size_t n, float * scratch){
+    const float mad_scaling_factor = 1.4826;
+    memcpy(scratch, x, n * sizeof(float));
+    const float med = median_inplace(scratch, n);
+    for(size_t i=0 ; i < n ; i++){
+        scratch[i] = fabsf(x[i] - med);
+    }
+    float mad = median_inplace(scratch, n) * mad_scaling_factor;
+    if(!isfinite(mad) || mad <= 0.0f){
+        mad = 1.0f;
+    }
+    for(size_t i=0 ; i < n ; i++){
+        x[i] = (x[i] - med) / mad;
+    }
+}
+
+
+/**  Call the first samples of a read
+ *
+ *   The first prefix_length samples of the signal are trimmed, normalised
+ *   by their median and MAD, run through the network and decoded, without
+ *   allocating memory.  The path is decoded from the transitions of the
+ *   network directly rather than their posterior, since that is the single
+ *   most expensive step of a full call.
+ *
+ *  @param pc Classifier
+ *  @param signal Raw signal of read so far, untrimmed
+ *  @param nsample Length of signal.  Samples beyond the prefix are ignored.
+ *  @param res [out] Call of prefix
+ *
+ *  @returns true on success, false if the read is too short to call
+ **/
+bool flappie_call_prefix(flappie_prefix_classifier pc, const float * signal, size_t nsample,
+                         struct flappie_prefix_call * res){
+    RETURN_NULL_IF(NULL == pc, false);
+    RETURN_NULL_IF(NULL == signal, false);
+    RETURN_NULL_IF(NULL == res, false);
+    const double start = flappie_profile_clock();
+
+    nsample = (nsample < pc->prefix_length) ? nsample : pc->prefix_length;
+    if(nsample < pc->trim_start + min_prefix_nsample){
+        return false;
+    }
+    const size_t ntrimmed = nsample - pc->trim_start;
+    memcpy(pc->signal, signal + pc->trim_start, ntrimmed * sizeof(float));
+    medmad_normalise_scratch(pc->signal, ntrimmed, pc->scratch);
+
+    const raw_table rt = {.n = ntrimmed, .start = 0, .end = ntrimmed, .raw = pc->signal};
+    const_flappie_matrix trans = flipflop_transitions_workspace(rt, pc->temperature, pc->network);
+    RETURN_NULL_IF(NULL == trans, false);
+    const size_t nblock = trans->nc;
+    const float score = decode_crf_flipflop_tb(trans, false, pc->tb, pc->path, pc->qpath);
+    RETURN_NULL_IF(!isfinite(score), false);
+
+    const size_t nbase = change_positions(pc->path, nblock, pc->path_idx);
+    for(size_t i=0 ; i < nbase ; i++){
+        pc->bases[i] = base_lookup[pc->path[pc->path_idx[i]] % pc->nbase];
+    }
+    pc->bases[nbase] = '\0';
+
+    //  Transitions are globally normalised, so the score is the log-probability of the path
+    *res = (struct flappie_prefix_call){
+        .bases = pc->bases,
+        .nbase = nbase,
+        .nsample = nsample,
+        .confidence = expf(score / nblock),
+        .seconds = flappie_profile_clock() - start};
+    return true;
+}
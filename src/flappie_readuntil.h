@@ -0,0 +1,51 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#pragma once
+#ifndef FLAPPIE_READUNTIL_H
+#    define FLAPPIE_READUNTIL_H
+
+#    include <stdbool.h>
+#    include <stddef.h>
+
+#    include "flappie_caller.h"
+
+/**  Call of the start of a read
+ *
+ *   Bases are owned by the classifier and valid until its next call.
+ **/
+struct flappie_prefix_call {
+    const char * bases;
+    size_t nbase;
+    //  Samples of read called, including those trimmed
+    size_t nsample;
+    //  Geometric mean over blocks of the probability of the called path, 0 to 1
+    float confidence;
+    //  Time taken by call
+    double seconds;
+};
+
+/**  Basecaller for the first samples of reads, for read until
+ *
+ *   Calls the prefix of a read with the flip-flop network of the caller and
+ *   the Viterbi decoder, so a tool can decide whether to eject a molecule
+ *   while it is still being sequenced.  All memory is allocated when the
+ *   classifier is made and the work of a call is bounded by the prefix
+ *   length, so the latency of a call does not depend on the read.
+ *
+ *   A classifier keeps no state between calls, so one per thread can serve
+ *   any number of channels.
+ **/
+typedef struct _flappie_prefix_classifier *flappie_prefix_classifier;
+
+flappie_prefix_classifier make_flappie_prefix_classifier(struct flappie_caller_options options, size_t prefix_length);
+flappie_prefix_classifier free_flappie_prefix_classifier(flappie_prefix_classifier pc);
+bool flappie_call_prefix(flappie_prefix_classifier pc, const float * signal, size_t nsample,
+                         struct flappie_prefix_call * res);
+
+#endif /* FLAPPIE_READUNTIL_H */
@@ -0,0 +1,256 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+//  nanosleep is not part of C99
+#define _POSIX_C_SOURCE 200112L
+
+#include <dirent.h>
+#include <glob.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fast5_interface.h"
+#include "flappie_stdlib.h"
+#include "flappie_structures.h"
+#include "version.h"
+
+#if !defined(FLAPPIE_VERSION)
+#    define FLAPPIE_VERSION "unknown"
+#endif
+const char *argp_program_version = "flappie_replay " FLAPPIE_VERSION;
+const char *argp_program_bug_address = "<tim.massingham@nanoporetech.com>";
+
+// Doesn't play nice with other headers, include last
+#include <argp.h>
+
+
+extern const char *argp_program_version;
+extern const char *argp_program_bug_address;
+static char doc[] = "Flappie replay -- stream signal of reads as if from a sequencer, for flappie --stream";
+static char args_doc[] = "fast5 [fast5 ...]";
+static struct argp_option options[] = {
+    {"channels", 'c', "nchannel", 0, "Number of channels sequencing at once"},
+    {"block", 'b', "nsample", 0, "Samples sent per channel in each message"},
+    {"rate", 'r', "nsample", 0, "Samples per second per channel, as a sequencer (0 sends as fast as possible)"},
+    {"output", 'o', "filename", 0, "Write to file or FIFO rather than stdout"},
+    {"listen", 'L', "socket", 0, "Wait for flappie --stream to connect to Unix domain socket and write to it"},
+    {0}
+};
+
+
+struct arguments {
+    size_t nchannel;
+    size_t block;
+    size_t rate;
+    char * output;
+    char * listen;
+    char ** files;
+};
+
+static struct arguments args = {
+    .nchannel = 8,
+    .block = 400,
+    .rate = 0,
+    .output = NULL,
+    .listen = NULL,
+    .files = NULL
+};
+
+
+static error_t parse_arg(int key, char * arg, struct  argp_state * state){
+    switch(key){
+    case 'c':
+        args.nchannel = atoi(arg);
+        assert(args.nchannel > 0);
+        break;
+    case 'b':
+        args.block = atoi(arg);
+        assert(args.block > 0);
+        break;
+    case 'r':
+        args.rate = atoi(arg);
+        break;
+    case 'o':
+        args.output = arg;
+        break;
+    case 'L':
+        args.listen = arg;
+        break;
+    case ARGP_KEY_NO_ARGS:
+        argp_usage (state);
+        break;
+
+    case ARGP_KEY_ARG:
+        args.files = &state->argv[state->next - 1];
+        state->next = state->argc;
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+
+static struct argp argp = {options, parse_arg, args_doc, doc};
+
+
+/**  Reads of every fast5 file on the command line, in turn
+ **/
+struct read_source {
+    size_t file;
+    glob_t globbuf;
+    size_t path;
+    fast5_reader reader;
+};
+
+
+//  Expand next argument into list of fast5 files
+static bool glob_next_file(struct read_source * source){
+    while(NULL != args.files[source->file]){
+        const char * name = args.files[source->file++];
+        const size_t rootlen = strlen(name);
+        char * globpath = calloc(rootlen + 9, sizeof(char));
+        RETURN_NULL_IF(NULL == globpath, false);
+        memcpy(globpath, name, rootlen * sizeof(char));
+        DIR * dirp = opendir(name);
+        if(NULL != dirp){
+            memcpy(globpath + rootlen, "/*.fast5", 8 * sizeof(char));
+            closedir(dirp);
+        }
+        const int globret = glob(globpath, 0, NULL, &source->globbuf);
+        free(globpath);
+        if(0 == globret){
+            source->path = 0;
+            return true;
+        }
+        warnx("File or directory \"%s\" does not exist or no fast5 files found.", name);
+        globfree(&source->globbuf);
+    }
+    return false;
+}
+
+
+static bool next_read(struct read_source * source, raw_table * rt){
+    for(;;){
+        if(NULL != source->reader && fast5_reader_next(source->reader, true, rt)){
+            return true;
+        }
+        source->reader = close_fast5_reader(source->reader);
+        if(source->path >= source->globbuf.gl_pathc){
+            if(source->path > 0){
+                globfree(&source->globbuf);
+                source->globbuf = (glob_t){0};
+                source->path = 0;
+            }
+            if(!glob_next_file(source)){
+                return false;
+            }
+        }
+        const char * filename = source->globbuf.gl_pathv[source->path++];
+        source->reader = open_fast5_reader(filename);
+        if(NULL == source->reader){
+            warnx("Failed to open \"%s\".", filename);
+        }
+    }
+}
+
+
+static FILE * open_output(void){
+    if(NULL == args.listen){
+        return (NULL != args.output) ? fopen(args.output, "w") : stdout;
+    }
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    const size_t pathlen = strlen(args.listen);
+    if(pathlen >= sizeof(addr.sun_path)){
+        errx(EXIT_FAILURE, "Name of socket \"%s\" is too long.", args.listen);
+    }
+    memcpy(addr.sun_path, args.listen, pathlen * sizeof(char));
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || 0 != bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || 0 != listen(fd, 1)){
+        err(EXIT_FAILURE, "Failed to listen on socket \"%s\"", args.listen);
+    }
+    const int conn = accept(fd, NULL, NULL);
+    close(fd);
+    unlink(args.listen);
+    if(conn < 0){
+        err(EXIT_FAILURE, "Failed to accept connection");
+    }
+    return fdopen(conn, "w");
+}
+
+
+struct channel {
+    raw_table rt;
+    size_t sent;
+};
+
+
+int main(int argc, char * argv[]){
+    argp_parse(&argp, argc, argv, 0, 0, NULL);
+    FILE * out = open_output();
+    if(NULL == out){
+        err(EXIT_FAILURE, "Failed to open output");
+    }
+    struct channel * channel = calloc(args.nchannel, sizeof(struct channel));
+    if(NULL == channel){
+        errx(EXIT_FAILURE, "Failed to allocate %zu channels.", args.nchannel);
+    }
+    const double block_time = (args.rate > 0) ? ((double)args.block / args.rate) : 0.0;
+    const struct timespec pause = {(time_t)block_time, (long)(1e9 * (block_time - (time_t)block_time))};
+
+    struct read_source source = {0};
+    bool more = true;
+    size_t nread = 0;
+    for(;;){
+        size_t nactive = 0;
+        for(size_t c=0 ; c < args.nchannel ; c++){
+            struct channel * ch = channel + c;
+            if(NULL == ch->rt.raw && more){
+                more = next_read(&source, &ch->rt);
+                ch->sent = 0;
+                nread += more ? 1 : 0;
+            }
+            if(NULL == ch->rt.raw){
+                continue;
+            }
+            nactive += 1;
+
+            const size_t remaining = ch->rt.n - ch->sent;
+            const size_t n = (remaining < args.block) ? remaining : args.block;
+            fprintf(out, "signal %zu %s %zu\n", c, (NULL != ch->rt.uuid) ? ch->rt.uuid : "unknown", n);
+            fwrite(ch->rt.raw + ch->sent, sizeof(float), n, out);
+            ch->sent += n;
+            if(ch->sent == ch->rt.n){
+                fprintf(out, "end %zu\n", c);
+                free_raw_table(&ch->rt);
+                ch->rt = (raw_table){0};
+            }
+        }
+        if(0 == nactive){
+            break;
+        }
+        if(0 != fflush(out)){
+            errx(EXIT_FAILURE, "Failed to write signal, has reader gone?");
+        }
+        if(args.rate > 0){
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    warnx("Replayed %zu reads over %zu channels.", nread, args.nchannel);
+    free(channel);
+    if(stdout != out){
+        fclose(out);
+    }
+    return EXIT_SUCCESS;
+}
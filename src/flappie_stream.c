@@ -0,0 +1,424 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#include <math.h>
+
+#include "decode.h"
+#include "flappie_stream.h"
+#include "flappie_stdlib.h"
+#include "layers.h"
+#include "networks.h"
+#include "util.h"
+
+/**  Read in progress on a channel
+ *
+ *   Positions are in samples of the read after trimming its start.  Signal
+ *   is kept from the context of the next window onwards.
+ **/
+struct stream_channel {
+    //  NULL if channel has no read
+    char * read_id;
+    bool ending;
+    //  Samples received, including those trimmed
+    size_t nsample;
+    float * signal;
+    size_t signal_start;
+    size_t nsignal;
+    size_t capacity;
+    //  Samples whose transitions have been decoded
+    size_t ncalled;
+    //  Most recent samples, for normalisation
+    float * history;
+    size_t nhistory;
+    size_t history_pos;
+    flipflop_fixed_lag decoder;
+};
+
+struct _flappie_stream {
+    const_flappie_caller caller;
+    struct flappie_stream_options options;
+    size_t stride;
+    size_t trim_start;
+    flappie_stream_callback callback;
+    void * data;
+    struct stream_channel * channel;
+    size_t nchannel;
+    //  Workspace for bases committed by a window
+    char * bases;
+};
+
+
+/**  Settings balancing latency against accuracy for R9.4.1 at 4kHz
+ *
+ *   Bases are committed within about 1.3 seconds of their signal.
+ **/
+struct flappie_stream_options default_flappie_stream_options(void){
+    return (struct flappie_stream_options){
+        .step = 2000,
+        .lookahead = 1000,
+        .context = 1000,
+        .lag = 50,
+        .norm_window = 8000};
+}
+
+
+static size_t round_to_stride(size_t n, size_t stride){
+    return stride * ((n + stride - 1) / stride);
+}
+
+
+/**  Create streaming basecaller
+ *
+ *  @param caller Caller of a flip-flop model, whose trim_start is applied to
+ *  each read.  Must outlive the stream.
+ *  @param options Settings.  Lengths are rounded up to the stride of the model.
+ *  @param callback Receives bases as they are committed
+ *  @param data Passed to callback
+ *
+ *  @returns Stream or NULL on failure
+ **/
+flappie_stream make_flappie_stream(const_flappie_caller caller, struct flappie_stream_options options,
+                                   flappie_stream_callback callback, void * data){
+    RETURN_NULL_IF(NULL == caller, NULL);
+    RETURN_NULL_IF(NULL == callback, NULL);
+    RETURN_NULL_IF(0 == options.step, NULL);
+    RETURN_NULL_IF(0 == options.norm_window, NULL);
+
+    const struct flappie_caller_options caller_options = flappie_caller_get_options(caller);
+    const size_t stride = get_model_stride(caller_options.model);
+    options.step = round_to_stride(options.step, stride);
+    options.lookahead = round_to_stride(options.lookahead, stride);
+    options.context = round_to_stride(options.context, stride);
+
+    flappie_stream stream = calloc(1, sizeof(*stream));
+    RETURN_NULL_IF(NULL == stream, NULL);
+    //  Last window of a read may be a full step and lookahead long
+    stream->bases = calloc((options.step + options.lookahead) / stride + options.lag + 2, sizeof(char));
+    if(NULL == stream->bases){
+        free(stream);
+        return NULL;
+    }
+    stream->caller = caller;
+    stream->options = options;
+    stream->stride = stride;
+    stream->trim_start = caller_options.trim_start;
+    stream->callback = callback;
+    stream->data = data;
+
+    return stream;
+}
+
+
+flappie_stream free_flappie_stream(flappie_stream stream){
+    if(NULL != stream){
+        for(size_t i=0 ; i < stream->nchannel ; i++){
+            struct stream_channel * ch = stream->channel + i;
+            ch->decoder = free_flipflop_fixed_lag(ch->decoder);
+            free(ch->history);
+            free(ch->signal);
+            free(ch->read_id);
+        }
+        free(stream->channel);
+        free(stream->bases);
+        free(stream);
+    }
+    return NULL;
+}
+
+
+/**  Longest time between receiving a sample and committing its bases
+ *
+ *   A step of signal is called once the lookahead following it has arrived
+ *   and its bases are committed once decoding has moved lag blocks on, which
+ *   happens a whole step at a time.  Time spent calling is not included.
+ *
+ *  @param stream Stream
+ *
+ *  @returns Latency in samples
+ **/
+size_t flappie_stream_max_latency(const_flappie_stream stream){
+    RETURN_NULL_IF(NULL == stream, 0);
+    const struct flappie_stream_options * opt = &stream->options;
+    const size_t lag_samples = opt->lag * stream->stride;
+    const size_t lag_steps = (lag_samples + opt->step - 1) / opt->step;
+    return opt->lookahead + opt->step * (1 + lag_steps);
+}
+
+
+static void reset_channel(struct stream_channel * ch){
+    free(ch->read_id);
+    ch->read_id = NULL;
+    ch->ending = false;
+    ch->nsample = 0;
+    ch->signal_start = 0;
+    ch->nsignal = 0;
+    ch->ncalled = 0;
+    ch->nhistory = 0;
+    ch->history_pos = 0;
+}
+
+
+static bool append_signal(const_flappie_stream stream, struct stream_channel * ch, const float * signal, size_t n){
+    if(NULL == ch->history){
+        ch->history = calloc(stream->options.norm_window, sizeof(float));
+        RETURN_NULL_IF(NULL == ch->history, false);
+    }
+    if(ch->nsignal + n > ch->capacity){
+        const size_t capacity = 2 * (ch->nsignal + n);
+        float * tmp = realloc(ch->signal, capacity * sizeof(float));
+        RETURN_NULL_IF(NULL == tmp, false);
+        ch->signal = tmp;
+        ch->capacity = capacity;
+    }
+
+    for(size_t i=0 ; i < n ; i++){
+        ch->nsample += 1;
+        if(ch->nsample <= stream->trim_start){
+            continue;
+        }
+        ch->signal[ch->nsignal++] = signal[i];
+        ch->history[ch->history_pos] = signal[i];
+        ch->history_pos = (ch->history_pos + 1) % stream->options.norm_window;
+        if(ch->nhistory < stream->options.norm_window){
+            ch->nhistory += 1;
+        }
+    }
+    return true;
+}
+
+
+static bool window_is_ready(const_flappie_stream stream, const struct stream_channel * ch){
+    if(NULL == ch->read_id){
+        return false;
+    }
+    const size_t nreceived = ch->signal_start + ch->nsignal;
+    return ch->ending || nreceived >= ch->ncalled + stream->options.step + stream->options.lookahead;
+}
+
+
+//  Range of samples run through network and range whose transitions are decoded
+struct stream_window {
+    size_t start;
+    size_t call_start;
+    size_t call_end;
+    size_t end;
+    //  Whether window finishes read
+    bool last;
+};
+
+
+static struct stream_window next_window(const_flappie_stream stream, const struct stream_channel * ch){
+    const struct flappie_stream_options * opt = &stream->options;
+    const size_t nreceived = ch->signal_start + ch->nsignal;
+    const bool last = ch->ending && nreceived <= ch->ncalled + opt->step + opt->lookahead;
+    struct stream_window win = {
+        .start = ch->signal_start,
+        .call_start = ch->ncalled,
+        .call_end = last ? nreceived : ch->ncalled + opt->step,
+        .end = last ? nreceived : ch->ncalled + opt->step + opt->lookahead,
+        .last = last};
+    assert(win.start + opt->context >= win.call_start);
+    assert(win.end <= nreceived);
+    return win;
+}
+
+
+//  Window of signal normalised by running median and MAD, NULL raw if empty
+static raw_table normalised_window(const struct stream_channel * ch, struct stream_window win){
+    const size_t n = win.end - win.start;
+    if(0 == n || 0 == ch->nhistory){
+        return (raw_table){0};
+    }
+    float * raw = calloc(n, sizeof(float));
+    RETURN_NULL_IF(NULL == raw, (raw_table){0});
+
+    const float med = medianf(ch->history, ch->nhistory);
+    float mad = madf(ch->history, ch->nhistory, &med);
+    if(!isfinite(mad) || mad <= 0.0f){
+        mad = 1.0f;
+    }
+    const float * signal = ch->signal + (win.start - ch->signal_start);
+    for(size_t i=0 ; i < n ; i++){
+        raw[i] = (signal[i] - med) / mad;
+    }
+    return (raw_table){NULL, n, 0, n, raw};
+}
+
+
+//  Decode transitions of window, pass bases to callback and move channel on
+static void finish_window(flappie_stream stream, size_t c, struct stream_window win, const_flappie_matrix trans){
+    struct stream_channel * ch = stream->channel + c;
+    size_t nbase = 0;
+    if(NULL != trans){
+        if(NULL == ch->decoder){
+            ch->decoder = make_flipflop_fixed_lag(nbase_from_flipflop_nparam(trans->nr), stream->options.lag);
+        }
+        const size_t first = (win.call_start - win.start) / stream->stride;
+        size_t nblock = (win.call_end - win.call_start + stream->stride - 1) / stream->stride;
+        nblock = (first + nblock <= trans->nc) ? nblock : (trans->nc - first);
+        const int nb = flipflop_fixed_lag_push(ch->decoder, trans, first, nblock, stream->bases);
+        nbase = (nb > 0) ? nb : 0;
+    }
+    ch->ncalled = win.call_end;
+
+    if(win.last){
+        if(NULL != ch->decoder){
+            nbase += flipflop_fixed_lag_finish(ch->decoder, stream->bases + nbase);
+        }
+        stream->callback(c, ch->read_id, stream->bases, nbase, ch->nsample, true, stream->data);
+        reset_channel(ch);
+        return;
+    }
+    if(nbase > 0){
+        stream->callback(c, ch->read_id, stream->bases, nbase, ch->nsample, false, stream->data);
+    }
+
+    //  Keep only the context of the next window
+    const size_t keep_from = (ch->ncalled > stream->options.context) ? (ch->ncalled - stream->options.context) : 0;
+    if(keep_from > ch->signal_start){
+        const size_t ndrop = keep_from - ch->signal_start;
+        memmove(ch->signal, ch->signal + ndrop, (ch->nsignal - ndrop) * sizeof(float));
+        ch->nsignal -= ndrop;
+        ch->signal_start = keep_from;
+    }
+}
+
+
+/**  Add signal of read on channel
+ *
+ *  @param stream Stream
+ *  @param channel Channel
+ *  @param read_id Id of read.  If different from the read on the channel,
+ *  that read is finished first.
+ *  @param signal Signal in picoamps
+ *  @param n Number of samples
+ *
+ *  @returns true on success
+ **/
+bool flappie_stream_push(flappie_stream stream, size_t channel, const char * read_id, const float * signal,
+                         size_t n){
+    RETURN_NULL_IF(NULL == stream, false);
+    RETURN_NULL_IF(NULL == read_id, false);
+    RETURN_NULL_IF(n > 0 && NULL == signal, false);
+
+    if(channel >= stream->nchannel){
+        const size_t nchannel = channel + 1;
+        struct stream_channel * tmp = realloc(stream->channel, nchannel * sizeof(struct stream_channel));
+        RETURN_NULL_IF(NULL == tmp, false);
+        memset(tmp + stream->nchannel, 0, (nchannel - stream->nchannel) * sizeof(struct stream_channel));
+        stream->channel = tmp;
+        stream->nchannel = nchannel;
+    }
+
+    struct stream_channel * ch = stream->channel + channel;
+    if(NULL != ch->read_id && 0 != strcmp(ch->read_id, read_id)){
+        flappie_stream_end(stream, channel);
+        flappie_stream_process(stream);
+    }
+    if(NULL == ch->read_id){
+        const size_t idlen = strlen(read_id);
+        ch->read_id = calloc(idlen + 1, sizeof(char));
+        RETURN_NULL_IF(NULL == ch->read_id, false);
+        memcpy(ch->read_id, read_id, idlen * sizeof(char));
+    }
+
+    return append_signal(stream, ch, signal, n);
+}
+
+
+/**  Mark read on channel as finished
+ *
+ *   The rest of its signal is called by the next flappie_stream_process.
+ *
+ *  @param stream Stream
+ *  @param channel Channel
+ *
+ *  @returns true if channel had a read
+ **/
+bool flappie_stream_end(flappie_stream stream, size_t channel){
+    RETURN_NULL_IF(NULL == stream, false);
+    if(channel >= stream->nchannel || NULL == stream->channel[channel].read_id){
+        return false;
+    }
+    stream->channel[channel].ending = true;
+    return true;
+}
+
+
+/**  Number of channels with a window of signal ready to call
+ *
+ *  @param stream Stream
+ *
+ *  @returns Number of channels
+ **/
+size_t flappie_stream_nready(const_flappie_stream stream){
+    RETURN_NULL_IF(NULL == stream, 0);
+    size_t nready = 0;
+    for(size_t c=0 ; c < stream->nchannel ; c++){
+        nready += window_is_ready(stream, stream->channel + c) ? 1 : 0;
+    }
+    return nready;
+}
+
+
+/**  Call every window of signal that is ready
+ *
+ *   Windows of all channels are run through the network together, repeating
+ *   while any channel has another window ready.  Bases are passed to the
+ *   callback of the stream.
+ *
+ *  @param stream Stream
+ *
+ *  @returns Number of windows called
+ **/
+size_t flappie_stream_process(flappie_stream stream){
+    RETURN_NULL_IF(NULL == stream, 0);
+    const size_t nchannel = stream->nchannel;
+    size_t * idx = calloc(nchannel, sizeof(size_t));
+    struct stream_window * win = calloc(nchannel, sizeof(struct stream_window));
+    raw_table * rt = calloc(nchannel, sizeof(raw_table));
+    flappie_matrix * trans = calloc(nchannel, sizeof(flappie_matrix));
+    if(NULL == idx || NULL == win || NULL == rt || NULL == trans){
+        free(trans);
+        free(rt);
+        free(win);
+        free(idx);
+        return 0;
+    }
+
+    size_t nwindow = 0;
+    for(;;){
+        size_t nready = 0;
+        for(size_t c=0 ; c < nchannel ; c++){
+            if(!window_is_ready(stream, stream->channel + c)){
+                continue;
+            }
+            idx[nready] = c;
+            win[nready] = next_window(stream, stream->channel + c);
+            rt[nready] = normalised_window(stream->channel + c, win[nready]);
+            nready += 1;
+        }
+        if(0 == nready){
+            break;
+        }
+
+        flappie_caller_transitions(stream->caller, rt, nready, trans);
+        for(size_t i=0 ; i < nready ; i++){
+            finish_window(stream, idx[i], win[i], trans[i]);
+            trans[i] = free_flappie_matrix(trans[i]);
+            free(rt[i].raw);
+        }
+        nwindow += nready;
+    }
+
+    free(trans);
+    free(rt);
+    free(win);
+    free(idx);
+    return nwindow;
+}
@@ -0,0 +1,70 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#pragma once
+#ifndef FLAPPIE_STREAM_H
+#    define FLAPPIE_STREAM_H
+
+#    include <stdbool.h>
+#    include <stddef.h>
+
+#    include "flappie_caller.h"
+
+/**  Settings of streaming basecaller, all in samples except lag
+ *
+ *   The network is run on windows of context + step + lookahead samples and
+ *   the transitions of the step are decoded.  Signal is normalised by the
+ *   median and MAD of the last norm_window samples of the read.
+ **/
+struct flappie_stream_options {
+    size_t step;
+    size_t lookahead;
+    size_t context;
+    //  Blocks decoding lags behind the network
+    size_t lag;
+    size_t norm_window;
+};
+
+/**  Callback receiving bases of a read as they are committed
+ *
+ *  @param channel Channel of read
+ *  @param read_id Id of read
+ *  @param bases Bases committed since last callback for read, not terminated
+ *  @param nbase Number of bases
+ *  @param nsample Samples of read received so far
+ *  @param end Whether the read is finished, the last callback for it
+ *  @param data Passed to make_flappie_stream
+ **/
+typedef void (*flappie_stream_callback)(size_t channel, const char * read_id, const char * bases, size_t nbase,
+                                        size_t nsample, bool end, void * data);
+
+/**  Streaming basecaller for reads still being sequenced
+ *
+ *   Signal arrives in blocks for any number of channels, each channel
+ *   carrying one read at a time.  Windows ready on every channel are run
+ *   through the network as one batch and the bases decoded so far are
+ *   passed to the callback.  A base is committed at most
+ *   flappie_stream_max_latency samples after the signal it was called from.
+ *   A stream belongs to a single thread; its caller may be shared.
+ **/
+typedef struct _flappie_stream *flappie_stream;
+typedef struct _flappie_stream const *const_flappie_stream;
+
+struct flappie_stream_options default_flappie_stream_options(void);
+flappie_stream make_flappie_stream(const_flappie_caller caller, struct flappie_stream_options options,
+                                   flappie_stream_callback callback, void * data);
+flappie_stream free_flappie_stream(flappie_stream stream);
+size_t flappie_stream_max_latency(const_flappie_stream stream);
+
+bool flappie_stream_push(flappie_stream stream, size_t channel, const char * read_id, const float * signal,
+                         size_t n);
+bool flappie_stream_end(flappie_stream stream, size_t channel);
+size_t flappie_stream_nready(const_flappie_stream stream);
+size_t flappie_stream_process(flappie_stream stream);
+
+#endif /* FLAPPIE_STREAM_H */
@@ -0,0 +1,322 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "flappie_numa.h"
+#include "flappie_threadpool.h"
+#include "flappie_stdlib.h"
+
+//  Network layers keep large work arrays on the stack
+static const size_t worker_stack_size = 16 * 1024 * 1024;
+
+/**  Loop submitted to pool
+ *
+ *   Lives on the stack of the submitting thread and is linked into the
+ *   pool's list of jobs while it has iterations waiting to be started.
+ **/
+struct parallel_job {
+    flappie_parallel_fun fun;
+    void * data;
+    size_t n;
+    //  Order in which iterations are started, NULL for 0 ... n - 1
+    const size_t * order;
+    size_t next;
+    size_t ndone;
+    pthread_cond_t done;
+    struct parallel_job * link;
+};
+
+struct threadpool_worker {
+    struct _flappie_threadpool * pool;
+    size_t idx;
+};
+
+struct _flappie_threadpool {
+    pthread_t * thread;
+    struct threadpool_worker * worker;
+    size_t nworker;
+    bool shutdown;
+    struct parallel_job * jobs;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    //  CPUs workers are pinned to and their NUMA node, if any
+    const int * cpu;
+    size_t ncpu;
+    int node;
+};
+
+
+//  Remove job from pool's list.  Pool must be locked.
+static void unlink_parallel_job(flappie_threadpool pool, struct parallel_job * job){
+    for(struct parallel_job ** p = &pool->jobs ; NULL != *p ; p = &(*p)->link){
+        if(job == *p){
+            *p = job->link;
+            return;
+        }
+    }
+}
+
+
+//  Claim next iteration of job.  Pool must be locked.
+static size_t claim_iteration(flappie_threadpool pool, struct parallel_job * job){
+    const size_t i = (NULL != job->order) ? job->order[job->next] : job->next;
+    job->next += 1;
+    if(job->next == job->n){
+        unlink_parallel_job(pool, job);
+    }
+    return i;
+}
+
+
+static void * run_threadpool_worker(void * ptr){
+    struct threadpool_worker * worker = ptr;
+    flappie_threadpool pool = worker->pool;
+    if(pool->ncpu > 0){
+        //  Calling thread is assumed to run on the first CPU
+        const size_t cpu = (worker->idx + 1) % pool->ncpu;
+        flappie_pin_thread(pool->cpu + cpu, 1);
+    }
+    flappie_set_thread_node(pool->node);
+
+    pthread_mutex_lock(&pool->lock);
+    while(!pool->shutdown){
+        struct parallel_job * job = pool->jobs;
+        if(NULL == job){
+            pthread_cond_wait(&pool->work, &pool->lock);
+            continue;
+        }
+        const size_t i = claim_iteration(pool, job);
+        pthread_mutex_unlock(&pool->lock);
+
+        job->fun(i, job->data);
+
+        pthread_mutex_lock(&pool->lock);
+        job->ndone += 1;
+        if(job->ndone == job->n){
+            pthread_cond_signal(&job->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+
+/**  Create pool of threads
+ *
+ *  @param nthread Total number of threads used by a loop, including the caller
+ *
+ *  @returns Pool or NULL on failure
+ **/
+flappie_threadpool make_flappie_threadpool(size_t nthread){
+    return make_flappie_threadpool_pinned(nthread, NULL, 0, -1);
+}
+
+
+/**  Create pool of threads, each pinned to a CPU of a NUMA node
+ *
+ *  Workers are pinned in turn to the CPUs after the first, which is left for
+ *  the calling thread, and wrap around if there are more workers than CPUs.
+ *  Memory workers first write, such as their scratch arrays, is then
+ *  placed on the node.
+ *
+ *  @param nthread Total number of threads used by a loop, including the caller
+ *  @param cpu Array of CPUs to pin workers to, in order.  Not pinned if NULL.
+ *  Must remain valid until the pool is freed.
+ *  @param ncpu Length of cpu
+ *  @param node NUMA node recorded for workers, -1 for none
+ *
+ *  @returns Pool or NULL on failure
+ **/
+flappie_threadpool make_flappie_threadpool_pinned(size_t nthread, const int * cpu, size_t ncpu, int node){
+    flappie_threadpool pool = calloc(1, sizeof(*pool));
+    RETURN_NULL_IF(NULL == pool, NULL);
+    pool->cpu = cpu;
+    pool->ncpu = (NULL != cpu) ? ncpu : 0;
+    pool->node = node;
+
+    const size_t nworker = (nthread > 1) ? (nthread - 1) : 0;
+    if(nworker > 0){
+        pool->thread = calloc(nworker, sizeof(pthread_t));
+        pool->worker = calloc(nworker, sizeof(struct threadpool_worker));
+        if(NULL == pool->thread || NULL == pool->worker){
+            free(pool->worker);
+            free(pool->thread);
+            free(pool);
+            return NULL;
+        }
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, worker_stack_size);
+    for( ; pool->nworker < nworker ; pool->nworker++){
+        pool->worker[pool->nworker] = (struct threadpool_worker){pool, pool->nworker};
+        if(0 != pthread_create(pool->thread + pool->nworker, &attr, run_threadpool_worker, pool->worker + pool->nworker)){
+            warnx("Failed to start worker thread for pool.");
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+
+    return pool;
+}
+
+
+flappie_threadpool free_flappie_threadpool(flappie_threadpool pool){
+    if(NULL != pool){
+        pthread_mutex_lock(&pool->lock);
+        pool->shutdown = true;
+        pthread_cond_broadcast(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+        for(size_t i=0 ; i < pool->nworker ; i++){
+            pthread_join(pool->thread[i], NULL);
+        }
+        pthread_cond_destroy(&pool->work);
+        pthread_mutex_destroy(&pool->lock);
+        free(pool->worker);
+        free(pool->thread);
+        free(pool);
+    }
+    return NULL;
+}
+
+
+static void run_parallel_job(flappie_threadpool pool, struct parallel_job * job){
+    pthread_cond_init(&job->done, NULL);
+
+    pthread_mutex_lock(&pool->lock);
+    job->link = pool->jobs;
+    pool->jobs = job;
+    pthread_cond_broadcast(&pool->work);
+    while(job->next < job->n){
+        const size_t i = claim_iteration(pool, job);
+        pthread_mutex_unlock(&pool->lock);
+
+        job->fun(i, job->data);
+
+        pthread_mutex_lock(&pool->lock);
+        job->ndone += 1;
+    }
+    while(job->ndone < job->n){
+        pthread_cond_wait(&job->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_cond_destroy(&job->done);
+}
+
+
+/**  Number of threads running iterations of a loop, including the caller
+ *
+ *  @param pool Pool of threads, may be NULL
+ *
+ *  @returns Number of threads, 1 if pool is NULL
+ **/
+size_t flappie_threadpool_nthread(const struct _flappie_threadpool * pool){
+    return (NULL != pool) ? (pool->nworker + 1) : 1;
+}
+
+
+/**  Run fun(i, data) for each i in [0, n), returning once all have finished
+ *
+ *  Iterations are started in order but may run concurrently and finish in
+ *  any order, so must not depend on each other.  The calling thread runs
+ *  iterations alongside the workers.
+ *
+ *  @param pool Pool of threads.  Loop is run serially if NULL.
+ *  @param n Number of iterations
+ *  @param fun Function to call for each iteration
+ *  @param data Passed to fun
+ **/
+void flappie_parallel_for(flappie_threadpool pool, size_t n, flappie_parallel_fun fun, void * data){
+    assert(NULL != fun);
+    if(NULL == pool || 0 == pool->nworker || n <= 1){
+        for(size_t i=0 ; i < n ; i++){
+            fun(i, data);
+        }
+        return;
+    }
+
+    struct parallel_job job = {.fun = fun, .data = data, .n = n};
+    run_parallel_job(pool, &job);
+}
+
+
+struct weighted_iteration {
+    size_t weight;
+    size_t idx;
+};
+
+
+static int cmp_weighted_iteration(const void * a, const void * b){
+    const struct weighted_iteration * wa = a;
+    const struct weighted_iteration * wb = b;
+    if(wa->weight != wb->weight){
+        //  Heaviest first
+        return (wa->weight > wb->weight) ? -1 : 1;
+    }
+    return (wa->idx < wb->idx) ? -1 : ((wa->idx > wb->idx) ? 1 : 0);
+}
+
+
+/**  Run loop whose iterations differ greatly in cost, heaviest first
+ *
+ *  Iterations are started in decreasing order of weight and every idle
+ *  thread takes the heaviest iteration not yet started, so nothing is
+ *  assigned to a thread in advance.  This is greedy longest-processing-time
+ *  scheduling: a single long iteration is started first rather than last and
+ *  the loop finishes within one iteration of total work / number of threads.
+ *
+ *  @param pool Pool of threads.  Loop is run serially, heaviest first, if NULL.
+ *  @param n Number of iterations
+ *  @param weight Array of length n with expected cost of each iteration,
+ *  e.g. number of samples in read
+ *  @param fun Function to call for each iteration
+ *  @param data Passed to fun
+ **/
+void flappie_parallel_for_weighted(flappie_threadpool pool, size_t n, const size_t * weight,
+                                   flappie_parallel_fun fun, void * data){
+    assert(NULL != weight);
+    if(n <= 1){
+        flappie_parallel_for(NULL, n, fun, data);
+        return;
+    }
+
+    struct weighted_iteration * witer = calloc(n, sizeof(struct weighted_iteration));
+    size_t * order = calloc(n, sizeof(size_t));
+    if(NULL == witer || NULL == order){
+        //  Still correct, just not in order of weight
+        free(order);
+        free(witer);
+        flappie_parallel_for(pool, n, fun, data);
+        return;
+    }
+    for(size_t i=0 ; i < n ; i++){
+        witer[i] = (struct weighted_iteration){weight[i], i};
+    }
+    qsort(witer, n, sizeof(struct weighted_iteration), cmp_weighted_iteration);
+    for(size_t i=0 ; i < n ; i++){
+        order[i] = witer[i].idx;
+    }
+    free(witer);
+
+    if(NULL == pool || 0 == pool->nworker){
+        for(size_t i=0 ; i < n ; i++){
+            fun(order[i], data);
+        }
+    } else {
+        struct parallel_job job = {.fun = fun, .data = data, .n = n, .order = order};
+        run_parallel_job(pool, &job);
+    }
+    free(order);
+}
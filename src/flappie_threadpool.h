@@ -0,0 +1,35 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#pragma once
+#ifndef FLAPPIE_THREADPOOL_H
+#    define FLAPPIE_THREADPOOL_H
+
+#    include <stddef.h>
+
+/**  Pool of worker threads for running independent iterations of a loop
+ *
+ *   A pool is created once and shared by every layer; it may be used from
+ *   several threads at the same time.  The thread calling
+ *   flappie_parallel_for also runs iterations, so a pool of nthread threads
+ *   has nthread - 1 workers.  A NULL pool runs loops serially.
+ **/
+typedef struct _flappie_threadpool *flappie_threadpool;
+
+typedef void (*flappie_parallel_fun)(size_t i, void * data);
+
+flappie_threadpool make_flappie_threadpool(size_t nthread);
+flappie_threadpool make_flappie_threadpool_pinned(size_t nthread, const int * cpu, size_t ncpu, int node);
+flappie_threadpool free_flappie_threadpool(flappie_threadpool pool);
+size_t flappie_threadpool_nthread(const struct _flappie_threadpool * pool);
+
+void flappie_parallel_for(flappie_threadpool pool, size_t n, flappie_parallel_fun fun, void * data);
+void flappie_parallel_for_weighted(flappie_threadpool pool, size_t n, const size_t * weight,
+                                   flappie_parallel_fun fun, void * data);
+
+#endif /* FLAPPIE_THREADPOOL_H */
@@ -12,7 +12,10 @@
 #    include <cblas.h>
 #endif
 #include <math.h>
+#include <pthread.h>
 #include "layers.h"
+#include "flappie_cpu.h"
+#include "flappie_math.h"
 #include "flappie_stdlib.h"
 #include "util.h"
 
@@ -23,24 +26,14 @@
  **/
 void tanh_activation_inplace(flappie_matrix C) {
     RETURN_NULL_IF(NULL == C, );
-    for (size_t c = 0; c < C->nc; ++c) {
-        const size_t offset = c * C->nrq;
-        for (size_t r = 0; r < C->nrq; ++r) {
-            C->data.v[offset + r] = TANHFV(C->data.v[offset + r]);
-        }
-    }
+    flappie_math_inplace(FLAPPIE_MATH_TANH, C->data.f, C->nc * C->nrq * 4);
     (void)validate_flappie_matrix(C, -1.0, 1.0, 0.0, true, __FILE__, __LINE__);
 }
 
 void tanh_activation_inplace_vec(flappie_matrix_vec C, int nfiles) {
     for (int ii = 0; ii < nfiles; ii++) {
 	    RETURN_NULL_IF(NULL == C, );
-	    for (size_t c = 0; c < C[ii]->nc; ++c) {
-		const size_t offset = c * C[ii]->nrq;
-		for (size_t r = 0; r < C[ii]->nrq; ++r) {
-		    C[ii]->data.v[offset + r] = TANHFV(C[ii]->data.v[offset + r]);
-		}
-	    }
+	    flappie_math_inplace(FLAPPIE_MATH_TANH, C[ii]->data.f, C[ii]->nc * C[ii]->nrq * 4);
 	    (void)validate_flappie_matrix(C[ii], -1.0, 1.0, 0.0, true, __FILE__, __LINE__);
     }	    
 }
@@ -51,12 +44,7 @@ void tanh_activation_inplace_vec(flappie_matrix_vec C, int nfiles) {
  **/
 void exp_activation_inplace(flappie_matrix C) {
     RETURN_NULL_IF(NULL == C, );
-    for (size_t c = 0; c < C->nc; ++c) {
-        const size_t offset = c * C->nrq;
-        for (size_t r = 0; r < C->nrq; ++r) {
-            C->data.v[offset + r] = EXPFV(C->data.v[offset + r]);
-        }
-    }
+    flappie_math_inplace(FLAPPIE_MATH_EXP, C->data.f, C->nc * C->nrq * 4);
     (void)validate_flappie_matrix(C, 0.0, INFINITY, 1.0, true, __FILE__,
                                    __LINE__);
 }
@@ -68,12 +56,7 @@ void exp_activation_inplace(flappie_matrix C) {
  **/
 void log_activation_inplace(flappie_matrix C) {
     RETURN_NULL_IF(NULL == C, );
-    for (size_t c = 0; c < C->nc; ++c) {
-        const size_t offset = c * C->nrq;
-        for (size_t r = 0; r < C->nrq; ++r) {
-            C->data.v[offset + r] = LOGFV(C->data.v[offset + r]);
-        }
-    }
+    flappie_math_inplace(FLAPPIE_MATH_LOG, C->data.f, C->nc * C->nrq * 4);
 }
 
 
@@ -83,12 +66,7 @@ void log_activation_inplace(flappie_matrix C) {
  **/
 void elu_activation_inplace(flappie_matrix C) {
     RETURN_NULL_IF(NULL == C, );
-    for (size_t c = 0; c < C->nc; ++c) {
-        const size_t offset = c * C->nrq;
-        for (size_t r = 0; r < C->nrq; ++r) {
-            C->data.v[offset + r] = ELUFV(C->data.v[offset + r]);
-        }
-    }
+    flappie_math_inplace(FLAPPIE_MATH_ELU, C->data.f, C->nc * C->nrq * 4);
 }
 
 
@@ -112,10 +90,10 @@ void robustlog_activation_inplace(flappie_matrix C, float min_prob) {
     for (size_t i = 0; i < nblock; i++) {
         const size_t offset = i * C->nrq;
         for (size_t r = 0; r < C->nrq; r++) {
-            C->data.v[offset + r] =
-                LOGFV(mpv + mpvm1 * C->data.v[offset + r]);
+            C->data.v[offset + r] = mpv + mpvm1 * C->data.v[offset + r];
         }
     }
+    flappie_math_inplace(FLAPPIE_MATH_LOG, C->data.f, nblock * C->nrq * 4);
 }
 
 
@@ -376,34 +354,36 @@ flappie_matrix convolution(const_flappie_matrix X, const_flappie_matrix W,
 }
 
 // NOTES. vector version of convolution
-flappie_matrix_vec convolution_vec(flappie_matrix_vec X, const_flappie_matrix W,
-                            const_flappie_matrix b, size_t stride, int nfiles) {
-    RETURN_NULL_IF(NULL == X, NULL);
-    assert(NULL != W);
-    assert(NULL != b);
-    assert(W->nc == b->nr);
-    assert(stride > 0);
-    // Window length of filter
-    assert((W->nrq % X[0]->nrq) == 0);
-    const size_t winlen = W->nrq / X[0]->nrq;
-    const size_t nfilter = W->nc;
-    // Padding -- right-hand side is longer when asymmetric padding is required
-    const size_t padL = (winlen - 1) / 2;
-    const size_t padR = winlen / 2;
-    const size_t ncolC = iceil(X[0]->nc, stride);
-    flappie_matrix_vec C = make_flappie_matrix_vec(nfilter, ncolC, nfiles);
-    RETURN_NULL_IF(NULL == C, NULL);
-
-    for(int ii = 0; ii < nfiles; ii++) {
+struct convolution_vec_data {
+    flappie_matrix_vec X;
+    const_flappie_matrix W;
+    const_flappie_matrix b;
+    size_t stride;
+    flappie_matrix_vec C;
+};
+
+
+static void convolution_vec_read(size_t ii, void * ptr){
+	    struct convolution_vec_data * d = ptr;
+	    const_flappie_matrix X = d->X[ii];
+	    const_flappie_matrix W = d->W;
+	    const_flappie_matrix b = d->b;
+	    const size_t stride = d->stride;
+	    flappie_matrix C = d->C[ii];
+	    // Window length of filter
+	    const size_t winlen = W->nrq / X->nrq;
+	    // Padding -- right-hand side is longer when asymmetric padding is required
+	    const size_t padL = (winlen - 1) / 2;
+	    const size_t padR = winlen / 2;
 	    // Matrix strides
-	    const size_t ldC = C[ii]->stride;
+	    const size_t ldC = C->stride;
 	    const size_t ldW = W->stride;
-	    const size_t ldX = X[ii]->stride;
+	    const size_t ldX = X->stride;
 	    const size_t ldFeature = ldX;
 
 	    // Copy bias into result matrix
-	    for (size_t i = 0; i < C[ii]->nc; i++) {
-		memcpy(C[ii]->data.v + i * C[ii]->nrq, b->data.v, C[ii]->nrq * sizeof(__m128));
+	    for (size_t i = 0; i < C->nc; i++) {
+		memcpy(C->data.v + i * C->nrq, b->data.v, C->nrq * sizeof(__m128));
 	    }
 
 	    // Left-hand side edge case where only part of the filter covers the input
@@ -412,7 +392,7 @@ flappie_matrix_vec convolution_vec(flappie_matrix_vec X, const_flappie_matrix W,
 		const size_t ncol = w / stride;
 		cblas_sgemv(CblasColMajor, CblasTrans, W->nr - offsetW, W->nc,
 			    1.0, W->data.f + offsetW, ldW,
-			    X[ii]->data.f, 1, 1.0, C[ii]->data.f + ldC * ncol, 1);
+			    X->data.f, 1, 1.0, C->data.f + ldC * ncol, 1);
 	    }
 
 	    // Number of columns of X already filled * ldC
@@ -435,33 +415,56 @@ flappie_matrix_vec convolution_vec(flappie_matrix_vec X, const_flappie_matrix W,
 		//   - Ncolumns is (X->nc - w) / nstepX + adjustment if a final window fits
 		//  Filter matrix needs to be padded appropriately for the padding of X.
 		//
-		const size_t ncol_processed = ifloor(X[ii]->nc - shiftX_L - w, nstepX);
+		const size_t ncol_processed = ifloor(X->nc - shiftX_L - w, nstepX);
 		const size_t initial_col = ifloor(w, stride);
 		cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans, W->nc,
 			    ncol_processed, W->nr, 1.0, W->data.f, ldW,
-			    X[ii]->data.f + ldX * w + offsetX_L, ldX * nstepX, 1.0,
-			    C[ii]->data.f + ldC * initial_col + offsetC_L, ldC * nstepC);
+			    X->data.f + ldX * w + offsetX_L, ldX * nstepX, 1.0,
+			    C->data.f + ldC * initial_col + offsetC_L, ldC * nstepC);
 	    }
 
 	    // Right-hand side edge case where only part of the filter covers the input
-	    const size_t maxCol_reshape = ifloor(X[ii]->nc - shiftX_L, nstepX);
-	    const size_t remainder_reshape = (X[ii]->nc - shiftX_L) % nstepX;
+	    const size_t maxCol_reshape = ifloor(X->nc - shiftX_L, nstepX);
+	    const size_t remainder_reshape = (X->nc - shiftX_L) % nstepX;
 	    const size_t offsetC_R =
 		offsetC_L + ldC * nstepC * (maxCol_reshape - 1) +
 		ldC * (remainder_reshape / stride) + ldC;
-	    const size_t offsetX_R = (X[ii]->nc - winlen + 1) * ldX;
+	    const size_t offsetX_R = (X->nc - winlen + 1) * ldX;
 	    // How far into padding is first block
-	    const int startR = stride - (padL + X[ii]->nc - winlen) % stride - 1;
+	    const int startR = stride - (padL + X->nc - winlen) % stride - 1;
 	    for (size_t w = startR; w < padR; w += stride) {
 		const size_t offsetW = ldFeature * (w + 1);
 		cblas_sgemv(CblasColMajor, CblasTrans, W->nr - offsetW, W->nc, 1.0,
 			    W->data.f, ldW,
-			    X[ii]->data.f + offsetX_R + ldX * w, 1, 1.0,
-			    C[ii]->data.f + offsetC_R + ldC * (w / stride), 1);
+			    X->data.f + offsetX_R + ldX * w, 1, 1.0,
+			    C->data.f + offsetC_R + ldC * (w / stride), 1);
 	    }
-	    assert(validate_flappie_matrix (C[ii], NAN, NAN, 0.0, true, __FILE__, __LINE__));
+	    assert(validate_flappie_matrix (C, NAN, NAN, 0.0, true, __FILE__, __LINE__));
+}
+
 
-    } // end num_files for loop	    
+flappie_matrix_vec convolution_vec(flappie_matrix_vec X, const_flappie_matrix W,
+                            const_flappie_matrix b, size_t stride, int nfiles,
+                            flappie_threadpool pool) {
+    RETURN_NULL_IF(NULL == X, NULL);
+    assert(NULL != W);
+    assert(NULL != b);
+    assert(W->nc == b->nr);
+    assert(stride > 0);
+    // Window length of filter
+    assert((W->nrq % X[0]->nrq) == 0);
+    const size_t nfilter = W->nc;
+    size_t * ncolC = malloc(nfiles * sizeof(size_t));
+    RETURN_NULL_IF(NULL == ncolC, NULL);
+    for(int ii = 0; ii < nfiles; ii++) {
+        ncolC[ii] = iceil(X[ii]->nc, stride);
+    }
+    flappie_matrix_vec C = make_flappie_matrix_vec_nc(nfilter, ncolC, nfiles);
+    free(ncolC);
+    RETURN_NULL_IF(NULL == C, NULL);
+
+    struct convolution_vec_data data = {X, W, b, stride, C};
+    flappie_parallel_for(pool, nfiles, convolution_vec_read, &data);
     return C;
 }
 
@@ -735,9 +738,7 @@ void gru_step(const_flappie_matrix x, const_flappie_matrix istate,
      */
     cblas_sgemv(CblasColMajor, CblasTrans, sW->nr, sW->nc, 1.0, sW->data.f,
                 sW->stride, istate->data.f, 1, 1.0, xF->data.f, 1);
-    for (size_t i = 0; i < (sizeq +sizeq); i++) {
-        xF->data.v[i] = LOGISTICFV(xF->data.v[i]);
-    }
+    flappie_math_inplace(FLAPPIE_MATH_LOGISTIC, xF->data.f, size + size);
 
     const __m128 *z = xF->data.v;
     __m128 *r = xF->data.v + sizeq;
@@ -747,9 +748,7 @@ void gru_step(const_flappie_matrix x, const_flappie_matrix istate,
     }
     cblas_sgemv(CblasColMajor, CblasTrans, sW2->nr, sW2->nc, 1.0, sW2->data.f,
                 sW2->stride, (float *)r, 1, 1.0, (float *)hbar, 1);
-    for (size_t i = 0; i < sizeq; i++) {
-        hbar[i] = TANHFV(hbar[i]);
-    }
+    flappie_math_inplace(FLAPPIE_MATH_TANH, (float *)hbar, size);
 
     const __m128 ones = _mm_set1_ps(1.0f);
     for (size_t i = 0; i < sizeq ; i++) {
@@ -757,8 +756,146 @@ void gru_step(const_flappie_matrix x, const_flappie_matrix istate,
     }
 }
 
-#    define LOGISTICF fast_logisticf
-#    define TANHF fast_tanhf
+
+/**  Fused step of modified GRU for a batch of lanes
+ *
+ *  The recurrent matrix-vector product, gates and update of the state are
+ *  computed together, reading the weights in place.  Every lane is stepped
+ *  with one block of weights before moving to the next, so the weights are
+ *  streamed from memory once per step however many lanes there are.  Any
+ *  size of layer is supported.  Runs the kernel for the instruction set
+ *  chosen by flappie_kernels.
+ *
+ *  @param x Input projection of step for first lane, z, r and candidate parts each of size
+ *  @param ldx Distance between lanes of x
+ *  @param istate Previous state of first lane, size
+ *  @param ldh Distance between lanes of istate
+ *  @param sW Recurrent weights, size x 3 * size
+ *  @param ostate [out] New state of first lane, size.  Must not overlap istate.
+ *  @param ldo Distance between lanes of ostate
+ *  @param nlane Number of lanes
+ **/
+void grumod_step_fused_batch(const float * x, size_t ldx, const float * istate, size_t ldh,
+                             const_flappie_matrix sW, float * ostate, size_t ldo, size_t nlane){
+    assert(NULL != x);
+    assert(NULL != istate);
+    assert(NULL != sW);
+    assert(NULL != ostate);
+    assert(3 * sW->nr == sW->nc);
+    flappie_kernels()->grumod_step_batch(x, ldx, istate, ldh, sW, ostate, ldo, nlane);
+}
+
+
+/**  Fused step of modified GRU for a batch of lanes, with int8 recurrent weights
+ *
+ *  As grumod_step_fused_batch but the state of each lane is quantised to
+ *  int8 and multiplied by the quantised weights with integer arithmetic.
+ *  The gates are calculated in float.
+ *
+ *  @param x Input projection of step for first lane, z, r and candidate parts each of size
+ *  @param ldx Distance between lanes of x
+ *  @param istate Previous state of first lane, size
+ *  @param ldh Distance between lanes of istate
+ *  @param sW Quantised recurrent weights, size x 3 * size
+ *  @param ostate [out] New state of first lane, size.  Must not overlap istate.
+ *  @param ldo Distance between lanes of ostate
+ *  @param nlane Number of lanes
+ **/
+void grumod_step_fused_batch_int8(const float * x, size_t ldx, const float * istate, size_t ldh,
+                                  const_flappie_qmatrix sW, float * ostate, size_t ldo, size_t nlane){
+    assert(NULL != x);
+    assert(NULL != istate);
+    assert(NULL != sW);
+    assert(NULL != ostate);
+    assert(3 * sW->nr == sW->nc);
+    flappie_kernels()->grumod_step_batch_int8(x, ldx, istate, ldh, sW, ostate, ldo, nlane);
+}
+
+
+/**  Fused step of modified GRU for a batch of lanes, with sixteen bit recurrent weights
+ *
+ *  As grumod_step_fused_batch but the weights are widened to float as they
+ *  are read, halving the memory streamed each step.
+ *
+ *  @param x Input projection of step for first lane, z, r and candidate parts each of size
+ *  @param ldx Distance between lanes of x
+ *  @param istate Previous state of first lane, size
+ *  @param ldh Distance between lanes of istate
+ *  @param sW Recurrent weights as sixteen bit floats, size x 3 * size
+ *  @param ostate [out] New state of first lane, size.  Must not overlap istate.
+ *  @param ldo Distance between lanes of ostate
+ *  @param nlane Number of lanes
+ **/
+void grumod_step_fused_batch_half(const float * x, size_t ldx, const float * istate, size_t ldh,
+                                  const_flappie_hmatrix sW, float * ostate, size_t ldo, size_t nlane){
+    assert(NULL != x);
+    assert(NULL != istate);
+    assert(NULL != sW);
+    assert(NULL != ostate);
+    assert(3 * sW->nr == sW->nc);
+    flappie_kernels()->grumod_step_batch_half(x, ldx, istate, ldh, sW, ostate, ldo, nlane);
+}
+
+
+/**  Affine map of a vector in fixed point, out = narrow(W^t x + b)
+ *
+ *  @param W First column of weights
+ *  @param ld Distance between columns, at least n
+ *  @param ncol Number of columns
+ *  @param x Vector
+ *  @param n Length of columns and x, a multiple of 8 padded with zeros
+ *  @param b Bias at the format of the products, or NULL for none
+ *  @param shift Bits the sums are narrowed by, rounding to nearest.  Not negative.
+ *  @param out [out] Result, saturated, length ncol
+ **/
+void affine_columns_fixed(const fixed_point_t * W, size_t ld, size_t ncol, const fixed_point_t * x,
+                          size_t n, const int32_t * b, int shift, fixed_point_t * out){
+    assert(NULL != W);
+    assert(NULL != x);
+    assert(NULL != out);
+    assert(0 == n % 8);
+    assert(shift >= 0);
+    flappie_kernels()->affine_columns_fixed(W, ld, ncol, x, n, b, shift, out);
+}
+
+
+/**  Fused step of modified GRU for a single lane
+ *
+ *  @param x Input projection of step, z, r and candidate parts each of size
+ *  @param istate Previous state, size
+ *  @param sW Recurrent weights, size x 3 * size
+ *  @param ostate [out] New state, size.  Must not overlap istate.
+ **/
+void grumod_step_fused(const float * x, const float * istate, const_flappie_matrix sW, float * ostate){
+    grumod_step_fused_batch(x, 0, istate, 0, sW, ostate, 0, 1);
+}
+
+/**  Recurrence of modified GRU over a precomputed input projection
+ *
+ *  The first output column (last when backward) is the zero initial state.
+ *  X and ostate may be views onto the valid columns of a padded batch.
+ *
+ *  @param X Input projection, 3 * size x N
+ *  @param sW Recurrent weights, size x 3 * size
+ *  @param ostate [out] Output state, size x N
+ *  @param backward Run recurrence from last column to first
+ **/
+static void aes_grumod_recurrence(const_flappie_matrix X, const_flappie_matrix sW, flappie_matrix ostate, bool backward) {
+    assert(X->nr == sW->nc && ostate->nr == sW->nr);
+    assert(X->nc == ostate->nc);
+    const size_t N = X->nc;
+
+    memset(backward ? ostate->data.f + (N - 1) * ostate->stride : ostate->data.f, 0, ostate->nr * sizeof(float));
+
+    for (size_t i = 1; i < N; i++) {
+	    const size_t index = backward ? (N - i - 1) : i;
+	    float * Bnext = ostate->data.f + index * ostate->stride;
+	    //  B is previous state
+	    const float * B = backward ? (Bnext + ostate->stride) : (Bnext - ostate->stride);
+	    grumod_step_fused(X->data.f + index * X->stride, B, sW, Bnext);
+    }
+}
+
 
 flappie_matrix aes_grumod_linear( const_flappie_matrix X, const_flappie_matrix sW, flappie_matrix ostate, int backward, const_flappie_matrix W, const_flappie_matrix b) {
     RETURN_NULL_IF(NULL == X, NULL);
@@ -773,7 +910,7 @@ flappie_matrix aes_grumod_linear( const_flappie_matrix X, const_flappie_matrix s
     ostate = remake_flappie_matrix(ostate, size, N);
     flappie_matrix xColTmp = make_flappie_matrix(3 * size, 1);
 
-    _Mat xCol, sCol1, sCol2, XnextBuf;
+    _Mat xCol, sCol1, sCol2;
     memset(ostate->data.v, 0, ostate->nrq * sizeof(__m128));
     xCol = *X;
     sCol1 = *ostate;
@@ -797,66 +934,15 @@ flappie_matrix aes_grumod_linear( const_flappie_matrix X, const_flappie_matrix s
         memcpy(Xnext->data.v + c * Xnext->nrq, b->data.v, Xnext->nrq * sizeof(__m128));
     }
 
-    //float *Cin, *Cout, *A, *Bnext;
-    float Cin[768], Cout[768], A[256*768]; 
-    float *Bnext;
-
-    for (int i = 1; i < N; i++) {
-       	size_t index; 
-	// LOAD
-        {
-        	if(backward) {
-	   		index = N - i - 1;
-           		xCol.data.f = X->data.f + index * X->nr;
-           		sCol1.data.f = ostate->data.f + (index + 1) * ostate->nr;
-           		sCol2.data.f = ostate->data.f + index * ostate->nr;
-	}
-		else {
-	  	        index = i;
-           		xCol.data.f = X->data.f + index * X->nr;
-           		sCol1.data.f = ostate->data.f + (index - 1) * ostate->nr;
-           		sCol2.data.f = ostate->data.f + index * ostate->nr;
-		}
-    		//Cin = xCol.data.f; Cout = xColTmp->data.f;  A = sW->data.f; Bnext = sCol2.data.f;
-    		memcpy(Cin, xCol.data.f, 768*sizeof(float)); 
-		memcpy(Cout, xColTmp->data.f, 768*sizeof(float));  
-		memcpy(A, sW->data.f, 256*768*sizeof(float)); 
-		//memcpy(Bnext, sCol2.data.f, 256 * sizeof(float));
-		Bnext = sCol2.data.f; 
-        }
+    for (size_t i = 1; i < N; i++) {
+        const size_t index = backward ? (N - i - 1) : i;
+        float * Bnext = ostate->data.f + index * ostate->stride;
+        //  B is previous state
+        const float * B = backward ? (Bnext + ostate->stride) : (Bnext - ostate->stride);
+        grumod_step_fused(X->data.f + index * X->stride, B, sW, Bnext);
 
-        // COMPUTE
-        { 
-                //flappie_matrix Cin = &xCol; flappie_matrix Cout = xColTmp;  flappie_matrix A = sW; flappie_matrix Bnext = &sCol2;
-                float *B;
-                if(backward) B = Bnext + 256; //B is ostate
-                else B = Bnext - 256;
-        	const size_t size = 256;
-        	memcpy(Cout, Cin, 768 * sizeof(float) );
-        	memset(Cout + size + size, 0, size *sizeof(float));
-
-        	cblas_sgemv(CblasColMajor, CblasTrans, 256, 768, 1.0, A, 256, B, 1, 1.0, Cout, 1);
-
-        	for (size_t i = 0; i < size; i++) {
-                	Cout[i] = LOGISTICF(Cout[i]); 
-                	Cout[size+i] = LOGISTICF(Cout[size+i]); 
-                	Cout[i+size+size] = TANHF(Cout[i+size] * Cout[i+size+size] + Cin[i+size+size]); 
-                	Bnext[i] = (-1) * Cout[i] * Cout[i+size+size] + Cout[i+size+size]; 
-                	Bnext[i] = Cout[i] * B[i] + Bnext[i];
-        	}
-
-                if(backward) {
-       			XnextBuf.data.f = Xnext->data.f + (index+1) * Xnext->nr;
-		}else {
-       			XnextBuf.data.f = Xnext->data.f + (index-1) * Xnext->nr;
-		}
-        	cblas_sgemv(CblasColMajor, CblasTrans, W->nr, W->nc, 1.0, W->data.f, W->stride, B, 1, 1.0, XnextBuf.data.f, 1);
-        	//cblas_sgemv(CblasColMajor, CblasTrans, W->nr, W->nc, 1.0, W->data.f, W->stride, Bnext, 1, 1.0, sCol2.data.f, 1);
-	}
-
-	// STORE
-        {
-	}
+        float * XnextCol = Xnext->data.f + (backward ? (index + 1) : (index - 1)) * Xnext->stride;
+        cblas_sgemv(CblasColMajor, CblasTrans, W->nr, W->nc, 1.0, W->data.f, W->stride, B, 1, 1.0, XnextCol, 1);
     }
     xColTmp = free_flappie_matrix(xColTmp);
     assert(validate_flappie_matrix (ostate, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
@@ -885,232 +971,427 @@ flappie_matrix_vec aes_grumod_vec( flappie_matrix_vec Xin, const_flappie_matrix
     ostate = make_flappie_matrix_vec(size, N, 2);
 
     for (int ii = 0; ii < num_files; ii++) {
-
-	    flappie_matrix xColTmp = make_flappie_matrix(3 * size, 1);
-
-	    _Mat xCol, sCol1, sCol2;
-	    memset(ostate[ii]->data.f, 0, ostate[ii]->nr * sizeof(float));
-	    xCol = *X[ii];
-	    sCol1 = *ostate[ii];
-	    sCol2 = *ostate[ii];
-	    xCol.nc = sCol1.nc = sCol2.nc = 1;
-
-	    float Cin[768], Cout[768], A[256*768]; 
-	    float *Bnext;
-
-	    for (int i = 1; i < N; i++) {
-		size_t index; 
-		// LOAD
-		{
-			if(backward) {
-				index = N - i - 1;
-				xCol.data.f = X[ii]->data.f + index * X[ii]->nr;
-				sCol1.data.f = ostate[ii]->data.f + (index + 1) * ostate[ii]->nr;
-				sCol2.data.f = ostate[ii]->data.f + index * ostate[ii]->nr;
-		}
-			else {
-				index = i;
-				xCol.data.f = X[ii]->data.f + index * X[ii]->nr;
-				sCol1.data.f = ostate[ii]->data.f + (index - 1) * ostate[ii]->nr;
-				sCol2.data.f = ostate[ii]->data.f + index * ostate[ii]->nr;
-			}
-			memcpy(Cin, xCol.data.f, 768*sizeof(float)); 
-			memcpy(Cout, xColTmp->data.f, 768*sizeof(float));  
-			memcpy(A, sW->data.f, 256*768*sizeof(float)); 
-			Bnext = sCol2.data.f; 
-		}
-
-		// COMPUTE
-		{ 
-			float *B;
-			if(backward) B = Bnext + 256; //B is ostate
-			else B = Bnext - 256;
-			const size_t size = 256;
-			memcpy(Cout, Cin, 768 * sizeof(float) );
-			memset(Cout + size + size, 0, size *sizeof(float));
-
-			cblas_sgemv(CblasColMajor, CblasTrans, 256, 768, 1.0, A, 256, B, 1, 1.0, Cout, 1);
-
-			for (size_t i = 0; i < size; i++) {
-				Cout[i] = LOGISTICF(Cout[i]); 
-				Cout[size+i] = LOGISTICF(Cout[size+i]); 
-				Cout[i+size+size] = TANHF(Cout[i+size] * Cout[i+size+size] + Cin[i+size+size]); 
-				Bnext[i] = (-1) * Cout[i] * Cout[i+size+size] + Cout[i+size+size]; 
-				Bnext[i] = Cout[i] * B[i] + Bnext[i];
-			}
-		}
-
-		// STORE
-		{
-		}
-	    }
-	    xColTmp = free_flappie_matrix(xColTmp);
+	    aes_grumod_recurrence(X[ii], sW, ostate[ii], backward);
 	    assert(validate_flappie_matrix (ostate[ii], -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
-    } // end for num_files
+    }
     X = free_flappie_matrix_vec(X, 2);
     return ostate;
 }
 
 
-flappie_matrix_vec aes_grumod_vec_forward( flappie_matrix_vec Xin, const_flappie_matrix sW, flappie_matrix_vec ostate, const_flappie_matrix W, const_flappie_matrix b, int nfiles) {
+struct aes_grumod_vec_data {
+    const_flappie_matrix_vec Xin;
+    const_flappie_matrix sW;
+    const_flappie_matrix W;
+    const_flappie_matrix b;
+    flappie_matrix_vec X;
+    flappie_matrix_vec ostate;
+    bool backward;
+};
 
-    //flappie_matrix X = affine_map(X1, W, b, NULL);
-    
-    flappie_matrix_vec X = make_flappie_matrix_vec(W->nc, Xin[0]->nc, nfiles);
-    RETURN_NULL_IF(NULL == X, NULL);
 
-    for (int ii = 0; ii < nfiles; ii++) {
-	    /* Copy bias */
-	    for (size_t c = 0; c < X[ii]->nc; c++) {
-		memcpy(X[ii]->data.f + c * X[ii]->nr, b->data.f, X[ii]->nr * sizeof(float));
-	    }
-	    /* Affine transform */
-	    cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans, W->nc, Xin[ii]->nc, W->nr, 1.0, W->data.f, W->stride, Xin[ii]->data.f, Xin[ii]->stride, 1.0, X[ii]->data.f, X[ii]->stride);
+//  Input projection and recurrence for one read of batch
+static void aes_grumod_vec_read(size_t ii, void * ptr){
+    struct aes_grumod_vec_data * d = ptr;
+    flappie_matrix X = d->X[ii];
+    /* Copy bias */
+    for (size_t c = 0; c < X->nc; c++) {
+        memcpy(X->data.f + c * X->nr, d->b->data.f, X->nr * sizeof(float));
     }
+    /* Affine transform */
+    cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans, d->W->nc, d->Xin[ii]->nc, d->W->nr, 1.0, d->W->data.f, d->W->stride, d->Xin[ii]->data.f, d->Xin[ii]->stride, 1.0, X->data.f, X->stride);
+
+    aes_grumod_recurrence(X, d->sW, d->ostate[ii], d->backward);
+    assert(validate_flappie_matrix (d->ostate[ii], -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
+}
 
-    const size_t size = sW->nr;
-    const size_t N = X[0]->nc;
-    ostate = make_flappie_matrix_vec(size, N, nfiles);
 
-    // check num_files value and test for multiple files
-    // close the below for loop before the next for loop and convert the B and C from vec to array
+static flappie_matrix_vec aes_grumod_vec_direction( flappie_matrix_vec Xin, const_flappie_matrix sW, bool backward, const_flappie_matrix W, const_flappie_matrix b, int nfiles, flappie_threadpool pool) {
+    size_t * ncol = malloc(nfiles * sizeof(size_t));
+    RETURN_NULL_IF(NULL == ncol, NULL);
     for (int ii = 0; ii < nfiles; ii++) {
+	    ncol[ii] = Xin[ii]->nc;
+    }
+    flappie_matrix_vec X = make_flappie_matrix_vec_nc(W->nc, ncol, nfiles);
+    flappie_matrix_vec ostate = make_flappie_matrix_vec_nc(sW->nr, ncol, nfiles);
+    free(ncol);
+    if (NULL == X || NULL == ostate) {
+	    X = free_flappie_matrix_vec(X, nfiles);
+	    return free_flappie_matrix_vec(ostate, nfiles);
+    }
 
-	    flappie_matrix xColTmp = make_flappie_matrix(3 * size, 1);
+    //  Reads are independent so each runs on its own thread
+    struct aes_grumod_vec_data data = {(const_flappie_matrix_vec)Xin, sW, W, b, X, ostate, backward};
+    flappie_parallel_for(pool, nfiles, aes_grumod_vec_read, &data);
 
-	    _Mat xCol, sCol1, sCol2;
-	    memset(ostate[ii]->data.f, 0, ostate[ii]->nr * sizeof(float));
-	    xCol = *X[ii];
-	    sCol1 = *ostate[ii];
-	    sCol2 = *ostate[ii];
-	    xCol.nc = sCol1.nc = sCol2.nc = 1;
-
-	    float Cin[768], Cout[768], A[256*768]; 
-	    float *Bnext;
-
-	    for (int i = 1; i < N; i++) {
-		size_t index; 
-		// LOAD
-			index = i;
-			xCol.data.f = X[ii]->data.f + index * X[ii]->nr;
-			sCol1.data.f = ostate[ii]->data.f + (index - 1) * ostate[ii]->nr;
-			sCol2.data.f = ostate[ii]->data.f + index * ostate[ii]->nr;
-
-			memcpy(Cin, xCol.data.f, 768*sizeof(float)); 
-			memcpy(Cout, xColTmp->data.f, 768*sizeof(float));  
-			memcpy(A, sW->data.f, 256*768*sizeof(float)); 
-			Bnext = sCol2.data.f; 
-			float *B;
-			//if(backward) B = Bnext + 256; //B is ostate
-			//else 
-			B = Bnext - 256;
-			const size_t size = 256;
-			memcpy(Cout, Cin, 768 * sizeof(float) );
-			memset(Cout + size + size, 0, size *sizeof(float));
-
-		// COMPUTE
-			cblas_sgemv(CblasColMajor, CblasTrans, 256, 768, 1.0, A, 256, B, 1, 1.0, Cout, 1);
-
-			for (size_t i = 0; i < size; i++) {
-				Cout[i] = LOGISTICF(Cout[i]); 
-				Cout[size+i] = LOGISTICF(Cout[size+i]); 
-				Cout[i+size+size] = TANHF(Cout[i+size] * Cout[i+size+size] + Cin[i+size+size]); 
-				Bnext[i] = (-1) * Cout[i] * Cout[i+size+size] + Cout[i+size+size]; 
-				Bnext[i] = Cout[i] * B[i] + Bnext[i];
-			}
-
-		// STORE
-	    }
-	    xColTmp = free_flappie_matrix(xColTmp);
-	    assert(validate_flappie_matrix (ostate[ii], -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
-    } // end for num_files
     X = free_flappie_matrix_vec(X, nfiles);
     return ostate;
 }
 
 
+/**  Modified GRU run forward over each read of a batch
+ *
+ *   ostate is ignored; the output is always freshly allocated.
+ **/
+flappie_matrix_vec aes_grumod_vec_forward( flappie_matrix_vec Xin, const_flappie_matrix sW, flappie_matrix_vec ostate, const_flappie_matrix W, const_flappie_matrix b, int nfiles, flappie_threadpool pool) {
+    (void)ostate;
+    return aes_grumod_vec_direction(Xin, sW, false, W, b, nfiles, pool);
+}
+
+
+/**  Modified GRU run backward over each read of a batch
+ *
+ *   ostate is ignored; the output is always freshly allocated.
+ **/
+flappie_matrix_vec aes_grumod_vec_backward( flappie_matrix_vec Xin, const_flappie_matrix sW, flappie_matrix_vec ostate, const_flappie_matrix W, const_flappie_matrix b, int nfiles, flappie_threadpool pool) {
+    (void)ostate;
+    return aes_grumod_vec_direction(Xin, sW, true, W, b, nfiles, pool);
+}
 
-flappie_matrix_vec aes_grumod_vec_backward( flappie_matrix_vec Xin, const_flappie_matrix sW, flappie_matrix_vec ostate, const_flappie_matrix W, const_flappie_matrix b, int nfiles) {
 
-    //flappie_matrix X = affine_map(X1, W, b, NULL);
-    
-    flappie_matrix_vec X = make_flappie_matrix_vec(W->nc, Xin[0]->nc, nfiles);
+struct convolution_padded_data {
+    const_flappie_matrix X;
+    const_flappie_matrix W;
+    const_flappie_matrix b;
+    size_t stride;
+    size_t nbatch;
+    const size_t * nvalid;
+    flappie_matrix C;
+};
+
+
+static void convolution_padded_read(size_t i, void * ptr){
+    struct convolution_padded_data * d = ptr;
+    if (0 == d->nvalid[i]) {
+        return;
+    }
+    _Mat Xview = flappie_matrix_batch_view(d->X, d->nbatch, i, d->nvalid[i]);
+    _Mat Cview = flappie_matrix_batch_view(d->C, d->nbatch, i, iceil(d->nvalid[i], d->stride));
+    (void)convolution(&Xview, d->W, d->b, d->stride, &Cview);
+}
+
+
+/**  Convolution over a padded batch of reads
+ *
+ *  Each read is convolved over its valid columns only, so padding does not
+ *  leak into the edges of the filter.  Padding in the output is zero.
+ *
+ *  @param X Padded batch, features x (nbatch * npad)
+ *  @param W Filter matrix (winlen * features x nfilter)
+ *  @param b Bias
+ *  @param stride Stride of convolution
+ *  @param nbatch Number of reads in batch
+ *  @param nvalid Array of length nbatch with number of valid columns of each read in X
+ *  @param pool Threads to run reads of batch concurrently, NULL to run serially
+ *
+ *  @returns Padded batch, nfilter x (nbatch * ceil(npad / stride)), or NULL on failure
+ **/
+flappie_matrix convolution_padded(const_flappie_matrix X, const_flappie_matrix W,
+                                  const_flappie_matrix b, size_t stride,
+                                  size_t nbatch, const size_t * nvalid,
+                                  flappie_threadpool pool) {
     RETURN_NULL_IF(NULL == X, NULL);
+    assert(NULL != nvalid);
+    assert(nbatch > 0 && 0 == X->nc % nbatch);
+    const size_t npadC = iceil(X->nc / nbatch, stride);
+    flappie_matrix C = make_flappie_matrix(W->nc, nbatch * npadC);
+    RETURN_NULL_IF(NULL == C, NULL);
 
-    for (int ii = 0; ii < nfiles; ii++) {
-	    /* Copy bias */
-	    for (size_t c = 0; c < X[ii]->nc; c++) {
-		memcpy(X[ii]->data.f + c * X[ii]->nr, b->data.f, X[ii]->nr * sizeof(float));
-	    }
-	    /* Affine transform */
-	    cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans, W->nc, Xin[ii]->nc, W->nr, 1.0, W->data.f, W->stride, Xin[ii]->data.f, Xin[ii]->stride, 1.0, X[ii]->data.f, X[ii]->stride);
+    struct convolution_padded_data data = {X, W, b, stride, nbatch, nvalid, C};
+    flappie_parallel_for_weighted(pool, nbatch, nvalid, convolution_padded_read, &data);
+
+    return C;
+}
+
+
+struct aes_grumod_padded_data {
+    const_flappie_matrix Xin;
+    const_flappie_matrix sW;
+    const_flappie_matrix W;
+    const_flappie_matrix b;
+    size_t nbatch;
+    const size_t * nvalid;
+    bool backward;
+    flappie_matrix X;
+    flappie_matrix ostate;
+};
+
+
+static void aes_grumod_padded_read(size_t i, void * ptr){
+    struct aes_grumod_padded_data * d = ptr;
+    if (0 == d->nvalid[i]) {
+        return;
+    }
+    _Mat Xinview = flappie_matrix_batch_view(d->Xin, d->nbatch, i, d->nvalid[i]);
+    _Mat Xview = flappie_matrix_batch_view(d->X, d->nbatch, i, d->nvalid[i]);
+    _Mat Oview = flappie_matrix_batch_view(d->ostate, d->nbatch, i, d->nvalid[i]);
+    (void)affine_map(&Xinview, d->W, d->b, &Xview);
+    aes_grumod_recurrence(&Xview, d->sW, &Oview, d->backward);
+}
+
+
+/**  Modified GRU layer over a padded batch of reads
+ *
+ *  The input projection and recurrence for each read run over its valid
+ *  columns only, starting from the last valid column when backward.  Reads
+ *  are independent so may be spread over a pool of threads.  Padding in the
+ *  output is zero.
+ *
+ *  @param Xin Padded batch, features x (nbatch * npad)
+ *  @param sW Recurrent weights
+ *  @param backward Run recurrence backward in time
+ *  @param W Input weights
+ *  @param b Bias
+ *  @param nbatch Number of reads in batch
+ *  @param nvalid Array of length nbatch with number of valid columns of each read
+ *  @param pool Threads to run reads of batch concurrently, NULL to run serially
+ *
+ *  @returns Padded batch, size x (nbatch * npad), or NULL on failure
+ **/
+flappie_matrix aes_grumod_padded(const_flappie_matrix Xin, const_flappie_matrix sW, bool backward,
+                                 const_flappie_matrix W, const_flappie_matrix b,
+                                 size_t nbatch, const size_t * nvalid, flappie_threadpool pool) {
+    RETURN_NULL_IF(NULL == Xin, NULL);
+    assert(NULL != nvalid);
+
+    flappie_matrix X = make_flappie_matrix(W->nc, Xin->nc);
+    RETURN_NULL_IF(NULL == X, NULL);
+    flappie_matrix ostate = make_flappie_matrix(sW->nr, Xin->nc);
+    if (NULL == ostate) {
+        free_flappie_matrix(X);
+        return NULL;
     }
 
-    const size_t size = sW->nr;
-    const size_t N = X[0]->nc;
-    ostate = make_flappie_matrix_vec(size, N, nfiles);
+    struct aes_grumod_padded_data data = {Xin, sW, W, b, nbatch, nvalid, backward, X, ostate};
+    flappie_parallel_for_weighted(pool, nbatch, nvalid, aes_grumod_padded_read, &data);
+    X = free_flappie_matrix(X);
 
-    for (int ii = 0; ii < nfiles; ii++) {
+    assert(validate_flappie_matrix(ostate, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
+    return ostate;
+}
 
-	    flappie_matrix xColTmp = make_flappie_matrix(3 * size, 1);
 
-	    _Mat xCol, sCol1, sCol2;
-	    memset(ostate[ii]->data.f, 0, ostate[ii]->nr * sizeof(float));
-	    xCol = *X[ii];
-	    sCol1 = *ostate[ii];
-	    sCol2 = *ostate[ii];
-	    xCol.nc = sCol1.nc = sCol2.nc = 1;
+struct aes_grumod_interleaved_data {
+    const_flappie_matrix sW;
+    const_flappie_qmatrix sWq;
+    const_flappie_hmatrix sWh;
+    size_t nbatch;
+    const size_t * nvalid;
+    size_t ngroup;
+    size_t npad;
+    bool backward;
+    //  Steps [tlo, thi) are taken.  Projection and state of step t are at
+    //  column (t - tlo) * nbatch of x and h, which may be views of part of
+    //  the batch; the state before the first step taken is the block before
+    //  (forward) or after (backward) them.
+    size_t tlo, thi;
+    const float * x;
+    size_t ldx;
+    float * h;
+    size_t ldh;
+};
+
+
+//  Number of leading lanes in [lo, hi) longer than len; lanes are longest first
+static size_t nlane_longer(const size_t * nvalid, size_t lo, size_t hi, size_t len){
+    size_t j = lo;
+    while(j < hi && nvalid[j] > len){
+        j += 1;
+    }
+    return j - lo;
+}
 
-	    float Cin[768], Cout[768], A[256*768]; 
-	    float *Bnext;
-
-	    for (int i = 1; i < N; i++) {
-		size_t index; 
-		// LOAD
-		{
-			//if(backward) {
-			index = N - i - 1;
-			xCol.data.f = X[ii]->data.f + index * X[ii]->nr;
-			sCol1.data.f = ostate[ii]->data.f + (index + 1) * ostate[ii]->nr;
-			sCol2.data.f = ostate[ii]->data.f + index * ostate[ii]->nr;
-
-			memcpy(Cin, xCol.data.f, 768*sizeof(float)); 
-			memcpy(Cout, xColTmp->data.f, 768*sizeof(float));  
-			memcpy(A, sW->data.f, 256*768*sizeof(float)); 
-			Bnext = sCol2.data.f; 
-		}
-
-		// COMPUTE
-		{ 
-			float *B;
-			//if(backward) 
-			B = Bnext + 256; //B is ostate
-			//else B = Bnext - 256;
-			const size_t size = 256;
-			memcpy(Cout, Cin, 768 * sizeof(float) );
-			memset(Cout + size + size, 0, size *sizeof(float));
-
-			cblas_sgemv(CblasColMajor, CblasTrans, 256, 768, 1.0, A, 256, B, 1, 1.0, Cout, 1);
-
-			for (size_t i = 0; i < size; i++) {
-				Cout[i] = LOGISTICF(Cout[i]); 
-				Cout[size+i] = LOGISTICF(Cout[size+i]); 
-				Cout[i+size+size] = TANHF(Cout[i+size] * Cout[i+size+size] + Cin[i+size+size]); 
-				Bnext[i] = (-1) * Cout[i] * Cout[i+size+size] + Cout[i+size+size]; 
-				Bnext[i] = Cout[i] * B[i] + Bnext[i];
-			}
-		}
-
-		// STORE
-		{
-		}
-	    }
-	    xColTmp = free_flappie_matrix(xColTmp);
-	    assert(validate_flappie_matrix (ostate[ii], -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
-    } // end for num_files
-    X = free_flappie_matrix_vec(X, 2);
+
+//  Step a contiguous group of lanes through steps [tlo, thi) of the batch
+static void aes_grumod_interleaved_group(size_t g, void * ptr){
+    const struct aes_grumod_interleaved_data * d = ptr;
+    const size_t lo = g * d->nbatch / d->ngroup;
+    const size_t hi = (g + 1) * d->nbatch / d->ngroup;
+    if(lo == hi){
+        return;
+    }
+    const size_t nB = d->nbatch;
+
+    for(size_t k=0 ; k < d->thi - d->tlo ; k++){
+        const size_t t = d->backward ? (d->thi - 1 - k) : (d->tlo + k);
+        //  First column of each lane is the zero initial state, so its step is skipped
+        if(t == (d->backward ? (d->npad - 1) : 0)){
+            continue;
+        }
+        //  Lanes with a previous column at this step.  When backward, lanes
+        //  starting at t are the trailing active lanes and stay zero.
+        const size_t n = d->backward ? nlane_longer(d->nvalid, lo, hi, t + 1)
+                                     : nlane_longer(d->nvalid, lo, hi, t);
+        if(0 == n){
+            if(d->backward){
+                continue;
+            }
+            break;
+        }
+        const ptrdiff_t col = (ptrdiff_t)((t - d->tlo) * nB + lo);
+        const ptrdiff_t prev = col + (d->backward ? (ptrdiff_t)nB : -(ptrdiff_t)nB);
+        const float * x = d->x + col * (ptrdiff_t)d->ldx;
+        const float * istate = d->h + prev * (ptrdiff_t)d->ldh;
+        float * ostate = d->h + col * (ptrdiff_t)d->ldh;
+        if(NULL != d->sWq){
+            grumod_step_fused_batch_int8(x, d->ldx, istate, d->ldh, d->sWq, ostate, d->ldh, n);
+        } else if(NULL != d->sWh){
+            grumod_step_fused_batch_half(x, d->ldx, istate, d->ldh, d->sWh, ostate, d->ldh, n);
+        } else {
+            grumod_step_fused_batch(x, d->ldx, istate, d->ldh, d->sW, ostate, d->ldh, n);
+        }
+    }
+}
+
+
+/**  Modified GRU layer over an interleaved batch of reads
+ *
+ *  Equivalent to aes_grumod_padded, but each step of every read is
+ *  contiguous (see interleave_flappie_matrix) so the recurrent weights are
+ *  applied to all reads at once, streamed once per step rather than once per
+ *  read and step.  Lanes are split into one contiguous group per thread of
+ *  pool.  Padding in the output is zero.
+ *
+ *  @param Xin Interleaved batch, features x (npad * nbatch)
+ *  @param sW Recurrent weights
+ *  @param sWq Recurrent weights quantised to int8, used in place of sW unless NULL
+ *  @param sWh Recurrent weights as sixteen bit floats, used in place of sW unless NULL
+ *  @param backward Run recurrence backward in time
+ *  @param W Input weights
+ *  @param b Bias
+ *  @param nbatch Number of lanes in batch
+ *  @param nvalid Array of length nbatch with number of valid columns of each lane,
+ *  lanes ordered longest first
+ *  @param pool Threads to run groups of lanes concurrently, NULL to run serially
+ *
+ *  @returns Interleaved batch, size x (npad * nbatch), or NULL on failure
+ **/
+flappie_matrix aes_grumod_interleaved(const_flappie_matrix Xin, const_flappie_matrix sW,
+                                      const_flappie_qmatrix sWq, const_flappie_hmatrix sWh, bool backward,
+                                      const_flappie_matrix W, const_flappie_matrix b,
+                                      size_t nbatch, const size_t * nvalid, flappie_threadpool pool) {
+    RETURN_NULL_IF(NULL == Xin, NULL);
+    assert(NULL != nvalid);
+    assert(nbatch > 0 && 0 == Xin->nc % nbatch);
+    assert(W->nc == sW->nc && sW->nc == 3 * sW->nr);
+    for(size_t j=1 ; j < nbatch ; j++){
+        assert(nvalid[j - 1] >= nvalid[j]);
+    }
+
+    //  Padding columns are projected too but never read by the recurrence
+    flappie_matrix X = affine_map(Xin, W, b, NULL);
+    RETURN_NULL_IF(NULL == X, NULL);
+    flappie_matrix ostate = make_flappie_matrix(sW->nr, Xin->nc);
+    if (NULL == ostate) {
+        free_flappie_matrix(X);
+        return NULL;
+    }
+
+    const size_t nthread = flappie_threadpool_nthread(pool);
+    const size_t npad = Xin->nc / nbatch;
+    struct aes_grumod_interleaved_data data = {sW, sWq, sWh, nbatch, nvalid, (nthread < nbatch) ? nthread : nbatch,
+                                               npad, backward, 0, npad, X->data.f, X->stride,
+                                               ostate->data.f, ostate->stride};
+    flappie_parallel_for(pool, data.ngroup, aes_grumod_interleaved_group, &data);
+    X = free_flappie_matrix(X);
+
+    assert(validate_flappie_matrix(ostate, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
+    return ostate;
+}
+
+
+//  Steps of an interleaved batch whose input projection is held in float at once
+static const size_t interleaved_chunk_steps = 64;
+
+
+/**  Modified GRU layer over an interleaved batch held as sixteen bit floats
+ *
+ *  As aes_grumod_interleaved but the input and output of the layer are
+ *  stored as sixteen bit floats.  The layer runs over chunks of steps in
+ *  turn, projecting the input of each chunk just before its steps, so only a
+ *  chunk of the projection and state is ever held in float.  The recurrence
+ *  is calculated in float throughout.
+ *
+ *  @param Xin Interleaved batch, features x (npad * nbatch)
+ *  @param sW Recurrent weights
+ *  @param sWq Recurrent weights quantised to int8, used in place of sW unless NULL
+ *  @param sWh Recurrent weights as sixteen bit floats, used in place of sW unless NULL
+ *  @param backward Run recurrence backward in time
+ *  @param W Input weights
+ *  @param b Bias
+ *  @param nbatch Number of lanes in batch
+ *  @param nvalid Array of length nbatch with number of valid columns of each lane,
+ *  lanes ordered longest first
+ *  @param pool Threads to run groups of lanes concurrently, NULL to run serially
+ *
+ *  @returns Interleaved batch, size x (npad * nbatch), in the format of Xin or
+ *  NULL on failure
+ **/
+flappie_hmatrix aes_grumod_interleaved_half(const_flappie_hmatrix Xin, const_flappie_matrix sW,
+                                            const_flappie_qmatrix sWq, const_flappie_hmatrix sWh, bool backward,
+                                            const_flappie_matrix W, const_flappie_matrix b,
+                                            size_t nbatch, const size_t * nvalid, flappie_threadpool pool) {
+    RETURN_NULL_IF(NULL == Xin, NULL);
+    assert(NULL != nvalid);
+    assert(nbatch > 0 && 0 == Xin->nc % nbatch);
+    assert(W->nr == Xin->nr);
+    assert(W->nc == sW->nc && sW->nc == 3 * sW->nr);
+    for(size_t j=1 ; j < nbatch ; j++){
+        assert(nvalid[j - 1] >= nvalid[j]);
+    }
+
+    const size_t size = sW->nr;
+    const size_t npad = Xin->nc / nbatch;
+    const size_t chunk = (npad < interleaved_chunk_steps) ? npad : interleaved_chunk_steps;
+    //  Input and projection of a chunk, and its state with the state before it
+    flappie_matrix in = make_flappie_matrix(Xin->nr, chunk * nbatch);
+    flappie_matrix X = make_flappie_matrix(W->nc, chunk * nbatch);
+    flappie_matrix state = make_flappie_matrix(size, (chunk + 1) * nbatch);
+    flappie_matrix carry = make_flappie_matrix(size, nbatch);
+    flappie_hmatrix ostate = make_flappie_hmatrix(size, Xin->nc, Xin->format);
+    if(NULL == in || NULL == X || NULL == state || NULL == carry || NULL == ostate){
+        ostate = free_flappie_hmatrix(ostate);
+        goto cleanup;
+    }
+
+    const size_t nthread = flappie_threadpool_nthread(pool);
+    const size_t ldh = state->stride;
+    const size_t block = nbatch * ldh;
+    for(size_t done=0 ; done < npad ; done += chunk){
+        const size_t m = (npad - done < chunk) ? (npad - done) : chunk;
+        const size_t tlo = backward ? (npad - done - m) : done;
+        _Mat in_view = *in;
+        in_view.nc = m * nbatch;
+        _Mat X_view = *X;
+        X_view.nc = m * nbatch;
+        read_half_columns(Xin, tlo * nbatch, &in_view);
+        affine_map(&in_view, W, b, &X_view);
+
+        //  State before chunk precedes it when forward, follows it when backward
+        memset(state->data.f, 0, state->nc * ldh * sizeof(float));
+        float * h = backward ? state->data.f : (state->data.f + block);
+        memcpy(backward ? (h + m * block) : (h - block), carry->data.f, block * sizeof(float));
+
+        struct aes_grumod_interleaved_data data = {sW, sWq, sWh, nbatch, nvalid, (nthread < nbatch) ? nthread : nbatch,
+                                                   npad, backward, tlo, tlo + m, X->data.f, X->stride, h, ldh};
+        flappie_parallel_for(pool, data.ngroup, aes_grumod_interleaved_group, &data);
+
+        memcpy(carry->data.f, backward ? h : (h + (m - 1) * block), block * sizeof(float));
+        _Mat h_view = *state;
+        h_view.nc = m * nbatch;
+        h_view.data.f = h;
+        write_half_columns(&h_view, tlo * nbatch, ostate);
+    }
+
+cleanup:
+    free_flappie_matrix(carry);
+    free_flappie_matrix(state);
+    free_flappie_matrix(X);
+    free_flappie_matrix(in);
     return ostate;
 }
+
+
 flappie_matrix aes_grumod( const_flappie_matrix Xin, const_flappie_matrix sW, flappie_matrix ostate, bool backward, const_flappie_matrix W, const_flappie_matrix b) {
 
     //flappie_matrix X = affine_map(X1, W, b, NULL);
@@ -1124,68 +1405,12 @@ flappie_matrix aes_grumod( const_flappie_matrix Xin, const_flappie_matrix sW, fl
     /* Affine transform */
     cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans, W->nc, Xin->nc, W->nr, 1.0, W->data.f, W->stride, Xin->data.f, Xin->stride, 1.0, X->data.f, X->stride);
     
-    const size_t size = sW->nr;
-    const size_t N = X->nc;
-    ostate = remake_flappie_matrix(ostate, size, N);
-    flappie_matrix xColTmp = make_flappie_matrix(3 * size, 1);
-
-    _Mat xCol, sCol1, sCol2;
-    memset(ostate->data.f, 0, ostate->nr * sizeof(float));
-    xCol = *X;
-    sCol1 = *ostate;
-    sCol2 = *ostate;
-    xCol.nc = sCol1.nc = sCol2.nc = 1;
-
-    float Cin[768], Cout[768], A[256*768]; 
-    float *Bnext;
-
-    for (int i = 1; i < N; i++) {
-       	size_t index; 
-	// LOAD
-        {
-        	if(backward) {
-	   		index = N - i - 1;
-           		xCol.data.f = X->data.f + index * X->nr;
-           		sCol1.data.f = ostate->data.f + (index + 1) * ostate->nr;
-           		sCol2.data.f = ostate->data.f + index * ostate->nr;
-	}
-		else {
-	  	        index = i;
-           		xCol.data.f = X->data.f + index * X->nr;
-           		sCol1.data.f = ostate->data.f + (index - 1) * ostate->nr;
-           		sCol2.data.f = ostate->data.f + index * ostate->nr;
-		}
-    		memcpy(Cin, xCol.data.f, 768*sizeof(float)); 
-		memcpy(Cout, xColTmp->data.f, 768*sizeof(float));  
-		memcpy(A, sW->data.f, 256*768*sizeof(float)); 
-		Bnext = sCol2.data.f; 
-        }
-
-        // COMPUTE
-        { 
-                float *B;
-                if(backward) B = Bnext + 256; //B is ostate
-                else B = Bnext - 256;
-        	const size_t size = 256;
-        	memcpy(Cout, Cin, 768 * sizeof(float) );
-        	memset(Cout + size + size, 0, size *sizeof(float));
-
-        	cblas_sgemv(CblasColMajor, CblasTrans, 256, 768, 1.0, A, 256, B, 1, 1.0, Cout, 1);
-
-        	for (size_t i = 0; i < size; i++) {
-                	Cout[i] = LOGISTICF(Cout[i]); 
-                	Cout[size+i] = LOGISTICF(Cout[size+i]); 
-                	Cout[i+size+size] = TANHF(Cout[i+size] * Cout[i+size+size] + Cin[i+size+size]); 
-                	Bnext[i] = (-1) * Cout[i] * Cout[i+size+size] + Cout[i+size+size]; 
-                	Bnext[i] = Cout[i] * B[i] + Bnext[i];
-        	}
-	}
-
-	// STORE
-        {
-	}
+    ostate = remake_flappie_matrix(ostate, sW->nr, X->nc);
+    if (NULL == ostate) {
+        free_flappie_matrix(X);
+        return NULL;
     }
-    xColTmp = free_flappie_matrix(xColTmp);
+    aes_grumod_recurrence(X, sW, ostate, backward);
     X = free_flappie_matrix(X);
     assert(validate_flappie_matrix (ostate, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
     return ostate;
@@ -1206,12 +1431,11 @@ flappie_matrix grumod_forward(const_flappie_matrix X, const_flappie_matrix sW,
     ostate = remake_flappie_matrix(ostate, size, bsize);
     RETURN_NULL_IF(NULL == ostate, NULL);
 
-    flappie_matrix tmp = make_flappie_matrix(3 * size, 1);
-    if(NULL == tmp){
-        //  Memory allocation falled, clean-up and return
-        free(ostate);
-        return NULL;
-    }
+    //  Gates of a single step, kept on the stack so the layer allocates nothing
+    //  when ostate is already the right size
+    float tmp_data[3 * size];
+    _Mat tmp_mat = {.nr = 3 * size, .nrq = (3 * size) / 4, .nc = 1, .stride = 3 * size, .data.f = tmp_data};
+    flappie_matrix tmp = &tmp_mat;
 
     /* First step state is zero.  Set second column of ostate to zero and use that */
     _Mat xCol, sCol1, sCol2;
@@ -1231,8 +1455,6 @@ flappie_matrix grumod_forward(const_flappie_matrix X, const_flappie_matrix sW,
         grumod_step(&xCol, &sCol1, sW, tmp, &sCol2);
     }
 
-    tmp = free_flappie_matrix(tmp);
-
     assert(validate_flappie_matrix
            (ostate, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
     return ostate;
@@ -1297,12 +1519,11 @@ flappie_matrix grumod_backward(const_flappie_matrix X, const_flappie_matrix sW,
     ostate = remake_flappie_matrix(ostate, size, bsize);
     RETURN_NULL_IF(NULL == ostate, NULL);
 
-    flappie_matrix tmp = make_flappie_matrix(3 * size, 1);
-    if(NULL == tmp){
-        //  Memory allocation falled, clean-up and return
-        free(ostate);
-        return NULL;
-    }
+    //  Gates of a single step, kept on the stack so the layer allocates nothing
+    //  when ostate is already the right size
+    float tmp_data[3 * size];
+    _Mat tmp_mat = {.nr = 3 * size, .nrq = (3 * size) / 4, .nc = 1, .stride = 3 * size, .data.f = tmp_data};
+    flappie_matrix tmp = &tmp_mat;
 
     /* First step state is zero.  Set first column of ostate to zero and use that */
     _Mat xCol, sCol1, sCol2;
@@ -1324,8 +1545,6 @@ flappie_matrix grumod_backward(const_flappie_matrix X, const_flappie_matrix sW,
         grumod_step(&xCol, &sCol1, sW, tmp, &sCol2);
     }
 
-    tmp = free_flappie_matrix(tmp);
-
     assert(validate_flappie_matrix
            (ostate, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
     return ostate;
@@ -1413,9 +1632,7 @@ void grumod_step(const_flappie_matrix x, const_flappie_matrix istate,
                 sW->stride, istate->data.f, 1, 1.0, xF->data.f, 1);
 
 
-    for (size_t i = 0; i < (size + size); i++) {
-        xF->data.f[i] = LOGISTICF(xF->data.f[i]);
-    }
+    flappie_math_gate_inplace(FLAPPIE_MATH_LOGISTIC, xF->data.f, size + size);
 
     const float *z = xF->data.f;
     const float *a = xF->data.f + size;
@@ -1428,9 +1645,7 @@ void grumod_step(const_flappie_matrix x, const_flappie_matrix istate,
     }
 
 
-    for (size_t i = 0; i < size; i++) {
-        c[i] = TANHF(c[i]);
-    }
+    flappie_math_gate_inplace(FLAPPIE_MATH_TANH, c, size);
 
     float *c1 = ostate->data.f;
 
@@ -1596,9 +1811,7 @@ void gru_relu_step(const_flappie_matrix x, const_flappie_matrix istate,
      */
     cblas_sgemv(CblasColMajor, CblasTrans, sW->nr, sW->nc, 1.0, sW->data.f,
                 sW->stride, istate->data.f, 1, 1.0, xF->data.f, 1);
-    for (size_t i = 0; i < (sizeq +sizeq); i++) {
-        xF->data.v[i] = LOGISTICFV(xF->data.v[i]);
-    }
+    flappie_math_inplace(FLAPPIE_MATH_LOGISTIC, xF->data.f, size + size);
 
     const __m128 *z = xF->data.v;
     __m128 *r = xF->data.v + sizeq;
@@ -1756,21 +1969,212 @@ void lstm_step(const_flappie_matrix xAffine, const_flappie_matrix out_prev,
 
     assert(size % 4 == 0);  // Vectorisation assumes size divisible by 4
     const size_t sizeq = size / 4;
+    //  Update, forget and output gates are logistic, the candidate tanh
+    flappie_math_inplace(FLAPPIE_MATH_LOGISTIC, xF->data.f, size + size);
+    flappie_math_inplace(FLAPPIE_MATH_TANH, xF->data.f + size + size, size);
+    flappie_math_inplace(FLAPPIE_MATH_LOGISTIC, xF->data.f + 3 * size, size);
     for (size_t i = 0; i < sizeq; i++) {
         // Forget gate
-        __m128 forget = LOGISTICFV(xF->data.v[sizeq + i])
-                      * state->data.v[i];
+        __m128 forget = xF->data.v[sizeq + i] * state->data.v[i];
         // Update gate
-        __m128 update = LOGISTICFV(xF->data.v[i])
-                      * TANHFV(xF->data.v[2 * sizeq + i]);
+        __m128 update = xF->data.v[i] * xF->data.v[2 * sizeq + i];
         state->data.v[i] = _mm_add_ps(forget, update);
-        // Output gate
-        output->data.v[i] = LOGISTICFV(xF->data.v[3 * sizeq + i])
-                          * TANHFV(state->data.v[i]);
+    }
+    // Output gate
+    memcpy(output->data.v, state->data.v, sizeq * sizeof(__m128));
+    flappie_math_inplace(FLAPPIE_MATH_TANH, output->data.f, size);
+    for (size_t i = 0; i < sizeq; i++) {
+        output->data.v[i] *= xF->data.v[3 * sizeq + i];
+    }
+}
+
+
+/**  Update of recurrent layer for one read at one step
+ *
+ *  @param x Input for step, ngate * size
+ *  @param g Input plus recurrent contribution, ngate * size.  Overwritten.
+ *  @param state [in/out] Internal state of layer, size
+ *  @param h [in/out] Previous output on entry, new output on exit, size
+ *  @param size Size of layer
+ **/
+typedef void (*padded_update_fun)(const float * x, float * g, float * state, float * h, size_t size);
+
+
+static void lstm_update(const float * x, float * g, float * state, float * h, size_t size){
+    //  Input is already folded into the gates
+    (void)x;
+    const size_t sizeq = size / 4;
+    flappie_math_inplace(FLAPPIE_MATH_LOGISTIC, g, size + size);
+    flappie_math_inplace(FLAPPIE_MATH_TANH, g + size + size, size);
+    flappie_math_inplace(FLAPPIE_MATH_LOGISTIC, g + 3 * size, size);
+    const __m128 * gv = (const __m128 *)g;
+    __m128 * statev = (__m128 *)state;
+    __m128 * hv = (__m128 *)h;
+    for (size_t i = 0; i < sizeq; i++) {
+        // Forget gate
+        __m128 forget = gv[sizeq + i] * statev[i];
+        // Update gate
+        __m128 update = gv[i] * gv[2 * sizeq + i];
+        statev[i] = _mm_add_ps(forget, update);
+    }
+    // Output gate
+    memcpy(h, state, size * sizeof(float));
+    flappie_math_inplace(FLAPPIE_MATH_TANH, h, size);
+    for (size_t i = 0; i < sizeq; i++) {
+        hv[i] *= gv[3 * sizeq + i];
     }
 }
 
 
+static void grumod_update(const float * x, float * g, float * state, float * h, size_t size){
+    //  Modified GRU keeps no state beyond its output
+    (void)state;
+    flappie_math_gate_inplace(FLAPPIE_MATH_LOGISTIC, g, size + size);
+    const float * z = g;
+    const float * a = g + size;
+    float * c = g + size + size;
+    for (size_t i = 0; i < size; i++) {
+        c[i] = a[i] * c[i] + x[size + size + i];
+    }
+    flappie_math_gate_inplace(FLAPPIE_MATH_TANH, c, size);
+    for (size_t i = 0; i < size; i++) {
+        const float hbar = (-1) * z[i] * c[i] + c[i];
+        h[i] = z[i] * h[i] + hbar;
+    }
+}
+
+
+static int cmp_lane_length(const void * a, const void * b){
+    const size_t * la = a;
+    const size_t * lb = b;
+    //  Longest first, ties broken by index of read
+    if(la[0] != lb[0]){
+        return (la[0] > lb[0]) ? -1 : 1;
+    }
+    return (la[1] < lb[1]) ? -1 : ((la[1] > lb[1]) ? 1 : 0);
+}
+
+
+/**  Recurrent layer over a padded batch, stepping every read at once
+ *
+ *  At each step the recurrent contribution for all reads still running is a
+ *  single matrix-matrix product rather than one matrix-vector product per
+ *  read.  Reads are ordered longest first so those still running are always
+ *  the leading columns of the working matrices.
+ **/
+static flappie_matrix recurrent_padded(const_flappie_matrix X, const_flappie_matrix sW, bool backward,
+                                       size_t nbatch, const size_t * nvalid, bool zero_last_gate,
+                                       padded_update_fun update){
+    RETURN_NULL_IF(NULL == X, NULL);
+    assert(NULL != nvalid);
+    assert(nbatch > 0 && 0 == X->nc % nbatch);
+    assert(X->nr == sW->nc);
+    const size_t size = sW->nr;
+    assert(size % 4 == 0);
+    const size_t npad = X->nc / nbatch;
+
+    flappie_matrix output = make_flappie_matrix(size, X->nc);
+    flappie_matrix G = make_flappie_matrix(sW->nc, nbatch);
+    flappie_matrix H = make_flappie_matrix(size, nbatch);
+    flappie_matrix S = make_flappie_matrix(size, nbatch);
+    size_t * lane = calloc(2 * nbatch, sizeof(size_t));
+    if(NULL == output || NULL == G || NULL == H || NULL == S || NULL == lane){
+        output = free_flappie_matrix(output);
+        goto cleanup;
+    }
+
+    //  Pairs of (length, read)
+    for(size_t i=0 ; i < nbatch ; i++){
+        assert(nvalid[i] <= npad);
+        lane[2 * i] = nvalid[i];
+        lane[2 * i + 1] = i;
+    }
+    qsort(lane, nbatch, 2 * sizeof(size_t), cmp_lane_length);
+
+    size_t nactive = nbatch;
+    for(size_t k=0 ; k < npad ; k++){
+        while(nactive > 0 && lane[2 * (nactive - 1)] <= k){
+            nactive -= 1;
+        }
+        if(0 == nactive){
+            break;
+        }
+
+        for(size_t j=0 ; j < nactive ; j++){
+            const size_t len = lane[2 * j];
+            const size_t col = lane[2 * j + 1] * npad + (backward ? (len - 1 - k) : k);
+            memcpy(G->data.f + j * G->stride, X->data.f + col * X->stride, X->nr * sizeof(float));
+            if(zero_last_gate){
+                memset(G->data.f + j * G->stride + size + size, 0, size * sizeof(float));
+            }
+        }
+        cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans, sW->nc, nactive, sW->nr,
+                    1.0, sW->data.f, sW->stride, H->data.f, H->stride,
+                    1.0, G->data.f, G->stride);
+        for(size_t j=0 ; j < nactive ; j++){
+            const size_t len = lane[2 * j];
+            const size_t col = lane[2 * j + 1] * npad + (backward ? (len - 1 - k) : k);
+            float * h = H->data.f + j * H->stride;
+            update(X->data.f + col * X->stride, G->data.f + j * G->stride, S->data.f + j * S->stride, h, size);
+            memcpy(output->data.f + col * output->stride, h, size * sizeof(float));
+        }
+    }
+
+    assert(validate_flappie_matrix(output, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
+
+cleanup:
+    free(lane);
+    S = free_flappie_matrix(S);
+    H = free_flappie_matrix(H);
+    G = free_flappie_matrix(G);
+    return output;
+}
+
+
+/**  LSTM layer over a padded batch of reads
+ *
+ *  Equivalent to lstm_forward or lstm_backward applied to the valid columns
+ *  of each read, with all reads stepped together.  Padding in the output is
+ *  zero.
+ *
+ *  @param Xaffine Padded batch of input projections, 4 * size x (nbatch * npad)
+ *  @param sW Recurrent weights, size x 4 * size
+ *  @param backward Run recurrence backward in time, from last valid column of each read
+ *  @param nbatch Number of reads in batch
+ *  @param nvalid Array of length nbatch with number of valid columns of each read
+ *
+ *  @returns Padded batch, size x (nbatch * npad), or NULL on failure
+ **/
+flappie_matrix lstm_padded(const_flappie_matrix Xaffine, const_flappie_matrix sW, bool backward,
+                           size_t nbatch, const size_t * nvalid){
+    RETURN_NULL_IF(NULL == Xaffine, NULL);
+    assert(Xaffine->nr == 4 * sW->nr);
+    return recurrent_padded(Xaffine, sW, backward, nbatch, nvalid, false, lstm_update);
+}
+
+
+/**  Modified GRU layer over a padded batch of reads
+ *
+ *  Equivalent to grumod_forward or grumod_backward applied to the valid
+ *  columns of each read, with all reads stepped together.  Padding in the
+ *  output is zero.
+ *
+ *  @param X Padded batch of input projections, 3 * size x (nbatch * npad)
+ *  @param sW Recurrent weights, size x 3 * size
+ *  @param backward Run recurrence backward in time, from last valid column of each read
+ *  @param nbatch Number of reads in batch
+ *  @param nvalid Array of length nbatch with number of valid columns of each read
+ *
+ *  @returns Padded batch, size x (nbatch * npad), or NULL on failure
+ **/
+flappie_matrix grumod_padded(const_flappie_matrix X, const_flappie_matrix sW, bool backward,
+                             size_t nbatch, const size_t * nvalid){
+    RETURN_NULL_IF(NULL == X, NULL);
+    assert(X->nr == 3 * sW->nr);
+    return recurrent_padded(X, sW, backward, nbatch, nvalid, true, grumod_update);
+}
+
+
 size_t nbase_from_flipflop_nparam(size_t nparam){
     size_t nbase = roundf((-1.0f + sqrtf(1 + 2 * nparam)) / 2.0f);
     return nbase;
@@ -1783,8 +2187,8 @@ double crf_manystay_partition_function(const_flappie_matrix C){
     const size_t nstate = nbase + nbase;
     assert(nstate * (nbase + 1) == C->nr);
 
-    double * mem = calloc(2 * nstate, sizeof(double));
-    RETURN_NULL_IF(NULL==mem, NAN);
+    double mem[2 * nstate];
+    memset(mem, 0, sizeof(mem));
 
     double * curr = mem;
     double * prev = mem + nstate;
@@ -1818,17 +2222,13 @@ double crf_manystay_partition_function(const_flappie_matrix C){
         logZ = logsumexp(logZ, curr[st]);
     }
 
-    free(mem);
-
     return logZ;
 }
 
 
-flappie_matrix globalnorm_manystay(const_flappie_matrix X, const_flappie_matrix W,
-                                    const_flappie_matrix b, float temperature, flappie_matrix C) {
-    C = affine_map(X, W, b, C);
+//  Scale tanh of output layer and normalise by partition function
+static flappie_matrix manystay_normalise_inplace(flappie_matrix C, float temperature){
     RETURN_NULL_IF(NULL == C, NULL);
-    tanh_activation_inplace(C);
     shift_scale_matrix_inplace(C, 0.0f, temperature / 5.0f);
 
     float logZ = crf_manystay_partition_function(C) / (double)C->nc;
@@ -1845,12 +2245,312 @@ flappie_matrix globalnorm_manystay(const_flappie_matrix X, const_flappie_matrix
 }
 
 
+flappie_matrix globalnorm_manystay(const_flappie_matrix X, const_flappie_matrix W,
+                                    const_flappie_matrix b, float temperature, flappie_matrix C) {
+    C = affine_map(X, W, b, C);
+    RETURN_NULL_IF(NULL == C, NULL);
+    tanh_activation_inplace(C);
+    return manystay_normalise_inplace(C, temperature);
+}
+
+
 flappie_matrix globalnorm_flipflop(const_flappie_matrix X, const_flappie_matrix W,
                                     const_flappie_matrix b, float temperature, flappie_matrix C) {
     return globalnorm_manystay(X, W, b, temperature, C);
 }
 
 
+/*  Fixed point layers
+ *
+ *  Activations and weights are sixteen bit fixed point, see fixed_point_t.
+ *  Products are summed in 32 bits, which the formats of weights chosen by
+ *  fixed_weight_frac guarantee cannot overflow, and results are saturated
+ *  as they are narrowed back to sixteen bits.  Tanh and logistic are read
+ *  from a table.
+ */
+
+//  Tables of tanh over [-FIXED_TANH_RANGE, FIXED_TANH_RANGE] in steps of 2^-FIXED_TANH_STEP_BITS,
+//  one for each flappie_math_precision so calls agree with those in float.  That of the default
+//  precision is from tanhf; its gates use the fastest table, as they do in float.
+#define FIXED_TANH_RANGE 8
+#define FIXED_TANH_STEP_BITS 6
+#define FIXED_TANH_NSTEP ((2 * FIXED_TANH_RANGE) << FIXED_TANH_STEP_BITS)
+//  Fractional bits of position in table
+#define FIXED_TANH_FRAC 16
+#define FIXED_TANH_INTERP_BITS (FIXED_TANH_FRAC - FIXED_TANH_STEP_BITS)
+
+static fixed_point_t fixed_tanh_table[FLAPPIE_MATH_INVALID][FIXED_TANH_NSTEP + 1];
+static pthread_once_t fixed_tanh_once = PTHREAD_ONCE_INIT;
+
+static void init_fixed_tanh_table(void){
+    float y[FIXED_TANH_NSTEP + 1];
+    for(int precision=0 ; precision < FLAPPIE_MATH_INVALID ; precision++){
+        for(size_t i=0 ; i <= FIXED_TANH_NSTEP ; i++){
+            y[i] = ldexpf((float)i, -FIXED_TANH_STEP_BITS) - FIXED_TANH_RANGE;
+        }
+        if(FLAPPIE_MATH_DEFAULT == precision){
+            for(size_t i=0 ; i <= FIXED_TANH_NSTEP ; i++){
+                y[i] = tanhf(y[i]);
+            }
+        } else {
+            flappie_kernels()->math_inplace(FLAPPIE_MATH_TANH, precision, y, FIXED_TANH_NSTEP + 1);
+        }
+        for(size_t i=0 ; i <= FIXED_TANH_NSTEP ; i++){
+            fixed_tanh_table[precision][i] = float_to_fixed(y[i], FIXED_POINT_FRACTIONAL_BITS);
+        }
+    }
+}
+
+
+//  Table of tanh at the precision set, see flappie_set_math_precision
+static inline const fixed_point_t * get_fixed_tanh_table(void){
+    pthread_once(&fixed_tanh_once, init_fixed_tanh_table);
+    return fixed_tanh_table[flappie_math_precision()];
+}
+
+
+//  Table of tanh for gates of modified GRU layers, see flappie_math_gate_precision
+static inline const fixed_point_t * get_fixed_gate_tanh_table(void){
+    pthread_once(&fixed_tanh_once, init_fixed_tanh_table);
+    return fixed_tanh_table[flappie_math_gate_precision()];
+}
+
+
+/**  Tanh of fixed point number, interpolating linearly between entries of table
+ *
+ *  @param table Table of tanh
+ *  @param x Number
+ *  @param frac Fractional bits of x
+ *
+ *  @returns tanh(x) with FIXED_POINT_FRACTIONAL_BITS
+ **/
+static inline fixed_point_t fixed_tanh(const fixed_point_t * table, int32_t x, int frac){
+    //  Beyond the range of the table, tanh is one to within the format
+    const int64_t lim = (int64_t)FIXED_TANH_RANGE << frac;
+    int64_t u = (x < -lim) ? -lim : ((x >= lim) ? (lim - 1) : x);
+    u = (frac >= FIXED_TANH_FRAC) ? (u >> (frac - FIXED_TANH_FRAC)) : (u * ((int64_t)1 << (FIXED_TANH_FRAC - frac)));
+    u += (int64_t)FIXED_TANH_RANGE << FIXED_TANH_FRAC;
+    const int32_t i = (int32_t)(u >> FIXED_TANH_INTERP_BITS);
+    const int32_t r = (int32_t)(u & ((1 << FIXED_TANH_INTERP_BITS) - 1));
+    const int32_t t0 = table[i];
+    const int32_t t1 = table[i + 1];
+    return t0 + (((t1 - t0) * r + (1 << (FIXED_TANH_INTERP_BITS - 1))) >> FIXED_TANH_INTERP_BITS);
+}
+
+
+//  logistic(x) = (1 + tanh(x / 2)) / 2, and x / 2 is x with one more fractional bit
+static inline fixed_point_t fixed_logistic(const fixed_point_t * table, int32_t x, int frac){
+    return (32768 + fixed_tanh(table, x, frac + 1)) >> 1;
+}
+
+
+//  Dot product of sixteen bit vectors, both readable to a multiple of 8 elements
+static inline int32_t dot_fixed(const fixed_point_t * x, const fixed_point_t * y, size_t n){
+    __m128i acc = _mm_setzero_si128();
+    for(size_t i=0 ; i < n ; i += 8){
+        const __m128i xv = _mm_loadu_si128((const __m128i *)(x + i));
+        const __m128i yv = _mm_loadu_si128((const __m128i *)(y + i));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(xv, yv));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(acc);
+}
+
+
+/**  Convolution of signal followed by tanh, in fixed point
+ *
+ *  As convolution followed by tanh_activation_inplace for features of a
+ *  signal, which have one feature per sample.
+ *
+ *  @param x Signal, normalised
+ *  @param n Number of samples
+ *  @param frac Fractional bits samples are converted to, saturating larger samples
+ *  @param W Filter, winlen x nfilter
+ *  @param b Bias with fractional bits of frac + W->frac
+ *  @param stride Stride of convolution
+ *
+ *  @returns Matrix nfilter x ceil(n / stride) with FIXED_POINT_FRACTIONAL_BITS or NULL on failure
+ **/
+flappie_xmatrix convolution_tanh_fixed(const float * x, size_t n, int frac, const_flappie_xmatrix W,
+                                       const_flappie_imatrix b, size_t stride){
+    RETURN_NULL_IF(NULL == x, NULL);
+    assert(NULL != W);
+    assert(NULL != b);
+    assert(W->nc == b->nr);
+    assert(stride > 0);
+    const fixed_point_t * tanh_table = get_fixed_tanh_table();
+    const size_t winlen = W->nr;
+    const size_t padL = (winlen - 1) / 2;
+    const size_t ncol = iceil(n, stride);
+
+    //  Signal padded with zeros so every window, read to the padding of the filter, is inside
+    fixed_point_t * sig = calloc(padL + n + W->stride, sizeof(fixed_point_t));
+    RETURN_NULL_IF(NULL == sig, NULL);
+    for(size_t i=0 ; i < n ; i++){
+        sig[padL + i] = float_to_fixed(x[i], frac);
+    }
+    flappie_xmatrix C = make_flappie_xmatrix(W->nc, ncol, FIXED_POINT_FRACTIONAL_BITS);
+    if(NULL == C){
+        free(sig);
+        return NULL;
+    }
+
+    const int accfrac = frac + W->frac;
+    for(size_t c=0 ; c < ncol ; c++){
+        const fixed_point_t * window = sig + c * stride;
+        fixed_point_t * out = C->data + c * C->stride;
+        for(size_t f=0 ; f < W->nc ; f++){
+            const int32_t acc = b->data.f[f] + dot_fixed(W->data + f * W->stride, window, W->stride);
+            out[f] = fixed_tanh(tanh_table, acc, accfrac);
+        }
+    }
+    free(sig);
+    return C;
+}
+
+
+/**  Affine map in fixed point, C = W^t X + b
+ *
+ *  @param X Input
+ *  @param W Weights
+ *  @param b Bias with fractional bits of X->frac + W->frac
+ *  @param frac Fractional bits of result, which saturates
+ *
+ *  @returns Matrix or NULL on failure
+ **/
+flappie_xmatrix affine_map_fixed(const_flappie_xmatrix X, const_flappie_xmatrix W, const_flappie_imatrix b, int frac){
+    RETURN_NULL_IF(NULL == X, NULL);
+    assert(NULL != W);
+    assert(NULL != b);
+    assert(W->nr == X->nr);
+    assert(W->nc == b->nr);
+    assert(W->stride == X->stride);
+    flappie_xmatrix C = make_flappie_xmatrix(W->nc, X->nc, frac);
+    RETURN_NULL_IF(NULL == C, NULL);
+
+    const int shift = X->frac + W->frac - frac;
+    assert(shift >= 0);
+    for(size_t c=0 ; c < X->nc ; c++){
+        affine_columns_fixed(W->data, W->stride, W->nc, X->data + c * X->stride, X->stride, b->data.f, shift,
+                             C->data + c * C->stride);
+    }
+    return C;
+}
+
+
+/**  Modified GRU recurrence in fixed point
+ *
+ *  As aes_grumod_recurrence, so the first state is zero and the input for
+ *  that step unused.  The recurrent part of each gate, sW^t h, is narrowed
+ *  to the format of the input so the two can be added.
+ *
+ *  @param X Input to gates, 3 * size x nstep
+ *  @param sW Recurrent weights, size x 3 * size
+ *  @param backward Run recurrence from the last step to the first
+ *
+ *  @returns Matrix of states, size x nstep with FIXED_POINT_FRACTIONAL_BITS, or NULL on failure
+ **/
+flappie_xmatrix grumod_fixed(const_flappie_xmatrix X, const_flappie_xmatrix sW, bool backward){
+    RETURN_NULL_IF(NULL == X, NULL);
+    assert(NULL != sW);
+    const size_t size = sW->nr;
+    assert(X->nr == 3 * size);
+    assert(sW->nc == 3 * size);
+    const fixed_point_t * tanh_table = get_fixed_gate_tanh_table();
+
+    //  Created zeroed, so the first state is already set
+    flappie_xmatrix ostate = make_flappie_xmatrix(size, X->nc, FIXED_POINT_FRACTIONAL_BITS);
+    //  Recurrent part of gates
+    fixed_point_t * s = calloc(3 * size, sizeof(fixed_point_t));
+    if(NULL == ostate || NULL == s){
+        free(s);
+        return free_flappie_xmatrix(ostate);
+    }
+
+    const int frac = X->frac;
+    const int shift = FIXED_POINT_FRACTIONAL_BITS + sW->frac - frac;
+    for(size_t i=1 ; i < X->nc ; i++){
+        const size_t t = backward ? (X->nc - 1 - i) : i;
+        const fixed_point_t * istate = ostate->data + (backward ? (t + 1) : (t - 1)) * ostate->stride;
+        const fixed_point_t * x = X->data + t * X->stride;
+        fixed_point_t * h = ostate->data + t * ostate->stride;
+
+        affine_columns_fixed(sW->data, sW->stride, 3 * size, istate, sW->stride, NULL, shift, s);
+        for(size_t k=0 ; k < size ; k++){
+            const int32_t z = fixed_logistic(tanh_table, (int32_t)x[k] + s[k], frac);
+            const int32_t r = fixed_logistic(tanh_table, (int32_t)x[size + k] + s[size + k], frac);
+            //  Both terms are below 2^30 in magnitude
+            const int32_t hbar = fixed_tanh(tanh_table, x[2 * size + k] * 32768 + r * s[2 * size + k],
+                                            frac + FIXED_POINT_FRACTIONAL_BITS);
+            h[k] = (z * istate[k] + (32768 - z) * hbar + 16384) >> FIXED_POINT_FRACTIONAL_BITS;
+        }
+    }
+
+    free(s);
+    return ostate;
+}
+
+
+/**  Modified GRU layer in fixed point, input projection followed by recurrence
+ *
+ *  As aes_grumod.
+ *
+ *  @param Xin Input, with FIXED_POINT_FRACTIONAL_BITS
+ *  @param sW Recurrent weights
+ *  @param backward Run recurrence from the last step to the first
+ *  @param W Input weights
+ *  @param b Bias with fractional bits of Xin->frac + W->frac
+ *  @param frac Fractional bits of the input to the gates
+ *
+ *  @returns Matrix of states or NULL on failure
+ **/
+flappie_xmatrix aes_grumod_fixed(const_flappie_xmatrix Xin, const_flappie_xmatrix sW, bool backward,
+                                 const_flappie_xmatrix W, const_flappie_imatrix b, int frac){
+    RETURN_NULL_IF(NULL == Xin, NULL);
+    flappie_xmatrix X = affine_map_fixed(Xin, W, b, frac);
+    flappie_xmatrix ostate = grumod_fixed(X, sW, backward);
+    free_flappie_xmatrix(X);
+    return ostate;
+}
+
+
+/**  Flip-flop output layer with fixed point input and weights
+ *
+ *  As globalnorm_flipflop.  Tanh of the affine map is in fixed point and
+ *  scaling and normalisation, for the decoder, are in float.
+ *
+ *  @param X Input, with FIXED_POINT_FRACTIONAL_BITS
+ *  @param W Weights
+ *  @param b Bias with fractional bits of X->frac + W->frac
+ *  @param temperature Temperature of weights
+ *
+ *  @returns Matrix of transition weights or NULL on failure
+ **/
+flappie_matrix globalnorm_flipflop_fixed(const_flappie_xmatrix X, const_flappie_xmatrix W,
+                                         const_flappie_imatrix b, float temperature){
+    RETURN_NULL_IF(NULL == X, NULL);
+    assert(NULL != W);
+    assert(NULL != b);
+    assert(W->nr == X->nr);
+    assert(W->stride == X->stride);
+    const fixed_point_t * tanh_table = get_fixed_tanh_table();
+    flappie_matrix C = make_flappie_matrix(W->nc, X->nc);
+    RETURN_NULL_IF(NULL == C, NULL);
+
+    const int accfrac = X->frac + W->frac;
+    for(size_t c=0 ; c < X->nc ; c++){
+        const fixed_point_t * in = X->data + c * X->stride;
+        float * out = C->data.f + c * C->stride;
+        for(size_t r=0 ; r < W->nc ; r++){
+            const int32_t acc = b->data.f[r] + dot_fixed(W->data + r * W->stride, in, X->stride);
+            out[r] = fixed_to_float(fixed_tanh(tanh_table, acc, accfrac), FIXED_POINT_FRACTIONAL_BITS);
+        }
+    }
+    return manystay_normalise_inplace(C, temperature);
+}
+
+
 /**  Calculates number of bases
  *
  *   @param nparams
@@ -1919,6 +2619,18 @@ double runlength_partition_function(const_flappie_matrix C){
 }
 
 
+//  Tanh of transition parameters of run-length models, tanhf at the default precision
+static void transition_tanh_inplace(float * x, size_t n){
+    if(FLAPPIE_MATH_DEFAULT != flappie_math_precision()){
+        flappie_math_inplace(FLAPPIE_MATH_TANH, x, n);
+        return;
+    }
+    for(size_t i=0 ; i < n ; i++){
+        x[i] = tanhf(x[i]);
+    }
+}
+
+
 /**  Run-length encoded output layer
  *
  *   Performs initial linear transform and then scales all parameters appropriately.
@@ -1950,11 +2662,12 @@ flappie_matrix globalnorm_runlength(const_flappie_matrix X, const_flappie_matrix
 
     for(size_t c=0 ; c < C->nc ; c++){
         const size_t offset = c * C->stride;
+        transition_tanh_inplace(C->data.f + offset + 2 * nbase, 2 * nbase);
         for(size_t b=0 ; b < nbase ; b++){
             C->data.f[offset + b] = 1.0f + softplusf(C->data.f[offset + b]);
             C->data.f[offset + nbase + b] = ETA + softplusf(C->data.f[offset + nbase + b]);
-            C->data.f[offset + 2 * nbase + b] = 5.0f * tanhf(C->data.f[offset + 2 * nbase + b]) / temperature;
-            C->data.f[offset + 3 * nbase + b] = 5.0f * tanhf(C->data.f[offset + 3 * nbase + b]) / temperature;
+            C->data.f[offset + 2 * nbase + b] = 5.0f * C->data.f[offset + 2 * nbase + b] / temperature;
+            C->data.f[offset + 3 * nbase + b] = 5.0f * C->data.f[offset + 3 * nbase + b] / temperature;
         }
     }
 
@@ -2084,9 +2797,10 @@ flappie_matrix globalnorm_runlengthV2(const_flappie_matrix X, const_flappie_matr
             C->data.f[offset + b] = 1.0f + softplusf(C->data.f[offset + b]);
             C->data.f[offset + nbase + b] = 1e-8f + softplusf(C->data.f[offset + nbase + b]);
         }
+        //  Transition parameters
+        transition_tanh_inplace(C->data.f + offset + nrunparam, C->nr - nrunparam);
         for(size_t param=nrunparam ; param < C->nr ; param++){
-            //  Transition parameters
-            C->data.f[offset + param] = 5.0f * tanhf(C->data.f[offset + param]) / temperature;
+            C->data.f[offset + param] = 5.0f * C->data.f[offset + param] / temperature;
         }
     }
 
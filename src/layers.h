@@ -11,6 +11,7 @@
 #    define LAYERS_H
 
 #    include "flappie_matrix.h"
+#    include "flappie_threadpool.h"
 
 void tanh_activation_inplace(flappie_matrix C);
 void tanh_activation_inplace_vec(flappie_matrix_vec C, int nfiles);
@@ -25,7 +26,10 @@ flappie_matrix window(const_flappie_matrix input, size_t w, size_t stride);
 flappie_matrix convolution_linear(const_flappie_matrix X, const_flappie_matrix W, const_flappie_matrix b, size_t stride, flappie_matrix C,
 				const_flappie_matrix iW, const_flappie_matrix bG);
 flappie_matrix convolution(const_flappie_matrix X, const_flappie_matrix W, const_flappie_matrix b, size_t stride, flappie_matrix C);
-flappie_matrix_vec convolution_vec(flappie_matrix_vec X, const_flappie_matrix W, const_flappie_matrix b, size_t stride, int nfiles);
+flappie_matrix_vec convolution_vec(flappie_matrix_vec X, const_flappie_matrix W, const_flappie_matrix b, size_t stride, int nfiles,
+                                   flappie_threadpool pool);
+flappie_matrix convolution_padded(const_flappie_matrix X, const_flappie_matrix W, const_flappie_matrix b, size_t stride,
+                                  size_t nbatch, const size_t * nvalid, flappie_threadpool pool);
 flappie_matrix feedforward_linear(const_flappie_matrix X, const_flappie_matrix W, const_flappie_matrix b, flappie_matrix C);
 flappie_matrix_vec feedforward_linear_vec(const_flappie_matrix_vec X, const_flappie_matrix W, const_flappie_matrix b, flappie_matrix_vec C);
 flappie_matrix feedforward_tanh(const_flappie_matrix X,
@@ -65,13 +69,42 @@ flappie_matrix aes_grumod_linear(const_flappie_matrix X, const_flappie_matrix sW
 flappie_matrix aes_grumod(const_flappie_matrix X, const_flappie_matrix sW, flappie_matrix ostate, bool backward, const_flappie_matrix W, const_flappie_matrix b);
 flappie_matrix_vec aes_grumod_vec( flappie_matrix_vec Xin, const_flappie_matrix sW, flappie_matrix_vec ostate, bool backward, const_flappie_matrix W, const_flappie_matrix b); 
 
-flappie_matrix_vec aes_grumod_vec_forward( flappie_matrix_vec Xin, const_flappie_matrix sW, flappie_matrix_vec ostate, const_flappie_matrix W, const_flappie_matrix b, int nfiles); 
+flappie_matrix_vec aes_grumod_vec_forward( flappie_matrix_vec Xin, const_flappie_matrix sW, flappie_matrix_vec ostate, const_flappie_matrix W, const_flappie_matrix b, int nfiles, flappie_threadpool pool); 
 
-flappie_matrix_vec aes_grumod_vec_backward( flappie_matrix_vec Xin, const_flappie_matrix sW, flappie_matrix_vec ostate, const_flappie_matrix W, const_flappie_matrix b, int nfiles); 
+flappie_matrix_vec aes_grumod_vec_backward( flappie_matrix_vec Xin, const_flappie_matrix sW, flappie_matrix_vec ostate, const_flappie_matrix W, const_flappie_matrix b, int nfiles, flappie_threadpool pool); 
+flappie_matrix aes_grumod_padded(const_flappie_matrix X, const_flappie_matrix sW, bool backward,
+                                 const_flappie_matrix W, const_flappie_matrix b, size_t nbatch, const size_t * nvalid,
+                                 flappie_threadpool pool);
+flappie_matrix aes_grumod_interleaved(const_flappie_matrix Xin, const_flappie_matrix sW,
+                                      const_flappie_qmatrix sWq, const_flappie_hmatrix sWh, bool backward,
+                                      const_flappie_matrix W, const_flappie_matrix b,
+                                      size_t nbatch, const size_t * nvalid, flappie_threadpool pool);
+flappie_hmatrix aes_grumod_interleaved_half(const_flappie_hmatrix Xin, const_flappie_matrix sW,
+                                            const_flappie_qmatrix sWq, const_flappie_hmatrix sWh, bool backward,
+                                            const_flappie_matrix W, const_flappie_matrix b,
+                                            size_t nbatch, const size_t * nvalid, flappie_threadpool pool);
+
+flappie_xmatrix convolution_tanh_fixed(const float * x, size_t n, int frac, const_flappie_xmatrix W,
+                                       const_flappie_imatrix b, size_t stride);
+flappie_xmatrix affine_map_fixed(const_flappie_xmatrix X, const_flappie_xmatrix W, const_flappie_imatrix b, int frac);
+flappie_xmatrix grumod_fixed(const_flappie_xmatrix X, const_flappie_xmatrix sW, bool backward);
+flappie_xmatrix aes_grumod_fixed(const_flappie_xmatrix Xin, const_flappie_xmatrix sW, bool backward,
+                                 const_flappie_xmatrix W, const_flappie_imatrix b, int frac);
+flappie_matrix globalnorm_flipflop_fixed(const_flappie_xmatrix X, const_flappie_xmatrix W,
+                                         const_flappie_imatrix b, float temperature);
 
 void grumod_step(const_flappie_matrix x, const_flappie_matrix istate,
                  const_flappie_matrix sW, flappie_matrix xF,
                  flappie_matrix ostate);
+void grumod_step_fused(const float * x, const float * istate, const_flappie_matrix sW, float * ostate);
+void grumod_step_fused_batch(const float * x, size_t ldx, const float * istate, size_t ldh,
+                             const_flappie_matrix sW, float * ostate, size_t ldo, size_t nlane);
+void grumod_step_fused_batch_int8(const float * x, size_t ldx, const float * istate, size_t ldh,
+                                  const_flappie_qmatrix sW, float * ostate, size_t ldo, size_t nlane);
+void grumod_step_fused_batch_half(const float * x, size_t ldx, const float * istate, size_t ldh,
+                                  const_flappie_hmatrix sW, float * ostate, size_t ldo, size_t nlane);
+void affine_columns_fixed(const fixed_point_t * W, size_t ld, size_t ncol, const fixed_point_t * x,
+                          size_t n, const int32_t * b, int shift, fixed_point_t * out);
 
 flappie_matrix gru_relu_forward(const_flappie_matrix X, const_flappie_matrix sW,
                                 const_flappie_matrix sW2, flappie_matrix res);
@@ -88,6 +121,10 @@ flappie_matrix lstm_backward(const_flappie_matrix X, const_flappie_matrix sW,
 void lstm_step(const_flappie_matrix x, const_flappie_matrix out_prev,
                const_flappie_matrix sW, flappie_matrix xF,
                flappie_matrix state, flappie_matrix output);
+flappie_matrix lstm_padded(const_flappie_matrix Xaffine, const_flappie_matrix sW, bool backward,
+                           size_t nbatch, const size_t * nvalid);
+flappie_matrix grumod_padded(const_flappie_matrix X, const_flappie_matrix sW, bool backward,
+                             size_t nbatch, const size_t * nvalid);
 
 
 double crf_manystay_partition_function(const_flappie_matrix C);
@@ -6,6 +6,8 @@
  *  http://nanoporetech.com
  */
 
+#include <pthread.h>
+
 #include "layers.h"
 #include "models/flipflop_r941native.h"
 #include "models/flipflop_r941native5mC.h"
@@ -14,6 +16,8 @@
 #include "models/runlength_r941nativeV2.h"
 #include "networks.h"
 #include "nnfeatures.h"
+#include "flappie_numa.h"
+#include "flappie_profile.h"
 #include "flappie_stdlib.h"
 #include "util.h"
 
@@ -150,6 +154,8 @@ typedef struct {
 } sloika_model;
 
 
+struct fixed_guppy_model;
+
 typedef struct {
     //  Convolution layer
     const flappie_matrix conv_W;
@@ -178,6 +184,20 @@ typedef struct {
     //  Output
     const flappie_matrix FF_W;
     const flappie_matrix FF_b;
+    //  Recurrent weights quantised to int8, NULL unless model is quantised
+    const flappie_qmatrix gruB1_sWq;
+    const flappie_qmatrix gruF2_sWq;
+    const flappie_qmatrix gruB3_sWq;
+    const flappie_qmatrix gruF4_sWq;
+    const flappie_qmatrix gruB5_sWq;
+    //  Recurrent weights as sixteen bit floats, NULL unless model is stored so
+    const flappie_hmatrix gruB1_sWh;
+    const flappie_hmatrix gruF2_sWh;
+    const flappie_hmatrix gruB3_sWh;
+    const flappie_hmatrix gruF4_sWh;
+    const flappie_hmatrix gruB5_sWh;
+    //  Flip-flop model in fixed point, NULL unless model is stored so
+    struct fixed_guppy_model * const fixed;
 } guppy_model;
 
 
@@ -386,18 +406,6 @@ flappie_matrix flipflop_gru_transitions(const raw_table signal, float temperatur
     return trans;
 }
 
-#include <sys/time.h>
-struct timeval start, end_time;
-
-typedef uint16_t fixed_point_t;
-#define FIXED_POINT_FRACTIONAL_BITS 5
-inline float fixed_to_float(fixed_point_t input) {
-    return ((float)input / (float)(1 << FIXED_POINT_FRACTIONAL_BITS));
-}
-inline fixed_point_t float_to_fixed(float input) {
-    return (fixed_point_t)(round(input * (1 << FIXED_POINT_FRACTIONAL_BITS)));
-}
-
 flappie_matrix flipflop_guppy_transitions_linear(const raw_table signal, float temperature, const guppy_model * net){
     RETURN_NULL_IF(0 == signal.n, NULL);
     RETURN_NULL_IF(NULL == signal.raw, NULL);
@@ -428,38 +436,1425 @@ flappie_matrix flipflop_guppy_transitions_linear(const raw_table signal, float t
     return trans;
 }
 
-void flipflop_guppy_transitions_linear_vec(raw_table signal[], float temperature, const guppy_model * net, int nfiles, flappie_matrix trans_weights[]){
+void flipflop_guppy_transitions_linear_vec(raw_table signal[], float temperature, const guppy_model * net, int nfiles, flappie_matrix trans_weights[],
+                                           flappie_threadpool pool){
+  for (int fn=0; fn < nfiles; fn++){
+    trans_weights[fn] = NULL;
+  }
 
   flappie_matrix_vec raw_mat;
   flappie_matrix_vec conv;
   raw_mat = features_from_raw_vec(signal, nfiles);
+  if (NULL == raw_mat){
+    return;
+  }
 
-  conv = convolution_vec(raw_mat, net->conv_W, net->conv_b, net->conv_stride, nfiles);
-  tanh_activation_inplace_vec(conv, nfiles);
+  conv = convolution_vec(raw_mat, net->conv_W, net->conv_b, net->conv_stride, nfiles, pool);
   raw_mat = free_flappie_matrix_vec(raw_mat, nfiles);
+  if (NULL == conv){
+    return;
+  }
+  tanh_activation_inplace_vec(conv, nfiles);
 
-  flappie_matrix_vec gruB1 = aes_grumod_vec_backward(conv, net->gruB1_sW, NULL, net->gruB1_iW, net->gruB1_b, nfiles );
+  flappie_matrix_vec gruB1 = aes_grumod_vec_backward(conv, net->gruB1_sW, NULL, net->gruB1_iW, net->gruB1_b, nfiles, pool);
   conv = free_flappie_matrix_vec(conv, nfiles);
+  if (NULL == gruB1){
+    return;
+  }
 
-  flappie_matrix_vec gruF2 = aes_grumod_vec_forward(gruB1, net->gruF2_sW, NULL, net->gruF2_iW, net->gruF2_b, nfiles );
+  flappie_matrix_vec gruF2 = aes_grumod_vec_forward(gruB1, net->gruF2_sW, NULL, net->gruF2_iW, net->gruF2_b, nfiles, pool);
   gruB1 = free_flappie_matrix_vec(gruB1, nfiles);
+  if (NULL == gruF2){
+    return;
+  }
 
-  flappie_matrix_vec gruB3 = aes_grumod_vec_backward(gruF2, net->gruB3_sW, NULL, net->gruB3_iW, net->gruB3_b, nfiles);
+  flappie_matrix_vec gruB3 = aes_grumod_vec_backward(gruF2, net->gruB3_sW, NULL, net->gruB3_iW, net->gruB3_b, nfiles, pool);
   gruF2 = free_flappie_matrix_vec(gruF2, nfiles);
+  if (NULL == gruB3){
+    return;
+  }
 
-  flappie_matrix_vec gruF4 = aes_grumod_vec_forward(gruB3, net->gruF4_sW, NULL, net->gruF4_iW, net->gruF4_b, nfiles);
+  flappie_matrix_vec gruF4 = aes_grumod_vec_forward(gruB3, net->gruF4_sW, NULL, net->gruF4_iW, net->gruF4_b, nfiles, pool);
   gruB3 = free_flappie_matrix_vec(gruB3, nfiles);
+  if (NULL == gruF4){
+    return;
+  }
 
-  flappie_matrix_vec gruB5 = aes_grumod_vec_backward(gruF4, net->gruB5_sW, NULL, net->gruB5_iW, net->gruB5_b, nfiles);
+  flappie_matrix_vec gruB5 = aes_grumod_vec_backward(gruF4, net->gruB5_sW, NULL, net->gruB5_iW, net->gruB5_b, nfiles, pool);
   gruF4 = free_flappie_matrix_vec(gruF4, nfiles);
+  if (NULL == gruB5){
+    return;
+  }
 
   for (int fn=0; fn < nfiles; fn++)
     trans_weights[fn] = globalnorm_flipflop(gruB5[fn], net->FF_W, net->FF_b, temperature, NULL);
   gruB5 = free_flappie_matrix_vec(gruB5, nfiles);
 }
 
-void calculate_transitions_new(raw_table signal[], float temperature, enum model_type model, int nfiles, flappie_matrix trans_weights[]){
-    flipflop_guppy_transitions_linear_vec(signal, temperature, &flipflop_r941native_guppy, nfiles, trans_weights);
+typedef flappie_matrix (*globalnorm_function)(const_flappie_matrix X, const_flappie_matrix W,
+                                              const_flappie_matrix b, float temperature,
+                                              flappie_matrix C);
+
+struct globalnorm_padded_data {
+    globalnorm_function globalnorm;
+    const_flappie_matrix X;
+    const guppy_model * net;
+    float temperature;
+    size_t nbatch;
+    const size_t * nvalid;
+    flappie_matrix * trans_weights;
+};
+
+
+static void globalnorm_padded_read(size_t i, void * ptr){
+    struct globalnorm_padded_data * d = ptr;
+    if(0 == d->nvalid[i]){
+        return;
+    }
+    _Mat view = flappie_matrix_batch_view(d->X, d->nbatch, i, d->nvalid[i]);
+    d->trans_weights[i] = d->globalnorm(&view, d->net->FF_W, d->net->FF_b, d->temperature, NULL);
+}
+
+
+struct read_length {
+    size_t length;
+    int idx;
+};
+
+static int cmp_read_length(const void * a, const void * b){
+    const struct read_length * ra = a;
+    const struct read_length * rb = b;
+    if(ra->length != rb->length){
+        return (ra->length < rb->length) ? -1 : 1;
+    }
+    return ra->idx - rb->idx;
+}
+
+
+//  Lanes of an interleaved batch, longest read first, and their lengths
+static bool lanes_longest_first(const size_t * nvalid, size_t nbatch, size_t * order, size_t * lane_nvalid){
+    struct read_length * len = calloc(nbatch, sizeof(struct read_length));
+    RETURN_NULL_IF(NULL == len, false);
+    for(size_t i=0 ; i < nbatch ; i++){
+        len[i] = (struct read_length){nvalid[i], i};
+    }
+    qsort(len, nbatch, sizeof(struct read_length), cmp_read_length);
+    for(size_t j=0 ; j < nbatch ; j++){
+        order[j] = len[nbatch - 1 - j].idx;
+        lane_nvalid[j] = len[nbatch - 1 - j].length;
+    }
+    free(len);
+    return true;
+}
+
+
+//  Format of sixteen bit floats of a precision
+static enum flappie_half_format half_format(enum flappie_precision precision){
+    return (FLAPPIE_PRECISION_BF16 == precision) ? FLAPPIE_HALF_BF16 : FLAPPIE_HALF_FP16;
+}
+
+
+//  Precision of activations stored between layers
+static enum flappie_precision activation_precision = FLAPPIE_PRECISION_FLOAT;
+
+
+/**  Calculate transition weights for a padded batch of reads
+ *
+ *  Reads are padded to the length of the longest and the valid length of
+ *  each read is carried through every layer, so results match calling each
+ *  read separately.  The recurrent layers run on an interleaved copy of the
+ *  batch, longest read first, so each step of all reads is taken together
+ *  with one pass over the recurrent weights.  The interleaved activations
+ *  are stored as sixteen bit floats if set by flappie_set_activation_precision.
+ **/
+static void flipflop_guppy_transitions_padded(const raw_table * signal, size_t nbatch, float temperature,
+                                              const guppy_model * net, flappie_matrix * trans_weights,
+                                              flappie_threadpool pool){
+    for(size_t i=0 ; i < nbatch ; i++){
+        trans_weights[i] = NULL;
+    }
+
+    size_t * nvalid = calloc(3 * nbatch, sizeof(size_t));
+    if(NULL == nvalid){
+        return;
+    }
+    size_t * order = nvalid + nbatch;
+    size_t * lane_nvalid = order + nbatch;
+    size_t nsample = 0;
+    for(size_t i=0 ; i < nbatch ; i++){
+        nvalid[i] = signal[i].end - signal[i].start;
+        nsample += nvalid[i];
+    }
+    const bool half = (FLAPPIE_PRECISION_FLOAT != activation_precision);
+
+    double t = flappie_profile_start();
+    flappie_matrix raw_mat = features_from_raw_padded(signal, nbatch);
+    flappie_matrix conv = convolution_padded(raw_mat, net->conv_W, net->conv_b, net->conv_stride, nbatch, nvalid, pool);
+    raw_mat = free_flappie_matrix(raw_mat);
+    for(size_t i=0 ; i < nbatch ; i++){
+        nvalid[i] = iceil(nvalid[i], net->conv_stride);
+    }
+    if(NULL != conv){
+        tanh_activation_inplace(conv);
+    }
+    flappie_matrix lanes = NULL;
+    if(lanes_longest_first(nvalid, nbatch, order, lane_nvalid)){
+        lanes = interleave_flappie_matrix(conv, nbatch, order, NULL);
+    }
+    conv = free_flappie_matrix(conv);
+    flappie_hmatrix hlanes = NULL;
+    if(half && NULL != lanes){
+        hlanes = half_from_flappie_matrix(lanes, half_format(activation_precision));
+        lanes = free_flappie_matrix(lanes);
+    }
+    flappie_profile_stop_batch(FLAPPIE_PROFILE_CONVOLUTION, t, nbatch, nsample);
+
+    const_flappie_matrix iW[] = {net->gruB1_iW, net->gruF2_iW, net->gruB3_iW, net->gruF4_iW, net->gruB5_iW};
+    const_flappie_matrix sW[] = {net->gruB1_sW, net->gruF2_sW, net->gruB3_sW, net->gruF4_sW, net->gruB5_sW};
+    const_flappie_qmatrix sWq[] = {net->gruB1_sWq, net->gruF2_sWq, net->gruB3_sWq, net->gruF4_sWq, net->gruB5_sWq};
+    const_flappie_hmatrix sWh[] = {net->gruB1_sWh, net->gruF2_sWh, net->gruB3_sWh, net->gruF4_sWh, net->gruB5_sWh};
+    const_flappie_matrix b[] = {net->gruB1_b, net->gruF2_b, net->gruB3_b, net->gruF4_b, net->gruB5_b};
+    const enum flappie_profile_stage stage[] = {FLAPPIE_PROFILE_GRU1, FLAPPIE_PROFILE_GRU2, FLAPPIE_PROFILE_GRU3,
+                                                FLAPPIE_PROFILE_GRU4, FLAPPIE_PROFILE_GRU5};
+    for(size_t layer=0 ; layer < 5 ; layer++){
+        //  Layers alternate direction, starting backwards
+        const bool backward = (0 == layer % 2);
+        t = flappie_profile_start();
+        if(half){
+            flappie_hmatrix next = aes_grumod_interleaved_half(hlanes, sW[layer], sWq[layer], sWh[layer], backward,
+                                                               iW[layer], b[layer], nbatch, lane_nvalid, pool);
+            free_flappie_hmatrix(hlanes);
+            hlanes = next;
+        } else {
+            flappie_matrix next = aes_grumod_interleaved(lanes, sW[layer], sWq[layer], sWh[layer], backward,
+                                                         iW[layer], b[layer], nbatch, lane_nvalid, pool);
+            free_flappie_matrix(lanes);
+            lanes = next;
+        }
+        flappie_profile_stop_batch(stage[layer], t, nbatch, nsample);
+    }
+    if(half){
+        lanes = flappie_matrix_from_half(hlanes);
+        hlanes = free_flappie_hmatrix(hlanes);
+    }
+
+    flappie_matrix gru_out = deinterleave_flappie_matrix(lanes, nbatch, order, NULL);
+    lanes = free_flappie_matrix(lanes);
+
+    t = flappie_profile_start();
+    if(NULL != gru_out){
+        struct globalnorm_padded_data data = {globalnorm_flipflop, gru_out, net, temperature, nbatch, nvalid, trans_weights};
+        flappie_parallel_for_weighted(pool, nbatch, nvalid, globalnorm_padded_read, &data);
+    }
+    gru_out = free_flappie_matrix(gru_out);
+    flappie_profile_stop_batch(FLAPPIE_PROFILE_GLOBALNORM, t, nbatch, nsample);
+    free(nvalid);
+}
+
+
+//  Input projection of recurrent layer followed by recurrence, over a padded batch
+static flappie_matrix runlength_layer_padded(const_flappie_matrix X, const_flappie_matrix iW, const_flappie_matrix sW,
+                                             const_flappie_matrix b, bool backward, bool lstm,
+                                             size_t nbatch, const size_t * nvalid){
+    RETURN_NULL_IF(NULL == X, NULL);
+    //  Padding columns are projected too but never read by the recurrence
+    flappie_matrix Xin = feedforward_linear(X, iW, b, NULL);
+    flappie_matrix out = lstm ? lstm_padded(Xin, sW, backward, nbatch, nvalid)
+                              : grumod_padded(Xin, sW, backward, nbatch, nvalid);
+    Xin = free_flappie_matrix(Xin);
+    return out;
+}
+
+
+/**  Calculate run-length transition weights for a padded batch of reads
+ *
+ *  As flipflop_guppy_transitions_padded but each recurrent layer steps every
+ *  read of the batch together, so the recurrent weights are applied to the
+ *  whole batch with one matrix-matrix product per step.
+ *
+ *  @param lstm Recurrent layers are LSTM (runnie V2 model) rather than modified GRU
+ **/
+static void runlength_guppy_transitions_padded(const raw_table * signal, size_t nbatch, float temperature,
+                                               const guppy_model * net, flappie_matrix * trans_weights,
+                                               flappie_threadpool pool, bool lstm){
+    for(size_t i=0 ; i < nbatch ; i++){
+        trans_weights[i] = NULL;
+    }
+
+    size_t * nvalid = calloc(nbatch, sizeof(size_t));
+    if(NULL == nvalid){
+        return;
+    }
+    for(size_t i=0 ; i < nbatch ; i++){
+        nvalid[i] = signal[i].end - signal[i].start;
+    }
+
+    flappie_matrix raw_mat = features_from_raw_padded(signal, nbatch);
+    flappie_matrix conv = convolution_padded(raw_mat, net->conv_W, net->conv_b, net->conv_stride, nbatch, nvalid, pool);
+    raw_mat = free_flappie_matrix(raw_mat);
+    for(size_t i=0 ; i < nbatch ; i++){
+        nvalid[i] = iceil(nvalid[i], net->conv_stride);
+    }
+    if(NULL != conv){
+        tanh_activation_inplace(conv);
+    }
+
+    flappie_matrix gruB1 = runlength_layer_padded(conv, net->gruB1_iW, net->gruB1_sW, net->gruB1_b, true, lstm, nbatch, nvalid);
+    conv = free_flappie_matrix(conv);
+
+    flappie_matrix gruF2 = runlength_layer_padded(gruB1, net->gruF2_iW, net->gruF2_sW, net->gruF2_b, false, lstm, nbatch, nvalid);
+    gruB1 = free_flappie_matrix(gruB1);
+
+    flappie_matrix gruB3 = runlength_layer_padded(gruF2, net->gruB3_iW, net->gruB3_sW, net->gruB3_b, true, lstm, nbatch, nvalid);
+    gruF2 = free_flappie_matrix(gruF2);
+
+    flappie_matrix gruF4 = runlength_layer_padded(gruB3, net->gruF4_iW, net->gruF4_sW, net->gruF4_b, false, lstm, nbatch, nvalid);
+    gruB3 = free_flappie_matrix(gruB3);
+
+    flappie_matrix gruB5 = runlength_layer_padded(gruF4, net->gruB5_iW, net->gruB5_sW, net->gruB5_b, true, lstm, nbatch, nvalid);
+    gruF4 = free_flappie_matrix(gruF4);
+
+    if(NULL != gruB5){
+        struct globalnorm_padded_data data = {lstm ? globalnorm_runlengthV2 : globalnorm_runlength, gruB5, net,
+                                              temperature, nbatch, nvalid, trans_weights};
+        flappie_parallel_for_weighted(pool, nbatch, nvalid, globalnorm_padded_read, &data);
+    }
+    gruB5 = free_flappie_matrix(gruB5);
+    free(nvalid);
+}
+
+
+//  Longest read in a bucket is at most this much longer than the shortest
+static const float max_bucket_padding = 0.25f;
+
+//  Copies of the weights of each model at each precision local to a NUMA node, NULL if none
+static guppy_model * model_replica[FLAPPIE_MAX_NUMA_NODE][FLAPPIE_PRECISION_INVALID][RUNNIE_MODEL_INVALID];
+static pthread_mutex_t model_replica_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**  Flip-flop model in fixed point
+ *
+ *   Each affine map has weights in the format from fixed_weight_frac and a
+ *   32 bit bias at the format of its products.  The formats of the features
+ *   and of the input to the gates of each recurrent layer are set by the
+ *   calibration of the model or, if it has none, from bounds on the weights.
+ **/
+struct fixed_guppy_model {
+    int conv_stride;
+    int features_frac;
+    flappie_xmatrix conv_W;
+    flappie_imatrix conv_b;
+    int gate_frac[FLAPPIE_NLAYER_RECURRENT];
+    flappie_xmatrix iW[FLAPPIE_NLAYER_RECURRENT];
+    flappie_imatrix b[FLAPPIE_NLAYER_RECURRENT];
+    flappie_xmatrix sW[FLAPPIE_NLAYER_RECURRENT];
+    flappie_xmatrix FF_W;
+    flappie_imatrix FF_b;
+};
+
+//  Normalised signal rarely exceeds this; without a calibration, larger samples saturate
+static const float default_features_range = 8.0f;
+
+//  Calibration of each flip-flop model, set by flappie_set_calibration
+static struct flappie_calibration model_calibration[FLAPPIE_MODEL_INVALID];
+static bool model_calibrated[FLAPPIE_MODEL_INVALID];
+
+
+static struct fixed_guppy_model * free_fixed_guppy_model(struct fixed_guppy_model * net){
+    if(NULL != net){
+        free_flappie_xmatrix(net->conv_W);
+        free_flappie_imatrix(net->conv_b);
+        for(size_t layer=0 ; layer < FLAPPIE_NLAYER_RECURRENT ; layer++){
+            free_flappie_xmatrix(net->iW[layer]);
+            free_flappie_imatrix(net->b[layer]);
+            free_flappie_xmatrix(net->sW[layer]);
+        }
+        free_flappie_xmatrix(net->FF_W);
+        free_flappie_imatrix(net->FF_b);
+        free(net);
+    }
+    return NULL;
+}
+
+
+static bool fixed_guppy_model_complete(const struct fixed_guppy_model * net){
+    bool complete = NULL != net->conv_W && NULL != net->conv_b && NULL != net->FF_W && NULL != net->FF_b;
+    for(size_t layer=0 ; layer < FLAPPIE_NLAYER_RECURRENT ; layer++){
+        complete = complete && NULL != net->iW[layer] && NULL != net->b[layer] && NULL != net->sW[layer];
+    }
+    return complete;
+}
+
+
+static struct fixed_guppy_model * copy_fixed_guppy_model(const struct fixed_guppy_model * net){
+    RETURN_NULL_IF(NULL == net, NULL);
+    struct fixed_guppy_model * copy = calloc(1, sizeof(*copy));
+    RETURN_NULL_IF(NULL == copy, NULL);
+    copy->conv_stride = net->conv_stride;
+    copy->features_frac = net->features_frac;
+    copy->conv_W = copy_flappie_xmatrix(net->conv_W);
+    copy->conv_b = copy_flappie_imatrix(net->conv_b);
+    for(size_t layer=0 ; layer < FLAPPIE_NLAYER_RECURRENT ; layer++){
+        copy->gate_frac[layer] = net->gate_frac[layer];
+        copy->iW[layer] = copy_flappie_xmatrix(net->iW[layer]);
+        copy->b[layer] = copy_flappie_imatrix(net->b[layer]);
+        copy->sW[layer] = copy_flappie_xmatrix(net->sW[layer]);
+    }
+    copy->FF_W = copy_flappie_xmatrix(net->FF_W);
+    copy->FF_b = copy_flappie_imatrix(net->FF_b);
+    return fixed_guppy_model_complete(copy) ? copy : free_fixed_guppy_model(copy);
+}
+
+
+//  Weights of affine map in fixed point, and bias at the format of products with input of infrac bits
+static void fixed_affine_weights(const_flappie_matrix W, const_flappie_matrix b, int infrac,
+                                 flappie_xmatrix * fW, flappie_imatrix * fb){
+    if(NULL == W){
+        return;
+    }
+    const int frac = fixed_weight_frac(W, b);
+    *fW = fixed_from_flappie_matrix(W, frac);
+    *fb = fixed_bias(b, infrac + frac);
+}
+
+
+//  Largest sum of magnitudes of a column of weights and its bias
+static float max_column_sum(const_flappie_matrix W, const_flappie_matrix b){
+    float maxsum = 0.0f;
+    for(size_t c=0 ; c < W->nc ; c++){
+        float sum = (NULL != b) ? fabsf(b->data.f[c]) : 0.0f;
+        for(size_t r=0 ; r < W->nr ; r++){
+            sum += fabsf(W->data.f[c * W->stride + r]);
+        }
+        maxsum = fmaxf(maxsum, sum);
+    }
+    return maxsum;
+}
+
+
+/**  Convert flip-flop model to fixed point
+ *
+ *   Without a calibration, the input to the gates of each recurrent layer
+ *   is bounded by the sums of magnitudes of its weights, since its input
+ *   and state are bounded by one.  These bounds are loose, so costing
+ *   precision, but never saturate.
+ *
+ *  @param net Model
+ *  @param cal Calibration of model or NULL
+ *
+ *  @returns Model or NULL on failure
+ **/
+static struct fixed_guppy_model * make_fixed_guppy_model(const guppy_model * net, const struct flappie_calibration * cal){
+    struct fixed_guppy_model * fixed = calloc(1, sizeof(*fixed));
+    RETURN_NULL_IF(NULL == fixed, NULL);
+    fixed->conv_stride = net->conv_stride;
+    fixed->features_frac = fixed_frac_for_range((NULL != cal) ? cal->features : default_features_range,
+                                                FIXED_POINT_FRACTIONAL_BITS);
+
+    //  Filter without the rows padding the single feature to a vector of four
+    const size_t winlen = net->conv_W->nrq;
+    flappie_matrix conv_W = make_flappie_matrix(winlen, net->conv_W->nc);
+    if(NULL != conv_W){
+        for(size_t f=0 ; f < conv_W->nc ; f++){
+            for(size_t w=0 ; w < winlen ; w++){
+                conv_W->data.f[f * conv_W->stride + w] = net->conv_W->data.f[f * net->conv_W->stride + 4 * w];
+            }
+        }
+    }
+    fixed_affine_weights(conv_W, net->conv_b, fixed->features_frac, &fixed->conv_W, &fixed->conv_b);
+    conv_W = free_flappie_matrix(conv_W);
+
+    const_flappie_matrix iW[] = {net->gruB1_iW, net->gruF2_iW, net->gruB3_iW, net->gruF4_iW, net->gruB5_iW};
+    const_flappie_matrix sW[] = {net->gruB1_sW, net->gruF2_sW, net->gruB3_sW, net->gruF4_sW, net->gruB5_sW};
+    const_flappie_matrix b[] = {net->gruB1_b, net->gruF2_b, net->gruB3_b, net->gruF4_b, net->gruB5_b};
+    for(size_t layer=0 ; layer < FLAPPIE_NLAYER_RECURRENT ; layer++){
+        const float range = (NULL != cal) ? fmaxf(cal->gru_input[layer], cal->gru_recurrent[layer])
+                                          : fmaxf(max_column_sum(iW[layer], b[layer]), max_column_sum(sW[layer], NULL));
+        fixed->gate_frac[layer] = fixed_frac_for_range(range, FIXED_POINT_FRACTIONAL_BITS);
+        fixed_affine_weights(iW[layer], b[layer], FIXED_POINT_FRACTIONAL_BITS, &fixed->iW[layer], &fixed->b[layer]);
+        fixed->sW[layer] = fixed_from_flappie_matrix(sW[layer], fixed_weight_frac(sW[layer], NULL));
+    }
+    fixed_affine_weights(net->FF_W, net->FF_b, FIXED_POINT_FRACTIONAL_BITS, &fixed->FF_W, &fixed->FF_b);
+
+    return fixed_guppy_model_complete(fixed) ? fixed : free_fixed_guppy_model(fixed);
+}
+
+
+static void free_guppy_model_weights(guppy_model * net){
+    free_flappie_matrix(net->conv_W);
+    free_flappie_matrix(net->conv_b);
+    free_flappie_matrix(net->gruB1_iW);
+    free_flappie_matrix(net->gruB1_sW);
+    free_flappie_matrix(net->gruB1_b);
+    free_flappie_matrix(net->gruF2_iW);
+    free_flappie_matrix(net->gruF2_sW);
+    free_flappie_matrix(net->gruF2_b);
+    free_flappie_matrix(net->gruB3_iW);
+    free_flappie_matrix(net->gruB3_sW);
+    free_flappie_matrix(net->gruB3_b);
+    free_flappie_matrix(net->gruF4_iW);
+    free_flappie_matrix(net->gruF4_sW);
+    free_flappie_matrix(net->gruF4_b);
+    free_flappie_matrix(net->gruB5_iW);
+    free_flappie_matrix(net->gruB5_sW);
+    free_flappie_matrix(net->gruB5_b);
+    free_flappie_matrix(net->FF_W);
+    free_flappie_matrix(net->FF_b);
+    free_flappie_qmatrix(net->gruB1_sWq);
+    free_flappie_qmatrix(net->gruF2_sWq);
+    free_flappie_qmatrix(net->gruB3_sWq);
+    free_flappie_qmatrix(net->gruF4_sWq);
+    free_flappie_qmatrix(net->gruB5_sWq);
+    free_flappie_hmatrix(net->gruB1_sWh);
+    free_flappie_hmatrix(net->gruF2_sWh);
+    free_flappie_hmatrix(net->gruB3_sWh);
+    free_flappie_hmatrix(net->gruF4_sWh);
+    free_flappie_hmatrix(net->gruB5_sWh);
+    free_fixed_guppy_model(net->fixed);
+}
+
+
+//  Deep copy of weights, allocated and written by the calling thread
+static guppy_model * copy_guppy_model(const guppy_model * net){
+    const bool quantised = (NULL != net->gruB1_sWq);
+    const bool half = (NULL != net->gruB1_sWh);
+    guppy_model copy = {
+        .conv_W = copy_flappie_matrix(net->conv_W),
+        .conv_b = copy_flappie_matrix(net->conv_b),
+        .conv_stride = net->conv_stride,
+        .gruB1_iW = copy_flappie_matrix(net->gruB1_iW),
+        .gruB1_sW = copy_flappie_matrix(net->gruB1_sW),
+        .gruB1_b = copy_flappie_matrix(net->gruB1_b),
+        .gruF2_iW = copy_flappie_matrix(net->gruF2_iW),
+        .gruF2_sW = copy_flappie_matrix(net->gruF2_sW),
+        .gruF2_b = copy_flappie_matrix(net->gruF2_b),
+        .gruB3_iW = copy_flappie_matrix(net->gruB3_iW),
+        .gruB3_sW = copy_flappie_matrix(net->gruB3_sW),
+        .gruB3_b = copy_flappie_matrix(net->gruB3_b),
+        .gruF4_iW = copy_flappie_matrix(net->gruF4_iW),
+        .gruF4_sW = copy_flappie_matrix(net->gruF4_sW),
+        .gruF4_b = copy_flappie_matrix(net->gruF4_b),
+        .gruB5_iW = copy_flappie_matrix(net->gruB5_iW),
+        .gruB5_sW = copy_flappie_matrix(net->gruB5_sW),
+        .gruB5_b = copy_flappie_matrix(net->gruB5_b),
+        .FF_W = copy_flappie_matrix(net->FF_W),
+        .FF_b = copy_flappie_matrix(net->FF_b),
+        .gruB1_sWq = quantised ? copy_flappie_qmatrix(net->gruB1_sWq) : NULL,
+        .gruF2_sWq = quantised ? copy_flappie_qmatrix(net->gruF2_sWq) : NULL,
+        .gruB3_sWq = quantised ? copy_flappie_qmatrix(net->gruB3_sWq) : NULL,
+        .gruF4_sWq = quantised ? copy_flappie_qmatrix(net->gruF4_sWq) : NULL,
+        .gruB5_sWq = quantised ? copy_flappie_qmatrix(net->gruB5_sWq) : NULL,
+        .gruB1_sWh = half ? copy_flappie_hmatrix(net->gruB1_sWh) : NULL,
+        .gruF2_sWh = half ? copy_flappie_hmatrix(net->gruF2_sWh) : NULL,
+        .gruB3_sWh = half ? copy_flappie_hmatrix(net->gruB3_sWh) : NULL,
+        .gruF4_sWh = half ? copy_flappie_hmatrix(net->gruF4_sWh) : NULL,
+        .gruB5_sWh = half ? copy_flappie_hmatrix(net->gruB5_sWh) : NULL,
+        .fixed = (NULL != net->fixed) ? copy_fixed_guppy_model(net->fixed) : NULL};
+
+    const bool complete = NULL != copy.conv_W && NULL != copy.conv_b
+        && NULL != copy.gruB1_iW && NULL != copy.gruB1_sW && NULL != copy.gruB1_b
+        && NULL != copy.gruF2_iW && NULL != copy.gruF2_sW && NULL != copy.gruF2_b
+        && NULL != copy.gruB3_iW && NULL != copy.gruB3_sW && NULL != copy.gruB3_b
+        && NULL != copy.gruF4_iW && NULL != copy.gruF4_sW && NULL != copy.gruF4_b
+        && NULL != copy.gruB5_iW && NULL != copy.gruB5_sW && NULL != copy.gruB5_b
+        && NULL != copy.FF_W && NULL != copy.FF_b
+        && (!quantised || (NULL != copy.gruB1_sWq && NULL != copy.gruF2_sWq && NULL != copy.gruB3_sWq
+                           && NULL != copy.gruF4_sWq && NULL != copy.gruB5_sWq))
+        && (!half || (NULL != copy.gruB1_sWh && NULL != copy.gruF2_sWh && NULL != copy.gruB3_sWh
+                      && NULL != copy.gruF4_sWh && NULL != copy.gruB5_sWh))
+        && (NULL == net->fixed || NULL != copy.fixed);
+    guppy_model * replica = complete ? malloc(sizeof(guppy_model)) : NULL;
+    if(NULL == replica){
+        free_guppy_model_weights(&copy);
+        return NULL;
+    }
+    //  Members are const so the copy cannot be assigned
+    memcpy(replica, &copy, sizeof(guppy_model));
+    return replica;
+}
+
+
+//  Weights, with bias b if any, rounded to precision and back, so float layers see the values stored
+static flappie_matrix round_weights(const_flappie_matrix M, const_flappie_matrix b, enum flappie_precision precision){
+    if(FLAPPIE_PRECISION_INT16 == precision){
+        flappie_xmatrix X = fixed_from_flappie_matrix(M, fixed_weight_frac(M, b));
+        RETURN_NULL_IF(NULL == X, NULL);
+        flappie_matrix res = flappie_matrix_from_fixed(X);
+        free_flappie_xmatrix(X);
+        return res;
+    }
+    if(FLAPPIE_PRECISION_INT8 == precision){
+        flappie_qmatrix Q = quantise_flappie_matrix(M);
+        RETURN_NULL_IF(NULL == Q, NULL);
+        flappie_matrix res = dequantise_flappie_qmatrix(Q);
+        free_flappie_qmatrix(Q);
+        return res;
+    }
+    flappie_hmatrix H = half_from_flappie_matrix(M, half_format(precision));
+    RETURN_NULL_IF(NULL == H, NULL);
+    flappie_matrix res = flappie_matrix_from_half(H);
+    free_flappie_hmatrix(H);
+    return res;
+}
+
+
+//  Recurrent weights at a reduced precision, NULL if not of that precision
+static flappie_qmatrix reduce_int8(const_flappie_matrix sW, enum flappie_precision precision){
+    return (FLAPPIE_PRECISION_INT8 == precision) ? quantise_flappie_matrix(sW) : NULL;
+}
+
+static flappie_hmatrix reduce_half(const_flappie_matrix sW, enum flappie_precision precision){
+    const bool half = (FLAPPIE_PRECISION_FP16 == precision || FLAPPIE_PRECISION_BF16 == precision);
+    return half ? half_from_flappie_matrix(sW, half_format(precision)) : NULL;
+}
+
+
+/**  Copy of model with weights stored at a reduced precision
+ *
+ *   The input projection, recurrent and output weights are reduced; the
+ *   convolution and biases are kept in float.  Int8 weights are quantised
+ *   with one scale per output unit.  Recurrent weights are kept at the
+ *   reduced precision for the fused recurrent step, which streams them from
+ *   memory every step.  The other weights, and a float copy of the recurrent
+ *   weights for layers without a reduced kernel, hold the values the reduced
+ *   weights represent.  At int16, a flip-flop model is also converted whole,
+ *   convolution included, to fixed point.
+ *
+ *  @param net Model
+ *  @param model Type of model, for its calibration
+ *  @param precision Precision of weights, int8, fp16, bf16 or int16
+ *
+ *  @returns Model or NULL on failure
+ **/
+static guppy_model * reduce_guppy_model(const guppy_model * net, enum model_type model, enum flappie_precision precision){
+    assert(FLAPPIE_PRECISION_FLOAT != precision && precision < FLAPPIE_PRECISION_INVALID);
+    const bool half = (FLAPPIE_PRECISION_FP16 == precision || FLAPPIE_PRECISION_BF16 == precision);
+    const bool fixed = (FLAPPIE_PRECISION_INT16 == precision && model < FLAPPIE_MODEL_INVALID);
+    guppy_model copy = {
+        .conv_W = copy_flappie_matrix(net->conv_W),
+        .conv_b = copy_flappie_matrix(net->conv_b),
+        .conv_stride = net->conv_stride,
+        .gruB1_iW = round_weights(net->gruB1_iW, net->gruB1_b, precision),
+        .gruB1_sW = round_weights(net->gruB1_sW, NULL, precision),
+        .gruB1_b = copy_flappie_matrix(net->gruB1_b),
+        .gruF2_iW = round_weights(net->gruF2_iW, net->gruF2_b, precision),
+        .gruF2_sW = round_weights(net->gruF2_sW, NULL, precision),
+        .gruF2_b = copy_flappie_matrix(net->gruF2_b),
+        .gruB3_iW = round_weights(net->gruB3_iW, net->gruB3_b, precision),
+        .gruB3_sW = round_weights(net->gruB3_sW, NULL, precision),
+        .gruB3_b = copy_flappie_matrix(net->gruB3_b),
+        .gruF4_iW = round_weights(net->gruF4_iW, net->gruF4_b, precision),
+        .gruF4_sW = round_weights(net->gruF4_sW, NULL, precision),
+        .gruF4_b = copy_flappie_matrix(net->gruF4_b),
+        .gruB5_iW = round_weights(net->gruB5_iW, net->gruB5_b, precision),
+        .gruB5_sW = round_weights(net->gruB5_sW, NULL, precision),
+        .gruB5_b = copy_flappie_matrix(net->gruB5_b),
+        .FF_W = round_weights(net->FF_W, net->FF_b, precision),
+        .FF_b = copy_flappie_matrix(net->FF_b),
+        .gruB1_sWq = reduce_int8(net->gruB1_sW, precision),
+        .gruF2_sWq = reduce_int8(net->gruF2_sW, precision),
+        .gruB3_sWq = reduce_int8(net->gruB3_sW, precision),
+        .gruF4_sWq = reduce_int8(net->gruF4_sW, precision),
+        .gruB5_sWq = reduce_int8(net->gruB5_sW, precision),
+        .gruB1_sWh = reduce_half(net->gruB1_sW, precision),
+        .gruF2_sWh = reduce_half(net->gruF2_sW, precision),
+        .gruB3_sWh = reduce_half(net->gruB3_sW, precision),
+        .gruF4_sWh = reduce_half(net->gruF4_sW, precision),
+        .gruB5_sWh = reduce_half(net->gruB5_sW, precision),
+        .fixed = fixed ? make_fixed_guppy_model(net, model_calibrated[model] ? model_calibration + model : NULL) : NULL};
+
+    const bool complete = NULL != copy.conv_W && NULL != copy.conv_b
+        && NULL != copy.gruB1_iW && NULL != copy.gruB1_sW && NULL != copy.gruB1_b
+        && NULL != copy.gruF2_iW && NULL != copy.gruF2_sW && NULL != copy.gruF2_b
+        && NULL != copy.gruB3_iW && NULL != copy.gruB3_sW && NULL != copy.gruB3_b
+        && NULL != copy.gruF4_iW && NULL != copy.gruF4_sW && NULL != copy.gruF4_b
+        && NULL != copy.gruB5_iW && NULL != copy.gruB5_sW && NULL != copy.gruB5_b
+        && NULL != copy.FF_W && NULL != copy.FF_b
+        && (FLAPPIE_PRECISION_INT8 != precision
+            || (NULL != copy.gruB1_sWq && NULL != copy.gruF2_sWq && NULL != copy.gruB3_sWq
+                && NULL != copy.gruF4_sWq && NULL != copy.gruB5_sWq))
+        && (!half
+            || (NULL != copy.gruB1_sWh && NULL != copy.gruF2_sWh && NULL != copy.gruB3_sWh
+                && NULL != copy.gruF4_sWh && NULL != copy.gruB5_sWh))
+        && (!fixed || NULL != copy.fixed);
+    guppy_model * reduced = complete ? malloc(sizeof(guppy_model)) : NULL;
+    if(NULL == reduced){
+        free_guppy_model_weights(&copy);
+        return NULL;
+    }
+    memcpy(reduced, &copy, sizeof(guppy_model));
+    return reduced;
+}
+
+
+//  Copy of each model at each reduced precision, made when first used
+static guppy_model * model_reduced[FLAPPIE_PRECISION_INVALID][RUNNIE_MODEL_INVALID];
+static pthread_mutex_t model_reduced_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static const guppy_model * get_float_guppy_model(const enum model_type model){
+    switch(model){
+    case FLAPPIE_MODEL_R941_NATIVE:
+        return &flipflop_r941native_guppy;
+    case FLAPPIE_MODEL_R941_5mC:
+        return &flipflop_r941native5mC_guppy;
+    case FLAPPIE_MODEL_R10C_PCR:
+        return &flipflop_r10Cpcr_guppy;
+    case RUNNIE_MODEL_R941_NATIVE:
+        return &runlength_r941native_guppy;
+    case RUNNIE_NEWMODEL_R941_NATIVE:
+        return &runlengthV2_r941native_guppy;
+    case FLAPPIE_MODEL_INVALID:
+    case RUNNIE_MODEL_INVALID:
+        errx(EXIT_FAILURE, "Invalid Flappie model  %s:%d", __FILE__, __LINE__);
+    default:
+        errx(EXIT_FAILURE, "Flappie enum failure -- report as bug. %s:%d \n", __FILE__, __LINE__);
+    }
+    return NULL;
+}
+
+
+//  Weights of model at a precision, shared by every thread
+static const guppy_model * get_shared_guppy_model(const enum model_type model, enum flappie_precision precision){
+    assert(precision < FLAPPIE_PRECISION_INVALID);
+    const guppy_model * net = get_float_guppy_model(model);
+    if(FLAPPIE_PRECISION_FLOAT == precision){
+        return net;
+    }
+    pthread_mutex_lock(&model_reduced_lock);
+    if(NULL == model_reduced[precision][model]){
+        model_reduced[precision][model] = reduce_guppy_model(net, model, precision);
+    }
+    net = model_reduced[precision][model];
+    pthread_mutex_unlock(&model_reduced_lock);
+    if(NULL == net){
+        errx(EXIT_FAILURE, "Failed to convert weights of model %s to %s", flappie_model_string(model),
+             flappie_precision_string(precision));
+    }
+    return net;
+}
+
+
+static const char * precision_strings[FLAPPIE_PRECISION_INVALID] = {"float", "int8", "fp16", "bf16", "int16"};
+
+
+enum flappie_precision get_flappie_precision(const char * precisionstr){
+    assert(NULL != precisionstr);
+    for(enum flappie_precision precision=0 ; precision < FLAPPIE_PRECISION_INVALID ; precision++){
+        if(0 == strcmp(precisionstr, precision_strings[precision])){
+            return precision;
+        }
+    }
+    return FLAPPIE_PRECISION_INVALID;
+}
+
+
+const char * flappie_precision_string(enum flappie_precision precision){
+    return (precision < FLAPPIE_PRECISION_INVALID) ? precision_strings[precision] : "invalid";
+}
+
+
+/**  Set precision activations between layers are stored at
+ *
+ *   Applies to the output of the convolution and recurrent layers of
+ *   flip-flop models run on batches of reads.  Layers calculate in float.
+ *
+ *  @param precision Precision, float, fp16 or bf16
+ *
+ *  @returns true if precision is valid for activations
+ **/
+bool flappie_set_activation_precision(enum flappie_precision precision){
+    if(precision >= FLAPPIE_PRECISION_INVALID || FLAPPIE_PRECISION_INT8 == precision
+       || FLAPPIE_PRECISION_INT16 == precision){
+        return false;
+    }
+    activation_precision = precision;
+    return true;
+}
+
+
+enum flappie_precision flappie_activation_precision(void){
+    return activation_precision;
+}
+
+
+static float maxabs_flappie_matrix(const_flappie_matrix M){
+    return fmaxf(max_flappie_matrix(M), -min_flappie_matrix(M));
+}
+
+
+/**  Calibrate flip-flop model for fixed point on a read
+ *
+ *   Runs the model in float, raising the largest magnitude of each tensor
+ *   of the calibration to those seen in the read.
+ *
+ *  @param signal Read, trimmed and normalised
+ *  @param model Flip-flop model
+ *  @param cal [in/out] Calibration, zero before the first read
+ *
+ *  @returns true on success
+ **/
+bool flappie_calibrate_read(const raw_table signal, enum model_type model, struct flappie_calibration * cal){
+    RETURN_NULL_IF(model >= FLAPPIE_MODEL_INVALID, false);
+    RETURN_NULL_IF(NULL == cal, false);
+    if(0 == signal.n || NULL == signal.raw || signal.end <= signal.start){
+        return false;
+    }
+    const guppy_model * net = get_float_guppy_model(model);
+
+    flappie_matrix raw_mat = features_from_raw(signal);
+    RETURN_NULL_IF(NULL == raw_mat, false);
+    cal->features = fmaxf(cal->features, maxabs_flappie_matrix(raw_mat));
+    flappie_matrix layer = convolution(raw_mat, net->conv_W, net->conv_b, net->conv_stride, NULL);
+    raw_mat = free_flappie_matrix(raw_mat);
+    tanh_activation_inplace(layer);
+
+    const_flappie_matrix iW[] = {net->gruB1_iW, net->gruF2_iW, net->gruB3_iW, net->gruF4_iW, net->gruB5_iW};
+    const_flappie_matrix sW[] = {net->gruB1_sW, net->gruF2_sW, net->gruB3_sW, net->gruF4_sW, net->gruB5_sW};
+    const_flappie_matrix b[] = {net->gruB1_b, net->gruF2_b, net->gruB3_b, net->gruF4_b, net->gruB5_b};
+    for(size_t i=0 ; i < FLAPPIE_NLAYER_RECURRENT && NULL != layer ; i++){
+        const bool backward = (0 == i % 2);
+        flappie_matrix X = feedforward_linear(layer, iW[i], b[i], NULL);
+        flappie_matrix next = aes_grumod(layer, sW[i], NULL, backward, iW[i], b[i]);
+        //  Recurrent part of gates from every state, the zero initial state aside
+        flappie_matrix zero = make_flappie_matrix(sW[i]->nc, 1);
+        flappie_matrix S = (NULL != zero) ? feedforward_linear(next, sW[i], zero, NULL) : NULL;
+        if(NULL != X && NULL != S){
+            cal->gru_input[i] = fmaxf(cal->gru_input[i], maxabs_flappie_matrix(X));
+            cal->gru_recurrent[i] = fmaxf(cal->gru_recurrent[i], maxabs_flappie_matrix(S));
+        } else {
+            next = free_flappie_matrix(next);
+        }
+        S = free_flappie_matrix(S);
+        zero = free_flappie_matrix(zero);
+        X = free_flappie_matrix(X);
+        free_flappie_matrix(layer);
+        layer = next;
+    }
+    const bool ok = (NULL != layer);
+    layer = free_flappie_matrix(layer);
+    return ok;
+}
+
+
+/**  Write calibration of model
+ *
+ *   One tensor per line, as its name and largest magnitude.  Lines starting
+ *   with # are comments.
+ *
+ *  @returns true on success
+ **/
+bool write_flappie_calibration(FILE * fh, enum model_type model, const struct flappie_calibration * cal){
+    RETURN_NULL_IF(NULL == fh, false);
+    RETURN_NULL_IF(NULL == cal, false);
+    int ret = fprintf(fh, "#  Largest magnitude of tensors of model, for --precision int16\nmodel %s\nfeatures %.9g\n",
+                      flappie_model_string(model), cal->features);
+    for(size_t layer=0 ; layer < FLAPPIE_NLAYER_RECURRENT && ret > 0 ; layer++){
+        ret = fprintf(fh, "gru%zu_input %.9g\ngru%zu_recurrent %.9g\n", layer + 1, cal->gru_input[layer],
+                      layer + 1, cal->gru_recurrent[layer]);
+    }
+    return ret > 0;
+}
+
+
+/**  Read calibration written by write_flappie_calibration
+ *
+ *  @param fh File to read
+ *  @param model [out] Model calibrated
+ *  @param cal [out] Calibration
+ *
+ *  @returns true if every tensor of the calibration was read
+ **/
+bool read_flappie_calibration(FILE * fh, enum model_type * model, struct flappie_calibration * cal){
+    RETURN_NULL_IF(NULL == fh, false);
+    RETURN_NULL_IF(NULL == model, false);
+    RETURN_NULL_IF(NULL == cal, false);
+    *model = FLAPPIE_MODEL_INVALID;
+    //  Bit of each tensor read, features first
+    const unsigned int all = (1u << (1 + 2 * FLAPPIE_NLAYER_RECURRENT)) - 1;
+    unsigned int seen = 0;
+    char line[256];
+    while(NULL != fgets(line, sizeof(line), fh)){
+        char name[64], value[64];
+        if('#' == line[0] || 2 != sscanf(line, "%63s %63s", name, value)){
+            continue;
+        }
+        if(0 == strcmp(name, "model")){
+            *model = get_flappie_model_type(value);
+            continue;
+        }
+        char * end = NULL;
+        const float x = strtof(value, &end);
+        if(end == value || !isfinite(x) || x < 0.0f){
+            warnx("Invalid value \"%s\" of %s in calibration.", value, name);
+            return false;
+        }
+        size_t layer = 0;
+        char kind[32];
+        if(0 == strcmp(name, "features")){
+            cal->features = x;
+            seen |= 1u;
+        } else if(2 == sscanf(name, "gru%zu_%31s", &layer, kind) && layer >= 1 && layer <= FLAPPIE_NLAYER_RECURRENT
+                  && (0 == strcmp(kind, "input") || 0 == strcmp(kind, "recurrent"))){
+            const bool input = (0 == strcmp(kind, "input"));
+            if(input){
+                cal->gru_input[layer - 1] = x;
+            } else {
+                cal->gru_recurrent[layer - 1] = x;
+            }
+            seen |= 1u << (2 * layer - (input ? 1 : 0));
+        } else {
+            warnx("Unrecognised tensor \"%s\" in calibration.", name);
+            return false;
+        }
+    }
+    return all == seen && *model < FLAPPIE_MODEL_INVALID;
+}
+
+
+/**  Set calibration of flip-flop model, used when it is converted to fixed point
+ *
+ *   Models are converted when next used, so the calibration should be set
+ *   before any read is called.
+ *
+ *  @returns true if calibration is valid for model
+ **/
+bool flappie_set_calibration(enum model_type model, const struct flappie_calibration * cal){
+    if(model >= FLAPPIE_MODEL_INVALID || NULL == cal){
+        return false;
+    }
+    model_calibration[model] = *cal;
+    model_calibrated[model] = true;
+    return true;
+}
+
+
+/**  Calibration of flip-flop model
+ *
+ *  @returns true if model has been calibrated, when cal is set
+ **/
+bool flappie_get_calibration(enum model_type model, struct flappie_calibration * cal){
+    if(model >= FLAPPIE_MODEL_INVALID || !model_calibrated[model]){
+        return false;
+    }
+    *cal = model_calibration[model];
+    return true;
+}
+
+
+/**  Weights of model at a precision used by calling thread
+ *
+ *   Weights are converted to the precision when first used.  A thread bound
+ *   to a NUMA node uses the node's own copy of the weights if one has been
+ *   made at that precision by replicate_model_weights.
+ **/
+static const guppy_model * get_guppy_model(const enum model_type model, enum flappie_precision precision){
+    const int node = flappie_thread_node();
+    if(node >= 0 && node < FLAPPIE_MAX_NUMA_NODE && model < RUNNIE_MODEL_INVALID
+       && precision < FLAPPIE_PRECISION_INVALID){
+        pthread_mutex_lock(&model_replica_lock);
+        const guppy_model * replica = model_replica[node][precision][model];
+        pthread_mutex_unlock(&model_replica_lock);
+        if(NULL != replica){
+            return replica;
+        }
+    }
+    return get_shared_guppy_model(model, precision);
+}
+
+
+/**  Copy weights of model into memory local to NUMA node of calling thread
+ *
+ *   The calling thread should be pinned to the CPUs of its node, see
+ *   flappie_run_on_node, so first touch places the copy on that node.  Each
+ *   node has at most one copy of each model, shared by every caller on the
+ *   node and kept until the program exits, like the weights themselves.
+ *
+ *  @param model Model to copy
+ *  @param precision Precision of weights to copy
+ *
+ *  @returns true if node of thread has a copy of the weights
+ **/
+bool replicate_model_weights(const enum model_type model, enum flappie_precision precision){
+    const int node = flappie_thread_node();
+    RETURN_NULL_IF(node < 0 || node >= FLAPPIE_MAX_NUMA_NODE, false);
+    RETURN_NULL_IF(model >= RUNNIE_MODEL_INVALID || FLAPPIE_MODEL_INVALID == model, false);
+    RETURN_NULL_IF(precision >= FLAPPIE_PRECISION_INVALID, false);
+
+    pthread_mutex_lock(&model_replica_lock);
+    if(NULL == model_replica[node][precision][model]){
+        model_replica[node][precision][model] = copy_guppy_model(get_shared_guppy_model(model, precision));
+    }
+    const bool ok = (NULL != model_replica[node][precision][model]);
+    pthread_mutex_unlock(&model_replica_lock);
+    return ok;
+}
+
+/**  Calculate transition weights for a read with a flip-flop model in fixed point
+ **/
+static flappie_matrix flipflop_guppy_transitions_fixed(const raw_table signal, float temperature,
+                                                       const struct fixed_guppy_model * net){
+    const size_t nsample = signal.end - signal.start;
+    double t = flappie_profile_start();
+    flappie_xmatrix layer = convolution_tanh_fixed(signal.raw + signal.start, nsample, net->features_frac,
+                                                   net->conv_W, net->conv_b, net->conv_stride);
+    flappie_profile_stop_batch(FLAPPIE_PROFILE_CONVOLUTION, t, 1, nsample);
+
+    const enum flappie_profile_stage stage[] = {FLAPPIE_PROFILE_GRU1, FLAPPIE_PROFILE_GRU2, FLAPPIE_PROFILE_GRU3,
+                                                FLAPPIE_PROFILE_GRU4, FLAPPIE_PROFILE_GRU5};
+    for(size_t i=0 ; i < FLAPPIE_NLAYER_RECURRENT && NULL != layer ; i++){
+        //  Layers alternate direction, starting backwards
+        const bool backward = (0 == i % 2);
+        t = flappie_profile_start();
+        flappie_xmatrix next = aes_grumod_fixed(layer, net->sW[i], backward, net->iW[i], net->b[i], net->gate_frac[i]);
+        free_flappie_xmatrix(layer);
+        layer = next;
+        flappie_profile_stop_batch(stage[i], t, 1, nsample);
+    }
+
+    t = flappie_profile_start();
+    flappie_matrix trans = (NULL != layer) ? globalnorm_flipflop_fixed(layer, net->FF_W, net->FF_b, temperature) : NULL;
+    layer = free_flappie_xmatrix(layer);
+    flappie_profile_stop_batch(FLAPPIE_PROFILE_GLOBALNORM, t, 1, nsample);
+    return trans;
+}
+
+
+struct fixed_batch_data {
+    const raw_table * signal;
+    float temperature;
+    const struct fixed_guppy_model * net;
+    flappie_matrix * trans_weights;
+};
+
+
+static void fixed_transitions_read(size_t i, void * ptr){
+    struct fixed_batch_data * d = ptr;
+    d->trans_weights[i] = flipflop_guppy_transitions_fixed(d->signal[i], d->temperature, d->net);
+}
+
+
+/**  Calculate transition weights for a batch of reads with a flip-flop model in fixed point
+ *
+ *  Reads are independent, so are run concurrently rather than padded.
+ **/
+static void flipflop_guppy_transitions_fixed_batch(const raw_table * signal, size_t nbatch, float temperature,
+                                                   const struct fixed_guppy_model * net, flappie_matrix * trans_weights,
+                                                   flappie_threadpool pool){
+    for(size_t i=0 ; i < nbatch ; i++){
+        trans_weights[i] = NULL;
+    }
+    size_t * nsample = calloc(nbatch, sizeof(size_t));
+    if(NULL == nsample){
+        return;
+    }
+    for(size_t i=0 ; i < nbatch ; i++){
+        nsample[i] = signal[i].end - signal[i].start;
+    }
+    struct fixed_batch_data data = {signal, temperature, net, trans_weights};
+    flappie_parallel_for_weighted(pool, nbatch, nsample, fixed_transitions_read, &data);
+    free(nsample);
+}
+
+
+struct bucket_data {
+    const raw_table * bucket;
+    const size_t * bucket_start;
+    flappie_matrix * bucket_trans;
+    float temperature;
+    enum model_type model;
+    const guppy_model * net;
+    flappie_threadpool pool;
+};
+
+
+static void bucket_transitions(size_t i, void * ptr){
+    struct bucket_data * d = ptr;
+    const size_t start = d->bucket_start[i];
+    const size_t nbatch = d->bucket_start[i + 1] - start;
+    switch(d->model){
+    case RUNNIE_MODEL_R941_NATIVE:
+        runlength_guppy_transitions_padded(d->bucket + start, nbatch, d->temperature, d->net,
+                                           d->bucket_trans + start, d->pool, false);
+        break;
+    case RUNNIE_NEWMODEL_R941_NATIVE:
+        runlength_guppy_transitions_padded(d->bucket + start, nbatch, d->temperature, d->net,
+                                           d->bucket_trans + start, d->pool, true);
+        break;
+    default:
+        if(NULL != d->net->fixed){
+            flipflop_guppy_transitions_fixed_batch(d->bucket + start, nbatch, d->temperature, d->net->fixed,
+                                                   d->bucket_trans + start, d->pool);
+        } else {
+            flipflop_guppy_transitions_padded(d->bucket + start, nbatch, d->temperature, d->net,
+                                              d->bucket_trans + start, d->pool);
+        }
+    }
+}
+
+
+/**  Calculate transition weights for a batch of reads
+ *
+ *  @param signal Array of nfiles trimmed and normalised reads, may differ in length
+ *  @param temperature Temperature for weights
+ *  @param model Flip-flop or run-length model to use
+ *  @param precision Precision of weights
+ *  @param nfiles Number of reads in batch
+ *  @param trans_weights [out] Array of length nfiles to receive transition weights
+ *  @param pool Threads to run reads of a batch concurrently, NULL to run serially
+ **/
+void calculate_transitions_new(raw_table signal[], float temperature, enum model_type model,
+                               enum flappie_precision precision, int nfiles, flappie_matrix trans_weights[],
+                               flappie_threadpool pool){
+    const guppy_model * net = get_guppy_model(model, precision);
+
+    for(int i=0 ; i < nfiles ; i++){
+        trans_weights[i] = NULL;
+    }
+
+    //  Sort reads by length and run buckets of similar length together, so
+    //  little work is spent on padding.
+    struct read_length * order = calloc(nfiles, sizeof(struct read_length));
+    raw_table * bucket = calloc(nfiles, sizeof(raw_table));
+    flappie_matrix * bucket_trans = calloc(nfiles, sizeof(flappie_matrix));
+    size_t * bucket_start = calloc(nfiles + 1, sizeof(size_t));
+    size_t * bucket_nsample = calloc(nfiles, sizeof(size_t));
+    if(NULL == order || NULL == bucket || NULL == bucket_trans || NULL == bucket_start || NULL == bucket_nsample){
+        goto cleanup;
+    }
+
+    int nread = 0;
+    for(int i=0 ; i < nfiles ; i++){
+        if(0 == signal[i].n || NULL == signal[i].raw || signal[i].end <= signal[i].start){
+            continue;
+        }
+        order[nread].length = signal[i].end - signal[i].start;
+        order[nread].idx = i;
+        nread += 1;
+    }
+    qsort(order, nread, sizeof(struct read_length), cmp_read_length);
+
+    size_t nbucket = 0;
+    for(int start=0, end=0 ; start < nread ; start = end){
+        const size_t max_length = order[start].length + (size_t)(max_bucket_padding * order[start].length);
+        bucket_start[nbucket] = start;
+        for(end=start ; end < nread && order[end].length <= max_length ; end++){
+            bucket[end] = signal[order[end].idx];
+            bucket_nsample[nbucket] += order[end].length;
+        }
+        nbucket += 1;
+    }
+    bucket_start[nbucket] = nread;
+
+    //  Buckets are independent.  Start the one with the most samples first so
+    //  a single long read does not run on its own after everything else.
+    struct bucket_data data = {bucket, bucket_start, bucket_trans, temperature, model, net, pool};
+    flappie_parallel_for_weighted(pool, nbucket, bucket_nsample, bucket_transitions, &data);
+    for(int i=0 ; i < nread ; i++){
+        trans_weights[order[i].idx] = bucket_trans[i];
+    }
+
+cleanup:
+    free(bucket_nsample);
+    free(bucket_start);
+    free(bucket_trans);
+    free(bucket);
+    free(order);
+}
+
+
+/**  Stride of the network, the number of samples per block of transitions
+ *
+ *  @param model Model
+ *
+ *  @returns stride
+ **/
+size_t get_model_stride(const enum model_type model){
+    //  Same at every precision
+    return get_float_guppy_model(model)->conv_stride;
+}
+
+
+/**  Predict peak memory used in basecalling a read with a flip-flop model
+ *
+ *  Counts the raw signal and its features, the widest layer of the network
+ *  (input, affine transform and output state of a GRU layer) and the
+ *  transitions, posterior and forward matrix held while decoding.
+ *
+ *  @param model Model
+ *  @param nsample Number of samples in read
+ *
+ *  @returns Predicted size of working set in bytes
+ **/
+size_t predict_basecall_memory(const enum model_type model, size_t nsample){
+    RETURN_NULL_IF(model >= flappie_nmodel, 0);
+    //  Shapes are the same at every precision
+    const guppy_model * net = get_float_guppy_model(model);
+    const size_t nblock = (nsample + net->conv_stride - 1) / net->conv_stride;
+    const size_t size = net->gruB1_sW->nr;
+    const size_t nconv = net->conv_W->nc;
+    const size_t nparam = net->FF_W->nc;
+
+    //  Signal and its features, padded to a column of four
+    size_t nfloat = 5 * nsample;
+    const size_t gru_width = 5 * size;
+    const size_t conv_width = nconv + net->gruB1_iW->nc;
+    nfloat += nblock * ((gru_width > conv_width) ? gru_width : conv_width);
+    const size_t nstate = 2 * nbase_from_flipflop_nparam(nparam);
+    nfloat += nblock * (3 * nparam + 2 * nstate);
+
+    return nfloat * sizeof(float);
+}
+
+
+struct _flappie_network_workspace {
+    const guppy_model * net;
+    size_t max_nsample;
+    flappie_matrix features;
+    //  Layers alternate between two buffers, each large enough for any layer
+    flappie_matrix buffer[2];
+    _Mat view[2];
+};
+
+
+/**  Memory to run a flip-flop network on reads of bounded length
+ *
+ *   Every matrix the network needs is allocated up front so calculating the
+ *   transitions of a read makes no allocations.  A workspace belongs to a
+ *   single thread at a time.
+ *
+ *  @param model Flip-flop model, bound to the NUMA node of the calling thread
+ *  @param precision Precision of weights
+ *  @param max_nsample Longest read, in samples, the workspace is used for
+ *
+ *  @returns Workspace or NULL on failure
+ **/
+flappie_network_workspace make_flappie_network_workspace(const enum model_type model, enum flappie_precision precision,
+                                                         size_t max_nsample){
+    RETURN_NULL_IF(model >= flappie_nmodel, NULL);
+    RETURN_NULL_IF(precision >= FLAPPIE_PRECISION_INVALID, NULL);
+    RETURN_NULL_IF(0 == max_nsample, NULL);
+    const guppy_model * net = get_guppy_model(model, precision);
+    const size_t max_nblock = iceil(max_nsample, net->conv_stride);
+
+    const size_t width[] = {
+        net->conv_W->nc,
+        net->gruB1_iW->nc, net->gruF2_iW->nc, net->gruB3_iW->nc, net->gruF4_iW->nc, net->gruB5_iW->nc,
+        net->gruB1_sW->nr, net->gruF2_sW->nr, net->gruB3_sW->nr, net->gruF4_sW->nr, net->gruB5_sW->nr,
+        net->FF_W->nc};
+    size_t max_width = 0;
+    for(size_t i=0 ; i < sizeof(width) / sizeof(width[0]) ; i++){
+        max_width = (width[i] > max_width) ? width[i] : max_width;
+    }
+
+    flappie_network_workspace ws = calloc(1, sizeof(*ws));
+    RETURN_NULL_IF(NULL == ws, NULL);
+    ws->net = net;
+    ws->max_nsample = max_nsample;
+    ws->features = make_flappie_matrix(1, max_nsample);
+    ws->buffer[0] = make_flappie_matrix(max_width, max_nblock);
+    ws->buffer[1] = make_flappie_matrix(max_width, max_nblock);
+    if(NULL == ws->features || NULL == ws->buffer[0] || NULL == ws->buffer[1]){
+        ws = free_flappie_network_workspace(ws);
+    }
+    return ws;
+}
+
+
+flappie_network_workspace free_flappie_network_workspace(flappie_network_workspace ws){
+    if(NULL != ws){
+        ws->features = free_flappie_matrix(ws->features);
+        ws->buffer[0] = free_flappie_matrix(ws->buffer[0]);
+        ws->buffer[1] = free_flappie_matrix(ws->buffer[1]);
+        free(ws);
+    }
+    return NULL;
+}
+
+
+//  Matrix of nr x nc sharing the memory of a workspace buffer, so layers writing to it do not reallocate
+static flappie_matrix workspace_view(flappie_network_workspace ws, size_t i, size_t nr, size_t nc){
+    const size_t nrq = (nr + 3) / 4;
+    assert(nrq * nc <= ws->buffer[i]->nrq * ws->buffer[i]->nc);
+    ws->view[i] = (_Mat){.nr = nr, .nrq = nrq, .nc = nc, .stride = 4 * nrq, .data = ws->buffer[i]->data};
+    return &ws->view[i];
+}
+
+
+/**  Flip-flop transitions of a read using preallocated memory
+ *
+ *   Same layers as flipflop_guppy_transitions, each writing into one of the
+ *   two buffers of the workspace in turn.
+ *
+ *  @param signal Trimmed and normalised read of at most max_nsample samples
+ *  @param temperature Temperature of final layer
+ *  @param ws Workspace
+ *
+ *  @returns Transitions, owned by the workspace and valid until it is next
+ *  used, or NULL on failure
+ **/
+const_flappie_matrix flipflop_transitions_workspace(const raw_table signal, float temperature,
+                                                    flappie_network_workspace ws){
+    RETURN_NULL_IF(NULL == ws, NULL);
+    RETURN_NULL_IF(NULL == signal.raw, NULL);
+    const size_t nsample = signal.end - signal.start;
+    RETURN_NULL_IF(0 == nsample || nsample > ws->max_nsample, NULL);
+    const guppy_model * net = ws->net;
+    const size_t nblock = iceil(nsample, net->conv_stride);
+
+    _Mat features = *ws->features;
+    features.nc = nsample;
+    remake_features_from_raw(signal, &features);
+
+    flappie_matrix conv = workspace_view(ws, 0, net->conv_W->nc, nblock);
+    convolution(&features, net->conv_W, net->conv_b, net->conv_stride, conv);
+    tanh_activation_inplace(conv);
+
+    //  Input to each GRU layer in second buffer, its output in the first
+    const_flappie_matrix iW[] = {net->gruB1_iW, net->gruF2_iW, net->gruB3_iW, net->gruF4_iW, net->gruB5_iW};
+    const_flappie_matrix sW[] = {net->gruB1_sW, net->gruF2_sW, net->gruB3_sW, net->gruF4_sW, net->gruB5_sW};
+    const_flappie_matrix b[] = {net->gruB1_b, net->gruF2_b, net->gruB3_b, net->gruF4_b, net->gruB5_b};
+    flappie_matrix gru = conv;
+    for(size_t layer=0 ; layer < 5 ; layer++){
+        flappie_matrix gru_in = workspace_view(ws, 1, iW[layer]->nc, nblock);
+        feedforward_linear(gru, iW[layer], b[layer], gru_in);
+        gru = workspace_view(ws, 0, sW[layer]->nr, nblock);
+        //  Layers alternate direction, starting backwards
+        if(0 == layer % 2){
+            grumod_backward(gru_in, sW[layer], gru);
+        } else {
+            grumod_forward(gru_in, sW[layer], gru);
+        }
+    }
+
+    flappie_matrix trans = workspace_view(ws, 1, net->FF_W->nc, nblock);
+    globalnorm_flipflop(gru, net->FF_W, net->FF_b, temperature, trans);
+
+    return trans;
+}
+
+
+/**  Cut a read into overlapping chunks of signal
+ *
+ *  Chunks share the raw signal of the read and must not be freed.  Starts of
+ *  chunks are separated by a multiple of the stride so chunk boundaries fall
+ *  on block boundaries.  The final chunk may be shorter than chunk_size.
+ *
+ *  @param signal Trimmed and normalised read
+ *  @param chunk_size Maximum number of samples in chunk
+ *  @param chunk_overlap Number of samples shared between neighbouring chunks
+ *  @param stride Stride of network
+ *  @param nchunk [out] Number of chunks
+ *
+ *  @returns Array of chunks or NULL on failure
+ **/
+raw_table * chunk_raw_table(const raw_table signal, size_t chunk_size, size_t chunk_overlap, size_t stride, size_t * nchunk){
+    assert(NULL != nchunk);
+    assert(stride > 0);
+    assert(chunk_overlap < chunk_size);
+    *nchunk = 0;
+    RETURN_NULL_IF(NULL == signal.raw, NULL);
+    RETURN_NULL_IF(signal.end <= signal.start, NULL);
+
+    size_t step = ((chunk_size - chunk_overlap) / stride) * stride;
+    step = (step > 0) ? step : stride;
+    const size_t nsample = signal.end - signal.start;
+    const size_t n = (nsample > chunk_size) ? (1 + iceil(nsample - chunk_size, step)) : 1;
+
+    raw_table * chunks = calloc(n, sizeof(raw_table));
+    RETURN_NULL_IF(NULL == chunks, NULL);
+    for(size_t i=0 ; i < n ; i++){
+        chunks[i] = signal;
+        chunks[i].start = signal.start + i * step;
+        chunks[i].end = (chunks[i].start + chunk_size < signal.end) ? (chunks[i].start + chunk_size) : signal.end;
+    }
+
+    *nchunk = n;
+    return chunks;
+}
+
+
+/**  Stitch transitions of overlapping chunks into transitions for whole read
+ *
+ *  Neighbouring chunks are joined at the midpoint of their overlap, away from
+ *  the edges where the recurrent layers have seen little context.
+ *
+ *  @param signal Read that chunks were cut from
+ *  @param chunks Array of chunks from chunk_raw_table
+ *  @param trans Array of transitions for each chunk
+ *  @param nchunk Number of chunks
+ *  @param stride Stride of network
+ *
+ *  @returns Transitions for read or NULL on failure
+ **/
+flappie_matrix stitch_chunk_transitions(const raw_table signal, const raw_table * chunks,
+                                        const flappie_matrix * trans, size_t nchunk, size_t stride){
+    RETURN_NULL_IF(NULL == chunks, NULL);
+    RETURN_NULL_IF(NULL == trans, NULL);
+    RETURN_NULL_IF(0 == nchunk, NULL);
+    for(size_t i=0 ; i < nchunk ; i++){
+        RETURN_NULL_IF(NULL == trans[i], NULL);
+        assert(trans[i]->nr == trans[0]->nr);
+    }
+
+    const size_t nblock = iceil(signal.end - signal.start, stride);
+    flappie_matrix res = make_flappie_matrix(trans[0]->nr, nblock);
+    RETURN_NULL_IF(NULL == res, NULL);
+
+    size_t from = 0;
+    for(size_t i=0 ; i < nchunk ; i++){
+        const size_t offset = (chunks[i].start - signal.start) / stride;
+        assert(offset + trans[i]->nc <= nblock);
+        size_t to = offset + trans[i]->nc;
+        if(i + 1 < nchunk){
+            const size_t next_offset = (chunks[i + 1].start - signal.start) / stride;
+            to = (next_offset + to) / 2;
+        }
+        assert(from >= offset && to >= from);
+        memcpy(res->data.v + from * res->nrq, trans[i]->data.v + (from - offset) * trans[i]->nrq,
+               (to - from) * res->nrq * sizeof(__m128));
+        from = to;
+    }
+    assert(nblock == from);
+
+    return res;
+}
+
+
+/**  Calculate transitions for a read by running overlapping chunks together
+ *
+ *  @param signal Trimmed and normalised read
+ *  @param chunk_size Maximum number of samples in chunk
+ *  @param chunk_overlap Number of samples shared between neighbouring chunks
+ *  @param temperature Temperature for weights
+ *  @param model Flip-flop model to use
+ *  @param precision Precision of weights
+ *  @param pool Threads to run chunks concurrently, NULL to run serially
+ *
+ *  @returns Transitions for read or NULL on failure
+ **/
+flappie_matrix calculate_transitions_chunked(const raw_table signal, size_t chunk_size, size_t chunk_overlap,
+                                             float temperature, enum model_type model,
+                                             enum flappie_precision precision, flappie_threadpool pool){
+    const size_t stride = get_model_stride(model);
+    size_t nchunk = 0;
+    raw_table * chunks = chunk_raw_table(signal, chunk_size, chunk_overlap, stride, &nchunk);
+    RETURN_NULL_IF(NULL == chunks, NULL);
+
+    flappie_matrix * trans = calloc(nchunk, sizeof(flappie_matrix));
+    if(NULL == trans){
+        free(chunks);
+        return NULL;
+    }
+    calculate_transitions_new(chunks, temperature, model, precision, nchunk, trans, pool);
+    flappie_matrix res = stitch_chunk_transitions(signal, chunks, trans, nchunk, stride);
+
+    for(size_t i=0 ; i < nchunk ; i++){
+        trans[i] = free_flappie_matrix(trans[i]);
+    }
+    free(trans);
+    free(chunks);
+    return res;
 }
 
 // NOTES. vector version of guppy transitions
@@ -467,7 +1862,6 @@ void calculate_transitions_new(raw_table signal[], float temperature, enum model
 /*flappie_matrix flipflop_guppy_transitions_vec(const raw_table signal, float temperature, const guppy_model * net){
     RETURN_NULL_IF(0 == signal.n, NULL);
     RETURN_NULL_IF(NULL == signal.raw, NULL);
-    long useconds, seconds, mseconds;
 
     // NOTES. For loop for all files
     flappie_matrix raw_mat = features_from_raw(signal);
@@ -511,7 +1905,6 @@ void calculate_transitions_new(raw_table signal[], float temperature, enum model
 flappie_matrix flipflop_guppy_transitions(const raw_table signal, float temperature, const guppy_model * net){
     RETURN_NULL_IF(0 == signal.n, NULL);
     RETURN_NULL_IF(NULL == signal.raw, NULL);
-    long useconds, seconds, mseconds;
 
     // NOTES. For loop for all files
     flappie_matrix raw_mat = features_from_raw(signal);
@@ -546,21 +1939,12 @@ flappie_matrix flipflop_guppy_transitions(const raw_table signal, float temperat
     //  NOTES No for loop. Single invocation, but pass array of conv and return array of gruB1in.
     flappie_matrix gruB1in = feedforward_linear(conv, net->gruB1_iW, net->gruB1_b, NULL);
     conv = free_flappie_matrix(conv);
-    gettimeofday(&start, NULL);
     //  NOTES No for loop. Single invocation, but pass array of gruB1in and return array of gruB1
-    //  And t
     flappie_matrix gruB1 = grumod_backward(gruB1in, net->gruB1_sW, NULL);
-
-
-    gettimeofday(&end_time, NULL);
-    useconds = end_time.tv_usec - start.tv_usec;
-    seconds = end_time.tv_sec - start.tv_sec;
-    mseconds = ((seconds) * 1000 + useconds/1000.0) + 0.5;
-    fprintf(stderr,"Time elapsed (doing 1 GRU): %ld msec\n", mseconds );
     gruB1in = free_flappie_matrix(gruB1in);
     //  Second GRU layer
-    flappie_matrix gruF2in = feedforward_linear(gruB1, net->gruF2_iW, net->gruF2_b, NULL); // changed
-    //gruB1 = free_flappie_matrix(gruB1);
+    flappie_matrix gruF2in = feedforward_linear(gruB1, net->gruF2_iW, net->gruF2_b, NULL);
+    gruB1 = free_flappie_matrix(gruB1);
     flappie_matrix gruF2 = grumod_forward(gruF2in, net->gruF2_sW, NULL);
     gruF2in = free_flappie_matrix(gruF2in);
     //  Third GRU layer
@@ -720,24 +2104,24 @@ flappie_matrix runlengthV2_guppy_transitions(const raw_table signal, float tempe
 
 
 flappie_matrix flipflop_transitions_r941native(const raw_table signal, float temperature){
-    return flipflop_guppy_transitions(signal, temperature, &flipflop_r941native_guppy);
+    return flipflop_guppy_transitions(signal, temperature, get_guppy_model(FLAPPIE_MODEL_R941_NATIVE, FLAPPIE_PRECISION_FLOAT));
     //return flipflop_guppy_transitions_vec(signal, temperature, &flipflop_r941native_guppy);
     //return flipflop_guppy_transitions_linear(signal, temperature, &flipflop_r941native_guppy);
     //return flipflop_guppy_transitions_linear_vec(signal, temperature, &flipflop_r941native_guppy);
 }
 
 flappie_matrix flipflop_transitions_r941native5mC(const raw_table signal, float temperature){
-    return flipflop_guppy_transitions(signal, temperature, &flipflop_r941native5mC_guppy);
+    return flipflop_guppy_transitions(signal, temperature, get_guppy_model(FLAPPIE_MODEL_R941_5mC, FLAPPIE_PRECISION_FLOAT));
 }
 
 flappie_matrix flipflop_transitions_r10Cpcr(const raw_table signal, float temperature){
-    return flipflop_guppy_transitions(signal, temperature, &flipflop_r10Cpcr_guppy);
+    return flipflop_guppy_transitions(signal, temperature, get_guppy_model(FLAPPIE_MODEL_R10C_PCR, FLAPPIE_PRECISION_FLOAT));
 }
 
 flappie_matrix runlength_transitions_r941native(const raw_table signal, float temperature){
-    return runlength_guppy_transitions(signal, temperature, &runlength_r941native_guppy);
+    return runlength_guppy_transitions(signal, temperature, get_guppy_model(RUNNIE_MODEL_R941_NATIVE, FLAPPIE_PRECISION_FLOAT));
 }
 
 flappie_matrix runlengthV2_transitions_r941native(const raw_table signal, float temperature){
-    return runlengthV2_guppy_transitions(signal, temperature, &runlengthV2_r941native_guppy);
+    return runlengthV2_guppy_transitions(signal, temperature, get_guppy_model(RUNNIE_NEWMODEL_R941_NATIVE, FLAPPIE_PRECISION_FLOAT));
 }
@@ -12,6 +12,7 @@
 #    include <stdbool.h>
 #    include "flappie_matrix.h"
 #    include "flappie_structures.h"
+#    include "flappie_threadpool.h"
 
 typedef flappie_matrix (*transition_function_ptr)(const raw_table, float);
 
@@ -28,13 +29,67 @@ enum model_type {
 static const enum model_type flappie_nmodel = FLAPPIE_MODEL_INVALID;
 static const enum model_type runnie_nmodel = RUNNIE_MODEL_INVALID - FLAPPIE_MODEL_INVALID;
 
+/**  Numerical precision of weights used by networks, or of activations stored between layers
+ **/
+enum flappie_precision {
+    FLAPPIE_PRECISION_FLOAT = 0,
+    FLAPPIE_PRECISION_INT8,
+    FLAPPIE_PRECISION_FP16,
+    FLAPPIE_PRECISION_BF16,
+    FLAPPIE_PRECISION_INT16,
+    FLAPPIE_PRECISION_INVALID
+};
+
+//  Number of recurrent layers of flip-flop and run-length models
+#define FLAPPIE_NLAYER_RECURRENT 5
+
+/**  Largest magnitude of each unbounded tensor of a flip-flop network
+ *
+ *   Sets the fixed point format of each tensor when weights are int16.
+ *   Other tensors are the output of tanh or logistic, so bounded by one.
+ **/
+struct flappie_calibration {
+    //  Normalised signal
+    float features;
+    //  Input to gates of each recurrent layer, its input projection and recurrent part
+    float gru_input[FLAPPIE_NLAYER_RECURRENT];
+    float gru_recurrent[FLAPPIE_NLAYER_RECURRENT];
+};
+
 enum model_type get_flappie_model_type(const char *modelstr);
 const char *flappie_model_string(const enum model_type model);
 const char *flappie_model_description(const enum model_type model);
 transition_function_ptr get_transition_function(const enum model_type model);
 
 flappie_matrix calculate_transitions(const raw_table signal, float temperature, enum model_type model);
-void calculate_transitions_new(raw_table signal[], float temperature, enum model_type model, int nfiles, flappie_matrix trans_weights[]);
+void calculate_transitions_new(raw_table signal[], float temperature, enum model_type model,
+                               enum flappie_precision precision, int nfiles, flappie_matrix trans_weights[],
+                               flappie_threadpool pool);
+flappie_matrix calculate_transitions_chunked(const raw_table signal, size_t chunk_size, size_t chunk_overlap,
+                                             float temperature, enum model_type model,
+                                             enum flappie_precision precision, flappie_threadpool pool);
+size_t get_model_stride(const enum model_type model);
+size_t predict_basecall_memory(const enum model_type model, size_t nsample);
+bool replicate_model_weights(const enum model_type model, enum flappie_precision precision);
+enum flappie_precision get_flappie_precision(const char * precisionstr);
+const char * flappie_precision_string(enum flappie_precision precision);
+bool flappie_set_activation_precision(enum flappie_precision precision);
+enum flappie_precision flappie_activation_precision(void);
+bool flappie_calibrate_read(const raw_table signal, enum model_type model, struct flappie_calibration * cal);
+bool write_flappie_calibration(FILE * fh, enum model_type model, const struct flappie_calibration * cal);
+bool read_flappie_calibration(FILE * fh, enum model_type * model, struct flappie_calibration * cal);
+bool flappie_set_calibration(enum model_type model, const struct flappie_calibration * cal);
+bool flappie_get_calibration(enum model_type model, struct flappie_calibration * cal);
+
+typedef struct _flappie_network_workspace *flappie_network_workspace;
+flappie_network_workspace make_flappie_network_workspace(const enum model_type model, enum flappie_precision precision,
+                                                         size_t max_nsample);
+flappie_network_workspace free_flappie_network_workspace(flappie_network_workspace ws);
+const_flappie_matrix flipflop_transitions_workspace(const raw_table signal, float temperature,
+                                                    flappie_network_workspace ws);
+raw_table * chunk_raw_table(const raw_table signal, size_t chunk_size, size_t chunk_overlap, size_t stride, size_t * nchunk);
+flappie_matrix stitch_chunk_transitions(const raw_table signal, const raw_table * chunks,
+                                        const flappie_matrix * trans, size_t nchunk, size_t stride);
 
 flappie_matrix flipflop_transitions_r941native(const raw_table signal, float temperature);
 flappie_matrix flipflop_transitions_r941native5mC(const raw_table signal, float temperature);
@@ -13,10 +13,21 @@
 #include "util.h"
 
 flappie_matrix features_from_raw(const raw_table signal) {
+    return remake_features_from_raw(signal, NULL);
+}
+
+/**  Features of signal, reusing a matrix if it is already the right size
+ *
+ *  @param signal Signal, features are made from samples between start and end
+ *  @param sigmat Matrix to reuse or NULL.  Its padding must be zero.
+ *
+ *  @returns Matrix of features, sigmat if it could be reused
+ **/
+flappie_matrix remake_features_from_raw(const raw_table signal, flappie_matrix sigmat) {
     RETURN_NULL_IF(0 == signal.n, NULL);
     RETURN_NULL_IF(NULL == signal.raw, NULL);
     const size_t nsample = signal.end - signal.start;
-    flappie_matrix sigmat = make_flappie_matrix(1, nsample);
+    sigmat = remake_flappie_matrix(sigmat, 1, nsample);
     RETURN_NULL_IF(NULL == sigmat, NULL);
 
     const size_t offset = signal.start;
@@ -28,16 +39,55 @@ flappie_matrix features_from_raw(const raw_table signal) {
 }
 
 flappie_matrix_vec features_from_raw_vec(raw_table signal[], int nfiles) {
-    const size_t nsample = signal[0].end - signal[0].start;
-    flappie_matrix_vec sigmat = make_flappie_matrix_vec(1, nsample, nfiles);
+    size_t * nsample = calloc(nfiles, sizeof(size_t));
+    RETURN_NULL_IF(NULL == nsample, NULL);
+    for (int fn=0; fn < nfiles; fn++){
+        nsample[fn] = signal[fn].end - signal[fn].start;
+    }
+    flappie_matrix_vec sigmat = make_flappie_matrix_vec_nc(1, nsample, nfiles);
+    free(nsample);
     RETURN_NULL_IF(NULL == sigmat, NULL);
 
     for (int fn=0; fn < nfiles; fn++){
 	    const size_t offset = signal[fn].start;
-	    for (size_t i = 0 ; i < nsample ; i++) {
+	    for (size_t i = 0 ; i < sigmat[fn]->nc ; i++) {
 		// Copy with stride 4 because of required padding for matrix
 		sigmat[fn]->data.f[i * 4] = signal[fn].raw[i + offset];
 	    }
     }
     return sigmat;
 }
+
+/**  Features for a padded batch of reads
+ *
+ *  Reads are laid end to end, each padded with zeros to the length of the
+ *  longest read in the batch.
+ *
+ *  @param signal Array of nbatch reads
+ *  @param nbatch Number of reads
+ *
+ *  @returns Padded batch, 1 x (nbatch * longest read), or NULL on failure
+ **/
+flappie_matrix features_from_raw_padded(const raw_table * signal, size_t nbatch) {
+    RETURN_NULL_IF(NULL == signal, NULL);
+    size_t npad = 0;
+    for (size_t fn=0 ; fn < nbatch ; fn++) {
+        const size_t nsample = signal[fn].end - signal[fn].start;
+        npad = (nsample > npad) ? nsample : npad;
+    }
+    RETURN_NULL_IF(0 == npad, NULL);
+
+    flappie_matrix sigmat = make_flappie_matrix(1, nbatch * npad);
+    RETURN_NULL_IF(NULL == sigmat, NULL);
+
+    for (size_t fn=0 ; fn < nbatch ; fn++) {
+        const size_t nsample = signal[fn].end - signal[fn].start;
+        const size_t offset = signal[fn].start;
+        float * col = sigmat->data.f + fn * npad * 4;
+        for (size_t i = 0 ; i < nsample ; i++) {
+            // Copy with stride 4 because of required padding for matrix
+            col[i * 4] = signal[fn].raw[i + offset];
+        }
+    }
+    return sigmat;
+}
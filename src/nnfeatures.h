@@ -14,6 +14,8 @@
 #    include "flappie_matrix.h"
 
 flappie_matrix features_from_raw(const raw_table signal);
+flappie_matrix remake_features_from_raw(const raw_table signal, flappie_matrix sigmat);
 flappie_matrix_vec features_from_raw_vec(raw_table signal[], int nfiles);
+flappie_matrix features_from_raw_padded(const raw_table * signal, size_t nbatch);
 
 #endif /* FEATURES_H */
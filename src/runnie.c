@@ -10,6 +10,7 @@
 #include <glob.h>
 #include <libgen.h>
 #include <math.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <strings.h>
 
@@ -22,6 +23,7 @@
 #include "flappie_output.h"
 #include "flappie_stdlib.h"
 #include "flappie_structures.h"
+#include "flappie_threadpool.h"
 #include "util.h"
 #include "version.h"
 
@@ -61,6 +63,8 @@ static struct argp_option options[] = {
 
     {"uuid", 14, 0, 0, "Output UUID"},
     {"no-uuid", 15, 0, OPTION_ALIAS, "Output read file"},
+    {"batch-size", 19, "nreads", 0, "Maximum number of reads passed through network together"},
+    {"threads", 23, "nthread", 0, "Number of threads, each running a batch of reads"},
     {0}
 };
 
@@ -85,6 +89,8 @@ struct arguments {
     bool viterbi_only;
     char ** files;
     bool uuid;
+    int batch_size;
+    int threads;
 };
 
 static struct arguments args = {
@@ -104,7 +110,9 @@ static struct arguments args = {
     .varseg_thresh = 0.0f,
     .viterbi_only = false,
     .files = NULL,
-    .uuid = true
+    .uuid = true,
+    .batch_size = 4,
+    .threads = 1
 };
 
 
@@ -219,6 +227,14 @@ static error_t parse_arg(int key, char * arg, struct  argp_state * state){
     case 15:
         args.uuid = false;
         break;
+    case 19:
+        args.batch_size = atoi(arg);
+        assert(args.batch_size > 0);
+        break;
+    case 23:
+        args.threads = atoi(arg);
+        assert(args.threads > 0);
+        break;
     case ARGP_KEY_NO_ARGS:
         argp_usage (state);
         break;
@@ -238,14 +254,11 @@ static error_t parse_arg(int key, char * arg, struct  argp_state * state){
 static struct argp argp = {options, parse_arg, args_doc, doc};
 
 
-static void calculate_post(char * filename, enum model_type model){
-    RETURN_NULL_IF(NULL == filename, );
-
-    raw_table rt = read_raw(filename, true);
-    RETURN_NULL_IF(NULL == rt.raw, );
+static raw_table trim_and_normalise_read(raw_table rt){
+    RETURN_NULL_IF(NULL == rt.raw, rt);
 
     rt = trim_and_segment_raw(rt, args.trim_start, args.trim_end, args.varseg_chunk, args.varseg_thresh);
-    RETURN_NULL_IF(NULL == rt.raw, );
+    RETURN_NULL_IF(NULL == rt.raw, rt);
 
     if( args.delta == 0.0f){
         medmad_normalise_array(rt.raw + rt.start, rt.end - rt.start);
@@ -253,69 +266,258 @@ static void calculate_post(char * filename, enum model_type model){
         difference_array(rt.raw + rt.start, rt.end - rt.start);
         shift_scale_array(rt.raw + rt.start, rt.end - rt.start, 0.0, args.delta);
     }
+    return rt;
+}
+
+
+/**  Text of a called read, built while decoding and written out in order
+ **/
+struct text_buffer {
+    char * str;
+    size_t len;
+    size_t capacity;
+};
+
+
+static bool append_text(struct text_buffer * buf, const char * fmt, ...){
+    for(;;){
+        const size_t avail = buf->capacity - buf->len;
+        va_list ap;
+        va_start(ap, fmt);
+        const int nchar = vsnprintf((NULL != buf->str) ? (buf->str + buf->len) : NULL, avail, fmt, ap);
+        va_end(ap);
+        if(nchar < 0){
+            return false;
+        }
+        if((size_t)nchar < avail){
+            buf->len += nchar;
+            return true;
+        }
 
-    flappie_matrix trans_weights = calculate_transitions(rt, args.temperature, model);
-    if (NULL == trans_weights) {
+        const size_t capacity = 2 * buf->capacity + nchar + 1;
+        char * str = realloc(buf->str, capacity);
+        if(NULL == str){
+            return false;
+        }
+        buf->str = str;
+        buf->capacity = capacity;
+    }
+}
+
+
+static bool append_run(struct text_buffer * buf, const_flappie_matrix transpost, const int * path, size_t nbase, int blk, int dwell){
+    const size_t offset = blk * transpost->stride;
+    const int base = path[blk];
+    const float shape = transpost->data.f[offset + base];
+    const float scale = transpost->data.f[offset + nbase + base];
+    return append_text(buf, "%c\t%f\t%f\t%d\n", basechar(base), shape, scale, dwell);
+}
+
+
+/**  Decode read and format its runs into a buffer
+ *
+ *  Takes ownership of both the read and its transition weights.  Nothing
+ *  is written to the buffer if the read could not be called.
+ **/
+static void format_post(raw_table rt, flappie_matrix trans_weights, struct text_buffer * text){
+    text->len = 0;
+    if (NULL == rt.raw || NULL == trans_weights) {
+        trans_weights = free_flappie_matrix(trans_weights);
         free_raw_table(&rt);
         return;
     }
 
     const size_t nblock = trans_weights->nc;
     const size_t nparam = trans_weights->nr;
-    const size_t nbase = nbase_from_crf_runlength_nparam(nparam);
+    const int nbase = nbase_from_crf_runlength_nparam(nparam);
     int * path = calloc(nblock + 2, sizeof(int));
 
-    float score = NAN;
-
-
     flappie_matrix transpost = trans_weights;
     if(!args.viterbi_only){
         transpost = transpost_crf_runlength(trans_weights);
-        free(trans_weights);
+        trans_weights = free_flappie_matrix(trans_weights);
     }
-    score = decode_crf_runlength(transpost, path);
-    fprintf(args.output, "# %s\n", rt.uuid);
-
-    {
-        int dwell = 1;
-        int last_blk = -1;
-        for(size_t blk=0 ; blk < nblock ; blk++){
-            if(path[blk] >= nbase){
-                // No new base emitted, short circuit
-                dwell += 1;
-                continue;
-            }
-
-            //  New base
-            if(last_blk >= 0){
-                // If a base has already been called, emit run
-                const size_t offset = last_blk * transpost->stride;
-                const int base = path[last_blk];
-                const float shape = transpost->data.f[offset + base];
-                const float scale = transpost->data.f[offset + nbase + base];
-                fprintf(args.output, "%c\t%f\t%f\t%d\n",
-                        basechar(base), shape, scale, dwell);
-            }
-            last_blk = blk;
-            dwell = 1;
+    if(NULL == path || NULL == transpost){
+        warnx("Failed to decode read %s.", rt.uuid);
+        goto cleanup;
+    }
+    decode_crf_runlength(transpost, path);
+
+    bool ok = append_text(text, "# %s\n", rt.uuid);
+    int dwell = 1;
+    int last_blk = -1;
+    for(size_t blk=0 ; blk < nblock && ok ; blk++){
+        if(path[blk] >= nbase){
+            // No new base emitted, short circuit
+            dwell += 1;
+            continue;
         }
+
+        //  New base
         if(last_blk >= 0){
-            // Emit final base and run, if any
-            const size_t offset = last_blk * transpost->stride;
-            const int base = path[last_blk];
-            const float shape = transpost->data.f[offset + base];
-            const float scale = transpost->data.f[offset + nbase + base];
-            fprintf(args.output, "%c\t%f\t%f\t%d\n",
-                    basechar(base), shape, scale, dwell);
+            // If a base has already been called, emit run
+            ok = append_run(text, transpost, path, nbase, last_blk, dwell);
         }
+        last_blk = blk;
+        dwell = 1;
+    }
+    if(ok && last_blk >= 0){
+        // Emit final base and run, if any
+        ok = append_run(text, transpost, path, nbase, last_blk, dwell);
+    }
+    if(!ok){
+        warnx("Failed to format read %s.", rt.uuid);
+        text->len = 0;
     }
 
+cleanup:
     transpost = free_flappie_matrix(transpost);
     free(path);
     free_raw_table(&rt);
 }
 
 
+struct read_order {
+    size_t length;
+    size_t idx;
+};
+
+
+static int cmp_read_order(const void * a, const void * b){
+    const struct read_order * ra = a;
+    const struct read_order * rb = b;
+    if(ra->length != rb->length){
+        return (ra->length < rb->length) ? -1 : 1;
+    }
+    return (ra->idx < rb->idx) ? -1 : ((ra->idx > rb->idx) ? 1 : 0);
+}
+
+
+/**  Reads waiting to be called
+ *
+ *   Reads are trimmed, run through the network in batches of reads of
+ *   similar length and decoded, each step across all threads.  Output is
+ *   written in the order reads were added.
+ **/
+struct read_batch {
+    raw_table * rt;
+    flappie_matrix * trans;
+    struct text_buffer * text;
+    size_t * nsample;
+    size_t n;
+    size_t capacity;
+    //  Reads ordered by length and divided into network batches
+    struct read_order * order;
+    raw_table * network_rt;
+    flappie_matrix * network_trans;
+    size_t * network_nsample;
+    size_t network_size;
+    flappie_threadpool pool;
+};
+
+
+static bool init_read_batch(struct read_batch * batch, size_t network_size, size_t nnetwork){
+    *batch = (struct read_batch){.capacity = network_size * nnetwork, .network_size = network_size};
+    batch->rt = calloc(batch->capacity, sizeof(raw_table));
+    batch->trans = calloc(batch->capacity, sizeof(flappie_matrix));
+    batch->text = calloc(batch->capacity, sizeof(struct text_buffer));
+    batch->nsample = calloc(batch->capacity, sizeof(size_t));
+    batch->order = calloc(batch->capacity, sizeof(struct read_order));
+    batch->network_rt = calloc(batch->capacity, sizeof(raw_table));
+    batch->network_trans = calloc(batch->capacity, sizeof(flappie_matrix));
+    batch->network_nsample = calloc(nnetwork, sizeof(size_t));
+    return NULL != batch->rt && NULL != batch->trans && NULL != batch->text && NULL != batch->nsample
+        && NULL != batch->order && NULL != batch->network_rt && NULL != batch->network_trans
+        && NULL != batch->network_nsample;
+}
+
+
+static void free_read_batch(struct read_batch * batch){
+    if(NULL != batch->text){
+        for(size_t i=0 ; i < batch->capacity ; i++){
+            free(batch->text[i].str);
+        }
+    }
+    free(batch->network_nsample);
+    free(batch->network_trans);
+    free(batch->network_rt);
+    free(batch->order);
+    free(batch->nsample);
+    free(batch->text);
+    free(batch->trans);
+    free(batch->rt);
+}
+
+
+static void trim_and_normalise_batch_read(size_t i, void * data){
+    struct read_batch * batch = data;
+    batch->rt[i] = trim_and_normalise_read(batch->rt[i]);
+}
+
+
+static void calculate_transitions_network_batch(size_t i, void * data){
+    struct read_batch * batch = data;
+    const size_t start = i * batch->network_size;
+    const size_t nread = (batch->n - start < batch->network_size) ? (batch->n - start) : batch->network_size;
+    calculate_transitions_new(batch->network_rt + start, args.temperature, args.model, FLAPPIE_PRECISION_FLOAT, nread,
+                              batch->network_trans + start, batch->pool);
+}
+
+
+static void format_batch_read(size_t i, void * data){
+    struct read_batch * batch = data;
+    format_post(batch->rt[i], batch->trans[i], batch->text + i);
+    batch->trans[i] = NULL;
+}
+
+
+static void flush_read_batch(struct read_batch * batch){
+    if(0 == batch->n){
+        return;
+    }
+    //  Longest reads first so a long read does not finish after all the others
+    flappie_parallel_for_weighted(batch->pool, batch->n, batch->nsample, trim_and_normalise_batch_read, batch);
+
+    //  Reads of similar length are run through the network together
+    for(size_t i=0 ; i < batch->n ; i++){
+        const size_t length = (NULL != batch->rt[i].raw) ? (batch->rt[i].end - batch->rt[i].start) : 0;
+        batch->order[i] = (struct read_order){length, i};
+    }
+    qsort(batch->order, batch->n, sizeof(struct read_order), cmp_read_order);
+    const size_t nnetwork = iceil(batch->n, batch->network_size);
+    for(size_t i=0 ; i < nnetwork ; i++){
+        batch->network_nsample[i] = 0;
+    }
+    for(size_t i=0 ; i < batch->n ; i++){
+        batch->network_rt[i] = batch->rt[batch->order[i].idx];
+        batch->network_nsample[i / batch->network_size] += batch->order[i].length;
+    }
+    flappie_parallel_for_weighted(batch->pool, nnetwork, batch->network_nsample, calculate_transitions_network_batch, batch);
+    for(size_t i=0 ; i < batch->n ; i++){
+        batch->trans[batch->order[i].idx] = batch->network_trans[i];
+    }
+
+    flappie_parallel_for_weighted(batch->pool, batch->n, batch->nsample, format_batch_read, batch);
+    for(size_t i=0 ; i < batch->n ; i++){
+        fwrite(batch->text[i].str, sizeof(char), batch->text[i].len, args.output);
+    }
+    batch->n = 0;
+}
+
+
+static void add_read_batch(struct read_batch * batch, raw_table rt){
+    if(NULL == rt.raw){
+        return;
+    }
+    batch->rt[batch->n] = rt;
+    batch->nsample[batch->n] = rt.n;
+    batch->n += 1;
+    if(batch->n == batch->capacity){
+        flush_read_batch(batch);
+    }
+}
+
+
 int main(int argc, char * argv[]){
     argp_parse(&argp, argc, argv, 0, 0, NULL);
     if(NULL == args.output){
@@ -331,6 +533,18 @@ int main(int argc, char * argv[]){
     int reads_started = 0;
     const int reads_limit = args.limit;
 
+    //  Enough reads for every thread to run a full network batch
+    struct read_batch batch;
+    if(!init_read_batch(&batch, args.batch_size, args.threads)){
+        errx(EXIT_FAILURE, "Failed to allocate %d batches of %d reads.", args.threads, args.batch_size);
+    }
+    if(args.threads > 1){
+        batch.pool = make_flappie_threadpool(args.threads);
+        if(NULL == batch.pool){
+            errx(EXIT_FAILURE, "Failed to create pool of %d threads.", args.threads);
+        }
+    }
+
     for(int fn=0 ; fn < nfile ; fn++){
         if(reads_limit > 0 && reads_started >= reads_limit){
             continue;
@@ -365,14 +579,23 @@ int main(int argc, char * argv[]){
             if(reads_limit > 0 && reads_started >= reads_limit){
                 continue;
             }
-            reads_started += 1;
-
-            char * filename = globbuf.gl_pathv[fn2];
-            calculate_post(filename, args.model);
+            //  Each file is opened once and may contain many reads
+            fast5_reader reader = open_fast5_reader(globbuf.gl_pathv[fn2]);
+            if(NULL == reader){
+                continue;
+            }
+            raw_table rt;
+            while((reads_limit <= 0 || reads_started < reads_limit) && fast5_reader_next(reader, true, &rt)){
+                reads_started += 1;
+                add_read_batch(&batch, rt);
+            }
+            reader = close_fast5_reader(reader);
         }
         globfree(&globbuf);
     }
-
+    flush_read_batch(&batch);
+    batch.pool = free_flappie_threadpool(batch.pool);
+    free_read_batch(&batch);
 
     if (hdf5out >= 0) {
         H5Fclose(hdf5out);
@@ -10,11 +10,9 @@
 //#include "nanonet_rgr.h"
 #include "nnfeatures.h"
 #include "flappie_common.h"
+#include "flappie_profile.h"
 #include "flappie_util.h"
 #include "skeleton.h"
-#include <sys/time.h>
-struct timeval start, end_time;
-long useconds, seconds, mseconds;
 
 
 int main(int argc, char * argv[]){
@@ -39,7 +37,7 @@ int main(int argc, char * argv[]){
 
     raw_mat = free_flappie_matrix(raw_mat);
 
-    gettimeofday(&start, NULL);
+    const double start = flappie_profile_clock();
 
     flappie_matrix gruB1in = feedforward_linear(conv, net->gruB1_iW, net->gruB1_b, NULL);
     conv = free_flappie_matrix(conv);
@@ -48,10 +46,6 @@ int main(int argc, char * argv[]){
     write_flappie_matrix("gruB1.crp", gruB1);
     gruB1 = free_flappie_matrix(gruB1);
 
-    gettimeofday(&end_time, NULL);
-    useconds = end_time.tv_usec - start.tv_usec;
-    seconds = end_time.tv_sec - start.tv_sec;
-    mseconds = ((seconds) * 1000 + useconds/1000.0) + 0.5;
-    fprintf(stderr,"Time elapsed (doing 1 GRU): %ld msec\n", mseconds );
+    fprintf(stderr,"Time elapsed (doing 1 GRU): %.0f msec\n", 1000.0 * (flappie_profile_clock() - start));
 
 }
@@ -12,19 +12,43 @@
 
 int register_flappie_util(void);
 int register_test_skeleton(void);
+int register_test_cache(void);
+int register_test_caller(void);
+int register_test_chunk(void);
 int register_test_convolution(void);
 int register_test_elu(void);
+int register_test_grumod(void);
+int register_test_math(void);
 int register_test_matrix(void);
+int register_test_padded(void);
+int register_test_numa(void);
+int register_test_profile(void);
+int register_test_queue(void);
+int register_test_readuntil(void);
 int register_test_signal(void);
+int register_test_stream(void);
+int register_test_threadpool(void);
 int register_test_util(void);
 
 int (*test_suites[]) (void) = {
     register_test_skeleton,
     register_flappie_util,
+    register_test_cache,
+    register_test_caller,
+    register_test_chunk,
     register_test_convolution,
     register_test_elu,
+    register_test_grumod,
+    register_test_math,
     register_test_matrix,
+    register_test_padded,
+    register_test_numa,
+    register_test_profile,
+    register_test_queue,
+    register_test_readuntil,
     register_test_signal,
+    register_test_stream,
+    register_test_threadpool,
     register_test_util,
     NULL // Last element of array should be NULL
 };
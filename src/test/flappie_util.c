@@ -9,8 +9,10 @@
 #define BANANA 1
 #define _BSD_SOURCE
 
+#include <CUnit/Basic.h>
 #include <math.h>
 
+#include "flappie_cpu.h"
 #include "flappie_stdlib.h"
 #include "flappie_util.h"
 
@@ -184,3 +186,20 @@ flappie_matrix random_flappie_matrix(size_t nr, size_t nc, float lower, float up
            (mat, lower, upper, 0.0, true, __FILE__, __LINE__));
     return mat;
 }
+
+/**  Run a check at every level of kernels the host supports
+ *
+ *   Each level is selected in turn, from the lowest, before calling check.
+ *   The best level the host supports is selected again afterwards.
+ *
+ *  @param check Function containing the assertions to make at each level
+ **/
+void for_each_cpu_level(void (*check)(void)) {
+    const enum flappie_cpu_level best = flappie_cpu_detect();
+    for (int level = FLAPPIE_CPU_SSE4; level <= best; level++) {
+        CU_ASSERT_FATAL(flappie_set_cpu_level(level));
+        CU_ASSERT_EQUAL(flappie_cpu_level(), level);
+        check();
+    }
+    CU_ASSERT_FATAL(flappie_set_cpu_level(best));
+}
@@ -20,4 +20,6 @@ flappie_matrix read_flappie_matrix(char const * fn);
 flappie_matrix random_flappie_matrix(size_t nr, size_t nc, float lower,
                                        float upper);
 
+void for_each_cpu_level(void (*check)(void));
+
 #endif                          /* FLAPPIE_MATRIX_UTIL */
@@ -0,0 +1,195 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#define BANANA 1
+#include <CUnit/Basic.h>
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <flappie_cache.h>
+#include "test_common.h"
+
+static const char cache_dir[] = "test_cache_entries";
+static const char settings[] = "model test\n";
+static const size_t nsample = 100;
+
+
+//  Untrimmed read with signal 0, 1, 2, ...
+static raw_table make_read(const char * read_id){
+    char * uuid = calloc(16, sizeof(char));
+    float * raw = calloc(nsample, sizeof(float));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(uuid);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(raw);
+    snprintf(uuid, 16, "%s", read_id);
+    for(size_t i=0 ; i < nsample ; i++){
+        raw[i] = i;
+    }
+    return (raw_table){uuid, nsample, 0, nsample, raw};
+}
+
+
+static struct _raw_basecall_info make_basecall(const char * read_id){
+    raw_table rt = make_read(read_id);
+    rt.start = 10;
+    rt.end = 90;
+    //  Normalised signal differs from raw
+    for(size_t i=rt.start ; i < rt.end ; i++){
+        rt.raw[i] = -1.0f * i;
+    }
+    char * basecall = calloc(5, sizeof(char));
+    char * quality = calloc(5, sizeof(char));
+    flappie_imatrix trace = make_flappie_imatrix(8, 40);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(basecall);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(quality);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(trace);
+    memcpy(basecall, "ACGT", 4);
+    memcpy(quality, "!#+5", 4);
+    for(size_t c=0 ; c < trace->nc ; c++){
+        for(size_t r=0 ; r < trace->nr ; r++){
+            trace->data.f[c * trace->stride + r] = c * trace->nr + r;
+        }
+    }
+    return (struct _raw_basecall_info){.score = -12.5f, .rt = rt, .basecall = basecall, .quality = quality,
+                                       .basecall_length = 4, .trace = trace, .pos = NULL, .nblock = 40};
+}
+
+
+/**  Initialise test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_cache(void) {
+    return 0;
+}
+
+/**  Clean up after test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int clean_test_cache(void) {
+    DIR * dirp = opendir(cache_dir);
+    if(NULL == dirp){
+        return 0;
+    }
+    char filename[1024];
+    struct dirent * entry = NULL;
+    while(NULL != (entry = readdir(dirp))){
+        if('.' == entry->d_name[0]){
+            continue;
+        }
+        snprintf(filename, sizeof(filename), "%s/%s", cache_dir, entry->d_name);
+        remove(filename);
+    }
+    closedir(dirp);
+    return rmdir(cache_dir);
+}
+
+
+void test_roundtrip_cache(void) {
+    flappie_cache cache = make_flappie_cache(cache_dir, settings);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cache);
+    struct _raw_basecall_info res = make_basecall("read_roundtrip");
+    CU_ASSERT_FATAL(flappie_cache_store(cache, &res, false));
+
+    struct _raw_basecall_info cached;
+    CU_ASSERT_FATAL(flappie_cache_lookup(cache, make_read("read_roundtrip"), false, &cached));
+    CU_ASSERT_EQUAL(cached.score, res.score);
+    CU_ASSERT_EQUAL(cached.rt.n, res.rt.n);
+    CU_ASSERT_EQUAL(cached.rt.start, res.rt.start);
+    CU_ASSERT_EQUAL(cached.rt.end, res.rt.end);
+    CU_ASSERT_EQUAL(cached.nblock, res.nblock);
+    CU_ASSERT_EQUAL(cached.basecall_length, res.basecall_length);
+    CU_ASSERT_STRING_EQUAL(cached.basecall, res.basecall);
+    CU_ASSERT_STRING_EQUAL(cached.quality, res.quality);
+    CU_ASSERT_PTR_NULL(cached.trace);
+    //  Signal untouched when trace is not wanted
+    CU_ASSERT_EQUAL(cached.rt.raw[50], 50.0f);
+
+    free_raw_basecall_info(&cached);
+    free_raw_basecall_info(&res);
+    cache = free_flappie_cache(cache);
+}
+
+
+void test_trace_cache(void) {
+    flappie_cache cache = make_flappie_cache(cache_dir, settings);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cache);
+    struct _raw_basecall_info res = make_basecall("read_trace");
+    struct _raw_basecall_info cached;
+
+    //  Entry without trace does not satisfy lookup wanting one
+    CU_ASSERT_FATAL(flappie_cache_store(cache, &res, false));
+    raw_table rt = make_read("read_trace");
+    CU_ASSERT_FALSE(flappie_cache_lookup(cache, rt, true, &cached));
+
+    CU_ASSERT_FATAL(flappie_cache_store(cache, &res, true));
+    CU_ASSERT_FATAL(flappie_cache_lookup(cache, rt, true, &cached));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cached.trace);
+    CU_ASSERT_EQUAL(cached.trace->nr, res.trace->nr);
+    CU_ASSERT_EQUAL(cached.trace->nc, res.trace->nc);
+    for(size_t c=0 ; c < res.trace->nc ; c++){
+        for(size_t r=0 ; r < res.trace->nr ; r++){
+            CU_ASSERT_EQUAL(cached.trace->data.f[c * cached.trace->stride + r], res.trace->data.f[c * res.trace->stride + r]);
+        }
+    }
+    //  Normalised signal is restored
+    for(size_t i=0 ; i < nsample ; i++){
+        CU_ASSERT_EQUAL(cached.rt.raw[i], res.rt.raw[i]);
+    }
+
+    free_raw_basecall_info(&cached);
+    free_raw_basecall_info(&res);
+    cache = free_flappie_cache(cache);
+}
+
+
+void test_miss_cache(void) {
+    flappie_cache cache = make_flappie_cache(cache_dir, settings);
+    flappie_cache other = make_flappie_cache(cache_dir, "model other\n");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cache);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(other);
+    struct _raw_basecall_info res = make_basecall("read_miss");
+    CU_ASSERT_FATAL(flappie_cache_store(cache, &res, false));
+
+    struct _raw_basecall_info cached;
+    raw_table rt = make_read("read_miss");
+    //  Different settings
+    CU_ASSERT_FALSE(flappie_cache_lookup(other, rt, false, &cached));
+    //  Different read
+    raw_table unknown = make_read("read_unknown");
+    CU_ASSERT_FALSE(flappie_cache_lookup(cache, unknown, false, &cached));
+    //  Different length of signal
+    rt.n -= 1;
+    CU_ASSERT_FALSE(flappie_cache_lookup(cache, rt, false, &cached));
+    //  No cache
+    CU_ASSERT_FALSE(flappie_cache_lookup(NULL, rt, false, &cached));
+
+    free_raw_table(&unknown);
+    free_raw_table(&rt);
+    free_raw_basecall_info(&res);
+    other = free_flappie_cache(other);
+    cache = free_flappie_cache(cache);
+}
+
+
+static test_with_description tests[] = {
+    {"Basecall read back from cache matches that stored", test_roundtrip_cache},
+    {"Trace and normalised signal read back from cache", test_trace_cache},
+    {"Lookup misses for other reads and settings", test_miss_cache},
+    {0}};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_cache(void) {
+    return flappie_register_test_suite("On-disk cache of basecalls", init_test_cache, clean_test_cache, tests);
+}
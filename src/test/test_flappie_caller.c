@@ -0,0 +1,217 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#define BANANA 1
+#include <CUnit/Basic.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <flappie_caller.h>
+#include "test_common.h"
+
+#define NREAD 3
+#define NCALLER_THREAD 4
+
+static const size_t nsample[NREAD] = {3000, 2000, 2500};
+static int16_t * signal[NREAD] = {NULL};
+static flappie_caller caller = NULL;
+
+
+/**  Initialise test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_caller(void) {
+    struct flappie_caller_options options = default_flappie_caller_options();
+    options.nthread = 2;
+    caller = make_flappie_caller(options);
+    if(NULL == caller){
+        return 1;
+    }
+    srand(0x5eed);
+    for(size_t i=0 ; i < NREAD ; i++){
+        signal[i] = calloc(nsample[i], sizeof(int16_t));
+        if(NULL == signal[i]){
+            return 1;
+        }
+        for(size_t j=0 ; j < nsample[i] ; j++){
+            signal[i][j] = 400 + rand() % 200;
+        }
+    }
+    return 0;
+}
+
+/**  Clean up after test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int clean_test_caller(void) {
+    for(size_t i=0 ; i < NREAD ; i++){
+        free(signal[i]);
+        signal[i] = NULL;
+    }
+    caller = free_flappie_caller(caller);
+    return 0;
+}
+
+
+void test_call_signal_caller(void) {
+    struct _raw_basecall_info res;
+    CU_ASSERT_FATAL(flappie_call_signal(caller, signal[0], nsample[0], &res));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(res.basecall);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(res.quality);
+    CU_ASSERT_EQUAL(res.basecall_length, strlen(res.basecall));
+    CU_ASSERT_EQUAL(res.basecall_length, strlen(res.quality));
+    CU_ASSERT_PTR_NOT_NULL(res.trace);
+    CU_ASSERT_EQUAL(res.rt.n, nsample[0]);
+    CU_ASSERT(res.rt.start < res.rt.end);
+    free_raw_basecall_info(&res);
+}
+
+
+void test_empty_signal_caller(void) {
+    struct _raw_basecall_info res;
+    CU_ASSERT_FALSE(flappie_call_signal(caller, signal[0], 0, &res));
+    CU_ASSERT_PTR_NULL(res.basecall);
+}
+
+
+struct caller_thread_data {
+    struct _raw_basecall_info res[NREAD];
+    size_t ncalled;
+};
+
+static void * call_batch_thread(void * ptr){
+    struct caller_thread_data * data = ptr;
+    data->ncalled = flappie_call_signal_batch(caller, (const int16_t * const *)signal, nsample, NREAD, data->res);
+    return NULL;
+}
+
+
+void test_concurrent_calls_caller(void) {
+    struct caller_thread_data serial;
+    call_batch_thread(&serial);
+    CU_ASSERT_EQUAL_FATAL(serial.ncalled, NREAD);
+
+    struct caller_thread_data data[NCALLER_THREAD];
+    pthread_t thread[NCALLER_THREAD];
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    //  Layers keep large workspaces on the stack
+    pthread_attr_setstacksize(&attr, 16 * 1024 * 1024);
+    for(size_t t=0 ; t < NCALLER_THREAD ; t++){
+        CU_ASSERT_EQUAL_FATAL(pthread_create(thread + t, &attr, call_batch_thread, data + t), 0);
+    }
+    pthread_attr_destroy(&attr);
+
+    for(size_t t=0 ; t < NCALLER_THREAD ; t++){
+        pthread_join(thread[t], NULL);
+        CU_ASSERT_EQUAL(data[t].ncalled, NREAD);
+        for(size_t i=0 ; i < NREAD ; i++){
+            //  Calls made at the same time match those made alone
+            CU_ASSERT_EQUAL(data[t].res[i].score, serial.res[i].score);
+            CU_ASSERT_STRING_EQUAL(data[t].res[i].basecall, serial.res[i].basecall);
+            CU_ASSERT_STRING_EQUAL(data[t].res[i].quality, serial.res[i].quality);
+            free_raw_basecall_info(data[t].res + i);
+        }
+    }
+    for(size_t i=0 ; i < NREAD ; i++){
+        free_raw_basecall_info(serial.res + i);
+    }
+}
+
+
+void test_precision_per_caller(void) {
+    struct flappie_caller_options options = flappie_caller_get_options(caller);
+    CU_ASSERT_EQUAL(options.precision, FLAPPIE_PRECISION_FLOAT);
+
+    struct _raw_basecall_info before;
+    CU_ASSERT_FATAL(flappie_call_signal(caller, signal[0], nsample[0], &before));
+
+    options.precision = FLAPPIE_PRECISION_INT8;
+    flappie_caller reduced = make_flappie_caller(options);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(reduced);
+    CU_ASSERT_EQUAL(flappie_caller_get_options(reduced).precision, FLAPPIE_PRECISION_INT8);
+    struct _raw_basecall_info res;
+    CU_ASSERT_FATAL(flappie_call_signal(reduced, signal[0], nsample[0], &res));
+    free_raw_basecall_info(&res);
+    reduced = free_flappie_caller(reduced);
+
+    //  Caller at another precision does not change the weights of this one
+    struct _raw_basecall_info after;
+    CU_ASSERT_FATAL(flappie_call_signal(caller, signal[0], nsample[0], &after));
+    CU_ASSERT_EQUAL(after.score, before.score);
+    CU_ASSERT_STRING_EQUAL(after.basecall, before.basecall);
+    free_raw_basecall_info(&before);
+    free_raw_basecall_info(&after);
+}
+
+
+void test_predict_memory_caller(void) {
+    const enum model_type model = flappie_caller_get_options(caller).model;
+    CU_ASSERT_EQUAL(predict_basecall_memory(model, 0), 0);
+    const size_t short_read = predict_basecall_memory(model, 10000);
+    const size_t long_read = predict_basecall_memory(model, 100000);
+    //  At least the signal itself
+    CU_ASSERT(short_read >= 10000 * sizeof(float));
+    CU_ASSERT(long_read > 9 * short_read);
+    CU_ASSERT(long_read < 11 * short_read);
+}
+
+
+void test_calibration_caller(void) {
+    const enum model_type model = flappie_caller_get_options(caller).model;
+    float raw[2000];
+    for(size_t i=0 ; i < 2000 ; i++){
+        raw[i] = (signal[0][i] - 500.0f) / 60.0f;
+    }
+    const raw_table rt = {NULL, 2000, 0, 2000, raw};
+    struct flappie_calibration cal = {0};
+    CU_ASSERT_FATAL(flappie_calibrate_read(rt, model, &cal));
+    CU_ASSERT(cal.features > 1.0f);
+    for(size_t layer=0 ; layer < FLAPPIE_NLAYER_RECURRENT ; layer++){
+        CU_ASSERT(cal.gru_input[layer] > 0.0f);
+        CU_ASSERT(cal.gru_recurrent[layer] > 0.0f);
+    }
+
+    FILE * fh = tmpfile();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(fh);
+    CU_ASSERT(write_flappie_calibration(fh, model, &cal));
+    rewind(fh);
+    enum model_type read_model = FLAPPIE_MODEL_INVALID;
+    struct flappie_calibration read_cal = {0};
+    CU_ASSERT(read_flappie_calibration(fh, &read_model, &read_cal));
+    fclose(fh);
+    CU_ASSERT_EQUAL(read_model, model);
+    CU_ASSERT_EQUAL(read_cal.features, cal.features);
+    for(size_t layer=0 ; layer < FLAPPIE_NLAYER_RECURRENT ; layer++){
+        CU_ASSERT_EQUAL(read_cal.gru_input[layer], cal.gru_input[layer]);
+        CU_ASSERT_EQUAL(read_cal.gru_recurrent[layer], cal.gru_recurrent[layer]);
+    }
+}
+
+
+static test_with_description tests[] = {
+    {"Call of int16 signal is complete", test_call_signal_caller},
+    {"Empty signal is not called", test_empty_signal_caller},
+    {"Concurrent batches through one caller match serial calls", test_concurrent_calls_caller},
+    {"Callers at different precisions of weights coexist", test_precision_per_caller},
+    {"Predicted memory grows in proportion to length of read", test_predict_memory_caller},
+    {"Calibration of read is written and read back", test_calibration_caller},
+    {0}};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_caller(void) {
+    return flappie_register_test_suite("Reentrant basecaller", init_test_caller, clean_test_caller, tests);
+}
@@ -0,0 +1,120 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#define BANANA 1
+#include <CUnit/Basic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <networks.h>
+#include <util.h>
+#include "test_common.h"
+
+static float raw[1000];
+//  Trimmed read of 901 samples
+static const raw_table signal = {NULL, 1000, 50, 951, raw};
+static const size_t stride = 2;
+
+/**  Initialise test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_chunk(void) {
+    return 0;
+}
+
+/**  Clean up after test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int clean_test_chunk(void) {
+    return 0;
+}
+
+
+void test_chunks_cover_read_chunk(void) {
+    size_t nchunk = 0;
+    raw_table * chunks = chunk_raw_table(signal, 200, 51, stride, &nchunk);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(chunks);
+    CU_ASSERT_EQUAL(nchunk, 6);
+
+    CU_ASSERT_EQUAL(chunks[0].start, signal.start);
+    CU_ASSERT_EQUAL(chunks[nchunk - 1].end, signal.end);
+    for(size_t i=0 ; i < nchunk ; i++){
+        CU_ASSERT_PTR_EQUAL(chunks[i].raw, signal.raw);
+        CU_ASSERT(chunks[i].end - chunks[i].start <= 200);
+        //  Chunks start on a block boundary
+        CU_ASSERT_EQUAL((chunks[i].start - signal.start) % stride, 0);
+        if(i > 0){
+            //  Overlap is at least that requested
+            CU_ASSERT(chunks[i - 1].end >= chunks[i].start + 51);
+        }
+    }
+    free(chunks);
+}
+
+
+void test_short_read_is_one_chunk(void) {
+    size_t nchunk = 0;
+    raw_table * chunks = chunk_raw_table(signal, 2000, 100, stride, &nchunk);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(chunks);
+    CU_ASSERT_EQUAL(nchunk, 1);
+    CU_ASSERT_EQUAL(chunks[0].start, signal.start);
+    CU_ASSERT_EQUAL(chunks[0].end, signal.end);
+    free(chunks);
+}
+
+
+void test_stitch_chunk(void) {
+    size_t nchunk = 0;
+    raw_table * chunks = chunk_raw_table(signal, 200, 51, stride, &nchunk);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(chunks);
+
+    //  Each column of a chunk holds the index of the block of the read it covers
+    flappie_matrix * trans = calloc(nchunk, sizeof(flappie_matrix));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(trans);
+    for(size_t i=0 ; i < nchunk ; i++){
+        const size_t offset = (chunks[i].start - signal.start) / stride;
+        trans[i] = make_flappie_matrix(3, iceil(chunks[i].end - chunks[i].start, stride));
+        CU_ASSERT_PTR_NOT_NULL_FATAL(trans[i]);
+        for(size_t c=0 ; c < trans[i]->nc ; c++){
+            for(size_t r=0 ; r < trans[i]->nr ; r++){
+                trans[i]->data.f[c * trans[i]->stride + r] = offset + c;
+            }
+        }
+    }
+
+    flappie_matrix res = stitch_chunk_transitions(signal, chunks, (const flappie_matrix *)trans, nchunk, stride);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(res);
+    CU_ASSERT_EQUAL(res->nc, iceil(signal.end - signal.start, stride));
+    for(size_t c=0 ; c < res->nc ; c++){
+        CU_ASSERT_EQUAL(res->data.f[c * res->stride], (float)c);
+    }
+
+    res = free_flappie_matrix(res);
+    for(size_t i=0 ; i < nchunk ; i++){
+        trans[i] = free_flappie_matrix(trans[i]);
+    }
+    free(trans);
+    free(chunks);
+}
+
+
+static test_with_description tests[] = {
+    {"Chunks cover read with overlap", test_chunks_cover_read_chunk},
+    {"Read shorter than chunk size is a single chunk", test_short_read_is_one_chunk},
+    {"Stitched chunks recover every block of read", test_stitch_chunk},
+    {0}};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_chunk(void) {
+    return flappie_register_test_suite("Chunked calling of long reads", init_test_chunk, clean_test_chunk, tests);
+}
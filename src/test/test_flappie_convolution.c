@@ -8,6 +8,7 @@
 
 #define BANANA 1
 #include <CUnit/CUnit.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdlib.h>
 
@@ -416,6 +417,58 @@ void test_flappie_convolution_f1s1(void) {
 }
 
 
+//  Fixed point convolution followed by tanh against simple convolution
+void test_fixed_convolution(void) {
+    const size_t winlen = 5;
+    const size_t nfilter = 3;
+    const size_t stride = 2;
+    const int frac = fixed_frac_for_range(4.0f, FIXED_POINT_FRACTIONAL_BITS);
+    float _signal[23];
+    for(size_t i=0 ; i < 23 ; i++){
+        _signal[i] = 3.0f * sinf(0.7f * i);
+    }
+    Vec signal = {.elt = _signal, .len = 23};
+
+    flappie_matrix W = make_flappie_matrix(winlen, nfilter);
+    flappie_matrix b = make_flappie_matrix(nfilter, 1);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(W);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(b);
+    for(size_t f=0 ; f < nfilter ; f++){
+        for(size_t w=0 ; w < winlen ; w++){
+            W->data.f[f * W->stride + w] = 0.1f * (f + 1.0f) * ((float)w - 1.5f);
+        }
+        b->data.f[f] = 0.2f * f - 0.1f;
+    }
+    const int wfrac = fixed_weight_frac(W, b);
+    flappie_xmatrix Wx = fixed_from_flappie_matrix(W, wfrac);
+    flappie_imatrix bx = fixed_bias(b, frac + wfrac);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(Wx);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(bx);
+    flappie_xmatrix C = convolution_tanh_fixed(signal.elt, signal.len, frac, Wx, bx, stride);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(C);
+    CU_ASSERT_EQUAL(C->nr, nfilter);
+    CU_ASSERT_EQUAL(C->nc, 12);
+
+    for(size_t f=0 ; f < nfilter ; f++){
+        Vec filter = {.elt = W->data.f + f * W->stride, .len = winlen};
+        Vec y = simple_convolution(signal, filter);
+        Vec ys = simple_stride(y, stride);
+        for(size_t c=0 ; c < ys.len ; c++){
+            const float expected = tanhf(ys.elt[c] + b->data.f[f]);
+            CU_ASSERT_DOUBLE_EQUAL(fixed_to_float(C->data[c * C->stride + f], C->frac), expected, 1e-3);
+        }
+        free(ys.elt);
+        free(y.elt);
+    }
+
+    C = free_flappie_xmatrix(C);
+    bx = free_flappie_imatrix(bx);
+    Wx = free_flappie_xmatrix(Wx);
+    b = free_flappie_matrix(b);
+    W = free_flappie_matrix(W);
+}
+
+
 static const test_with_description tests[] = {
     {"Simple stride 1", test_stride1_convolution},
     {"Simple stride 2", test_stride2_convolution},
@@ -436,6 +489,7 @@ static const test_with_description tests[] = {
     {"Simple convolution, unit filter length 5", test_convolution_ones_f5},
     {"Simple convolution, antisymmetric filter length 3", test_convolution_antisymmetric_f3},
     {"Scrappie convolution, antisymmetric filter length 3", test_flappie_convolution_f1s1},
+    {"Fixed point convolution matches float", test_fixed_convolution},
     {0}};
 
 /**   Register tests with CUnit
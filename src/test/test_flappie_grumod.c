@@ -0,0 +1,340 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#define BANANA 1
+#include <CUnit/Basic.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <flappie_cpu.h>
+#include <layers.h>
+#include "flappie_util.h"
+#include "test_common.h"
+
+static const float fused_tol = 1e-5;
+
+
+/**  Initialise test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_grumod(void) {
+    srand(4321);
+    return 0;
+}
+
+/**  Clean up after test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int clean_test_grumod(void) {
+    return 0;
+}
+
+
+//  Fused step against step via temporary vector and sgemv
+static void check_fused_step(size_t size) {
+    flappie_matrix sW = random_flappie_matrix(size, 3 * size, -0.5f, 0.5f);
+    flappie_matrix x = random_flappie_matrix(3 * size, 1, -2.0f, 2.0f);
+    flappie_matrix istate = random_flappie_matrix(size, 1, -1.0f, 1.0f);
+    flappie_matrix xF = make_flappie_matrix(3 * size, 1);
+    flappie_matrix expected = make_flappie_matrix(size, 1);
+    flappie_matrix ostate = make_flappie_matrix(size, 1);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(xF);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(expected);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ostate);
+
+    //  grumod_step overwrites the candidate part of its input
+    grumod_step_fused(x->data.f, istate->data.f, sW, ostate->data.f);
+    grumod_step(x, istate, sW, xF, expected);
+    CU_ASSERT(equality_flappie_matrix(ostate, expected, fused_tol));
+
+    ostate = free_flappie_matrix(ostate);
+    expected = free_flappie_matrix(expected);
+    xF = free_flappie_matrix(xF);
+    istate = free_flappie_matrix(istate);
+    x = free_flappie_matrix(x);
+    sW = free_flappie_matrix(sW);
+}
+
+
+void test_fused_step_small_grumod(void) {
+    check_fused_step(4);
+}
+
+
+//  Blocks of eight units plus a partial block
+void test_fused_step_tail_grumod(void) {
+    check_fused_step(20);
+}
+
+
+void test_fused_step_256_grumod(void) {
+    check_fused_step(256);
+}
+
+
+//  Layer matches recurrence of grumod_forward / grumod_backward on projection
+void test_aes_layer_grumod(void) {
+    const size_t size = 36;
+    const size_t nfeature = 5;
+    const size_t N = 23;
+    flappie_matrix iW = random_flappie_matrix(nfeature, 3 * size, -0.5f, 0.5f);
+    flappie_matrix sW = random_flappie_matrix(size, 3 * size, -0.2f, 0.2f);
+    flappie_matrix b = random_flappie_matrix(3 * size, 1, -0.5f, 0.5f);
+    flappie_matrix X = random_flappie_matrix(nfeature, N, -1.0f, 1.0f);
+
+    for(int backward=0 ; backward < 2 ; backward++){
+        flappie_matrix out = aes_grumod(X, sW, NULL, backward, iW, b);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(out);
+        flappie_matrix xproj = affine_map(X, iW, b, NULL);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(xproj);
+        //  First state of layer is zero rather than a step from zero
+        flappie_matrix xF = make_flappie_matrix(3 * size, 1);
+        flappie_matrix state = make_flappie_matrix(size, 1);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(xF);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(state);
+        for(size_t i=1 ; i < N ; i++){
+            const size_t index = backward ? (N - i - 1) : i;
+            _Mat xcol = {.nr = 3 * size, .nrq = xproj->nrq, .stride = xproj->stride, .nc = 1,
+                         .data.f = xproj->data.f + index * xproj->stride};
+            _Mat prev = {.nr = size, .nrq = out->nrq, .stride = out->stride, .nc = 1,
+                         .data.f = out->data.f + (backward ? (index + 1) : (index - 1)) * out->stride};
+            grumod_step(&xcol, &prev, sW, xF, state);
+            _Mat col = prev;
+            col.data.f = out->data.f + index * out->stride;
+            CU_ASSERT(equality_flappie_matrix(&col, state, fused_tol));
+        }
+        state = free_flappie_matrix(state);
+        xF = free_flappie_matrix(xF);
+        xproj = free_flappie_matrix(xproj);
+        out = free_flappie_matrix(out);
+    }
+
+    X = free_flappie_matrix(X);
+    b = free_flappie_matrix(b);
+    sW = free_flappie_matrix(sW);
+    iW = free_flappie_matrix(iW);
+}
+
+
+static void check_fused_steps(void) {
+    check_fused_step(20);
+    check_fused_step(256);
+}
+
+
+//  Kernels of every level the host supports agree with step via sgemv
+void test_cpu_levels_grumod(void) {
+    for_each_cpu_level(check_fused_steps);
+}
+
+
+void test_cpu_level_names_grumod(void) {
+    for(int level=FLAPPIE_CPU_SSE4 ; level < FLAPPIE_CPU_INVALID ; level++){
+        CU_ASSERT_EQUAL(get_flappie_cpu_level(flappie_cpu_level_string(level)), level);
+    }
+    CU_ASSERT_EQUAL(get_flappie_cpu_level("mmx"), FLAPPIE_CPU_INVALID);
+    CU_ASSERT_FALSE(flappie_set_cpu_level(FLAPPIE_CPU_INVALID));
+}
+
+
+//  Quantised weights are within half a step of the originals
+void test_quantise_grumod(void) {
+    flappie_matrix M = random_flappie_matrix(37, 10, -0.5f, 0.5f);
+    for(size_t r=0 ; r < M->nr ; r++){
+        M->data.f[3 * M->stride + r] = 0.0f;
+    }
+    flappie_qmatrix Q = quantise_flappie_matrix(M);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(Q);
+    CU_ASSERT_EQUAL(Q->stride % 32, 0);
+    CU_ASSERT_EQUAL(Q->scale[3], 0.0f);
+    flappie_matrix D = dequantise_flappie_qmatrix(Q);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(D);
+    for(size_t c=0 ; c < M->nc ; c++){
+        for(size_t r=0 ; r < M->nr ; r++){
+            CU_ASSERT(fabsf(M->data.f[c * M->stride + r] - D->data.f[c * D->stride + r]) <= 0.5f * Q->scale[c] + 1e-7f);
+        }
+        //  Padding of column is zero
+        for(size_t r=M->nr ; r < Q->stride ; r++){
+            CU_ASSERT_EQUAL(Q->data[c * Q->stride + r], 0);
+        }
+    }
+    D = free_flappie_matrix(D);
+    Q = free_flappie_qmatrix(Q);
+    M = free_flappie_matrix(M);
+}
+
+
+//  Int8 step against float step with the quantised weights, for a batch of lanes
+static void check_int8_step(size_t size, size_t nlane) {
+    flappie_matrix W = random_flappie_matrix(size, 3 * size, -0.1f, 0.1f);
+    flappie_qmatrix sWq = quantise_flappie_matrix(W);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sWq);
+    flappie_matrix sW = dequantise_flappie_qmatrix(sWq);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sW);
+    flappie_matrix x = random_flappie_matrix(3 * size, nlane, -2.0f, 2.0f);
+    flappie_matrix istate = random_flappie_matrix(size, nlane, -1.0f, 1.0f);
+    flappie_matrix expected = make_flappie_matrix(size, nlane);
+    flappie_matrix ostate = make_flappie_matrix(size, nlane);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(expected);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ostate);
+
+    grumod_step_fused_batch(x->data.f, x->stride, istate->data.f, istate->stride, sW,
+                            expected->data.f, expected->stride, nlane);
+    grumod_step_fused_batch_int8(x->data.f, x->stride, istate->data.f, istate->stride, sWq,
+                                 ostate->data.f, ostate->stride, nlane);
+    //  Only the state is rounded, to a step of 1 / 127
+    CU_ASSERT(equality_flappie_matrix(ostate, expected, 2e-2));
+
+    ostate = free_flappie_matrix(ostate);
+    expected = free_flappie_matrix(expected);
+    istate = free_flappie_matrix(istate);
+    x = free_flappie_matrix(x);
+    sW = free_flappie_matrix(sW);
+    sWq = free_flappie_qmatrix(sWq);
+    W = free_flappie_matrix(W);
+}
+
+
+static void check_int8_steps(void) {
+    check_int8_step(4, 1);
+    check_int8_step(20, 3);
+    check_int8_step(256, 11);
+}
+
+
+//  Int8 kernels of every level the host supports, with odd numbers of lanes and units
+void test_int8_step_grumod(void) {
+    for_each_cpu_level(check_int8_steps);
+}
+
+
+//  Sixteen bit step against float step with the rounded weights
+static void check_half_step(size_t size, size_t nlane, enum flappie_half_format format) {
+    flappie_matrix W = random_flappie_matrix(size, 3 * size, -0.5f, 0.5f);
+    flappie_hmatrix sWh = half_from_flappie_matrix(W, format);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sWh);
+    flappie_matrix sW = flappie_matrix_from_half(sWh);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sW);
+    flappie_matrix x = random_flappie_matrix(3 * size, nlane, -2.0f, 2.0f);
+    flappie_matrix istate = random_flappie_matrix(size, nlane, -1.0f, 1.0f);
+    flappie_matrix expected = make_flappie_matrix(size, nlane);
+    flappie_matrix ostate = make_flappie_matrix(size, nlane);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(expected);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ostate);
+
+    grumod_step_fused_batch(x->data.f, x->stride, istate->data.f, istate->stride, sW,
+                            expected->data.f, expected->stride, nlane);
+    grumod_step_fused_batch_half(x->data.f, x->stride, istate->data.f, istate->stride, sWh,
+                                 ostate->data.f, ostate->stride, nlane);
+    CU_ASSERT(equality_flappie_matrix(ostate, expected, fused_tol));
+
+    ostate = free_flappie_matrix(ostate);
+    expected = free_flappie_matrix(expected);
+    istate = free_flappie_matrix(istate);
+    x = free_flappie_matrix(x);
+    sW = free_flappie_matrix(sW);
+    sWh = free_flappie_hmatrix(sWh);
+    W = free_flappie_matrix(W);
+}
+
+
+static void check_half_steps(void) {
+    for(int format=FLAPPIE_HALF_FP16 ; format <= FLAPPIE_HALF_BF16 ; format++){
+        check_half_step(4, 1, format);
+        check_half_step(20, 3, format);
+        check_half_step(256, 4, format);
+    }
+}
+
+
+//  Sixteen bit kernels of every level the host supports, for both formats
+void test_half_step_grumod(void) {
+    for_each_cpu_level(check_half_steps);
+}
+
+
+//  Fixed point layer against float layer, inputs to gates lying within range
+static void check_fixed_layer(size_t size, size_t nstep, bool backward, float range) {
+    const float wscale = 0.25f * range / size;
+    const float bscale = 0.25f * range;
+    const float sscale = 0.5f * range / size;
+    flappie_matrix Xin = random_flappie_matrix(size, nstep, -1.0f, 1.0f);
+    flappie_matrix W = random_flappie_matrix(size, 3 * size, -wscale, wscale);
+    flappie_matrix b = random_flappie_matrix(3 * size, 1, -bscale, bscale);
+    flappie_matrix sW = random_flappie_matrix(size, 3 * size, -sscale, sscale);
+    flappie_matrix expected = aes_grumod(Xin, sW, NULL, backward, W, b);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(expected);
+
+    const int wfrac = fixed_weight_frac(W, b);
+    flappie_xmatrix Xinx = fixed_from_flappie_matrix(Xin, FIXED_POINT_FRACTIONAL_BITS);
+    flappie_xmatrix Wx = fixed_from_flappie_matrix(W, wfrac);
+    flappie_imatrix bx = fixed_bias(b, FIXED_POINT_FRACTIONAL_BITS + wfrac);
+    flappie_xmatrix sWx = fixed_from_flappie_matrix(sW, fixed_weight_frac(sW, NULL));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(Xinx);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(Wx);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(bx);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sWx);
+    flappie_xmatrix ostatex = aes_grumod_fixed(Xinx, sWx, backward, Wx, bx,
+                                               fixed_frac_for_range(range, FIXED_POINT_FRACTIONAL_BITS));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ostatex);
+    flappie_matrix ostate = flappie_matrix_from_fixed(ostatex);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ostate);
+    //  Error of table of tanh and rounding of inputs and weights, carried through the recurrence
+    CU_ASSERT(equality_flappie_matrix(ostate, expected, 5e-3));
+
+    ostate = free_flappie_matrix(ostate);
+    ostatex = free_flappie_xmatrix(ostatex);
+    sWx = free_flappie_xmatrix(sWx);
+    bx = free_flappie_imatrix(bx);
+    Wx = free_flappie_xmatrix(Wx);
+    Xinx = free_flappie_xmatrix(Xinx);
+    expected = free_flappie_matrix(expected);
+    sW = free_flappie_matrix(sW);
+    b = free_flappie_matrix(b);
+    W = free_flappie_matrix(W);
+    Xin = free_flappie_matrix(Xin);
+}
+
+
+static void check_fixed_layers(void) {
+    check_fixed_layer(4, 7, false, 2.0f);
+    check_fixed_layer(20, 50, true, 4.0f);
+    check_fixed_layer(256, 100, true, 3.0f);
+    check_fixed_layer(256, 100, false, 12.0f);
+}
+
+
+//  Fixed point kernels of every level the host supports
+void test_fixed_layer_grumod(void) {
+    for_each_cpu_level(check_fixed_layers);
+}
+
+
+static test_with_description tests[] = {
+    {"Fused step matches step for size smaller than a vector", test_fused_step_small_grumod},
+    {"Fused step matches step for size not a multiple of vector", test_fused_step_tail_grumod},
+    {"Fused step matches step for size of network", test_fused_step_256_grumod},
+    {"Layer of fused steps matches stepping each column", test_aes_layer_grumod},
+    {"Kernels of each CPU level supported match step", test_cpu_levels_grumod},
+    {"Names of CPU levels", test_cpu_level_names_grumod},
+    {"Quantising weights to int8 rounds to nearest", test_quantise_grumod},
+    {"Int8 step matches float step within rounding of state", test_int8_step_grumod},
+    {"Sixteen bit step matches float step with rounded weights", test_half_step_grumod},
+    {"Fixed point layer matches float layer", test_fixed_layer_grumod},
+    {0}};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_grumod(void) {
+    return flappie_register_test_suite("Fused modified GRU step", init_test_grumod, clean_test_grumod, tests);
+}
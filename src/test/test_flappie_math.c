@@ -0,0 +1,221 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#include <CUnit/Basic.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "flappie_util.h"
+#include "test_common.h"
+#include "flappie_cpu.h"
+#include "flappie_math.h"
+
+//  Number of floats functions are checked at, for each sign of argument
+#define NSAMPLE 20011
+
+//  Error allowed for each function and precision, in ulp or absolute, as documented with flappie_math_precision
+struct math_bound {
+    double err;
+    bool absolute;
+};
+
+static const struct {
+    enum flappie_math_function fun;
+    const char * name;
+    float lo;
+    float hi;
+    struct math_bound bound[FLAPPIE_MATH_INVALID];
+} math_cases[] = {
+    {FLAPPIE_MATH_EXP, "exp", -87.0f, 88.0f, {{1.0, false}, {1.1, false}, {710.0, false}, {7.4e5, false}}},
+    {FLAPPIE_MATH_LOG, "log", 1.17549435e-38f, 3.4e38f, {{0.9, false}, {0.8, false}, {46.0, false}, {0.04, true}}},
+    {FLAPPIE_MATH_TANH, "tanh", -10.0f, 10.0f, {{1.8e-7, true}, {1.4, false}, {240.0, false}, {0.03, true}}},
+    {FLAPPIE_MATH_LOGISTIC, "logistic", -80.0f, 80.0f, {{2.5, false}, {2.5, false}, {700.0, false}, {7.4e5, false}}},
+    {FLAPPIE_MATH_ELU, "elu", -87.0f, 1.0f, {{4.9e-8, true}, {1.4, false}, {4e-5, true}, {0.044, true}}}
+};
+
+
+static double reference(enum flappie_math_function fun, double x){
+    switch(fun){
+    case FLAPPIE_MATH_EXP:
+        return exp(x);
+    case FLAPPIE_MATH_LOG:
+        return log(x);
+    case FLAPPIE_MATH_TANH:
+        return tanh(x);
+    case FLAPPIE_MATH_LOGISTIC:
+        return 1.0 / (1.0 + exp(-x));
+    default:
+        return (x >= 0.0) ? x : expm1(x);
+    }
+}
+
+
+//  Size of last place of a float of magnitude y
+static double ulp(double y){
+    int e;
+    frexp(fmax(fabs(y), 1.17549435e-38), &e);
+    return ldexp(1.0, e - 24);
+}
+
+
+//  NSAMPLE floats from a to b, of the same sign, evenly spaced by representation
+static size_t fill_between(float a, float b, float * x){
+    uint32_t ba, bb;
+    memcpy(&ba, &a, sizeof(float));
+    memcpy(&bb, &b, sizeof(float));
+    for(size_t i=0 ; i < NSAMPLE ; i++){
+        const uint32_t bits = (bb >= ba) ? (ba + (uint32_t)(((uint64_t)(bb - ba) * i) / (NSAMPLE - 1)))
+                                         : (ba - (uint32_t)(((uint64_t)(ba - bb) * i) / (NSAMPLE - 1)));
+        memcpy(x + i, &bits, sizeof(float));
+    }
+    return NSAMPLE;
+}
+
+
+//  Samples of [lo, hi], each sign separately
+static size_t fill_samples(float lo, float hi, float * x){
+    size_t n = 0;
+    if(lo < 0.0f){
+        n += fill_between(-0.0f, lo, x);
+    }
+    if(hi > 0.0f){
+        n += fill_between((lo > 0.0f) ? lo : 0.0f, hi, x + n);
+    }
+    return n;
+}
+
+
+static float x[2 * NSAMPLE];
+static float y[2 * NSAMPLE];
+
+
+/**  Initialise test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_math(void) {
+    return 0;
+}
+
+/**  Clean up after test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int clean_test_math(void) {
+    flappie_set_math_precision(FLAPPIE_MATH_DEFAULT);
+    return 0;
+}
+
+
+void test_names_math(void) {
+    for(int precision=FLAPPIE_MATH_DEFAULT ; precision < FLAPPIE_MATH_INVALID ; precision++){
+        CU_ASSERT_EQUAL(get_flappie_math_precision(flappie_math_precision_string(precision)), precision);
+    }
+    CU_ASSERT_EQUAL(get_flappie_math_precision("sloppy"), FLAPPIE_MATH_INVALID);
+    CU_ASSERT_FALSE(flappie_set_math_precision(FLAPPIE_MATH_INVALID));
+}
+
+
+static void check_error_math(void) {
+    for(size_t c=0 ; c < sizeof(math_cases) / sizeof(math_cases[0]) ; c++){
+        const size_t n = fill_samples(math_cases[c].lo, math_cases[c].hi, x);
+        for(int precision=FLAPPIE_MATH_DEFAULT ; precision < FLAPPIE_MATH_INVALID ; precision++){
+            const struct math_bound bound = math_cases[c].bound[precision];
+            CU_ASSERT_FATAL(flappie_set_math_precision(precision));
+            memcpy(y, x, n * sizeof(float));
+            flappie_math_inplace(math_cases[c].fun, y, n);
+
+            double maxerr = 0.0;
+            for(size_t i=0 ; i < n ; i++){
+                const double ref = reference(math_cases[c].fun, x[i]);
+                const double err = fabs(y[i] - ref) / (bound.absolute ? 1.0 : ulp(ref));
+                maxerr = (err > maxerr || isnan(err)) ? err : maxerr;
+            }
+            if(!(maxerr <= bound.err)){
+                fprintf(stderr, "%s %s at %s: error %g, allowed %g\n", math_cases[c].name,
+                        flappie_math_precision_string(precision), flappie_cpu_level_string(flappie_cpu_level()),
+                        maxerr, bound.err);
+            }
+            CU_ASSERT(maxerr <= bound.err);
+        }
+    }
+}
+
+
+//  Error of every function at every precision and level is within that documented
+void test_error_math(void) {
+    for_each_cpu_level(check_error_math);
+}
+
+
+//  Lengths that are not a multiple of the vector are completed without touching what follows
+void test_tail_math(void) {
+    for(int precision=FLAPPIE_MATH_DEFAULT ; precision < FLAPPIE_MATH_INVALID ; precision++){
+        CU_ASSERT_FATAL(flappie_set_math_precision(precision));
+        for(size_t n=0 ; n < 40 ; n++){
+            for(size_t i=0 ; i <= n ; i++){
+                y[i] = 2.0f;
+            }
+            flappie_math_inplace(FLAPPIE_MATH_ELU, y, n);
+            flappie_math_inplace(FLAPPIE_MATH_LOG, y, n);
+            for(size_t i=0 ; i < n ; i++){
+                CU_ASSERT_DOUBLE_EQUAL(y[i], 0.6931472, 0.04);
+            }
+            CU_ASSERT_EQUAL(y[n], 2.0f);
+        }
+    }
+}
+
+
+//  Special values.  Log of sse_mathfun.h, used by default, does not treat them
+void test_special_math(void) {
+    for(int precision=FLAPPIE_MATH_EXACT ; precision < FLAPPIE_MATH_FASTEST ; precision++){
+        CU_ASSERT_FATAL(flappie_set_math_precision(precision));
+        float v[4] = {0.0f, -1.0f, INFINITY, 1e-40f};
+        flappie_math_inplace(FLAPPIE_MATH_LOG, v, 4);
+        CU_ASSERT(isinf(v[0]) && v[0] < 0.0f);
+        CU_ASSERT(isnan(v[1]));
+        CU_ASSERT(isinf(v[2]) && v[2] > 0.0f);
+        CU_ASSERT(isinf(v[3]) && v[3] < 0.0f);
+
+        float w[4] = {-1000.0f, 1000.0f, 0.0f, -0.0f};
+        flappie_math_inplace(FLAPPIE_MATH_TANH, w, 4);
+        CU_ASSERT_EQUAL(w[0], -1.0f);
+        CU_ASSERT_EQUAL(w[1], 1.0f);
+        CU_ASSERT_EQUAL(w[2], 0.0f);
+        CU_ASSERT_EQUAL(w[3], 0.0f);
+    }
+    for(int precision=FLAPPIE_MATH_DEFAULT ; precision < FLAPPIE_MATH_INVALID ; precision++){
+        CU_ASSERT_FATAL(flappie_set_math_precision(precision));
+        float u[4] = {-1000.0f, 1000.0f, 0.0f, 3.0f};
+        flappie_math_inplace(FLAPPIE_MATH_ELU, u, 4);
+        CU_ASSERT_DOUBLE_EQUAL(u[0], -1.0f, 1e-6);
+        CU_ASSERT_EQUAL(u[1], 1000.0f);
+        CU_ASSERT_EQUAL(u[2], 0.0f);
+        CU_ASSERT_EQUAL(u[3], 3.0f);
+    }
+    CU_ASSERT_FATAL(flappie_set_math_precision(FLAPPIE_MATH_DEFAULT));
+}
+
+
+static test_with_description tests[] = {
+    {"Test names of precisions of functions", test_names_math},
+    {"Test error of functions at each precision and level", test_error_math},
+    {"Test functions on arrays not a multiple of vector", test_tail_math},
+    {"Test functions at special values", test_special_math},
+    {0}};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_math(void) {
+    return flappie_register_test_suite("Test vectorised functions at each precision", init_test_math, clean_test_math, tests);
+}
@@ -0,0 +1,120 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#define BANANA 1
+#include <CUnit/Basic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <flappie_caller.h>
+#include <flappie_numa.h>
+#include "test_common.h"
+
+static flappie_topology topology = NULL;
+
+
+/**  Initialise test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_numa(void) {
+    topology = make_flappie_topology();
+    return (NULL == topology) ? 1 : 0;
+}
+
+/**  Clean up after test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int clean_test_numa(void) {
+    topology = free_flappie_topology(topology);
+    return 0;
+}
+
+
+void test_topology_numa(void) {
+    const size_t nnode = flappie_topology_nnode(topology);
+    CU_ASSERT_FATAL(nnode >= 1);
+    for(size_t node=0 ; node < nnode ; node++){
+        const size_t ncpu = flappie_topology_ncpu(topology, node);
+        const int * cpu = flappie_topology_cpus(topology, node);
+        CU_ASSERT(ncpu >= 1);
+        for(size_t i=0 ; i < ncpu ; i++){
+            CU_ASSERT(cpu[i] >= 0);
+            //  No CPU listed twice
+            for(size_t j=0 ; j < i ; j++){
+                CU_ASSERT_NOT_EQUAL(cpu[i], cpu[j]);
+            }
+        }
+    }
+}
+
+
+static void record_node(void * data){
+    int * node = data;
+    *node = flappie_thread_node();
+}
+
+
+void test_run_on_node_numa(void) {
+    CU_ASSERT_EQUAL(flappie_thread_node(), -1);
+    int node = -1;
+    CU_ASSERT_FATAL(flappie_run_on_node(topology, 0, record_node, &node));
+    CU_ASSERT_EQUAL(node, 0);
+    //  Node of calling thread unchanged
+    CU_ASSERT_EQUAL(flappie_thread_node(), -1);
+}
+
+
+void test_node_caller_numa(void) {
+    const size_t nsample = 3000;
+    int16_t * signal = calloc(nsample, sizeof(int16_t));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(signal);
+    srand(0x5eed);
+    for(size_t i=0 ; i < nsample ; i++){
+        signal[i] = 400 + rand() % 200;
+    }
+
+    struct flappie_caller_options options = default_flappie_caller_options();
+    options.nthread = 2;
+    flappie_caller shared = make_flappie_caller(options);
+    options.numa_node = 0;
+    flappie_caller bound = make_flappie_caller(options);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(shared);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(bound);
+
+    //  Copy of the weights gives the same call
+    struct _raw_basecall_info res_shared, res_bound;
+    CU_ASSERT_FATAL(flappie_call_signal(shared, signal, nsample, &res_shared));
+    CU_ASSERT_FATAL(flappie_call_signal(bound, signal, nsample, &res_bound));
+    CU_ASSERT_EQUAL(res_shared.score, res_bound.score);
+    CU_ASSERT_STRING_EQUAL(res_shared.basecall, res_bound.basecall);
+    CU_ASSERT_EQUAL(flappie_thread_node(), -1);
+
+    free_raw_basecall_info(&res_bound);
+    free_raw_basecall_info(&res_shared);
+    free_flappie_caller(bound);
+    free_flappie_caller(shared);
+    free(signal);
+}
+
+
+static test_with_description tests[] = {
+    {"Every node of topology has distinct CPUs", test_topology_numa},
+    {"Function is run on thread bound to node", test_run_on_node_numa},
+    {"Caller bound to node matches unbound caller", test_node_caller_numa},
+    {0}};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_numa(void) {
+    return flappie_register_test_suite("NUMA placement", init_test_numa, clean_test_numa, tests);
+}
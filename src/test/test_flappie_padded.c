@@ -0,0 +1,387 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#define BANANA 1
+#include <CUnit/Basic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <layers.h>
+#include <nnfeatures.h>
+#include "flappie_util.h"
+#include "test_common.h"
+
+static const float padded_tol = 1e-5;
+
+//  Reads of unequal length
+static const size_t nbatch = 3;
+static const size_t read_length[3] = {57, 12, 40};
+static raw_table signal[3];
+
+/**  Initialise test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_padded(void) {
+    srand(1234);
+    for(size_t i=0 ; i < nbatch ; i++){
+        float * raw = calloc(read_length[i] + 2, sizeof(float));
+        if(NULL == raw){
+            return 1;
+        }
+        for(size_t j=0 ; j < read_length[i] + 2 ; j++){
+            raw[j] = 2.0f * rand() / (float)RAND_MAX - 1.0f;
+        }
+        //  Valid region is offset within raw signal
+        signal[i] = (raw_table){NULL, read_length[i] + 2, 1, read_length[i] + 1, raw};
+    }
+    return 0;
+}
+
+/**  Clean up after test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int clean_test_padded(void) {
+    for(size_t i=0 ; i < nbatch ; i++){
+        free(signal[i].raw);
+        signal[i].raw = NULL;
+    }
+    return 0;
+}
+
+
+void test_features_padded(void) {
+    flappie_matrix features = features_from_raw_padded(signal, nbatch);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(features);
+    CU_ASSERT_EQUAL(features->nc, nbatch * 57);
+
+    for(size_t i=0 ; i < nbatch ; i++){
+        flappie_matrix expected = features_from_raw(signal[i]);
+        _Mat view = flappie_matrix_batch_view(features, nbatch, i, read_length[i]);
+        CU_ASSERT(equality_flappie_matrix(&view, expected, 0.0));
+        //  Padding is zero
+        _Mat full = flappie_matrix_batch_view(features, nbatch, i, 57);
+        for(size_t c=read_length[i] ; c < 57 ; c++){
+            CU_ASSERT_EQUAL(full.data.f[c * full.stride], 0.0f);
+        }
+        expected = free_flappie_matrix(expected);
+    }
+    features = free_flappie_matrix(features);
+}
+
+
+void test_convolution_padded(void) {
+    const size_t winlen = 5;
+    const size_t stride = 2;
+    flappie_matrix W = random_flappie_matrix(4 * winlen, 8, -0.5f, 0.5f);
+    flappie_matrix b = random_flappie_matrix(8, 1, -0.5f, 0.5f);
+    //  Only first row of each window is a feature, rest is padding
+    for(size_t c=0 ; c < W->nc ; c++){
+        for(size_t r=0 ; r < W->nr ; r++){
+            if(0 != r % 4){
+                W->data.f[c * W->stride + r] = 0.0f;
+            }
+        }
+    }
+
+    size_t nvalid[3];
+    for(size_t i=0 ; i < nbatch ; i++){
+        nvalid[i] = read_length[i];
+    }
+    flappie_matrix features = features_from_raw_padded(signal, nbatch);
+    flappie_matrix conv = convolution_padded(features, W, b, stride, nbatch, nvalid, NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(conv);
+    CU_ASSERT_EQUAL(conv->nc, nbatch * 29);
+
+    for(size_t i=0 ; i < nbatch ; i++){
+        flappie_matrix read_features = features_from_raw(signal[i]);
+        flappie_matrix expected = convolution(read_features, W, b, stride, NULL);
+        _Mat view = flappie_matrix_batch_view(conv, nbatch, i, expected->nc);
+        CU_ASSERT(equality_flappie_matrix(&view, expected, padded_tol));
+        expected = free_flappie_matrix(expected);
+        read_features = free_flappie_matrix(read_features);
+    }
+
+    conv = free_flappie_matrix(conv);
+    features = free_flappie_matrix(features);
+    b = free_flappie_matrix(b);
+    W = free_flappie_matrix(W);
+}
+
+
+void test_grumod_padded(void) {
+    const size_t size = 256;
+    const size_t nfeature = 8;
+    flappie_matrix iW = random_flappie_matrix(nfeature, 3 * size, -0.5f, 0.5f);
+    flappie_matrix sW = random_flappie_matrix(size, 3 * size, -0.05f, 0.05f);
+    flappie_matrix b = random_flappie_matrix(3 * size, 1, -0.5f, 0.5f);
+    flappie_matrix X = random_flappie_matrix(nfeature, nbatch * 57, -1.0f, 1.0f);
+    size_t nvalid[3];
+    for(size_t i=0 ; i < nbatch ; i++){
+        nvalid[i] = read_length[i];
+    }
+
+    for(int backward=0 ; backward < 2 ; backward++){
+        flappie_matrix out = aes_grumod_padded(X, sW, backward, iW, b, nbatch, nvalid, NULL);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(out);
+        CU_ASSERT_EQUAL(out->nc, X->nc);
+
+        for(size_t i=0 ; i < nbatch ; i++){
+            //  Each read on its own
+            _Mat xview = flappie_matrix_batch_view(X, nbatch, i, nvalid[i]);
+            flappie_matrix xread = copy_flappie_matrix(&xview);
+            flappie_matrix expected = aes_grumod(xread, sW, NULL, backward, iW, b);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(expected);
+            _Mat view = flappie_matrix_batch_view(out, nbatch, i, nvalid[i]);
+            CU_ASSERT(equality_flappie_matrix(&view, expected, padded_tol));
+            //  Padding is zero
+            _Mat full = flappie_matrix_batch_view(out, nbatch, i, 57);
+            for(size_t c=nvalid[i] ; c < 57 ; c++){
+                CU_ASSERT_EQUAL(full.data.f[c * full.stride], 0.0f);
+            }
+            expected = free_flappie_matrix(expected);
+            xread = free_flappie_matrix(xread);
+        }
+        out = free_flappie_matrix(out);
+    }
+
+    X = free_flappie_matrix(X);
+    b = free_flappie_matrix(b);
+    sW = free_flappie_matrix(sW);
+    iW = free_flappie_matrix(iW);
+}
+
+
+//  Check recurrent layer over padded batch against each read on its own
+static void check_recurrent_padded(size_t ngate, bool lstm) {
+    const size_t size = 64;
+    flappie_matrix sW = random_flappie_matrix(size, ngate * size, -0.1f, 0.1f);
+    flappie_matrix X = random_flappie_matrix(ngate * size, nbatch * 57, -1.0f, 1.0f);
+    size_t nvalid[3];
+    for(size_t i=0 ; i < nbatch ; i++){
+        nvalid[i] = read_length[i];
+    }
+
+    for(int backward=0 ; backward < 2 ; backward++){
+        flappie_matrix out = lstm ? lstm_padded(X, sW, backward, nbatch, nvalid)
+                                  : grumod_padded(X, sW, backward, nbatch, nvalid);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(out);
+        CU_ASSERT_EQUAL(out->nc, X->nc);
+
+        for(size_t i=0 ; i < nbatch ; i++){
+            //  Layers on a single read may overwrite their input
+            _Mat xview = flappie_matrix_batch_view(X, nbatch, i, nvalid[i]);
+            flappie_matrix xread = copy_flappie_matrix(&xview);
+            flappie_matrix expected = NULL;
+            if(lstm){
+                expected = backward ? lstm_backward(xread, sW, NULL) : lstm_forward(xread, sW, NULL);
+            } else {
+                expected = backward ? grumod_backward(xread, sW, NULL) : grumod_forward(xread, sW, NULL);
+            }
+            _Mat view = flappie_matrix_batch_view(out, nbatch, i, nvalid[i]);
+            CU_ASSERT(equality_flappie_matrix(&view, expected, padded_tol));
+            //  Padding is zero
+            _Mat full = flappie_matrix_batch_view(out, nbatch, i, 57);
+            for(size_t c=nvalid[i] ; c < 57 ; c++){
+                CU_ASSERT_EQUAL(full.data.f[c * full.stride], 0.0f);
+            }
+            expected = free_flappie_matrix(expected);
+            xread = free_flappie_matrix(xread);
+        }
+        out = free_flappie_matrix(out);
+    }
+
+    X = free_flappie_matrix(X);
+    sW = free_flappie_matrix(sW);
+}
+
+
+void test_lstm_padded(void) {
+    check_recurrent_padded(4, true);
+}
+
+
+void test_grumod_step_padded(void) {
+    check_recurrent_padded(3, false);
+}
+
+
+void test_threaded_padded(void) {
+    const size_t size = 256;
+    const size_t nfeature = 8;
+    flappie_matrix iW = random_flappie_matrix(nfeature, 3 * size, -0.5f, 0.5f);
+    flappie_matrix sW = random_flappie_matrix(size, 3 * size, -0.05f, 0.05f);
+    flappie_matrix b = random_flappie_matrix(3 * size, 1, -0.5f, 0.5f);
+    flappie_matrix X = random_flappie_matrix(nfeature, nbatch * 57, -1.0f, 1.0f);
+    size_t nvalid[3];
+    for(size_t i=0 ; i < nbatch ; i++){
+        nvalid[i] = read_length[i];
+    }
+    flappie_threadpool pool = make_flappie_threadpool(3);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pool);
+
+    flappie_matrix expected = aes_grumod_padded(X, sW, true, iW, b, nbatch, nvalid, NULL);
+    flappie_matrix out = aes_grumod_padded(X, sW, true, iW, b, nbatch, nvalid, pool);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(out);
+    CU_ASSERT(equality_flappie_matrix(out, expected, 0.0));
+
+    pool = free_flappie_threadpool(pool);
+    out = free_flappie_matrix(out);
+    expected = free_flappie_matrix(expected);
+    X = free_flappie_matrix(X);
+    b = free_flappie_matrix(b);
+    sW = free_flappie_matrix(sW);
+    iW = free_flappie_matrix(iW);
+}
+
+
+void test_interleave_padded(void) {
+    const size_t order[3] = {2, 0, 1};
+    flappie_matrix X = random_flappie_matrix(5, nbatch * 57, -1.0f, 1.0f);
+    flappie_matrix I = interleave_flappie_matrix(X, nbatch, order, NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(I);
+    //  Step t of lane j is read order[j]
+    for(size_t j=0 ; j < nbatch ; j++){
+        for(size_t t=0 ; t < 57 ; t++){
+            CU_ASSERT_EQUAL(I->data.f[(t * nbatch + j) * I->stride + 3], X->data.f[(order[j] * 57 + t) * X->stride + 3]);
+        }
+    }
+    flappie_matrix back = deinterleave_flappie_matrix(I, nbatch, order, NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(back);
+    CU_ASSERT(equality_flappie_matrix(back, X, 0.0));
+
+    back = free_flappie_matrix(back);
+    I = free_flappie_matrix(I);
+    X = free_flappie_matrix(X);
+}
+
+
+void test_grumod_interleaved_padded(void) {
+    const size_t size = 36;
+    const size_t nfeature = 8;
+    //  Lanes longest first
+    const size_t order[3] = {0, 2, 1};
+    size_t nvalid[3], lane_nvalid[3];
+    for(size_t i=0 ; i < nbatch ; i++){
+        nvalid[i] = read_length[i];
+        lane_nvalid[i] = read_length[order[i]];
+    }
+    flappie_matrix iW = random_flappie_matrix(nfeature, 3 * size, -0.5f, 0.5f);
+    flappie_matrix sW = random_flappie_matrix(size, 3 * size, -0.2f, 0.2f);
+    flappie_matrix b = random_flappie_matrix(3 * size, 1, -0.5f, 0.5f);
+    flappie_matrix X = random_flappie_matrix(nfeature, nbatch * 57, -1.0f, 1.0f);
+    flappie_matrix Xlanes = interleave_flappie_matrix(X, nbatch, order, NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(Xlanes);
+    flappie_threadpool pool = make_flappie_threadpool(2);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pool);
+
+    for(int backward=0 ; backward < 2 ; backward++){
+        flappie_matrix expected = aes_grumod_padded(X, sW, backward, iW, b, nbatch, nvalid, NULL);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(expected);
+        for(size_t nthread=0 ; nthread < 2 ; nthread++){
+            flappie_matrix out = aes_grumod_interleaved(Xlanes, sW, NULL, NULL, backward, iW, b, nbatch, lane_nvalid,
+                                                        (0 == nthread) ? NULL : pool);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(out);
+            flappie_matrix outpad = deinterleave_flappie_matrix(out, nbatch, order, NULL);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(outpad);
+            //  Including padding, which is zero
+            CU_ASSERT(equality_flappie_matrix(outpad, expected, padded_tol));
+            outpad = free_flappie_matrix(outpad);
+            out = free_flappie_matrix(out);
+        }
+        expected = free_flappie_matrix(expected);
+    }
+
+    pool = free_flappie_threadpool(pool);
+    Xlanes = free_flappie_matrix(Xlanes);
+    X = free_flappie_matrix(X);
+    b = free_flappie_matrix(b);
+    sW = free_flappie_matrix(sW);
+    iW = free_flappie_matrix(iW);
+}
+
+
+void test_grumod_interleaved_half_padded(void) {
+    const size_t size = 36;
+    const size_t nfeature = 8;
+    //  Long enough that the recurrence crosses blocks of steps
+    const size_t nstep = 150;
+    size_t nvalid[3] = {150, 97, 20};
+    const enum flappie_half_format format[2] = {FLAPPIE_HALF_FP16, FLAPPIE_HALF_BF16};
+    const float half_tol[2] = {1e-2f, 3e-2f};
+
+    flappie_matrix iW = random_flappie_matrix(nfeature, 3 * size, -0.5f, 0.5f);
+    flappie_matrix W = random_flappie_matrix(size, 3 * size, -0.2f, 0.2f);
+    flappie_matrix b = random_flappie_matrix(3 * size, 1, -0.5f, 0.5f);
+    flappie_matrix X = random_flappie_matrix(nfeature, nbatch * nstep, -1.0f, 1.0f);
+    flappie_threadpool pool = make_flappie_threadpool(2);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pool);
+
+    for(size_t f=0 ; f < 2 ; f++){
+        flappie_hmatrix sWh = half_from_flappie_matrix(W, format[f]);
+        flappie_hmatrix Xh = half_from_flappie_matrix(X, format[f]);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(sWh);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(Xh);
+        //  Float calculation on the same rounded weights and inputs
+        flappie_matrix sW = flappie_matrix_from_half(sWh);
+        flappie_matrix Xf = flappie_matrix_from_half(Xh);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(sW);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(Xf);
+
+        for(int backward=0 ; backward < 2 ; backward++){
+            flappie_matrix expected = aes_grumod_interleaved(Xf, sW, NULL, NULL, backward, iW, b, nbatch, nvalid,
+                                                             NULL);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(expected);
+            for(size_t nthread=0 ; nthread < 2 ; nthread++){
+                flappie_hmatrix out = aes_grumod_interleaved_half(Xh, sW, NULL, sWh, backward, iW, b, nbatch, nvalid,
+                                                                  (0 == nthread) ? NULL : pool);
+                CU_ASSERT_PTR_NOT_NULL_FATAL(out);
+                CU_ASSERT_EQUAL(out->format, format[f]);
+                flappie_matrix outf = flappie_matrix_from_half(out);
+                CU_ASSERT_PTR_NOT_NULL_FATAL(outf);
+                CU_ASSERT(equality_flappie_matrix(outf, expected, half_tol[f]));
+                outf = free_flappie_matrix(outf);
+                out = free_flappie_hmatrix(out);
+            }
+            expected = free_flappie_matrix(expected);
+        }
+
+        Xf = free_flappie_matrix(Xf);
+        sW = free_flappie_matrix(sW);
+        Xh = free_flappie_hmatrix(Xh);
+        sWh = free_flappie_hmatrix(sWh);
+    }
+
+    pool = free_flappie_threadpool(pool);
+    X = free_flappie_matrix(X);
+    b = free_flappie_matrix(b);
+    W = free_flappie_matrix(W);
+    iW = free_flappie_matrix(iW);
+}
+
+
+static test_with_description tests[] = {
+    {"Features of padded batch match each read", test_features_padded},
+    {"Convolution of padded batch matches each read", test_convolution_padded},
+    {"Modified GRU over padded batch matches aes_grumod on each read", test_grumod_padded},
+    {"LSTM stepping all reads of padded batch together matches each read", test_lstm_padded},
+    {"Modified GRU stepping all reads of padded batch together matches each read", test_grumod_step_padded},
+    {"Reads of batch run on pool of threads match serial", test_threaded_padded},
+    {"Interleaving padded batch is reversed by deinterleaving", test_interleave_padded},
+    {"Modified GRU over interleaved batch matches padded batch", test_grumod_interleaved_padded},
+    {"Modified GRU over sixteen bit interleaved batch matches float", test_grumod_interleaved_half_padded},
+    {0}};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_padded(void) {
+    return flappie_register_test_suite("Padded batches of reads of unequal length", init_test_padded, clean_test_padded, tests);
+}
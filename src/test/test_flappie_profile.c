@@ -0,0 +1,136 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#define BANANA 1
+#include <CUnit/Basic.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <flappie_profile.h>
+#include "test_common.h"
+
+#define NPROFILE_THREAD 4
+static const size_t ncall = 100;
+
+
+/**  Initialise test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_profile(void) {
+    flappie_profile_enable();
+    flappie_profile_reset();
+    return 0;
+}
+
+/**  Clean up after test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int clean_test_profile(void) {
+    flappie_profile_reset();
+    return 0;
+}
+
+
+//  Profile written as a string
+static char * profile_string(void){
+    FILE * fh = tmpfile();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(fh);
+    CU_ASSERT_FATAL(flappie_profile_write(fh, 2.0));
+    const long size = ftell(fh);
+    char * str = calloc(size + 1, sizeof(char));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(str);
+    rewind(fh);
+    CU_ASSERT_EQUAL(fread(str, sizeof(char), size, fh), (size_t)size);
+    fclose(fh);
+    return str;
+}
+
+
+static void * time_stages(void * ptr){
+    (void)ptr;
+    for(size_t i=0 ; i < ncall ; i++){
+        const double t = flappie_profile_start();
+        flappie_profile_stop(FLAPPIE_PROFILE_GRU3, t, "read", 10);
+    }
+    flappie_profile_add_read(1000, 50);
+    return NULL;
+}
+
+
+void test_threads_aggregated_profile(void) {
+    flappie_profile_reset();
+    pthread_t thread[NPROFILE_THREAD];
+    for(size_t i=0 ; i < NPROFILE_THREAD ; i++){
+        CU_ASSERT_EQUAL_FATAL(pthread_create(thread + i, NULL, time_stages, NULL), 0);
+    }
+    for(size_t i=0 ; i < NPROFILE_THREAD ; i++){
+        pthread_join(thread[i], NULL);
+    }
+
+    char * str = profile_string();
+    CU_ASSERT_PTR_NOT_NULL(strstr(str, "\"reads\": 4,"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(str, "\"samples\": 4000,"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(str, "\"bases_per_second\": 100.0,"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(str, "\"gru3\": {\"calls\": 400,"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(str, "\"gru2\": {\"calls\": 0,"));
+    free(str);
+}
+
+
+void test_monotonic_clock_profile(void) {
+    const double t0 = flappie_profile_clock();
+    const double t1 = flappie_profile_clock();
+    CU_ASSERT(t1 >= t0);
+}
+
+
+void test_timeline_profile(void) {
+    static const char filename[] = "test_timeline.json";
+    CU_ASSERT_FATAL(flappie_timeline_open(filename));
+    flappie_profile_name_thread("tester");
+    double t = flappie_profile_start();
+    flappie_profile_stop(FLAPPIE_PROFILE_DECODE, t, "read\"quoted", 123);
+    t = flappie_profile_start();
+    flappie_profile_stop_batch(FLAPPIE_PROFILE_GRU1, t, 4, 5000);
+    CU_ASSERT_FATAL(flappie_timeline_close());
+
+    FILE * fh = fopen(filename, "r");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(fh);
+    char str[4096] = {0};
+    fread(str, sizeof(char), sizeof(str) - 1, fh);
+    fclose(fh);
+    remove(filename);
+
+    CU_ASSERT_PTR_NOT_NULL(strstr(str, "\"traceEvents\""));
+    CU_ASSERT_PTR_NOT_NULL(strstr(str, "\"name\": \"decode\", \"ph\": \"X\""));
+    CU_ASSERT_PTR_NOT_NULL(strstr(str, "\"read_id\": \"read\\\"quoted\", \"nsample\": 123}"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(str, "\"nread\": 4, \"nsample\": 5000}"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(str, "\"args\": {\"name\": \"tester\"}"));
+    //  Closed properly
+    CU_ASSERT_PTR_NOT_NULL(strstr(str, "\n]}\n"));
+}
+
+
+static test_with_description tests[] = {
+    {"Counters of every thread are summed", test_threads_aggregated_profile},
+    {"Clock does not go backwards", test_monotonic_clock_profile},
+    {"Timeline holds a span for each stage", test_timeline_profile},
+    {0}};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_profile(void) {
+    return flappie_register_test_suite("Profiling of basecalling stages", init_test_profile, clean_test_profile, tests);
+}
@@ -0,0 +1,133 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#define BANANA 1
+#include <CUnit/Basic.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <flappie_queue.h>
+#include <test_common.h>
+
+static const size_t nitem = 1000;
+
+/**  Initialise test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_queue(void) {
+    return 0;
+}
+
+/**  Clean up after test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int clean_test_queue(void) {
+    return 0;
+}
+
+void test_fifo_order_queue(void) {
+    int item[3] = {1, 2, 3};
+    flappie_queue queue = make_flappie_queue(3, 1);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(queue);
+
+    for(size_t i=0 ; i < 3 ; i++){
+        CU_ASSERT_TRUE(flappie_queue_push(queue, item + i));
+    }
+    for(size_t i=0 ; i < 3 ; i++){
+        CU_ASSERT_EQUAL(flappie_queue_pop(queue), item + i);
+    }
+    queue = free_flappie_queue(queue);
+}
+
+void test_drain_after_close_queue(void) {
+    int item[2] = {1, 2};
+    flappie_queue queue = make_flappie_queue(2, 1);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(queue);
+
+    CU_ASSERT_TRUE(flappie_queue_push(queue, item));
+    CU_ASSERT_TRUE(flappie_queue_push(queue, item + 1));
+    flappie_queue_close(queue);
+    CU_ASSERT_FALSE(flappie_queue_push(queue, item));
+    CU_ASSERT_EQUAL(flappie_queue_pop(queue), item);
+    CU_ASSERT_EQUAL(flappie_queue_pop(queue), item + 1);
+    CU_ASSERT_PTR_NULL(flappie_queue_pop(queue));
+    queue = free_flappie_queue(queue);
+}
+
+void test_pop_batch_queue(void) {
+    int item[3] = {1, 2, 3};
+    void * batch[4] = {NULL};
+    flappie_queue queue = make_flappie_queue(4, 1);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(queue);
+
+    for(size_t i=0 ; i < 3 ; i++){
+        CU_ASSERT_TRUE(flappie_queue_push(queue, item + i));
+    }
+    //  Takes what is available without waiting for a full batch
+    CU_ASSERT_EQUAL(flappie_queue_pop_batch(queue, batch, 2), 2);
+    CU_ASSERT_EQUAL(batch[0], item);
+    CU_ASSERT_EQUAL(batch[1], item + 1);
+    CU_ASSERT_EQUAL(flappie_queue_pop_batch(queue, batch, 4), 1);
+    CU_ASSERT_EQUAL(batch[0], item + 2);
+    flappie_queue_close(queue);
+    CU_ASSERT_EQUAL(flappie_queue_pop_batch(queue, batch, 4), 0);
+    queue = free_flappie_queue(queue);
+}
+
+static void * produce_items(void * ptr){
+    flappie_queue queue = ptr;
+    for(size_t i=1 ; i <= nitem ; i++){
+        flappie_queue_push(queue, (void *)(uintptr_t)i);
+    }
+    flappie_queue_close(queue);
+    return NULL;
+}
+
+void test_threaded_producers_queue(void) {
+    //  Small capacity forces producers to block on a full queue
+    flappie_queue queue = make_flappie_queue(2, 2);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(queue);
+
+    pthread_t producer[2];
+    for(size_t i=0 ; i < 2 ; i++){
+        CU_ASSERT_EQUAL_FATAL(pthread_create(producer + i, NULL, produce_items, queue), 0);
+    }
+
+    size_t count = 0;
+    size_t total = 0;
+    void * item = NULL;
+    while(NULL != (item = flappie_queue_pop(queue))){
+        count += 1;
+        total += (uintptr_t)item;
+    }
+    for(size_t i=0 ; i < 2 ; i++){
+        pthread_join(producer[i], NULL);
+    }
+
+    CU_ASSERT_EQUAL(count, 2 * nitem);
+    CU_ASSERT_EQUAL(total, nitem * (nitem + 1));
+    queue = free_flappie_queue(queue);
+}
+
+static test_with_description tests[] = {
+    {"Items are returned in order added", test_fifo_order_queue},
+    {"Closed queue is drained before returning NULL", test_drain_after_close_queue},
+    {"Batches take available items without waiting", test_pop_batch_queue},
+    {"All items from multiple producing threads are received", test_threaded_producers_queue},
+    {0}};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_queue(void) {
+    return flappie_register_test_suite("Bounded queue for pipeline", init_test_queue, clean_test_queue, tests);
+}
@@ -0,0 +1,143 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#define BANANA 1
+#include <CUnit/Basic.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <decode.h>
+#include <flappie_readuntil.h>
+#include <layers.h>
+#include <networks.h>
+#include "test_common.h"
+
+static const size_t nsample = 3000;
+static const size_t prefix_length = 2000;
+static float * signal = NULL;
+static struct flappie_caller_options options;
+static flappie_prefix_classifier classifier = NULL;
+
+
+/**  Initialise test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_readuntil(void) {
+    srand(0x5eed);
+    signal = calloc(nsample, sizeof(float));
+    if(NULL == signal){
+        return 1;
+    }
+    for(size_t i=0 ; i < nsample ; i++){
+        signal[i] = 400 + rand() % 200;
+    }
+    options = default_flappie_caller_options();
+    classifier = make_flappie_prefix_classifier(options, prefix_length);
+    return (NULL == classifier) ? 1 : 0;
+}
+
+/**  Clean up after test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int clean_test_readuntil(void) {
+    classifier = free_flappie_prefix_classifier(classifier);
+    free(signal);
+    signal = NULL;
+    return 0;
+}
+
+
+void test_prefix_matches_transitions_readuntil(void) {
+    //  Call prefix the long way round, allocating as it goes
+    const size_t ntrimmed = prefix_length - options.trim_start;
+    float * raw = calloc(ntrimmed, sizeof(float));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(raw);
+    memcpy(raw, signal + options.trim_start, ntrimmed * sizeof(float));
+    medmad_normalise_array(raw, ntrimmed);
+    const raw_table rt = {.n = ntrimmed, .start = 0, .end = ntrimmed, .raw = raw};
+    flappie_matrix trans = calculate_transitions(rt, options.temperature, options.model);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(trans);
+    const size_t nblock = trans->nc;
+    const size_t nbase = nbase_from_flipflop_nparam(trans->nr);
+    int * path = calloc(nblock + 1, sizeof(int));
+    float * qpath = calloc(nblock + 1, sizeof(float));
+    char * expected = calloc(nblock + 1, sizeof(char));
+    CU_ASSERT_FATAL(NULL != path && NULL != qpath && NULL != expected);
+    const float score = decode_crf_flipflop(trans, false, path, qpath);
+    size_t nexpected = 0;
+    for(size_t blk=1 ; blk < nblock ; blk++){
+        if(path[blk] != path[blk - 1]){
+            expected[nexpected++] = base_lookup[path[blk] % nbase];
+        }
+    }
+
+    struct flappie_prefix_call res;
+    CU_ASSERT_FATAL(flappie_call_prefix(classifier, signal, prefix_length, &res));
+    CU_ASSERT_EQUAL(res.nsample, prefix_length);
+    CU_ASSERT_EQUAL(res.nbase, nexpected);
+    CU_ASSERT_EQUAL(0, memcmp(res.bases, expected, nexpected));
+    CU_ASSERT_DOUBLE_EQUAL(res.confidence, expf(score / nblock), 1e-4);
+    CU_ASSERT(res.confidence > 0.0f && res.confidence <= 1.0f);
+
+    free(expected);
+    free(qpath);
+    free(path);
+    trans = free_flappie_matrix(trans);
+    free(raw);
+}
+
+
+void test_samples_beyond_prefix_ignored_readuntil(void) {
+    struct flappie_prefix_call res;
+    CU_ASSERT_FATAL(flappie_call_prefix(classifier, signal, prefix_length, &res));
+    char * first = calloc(res.nbase + 1, sizeof(char));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(first);
+    memcpy(first, res.bases, res.nbase);
+    const size_t nfirst = res.nbase;
+    const float confidence = res.confidence;
+
+    //  Workspace is reused, so a repeated call gives the same answer
+    CU_ASSERT_FATAL(flappie_call_prefix(classifier, signal, nsample, &res));
+    CU_ASSERT_EQUAL(res.nsample, prefix_length);
+    CU_ASSERT_EQUAL(res.nbase, nfirst);
+    CU_ASSERT_EQUAL(0, memcmp(res.bases, first, nfirst));
+    CU_ASSERT_EQUAL(res.confidence, confidence);
+    free(first);
+}
+
+
+void test_shorter_read_readuntil(void) {
+    //  Reads shorter than the prefix are called in full
+    struct flappie_prefix_call res;
+    CU_ASSERT_FATAL(flappie_call_prefix(classifier, signal, 1000, &res));
+    CU_ASSERT_EQUAL(res.nsample, 1000);
+    CU_ASSERT_EQUAL(strlen(res.bases), res.nbase);
+}
+
+
+void test_too_short_read_readuntil(void) {
+    struct flappie_prefix_call res;
+    CU_ASSERT_FALSE(flappie_call_prefix(classifier, signal, options.trim_start, &res));
+}
+
+
+static test_with_description tests[] = {
+    {"Call of prefix matches transitions of network", test_prefix_matches_transitions_readuntil},
+    {"Samples beyond prefix are ignored", test_samples_beyond_prefix_ignored_readuntil},
+    {"Read shorter than prefix is called", test_shorter_read_readuntil},
+    {"Read too short to call is not called", test_too_short_read_readuntil},
+    {0}};
+
+
+int register_test_readuntil(void) {
+    return flappie_register_test_suite("Read until prefix calls", init_test_readuntil, clean_test_readuntil, tests);
+}
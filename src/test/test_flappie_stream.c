@@ -0,0 +1,195 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#define BANANA 1
+#include <CUnit/Basic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <decode.h>
+#include <flappie_stream.h>
+#include "test_common.h"
+
+#define NCHANNEL 3
+
+static const size_t nbase = 4;
+static const size_t nblock = 300;
+static flappie_matrix trans = NULL;
+static flappie_caller caller = NULL;
+
+
+/**  Initialise test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_stream(void) {
+    srand(0x5eed);
+    const size_t nstate = nbase + nbase;
+    trans = make_flappie_matrix(nstate * (nbase + 1), nblock);
+    if(NULL == trans){
+        return 1;
+    }
+    for(size_t blk=0 ; blk < nblock ; blk++){
+        for(size_t i=0 ; i < trans->nr ; i++){
+            trans->data.f[blk * trans->stride + i] = -5.0f * rand() / RAND_MAX;
+        }
+    }
+    struct flappie_caller_options options = default_flappie_caller_options();
+    options.trim_start = 0;
+    caller = make_flappie_caller(options);
+    return (NULL == caller) ? 1 : 0;
+}
+
+/**  Clean up after test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int clean_test_stream(void) {
+    caller = free_flappie_caller(caller);
+    trans = free_flappie_matrix(trans);
+    return 0;
+}
+
+
+void test_long_lag_matches_viterbi_stream(void) {
+    int * path = calloc(nblock + 1, sizeof(int));
+    float * qpath = calloc(nblock + 1, sizeof(float));
+    char * expected = calloc(nblock + 1, sizeof(char));
+    char * bases = calloc(2 * nblock + 2, sizeof(char));
+    CU_ASSERT_FATAL(NULL != path && NULL != qpath && NULL != expected && NULL != bases);
+    decode_crf_flipflop(trans, false, path, qpath);
+    size_t nexpected = 0;
+    for(size_t blk=1 ; blk <= nblock ; blk++){
+        if(path[blk] != path[blk - 1]){
+            expected[nexpected++] = base_lookup[path[blk] % nbase];
+        }
+    }
+
+    //  Nothing is committed until the end when lag covers every block
+    flipflop_fixed_lag dec = make_flipflop_fixed_lag(nbase, nblock + 1);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(dec);
+    CU_ASSERT_EQUAL(flipflop_fixed_lag_push(dec, trans, 0, 100, bases), 0);
+    CU_ASSERT_EQUAL(flipflop_fixed_lag_push(dec, trans, 100, nblock - 100, bases), 0);
+    const size_t nb = flipflop_fixed_lag_finish(dec, bases);
+    CU_ASSERT_EQUAL(nb, nexpected);
+    CU_ASSERT_EQUAL(0, memcmp(bases, expected, nexpected));
+    dec = free_flipflop_fixed_lag(dec);
+
+    free(bases);
+    free(expected);
+    free(qpath);
+    free(path);
+}
+
+
+void test_short_lag_commits_early_stream(void) {
+    const size_t lag = 10;
+    char * bases = calloc(nblock + lag + 1, sizeof(char));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(bases);
+    flipflop_fixed_lag dec = make_flipflop_fixed_lag(nbase, lag);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(dec);
+
+    size_t total = 0;
+    for(size_t blk=0 ; blk < nblock ; blk += 50){
+        const int nb = flipflop_fixed_lag_push(dec, trans, blk, 50, bases);
+        CU_ASSERT(nb >= 0);
+        total += nb;
+    }
+    CU_ASSERT(total > 0);
+    //  At most one base per block, and only lag blocks left to commit
+    const size_t nb = flipflop_fixed_lag_finish(dec, bases);
+    CU_ASSERT(nb <= lag + 1);
+    CU_ASSERT(total + nb <= nblock);
+    dec = free_flipflop_fixed_lag(dec);
+    free(bases);
+}
+
+
+struct stream_record {
+    size_t nbase[NCHANNEL];
+    size_t nend[NCHANNEL];
+    size_t nsample[NCHANNEL];
+    bool valid;
+};
+
+static void record_bases(size_t channel, const char * read_id, const char * bases, size_t nb, size_t nsample,
+                         bool end, void * data){
+    struct stream_record * rec = data;
+    rec->valid = rec->valid && channel < NCHANNEL && 0 == strncmp(read_id, "read", 4);
+    if(channel >= NCHANNEL){
+        return;
+    }
+    for(size_t i=0 ; i < nb ; i++){
+        rec->valid = rec->valid && NULL != strchr("ACGT", bases[i]);
+    }
+    rec->nbase[channel] += nb;
+    rec->nend[channel] += end ? 1 : 0;
+    rec->nsample[channel] = nsample;
+}
+
+
+void test_channels_streamed_stream(void) {
+    const size_t nsample = 12000;
+    const size_t block = 500;
+    float * signal = calloc(nsample, sizeof(float));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(signal);
+    for(size_t i=0 ; i < nsample ; i++){
+        signal[i] = 80.0f + 20.0f * rand() / RAND_MAX;
+    }
+
+    struct stream_record rec = {.valid = true};
+    flappie_stream stream = make_flappie_stream(caller, default_flappie_stream_options(), record_bases, &rec);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(stream);
+    CU_ASSERT(flappie_stream_max_latency(stream) >= 3000);
+
+    for(size_t i=0 ; i < nsample ; i += block){
+        for(size_t c=0 ; c < NCHANNEL ; c++){
+            //  Channels start at different times
+            const size_t start = i + c * block;
+            if(start < nsample){
+                CU_ASSERT(flappie_stream_push(stream, c, "read", signal + start, block));
+            }
+        }
+        flappie_stream_process(stream);
+        //  Every window is called as soon as it is ready
+        CU_ASSERT_EQUAL(flappie_stream_nready(stream), 0);
+    }
+    CU_ASSERT(rec.nbase[0] > 0);
+    CU_ASSERT_EQUAL(rec.nend[0], 0);
+    for(size_t c=0 ; c < NCHANNEL ; c++){
+        CU_ASSERT(flappie_stream_end(stream, c));
+    }
+    CU_ASSERT_EQUAL(flappie_stream_process(stream), NCHANNEL);
+    CU_ASSERT_FALSE(flappie_stream_end(stream, 0));
+
+    CU_ASSERT(rec.valid);
+    for(size_t c=0 ; c < NCHANNEL ; c++){
+        CU_ASSERT_EQUAL(rec.nend[c], 1);
+        CU_ASSERT_EQUAL(rec.nsample[c], nsample - c * block);
+        CU_ASSERT(rec.nbase[c] > 0);
+    }
+
+    stream = free_flappie_stream(stream);
+    free(signal);
+}
+
+
+static test_with_description tests[] = {
+    {"Fixed lag decoding with long lag is Viterbi decoding", test_long_lag_matches_viterbi_stream},
+    {"Fixed lag decoding commits bases before the end", test_short_lag_commits_early_stream},
+    {"Signal streamed on several channels is called", test_channels_streamed_stream},
+    {0}};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_stream(void) {
+    return flappie_register_test_suite("Streaming basecalling", init_test_stream, clean_test_stream, tests);
+}
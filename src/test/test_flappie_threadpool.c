@@ -0,0 +1,154 @@
+/*  Copyright 2018 Oxford Nanopore Technologies, Ltd */
+
+/*  This Source Code Form is subject to the terms of the Oxford Nanopore
+ *  Technologies, Ltd. Public License, v. 1.0. If a copy of the License
+ *  was not  distributed with this file, You can obtain one at
+ *  http://nanoporetech.com
+ */
+
+#define BANANA 1
+#include <CUnit/Basic.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <flappie_threadpool.h>
+#include <test_common.h>
+
+static const size_t nitem = 1000;
+static flappie_threadpool pool = NULL;
+
+/**  Initialise test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_threadpool(void) {
+    pool = make_flappie_threadpool(4);
+    return (NULL == pool) ? 1 : 0;
+}
+
+/**  Clean up after test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int clean_test_threadpool(void) {
+    pool = free_flappie_threadpool(pool);
+    return 0;
+}
+
+
+static void count_iteration(size_t i, void * data){
+    int * count = data;
+    //  Each iteration writes to its own element so no locking is needed
+    count[i] += 1;
+}
+
+
+void test_every_iteration_once_threadpool(void) {
+    int * count = calloc(nitem, sizeof(int));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(count);
+
+    flappie_parallel_for(pool, nitem, count_iteration, count);
+    for(size_t i=0 ; i < nitem ; i++){
+        CU_ASSERT_EQUAL(count[i], 1);
+    }
+    free(count);
+}
+
+
+void test_serial_without_pool_threadpool(void) {
+    int * count = calloc(nitem, sizeof(int));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(count);
+
+    flappie_parallel_for(NULL, nitem, count_iteration, count);
+    for(size_t i=0 ; i < nitem ; i++){
+        CU_ASSERT_EQUAL(count[i], 1);
+    }
+    free(count);
+}
+
+
+static void * submit_loop(void * ptr){
+    flappie_parallel_for(pool, nitem, count_iteration, ptr);
+    return NULL;
+}
+
+
+void test_concurrent_loops_threadpool(void) {
+    int * count[3];
+    pthread_t submitter[3];
+    for(size_t i=0 ; i < 3 ; i++){
+        count[i] = calloc(nitem, sizeof(int));
+        CU_ASSERT_PTR_NOT_NULL_FATAL(count[i]);
+        CU_ASSERT_EQUAL_FATAL(pthread_create(submitter + i, NULL, submit_loop, count[i]), 0);
+    }
+    for(size_t i=0 ; i < 3 ; i++){
+        pthread_join(submitter[i], NULL);
+        for(size_t j=0 ; j < nitem ; j++){
+            CU_ASSERT_EQUAL(count[i][j], 1);
+        }
+        free(count[i]);
+    }
+}
+
+
+struct start_order {
+    size_t nstarted;
+    size_t order[4];
+};
+
+
+static void record_start(size_t i, void * data){
+    struct start_order * start = data;
+    start->order[start->nstarted] = i;
+    start->nstarted += 1;
+}
+
+
+void test_heaviest_first_threadpool(void) {
+    const size_t weight[4] = {1, 5, 3, 9};
+    struct start_order start = {.nstarted = 0};
+
+    //  Serially so order of starting is deterministic
+    flappie_parallel_for_weighted(NULL, 4, weight, record_start, &start);
+    CU_ASSERT_EQUAL_FATAL(start.nstarted, 4);
+    CU_ASSERT_EQUAL(start.order[0], 3);
+    CU_ASSERT_EQUAL(start.order[1], 1);
+    CU_ASSERT_EQUAL(start.order[2], 2);
+    CU_ASSERT_EQUAL(start.order[3], 0);
+}
+
+
+void test_weighted_every_iteration_once_threadpool(void) {
+    int * count = calloc(nitem, sizeof(int));
+    size_t * weight = calloc(nitem, sizeof(size_t));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(count);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(weight);
+    for(size_t i=0 ; i < nitem ; i++){
+        weight[i] = (i * 7919) % 101;
+    }
+
+    flappie_parallel_for_weighted(pool, nitem, weight, count_iteration, count);
+    for(size_t i=0 ; i < nitem ; i++){
+        CU_ASSERT_EQUAL(count[i], 1);
+    }
+    free(weight);
+    free(count);
+}
+
+
+static test_with_description tests[] = {
+    {"Every iteration of loop is run once", test_every_iteration_once_threadpool},
+    {"Loop runs serially without pool", test_serial_without_pool_threadpool},
+    {"Loops submitted from several threads share pool", test_concurrent_loops_threadpool},
+    {"Every iteration of weighted loop is run once", test_weighted_every_iteration_once_threadpool},
+    {"Weighted loop starts heaviest iterations first", test_heaviest_first_threadpool},
+    {0}};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_threadpool(void) {
+    return flappie_register_test_suite("Pool of threads for parallel loops", init_test_threadpool, clean_test_threadpool, tests);
+}
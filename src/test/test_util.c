@@ -8,6 +8,7 @@
 
 #define BANANA 1
 #include <CUnit/Basic.h>
+#include <math.h>
 #include <stdbool.h>
 
 #include <util.h>
@@ -41,9 +42,72 @@ void test_median_even_util(void) {
     CU_ASSERT_DOUBLE_EQUAL(med, 1.5f, 1e-5);
 }
 
+void test_minmax_util(void) {
+    float arr[5] = {2.0f, 4.0f, 0.0f, 3.0f, 1.0f};
+    CU_ASSERT_EQUAL(valminf(arr, 5), 0.0f);
+    CU_ASSERT_EQUAL(valmaxf(arr, 5), 4.0f);
+}
+
+void test_fp16_util(void) {
+    CU_ASSERT_EQUAL(fp16_from_float(1.0f), 0x3c00);
+    CU_ASSERT_EQUAL(fp16_from_float(-2.0f), 0xc000);
+    CU_ASSERT_EQUAL(fp16_from_float(65504.0f), 0x7bff);
+    CU_ASSERT_EQUAL(fp16_from_float(1e6f), 0x7c00);
+    //  Smallest subnormal
+    CU_ASSERT_EQUAL(fp16_from_float(0x1p-24f), 0x0001);
+    //  Ties round to even
+    CU_ASSERT_EQUAL(fp16_from_float(1.0f + 0x1p-11f), 0x3c00);
+    CU_ASSERT_EQUAL(fp16_from_float(1.0f + 0x3p-11f), 0x3c02);
+    CU_ASSERT_EQUAL(float_from_fp16(0x3c00), 1.0f);
+    CU_ASSERT_EQUAL(float_from_fp16(0x0001), 0x1p-24f);
+    CU_ASSERT_EQUAL(float_from_fp16(0xfbff), -65504.0f);
+    CU_ASSERT(isinf(float_from_fp16(0x7c00)));
+    for(float x=-3.0f ; x < 3.0f ; x += 0.01f){
+        CU_ASSERT(fabsf(float_from_fp16(fp16_from_float(x)) - x) <= fabsf(x) * 0x1p-11f + 0x1p-25f);
+    }
+}
+
+void test_bf16_util(void) {
+    CU_ASSERT_EQUAL(bf16_from_float(1.0f), 0x3f80);
+    CU_ASSERT_EQUAL(bf16_from_float(-2.0f), 0xc000);
+    //  Ties round to even
+    CU_ASSERT_EQUAL(bf16_from_float(1.0f + 0x1p-8f), 0x3f80);
+    CU_ASSERT_EQUAL(bf16_from_float(1.0f + 0x3p-8f), 0x3f82);
+    CU_ASSERT(isnan(float_from_bf16(bf16_from_float(NAN))));
+    CU_ASSERT_EQUAL(float_from_bf16(0x3f80), 1.0f);
+    for(float x=-3.0f ; x < 3.0f ; x += 0.01f){
+        CU_ASSERT(fabsf(float_from_bf16(bf16_from_float(x)) - x) <= fabsf(x) * 0x1p-8f);
+    }
+}
+
+void test_fixed_util(void) {
+    CU_ASSERT_EQUAL(float_to_fixed(0.5f, 15), 16384);
+    CU_ASSERT_EQUAL(float_to_fixed(-1.5f, 8), -384);
+    //  Saturates symmetrically
+    CU_ASSERT_EQUAL(float_to_fixed(1.0f, 15), FIXED_POINT_MAX);
+    CU_ASSERT_EQUAL(float_to_fixed(-2.0f, 15), -FIXED_POINT_MAX);
+    CU_ASSERT_EQUAL(saturate_fixed(100000), FIXED_POINT_MAX);
+    CU_ASSERT_EQUAL(saturate_fixed(-100000), -FIXED_POINT_MAX);
+    CU_ASSERT_EQUAL(fixed_to_float(-384, 8), -1.5f);
+    //  Rounds to nearest, ties upwards
+    CU_ASSERT_EQUAL(rshift_round(5, 1), 3);
+    CU_ASSERT_EQUAL(rshift_round(-5, 1), -2);
+    CU_ASSERT_EQUAL(rshift_round(-7, 2), -2);
+    CU_ASSERT_EQUAL(rshift_round(3, -2), 12);
+    CU_ASSERT_EQUAL(fixed_frac_for_range(0.5f, 15), 15);
+    CU_ASSERT_EQUAL(fixed_frac_for_range(1.0f, 15), 14);
+    CU_ASSERT_EQUAL(fixed_frac_for_range(14.1f, 15), 11);
+    CU_ASSERT_EQUAL(fixed_frac_for_range(1e6f, 15), 0);
+}
+
+
 static test_with_description tests[] = {
     {"Median of odd length array", test_median_odd_util},
     {"Median of even length array", test_median_even_util},
+    {"Minimum and maximum of array", test_minmax_util},
+    {"Conversion to and from fp16", test_fp16_util},
+    {"Conversion to and from bf16", test_bf16_util},
+    {"Conversion to and from fixed point", test_fixed_util},
     {0}};
 
 /**   Register tests with CUnit
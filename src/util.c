@@ -67,7 +67,7 @@ float valminf(const float *x, size_t n) {
     }
     float vmin = x[0];
     for (size_t i = 1; i < n; i++) {
-        if (x[i] > vmin) {
+        if (x[i] < vmin) {
             vmin = x[i];
         }
     }
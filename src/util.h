@@ -17,38 +17,6 @@
 #    include "sse_mathfun.h"
 
 #define num_files 1
-#define max_files 100
-
-#    ifdef FAST_LOG
-#        define LOGFV fast_logfv
-#    else
-#        define LOGFV logfv
-#    endif
-
-#    ifdef FAST_EXP
-#        define EXPFV fast_expfv
-#    else
-#        define EXPFV expfv
-#    endif
-
-#    ifdef FAST_TANH
-#        define TANHFV fast_tanhfv
-#    else
-#        define TANHFV tanhfv
-#    endif
-
-#    ifdef FAST_LOGISTIC
-#        define LOGISTICFV fast_logisticfv
-#    else
-#        define LOGISTICFV logisticfv
-#    endif
-
-#    ifdef FAST_ELU
-#        define ELUFV fast_elufv
-#    else
-#        define ELUFV elufv
-#    endif
-
 
 /* From math.h */
 #    ifndef M_LN2
@@ -136,6 +104,106 @@ static inline float logdnegbinomf(float k, float r, float p){
 }
 
 
+/**
+ *   Sixteen bit floats, IEEE half precision (fp16) and bfloat16 (bf16)
+ *
+ *   Conversions from float round to nearest, ties to even.
+ **/
+typedef union {
+    float f;
+    uint32_t u;
+} float_bits;
+
+static inline uint16_t fp16_from_float(float x){
+    float_bits b = {.f = x};
+    const uint16_t sign = (b.u >> 16) & 0x8000;
+    b.u &= 0x7fffffff;
+    if(b.u >= 0x47800000){
+        //  Too large, infinite or not a number
+        return sign | ((b.u > 0x7f800000) ? 0x7e00 : 0x7c00);
+    }
+    if(b.u < 0x38800000){
+        //  Subnormal: adding 0.5 aligns the mantissa so the hardware rounds
+        b.f += 0.5f;
+        return sign | (uint16_t)(b.u - 0x3f000000);
+    }
+    //  Rebias exponent and round mantissa
+    b.u += 0xc8000fff + ((b.u >> 13) & 1);
+    return sign | (uint16_t)(b.u >> 13);
+}
+
+static inline float float_from_fp16(uint16_t h){
+    float_bits b = {.u = (uint32_t)(h & 0x7fff) << 13};
+    if((h & 0x7c00) == 0x7c00){
+        b.u |= 0x7f800000;
+    } else {
+        //  Rebias exponent, also normalising subnormals
+        b.f *= 0x1p112f;
+    }
+    b.u |= (uint32_t)(h & 0x8000) << 16;
+    return b.f;
+}
+
+static inline uint16_t bf16_from_float(float x){
+    float_bits b = {.f = x};
+    if((b.u & 0x7fffffff) > 0x7f800000){
+        return (uint16_t)((b.u >> 16) | 0x40);
+    }
+    return (uint16_t)((b.u + 0x7fff + ((b.u >> 16) & 1)) >> 16);
+}
+
+static inline float float_from_bf16(uint16_t h){
+    float_bits b = {.u = (uint32_t)h << 16};
+    return b.f;
+}
+
+
+/**
+ *   Sixteen bit fixed point
+ *
+ *   A number with frac fractional bits is the integer divided by 2^frac.
+ *   Activations bounded by one, the output of tanh and logistic, have
+ *   FIXED_POINT_FRACTIONAL_BITS.  Conversions saturate, so -32768 is never
+ *   produced and products of two numbers never overflow 31 bits.
+ **/
+typedef int16_t fixed_point_t;
+#define FIXED_POINT_FRACTIONAL_BITS 15
+#define FIXED_POINT_MAX 32767
+
+static inline fixed_point_t saturate_fixed(int64_t x){
+    return (x > FIXED_POINT_MAX) ? FIXED_POINT_MAX : ((x < -FIXED_POINT_MAX) ? -FIXED_POINT_MAX : x);
+}
+
+static inline float fixed_to_float(fixed_point_t x, int frac){
+    return ldexpf((float)x, -frac);
+}
+
+static inline fixed_point_t float_to_fixed(float x, int frac){
+    const float y = rintf(ldexpf(x, frac));
+    return (y >= FIXED_POINT_MAX) ? FIXED_POINT_MAX : ((y <= -FIXED_POINT_MAX) ? -FIXED_POINT_MAX : (fixed_point_t)y);
+}
+
+//  Divide by 2^shift rounding to nearest, ties upwards.  Negative shifts multiply.
+static inline int64_t rshift_round(int64_t x, int shift){
+    return (shift > 0) ? ((x + ((int64_t)1 << (shift - 1))) >> shift) : (x * ((int64_t)1 << -shift));
+}
+
+/**  Most fractional bits a number of magnitude up to maxabs may have
+ *
+ *   @param maxabs Largest magnitude
+ *   @param maxfrac Fractional bits wanted if maxabs is small
+ *
+ *   @returns Fractional bits, between 0 and maxfrac
+ **/
+static inline int fixed_frac_for_range(float maxabs, int maxfrac){
+    int frac = maxfrac;
+    while(frac > 0 && ldexpf(maxabs, frac) > FIXED_POINT_MAX){
+        frac -= 1;
+    }
+    return frac;
+}
+
+
 /**
  *   Logistic distribution
  **/
@@ -420,6 +488,7 @@ static inline int imax(int x, int y){
     return (x > y) ? x : y;
 }
 
+int floatcmp(const void *x, const void *y);
 void quantilef(const float *x, size_t nx, float *p, size_t np);
 float medianf(const float *x, size_t n);
 float madf(const float *x, size_t n, const float *med);